@@ -0,0 +1,137 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <ros/time.h>
+#include <stdint.h>
+
+namespace ethercat_hardware
+{
+
+
+/*!
+ * \brief Current estimate of how device clock relates to host clock.
+ *
+ * Trivially copyable, so it can be handed to diagnostics thread with RealtimeSnapshot.
+ */
+struct DeviceClockEstimate
+{
+  DeviceClockEstimate();
+  bool aligned_;          //!< true once enough timestamps have been seen for an estimate
+  uint32_t resets_;       //!< number of times estimate was restarted because device time jumped
+  uint32_t windows_;      //!< number of windows estimate is currently based on
+  double drift_ppm_;      //!< how much faster (positive) or slower host clock runs than device clock
+  double fit_error_us_;   //!< RMS distance of window minimums from fitted line
+  double latency_us_;     //!< average time from device sampling status to host receiving it, for latest window
+};
+
+
+/*!
+ * \brief Aligns 32bit microsecond timestamps of one device with host clock.
+ *
+ * Each cycle, host receive time of process data is paired with device timestamp of 
+ * same data.  Receive time is always later than device sample time, by a latency that
+ * is mostly constant but has one-sided jitter from network and host scheduling.
+ * So, smallest difference between host and device time over a window of cycles 
+ * tracks actual clock offset closely.  A line fitted through minimums of last 
+ * NUM_WINDOWS windows gives offset and drift of device clock.
+ *
+ * All work is done with timestamps already in process data, and update() is realtime safe.
+ * Fitting is only done when a window completes, and costs O(NUM_WINDOWS).
+ */
+class DeviceClock
+{
+public:
+  DeviceClock();
+
+  //! Forgets estimate, for instance after device was reset
+  void reset();
+
+  /*!
+   * \brief Pairs device timestamp of newest status data with host time it was received.
+   *
+   * Repeated device timestamps carry no new information and are ignored, 
+   * so it is safe to call more than once per cycle.
+   * \return true if estimate was refreshed
+   */
+  bool update(uint32_t device_time_us, const ros::Time &host_time);
+
+  /*!
+   * \brief Converts device timestamp to host time.  
+   *
+   * Timestamp should be close to timestamp of last update(), within 35 minutes either way.
+   * Until clock is aligned, host receive time of last update is used as reference instead.
+   */
+  ros::Time toHostTime(uint32_t device_time_us) const;
+
+  bool isAligned() const {return estimate_.aligned_;}
+  const DeviceClockEstimate &estimate() const {return estimate_;}
+
+  static const unsigned WINDOW_SIZE = 100;      //!< Number of updates in each window
+  static const unsigned NUM_WINDOWS = 32;       //!< Number of windows line is fitted through
+  static const unsigned MIN_WINDOWS = 4;        //!< Windows needed before clock is aligned
+  static const uint32_t MAX_STEP_US = 1000000;  //!< Larger step (or going back in time) restarts estimate
+
+protected:
+  void startWindow();
+  void fit();
+  //! Fitted (host - device) difference at device time, in nanoseconds
+  double fitted(int64_t device_us) const {return offset_ns_ + drift_ * double(device_us) * 1e3;}
+
+  bool started_;
+  uint32_t last_device_time_us_;
+  int64_t device_us_;             //!< device time of last update, unwrapped and relative to first update
+  int64_t host_base_ns_;          //!< host time of first update
+  int64_t last_diff_ns_;          //!< host minus device time of last update, relative to first update
+
+  unsigned window_count_;
+  int64_t window_min_ns_;         //!< smallest host minus device time in current window
+  int64_t window_min_device_us_;  //!< device time smallest difference was seen at
+  double window_latency_sum_ns_;
+
+  double point_device_us_[NUM_WINDOWS];
+  double point_diff_ns_[NUM_WINDOWS];
+  unsigned num_points_;
+  unsigned next_point_;
+
+  double offset_ns_;              //!< fitted host minus device time at first update 
+  double drift_;                  //!< fitted change of host minus device time, per unit of device time
+
+  DeviceClockEstimate estimate_;
+};
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,141 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+#include <boost/utility.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdarg>
+
+namespace ethercat_hardware
+{
+
+/*!
+ * \brief Fills in array of diagnostics status messages, re-using them from one cycle to next.
+ *
+ * Replaces building new DiagnosticStatusWrapper objects every cycle.  Status messages 
+ * and their key-value pairs are kept in the caller's vector between cycles.  
+ * Every value is formatted into a fixed buffer, and only copied into message 
+ * when key or text differs from what was in same slot last cycle.  
+ * Once all slots exist, and value strings have grown to their longest, 
+ * a diagnostics cycle does not allocate any memory.
+ *
+ * Usage :
+ *   builder.begin();
+ *   builder.beginStatus(); builder.setName("..."); builder.addf("key", "%d", value); ...
+ *   builder.beginStatus(); ...
+ *   builder.end();
+ *
+ * Method names match diagnostic_updater::DiagnosticStatusWrapper, 
+ * so existing diagnostics code only needs different type.
+ */
+class DiagnosticsBuilder : private boost::noncopyable
+{
+public:
+  enum {OK    = diagnostic_msgs::DiagnosticStatus::OK, 
+        WARN  = diagnostic_msgs::DiagnosticStatus::WARN, 
+        ERROR = diagnostic_msgs::DiagnosticStatus::ERROR};
+
+  //! Messages are built directly in statuses, which must outlive builder
+  explicit DiagnosticsBuilder(std::vector<diagnostic_msgs::DiagnosticStatus> &statuses);
+
+  //! Starts new diagnostics cycle
+  void begin();
+  //! Moves on to next status message of cycle.  Summary and values of new status are empty.
+  void beginStatus();
+  //! Finishes cycle, drops any status messages left over from a longer previous cycle.
+  void end();
+
+  void setName(const char *name);
+  void setName(const std::string &name) {setName(name.c_str());}
+  void setNamef(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+  void setHardwareId(const char *hardware_id);
+  void setHardwareId(const std::string &hardware_id) {setHardwareId(hardware_id.c_str());}
+  void setHardwareIdf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+  //! Removes all values added to current status
+  void clear() {value_count_ = 0;}
+
+  void clearSummary();
+  void summary(unsigned char lvl, const char *s);
+  void summary(unsigned char lvl, const std::string &s) {summary(lvl, s.c_str());}
+  void summaryf(unsigned char lvl, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+  //! Same rules as DiagnosticStatusWrapper::mergeSummary()
+  void mergeSummary(unsigned char lvl, const char *s);
+  void mergeSummary(unsigned char lvl, const std::string &s) {mergeSummary(lvl, s.c_str());}
+  void mergeSummaryf(unsigned char lvl, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+  unsigned char level() const {return level_;}
+
+  void add(const char *key, const char *value);
+  void add(const char *key, const std::string &value) {add(key, value.c_str());}
+  void add(const std::string &key, const char *value) {add(key.c_str(), value);}
+  void add(const std::string &key, const std::string &value) {add(key.c_str(), value.c_str());}
+  void addf(const char *key, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+  void addf(const std::string &key, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+
+  //! Number of key or value strings that had to be updated since begin()
+  unsigned changedCount() const {return changed_count_;}
+
+  static const unsigned MAX_VALUE_LENGTH = 1000;
+  static const unsigned MAX_MESSAGE_LENGTH = 1000;
+
+protected:
+  void vaddf(const char *key, const char *format, va_list ap);
+  void finishStatus();
+  //! Copies str into dest, if it differs
+  void update(std::string &dest, const char *str);
+  void appendMessage(const char *s);
+
+  std::vector<diagnostic_msgs::DiagnosticStatus> &statuses_;
+  //! Status currently being filled in, NULL outside of a cycle
+  diagnostic_msgs::DiagnosticStatus *status_;
+  unsigned status_count_;
+  unsigned value_count_;
+  unsigned changed_count_;
+
+  //! Summary of current status is built here, and copied into status when it is finished
+  unsigned char level_;
+  char message_[MAX_MESSAGE_LENGTH];
+  unsigned message_length_;
+
+  //! Scratch space for formatting values
+  char buffer_[MAX_VALUE_LENGTH];
+};
+
+}; //end namespace ethercat_hardware
@@ -43,7 +43,7 @@ public:
   void construct(EtherCAT_SlaveHandler *sh, int &start_address);
   ~EK1122();
   int initialize(pr2_hardware_interface::HardwareInterface *, bool);
-  void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *);
+  void diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *);
 
   enum {PRODUCT_CODE = 0x4622c52};
 
@@ -43,16 +43,25 @@
 
 #include <pr2_hardware_interface/hardware_interface.h>
 
+#include <ethercat_hardware/diagnostics_builder.h>
 #include <diagnostic_updater/DiagnosticStatusWrapper.h>
 
 #include <diagnostic_msgs/DiagnosticArray.h>
 
 #include <ethercat_hardware/ethercat_com.h>
+#include <ethercat_hardware/realtime_snapshot.h>
+#include <ethercat_hardware/DeviceTelemetry.h>
+#include <ethercat_hardware/metrics_segment.h>
 
 #include <pluginlib/class_list_macros.h>
 
 using namespace std;
 
+namespace ethercat_hardware
+{
+class WGMailboxScheduler;
+};
+
 struct et1x00_error_counters
 {
   struct {
@@ -111,7 +120,10 @@ public:
   // 
   // d         DiagnositcState to add diagnostics to.
   // numPorts  Number of ports device is supposed to have.  4 is max, 1 is min.
-  void publish(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned numPorts=4) const;
+  void publish(ethercat_hardware::DiagnosticsBuilder &d, unsigned numPorts=4) const;
+
+  // Copies raw counter values into telemetry message
+  void telemetry(ethercat_hardware::DeviceTelemetry &t) const;
 
 protected:
   void zeroTotals();
@@ -155,28 +167,66 @@ public:
   /**
    * \brief For EtherCAT devices that publish more than one EtherCAT Status message.
    * If sub-class implements multiDiagnostics() then diagnostics() is not used.
-   * \param vec     Vector of diagnostics status messages. Slave appends one or more new diagnostic status'.
+   * \param d       Diagnostics builder.  Slave calls d.beginStatus() before filling in each of its status messages.
    * \param buffer  Pointer to slave process data.\ 
    */  
-  virtual void multiDiagnostics(vector<diagnostic_msgs::DiagnosticStatus> &vec, unsigned char *buffer);
+  virtual void multiDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer);
 
   /**
    * \brief For EtherCAT device that only publish one EtherCAT Status message.
    * If sub-class implements multiDiagnostics() then diagnostics() is not used.
-   * \param d       Diagnostics status wrapper.
+   * \param d       Diagnostics builder, already positioned at status message for device.
    * \param buffer  Pointer to slave process data.
    */
-  virtual void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer);
+  virtual void diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer);
 
   /** 
    * \brief Adds diagnostic information for EtherCAT ports.
    * \param d       EtherCAT port diagnostics information will be appended.
    * \param buffer  Number of communication ports slave has.
    */
+  void ethercatDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned numPorts);
+
+  /**
+   * \brief Old DiagnosticStatusWrapper based diagnostics interface.
+   *
+   * Kept so out-of-tree devices written against it still publish diagnostics.
+   * When a sub-class does not override the DiagnosticsBuilder versions, the default
+   * multiDiagnostics(DiagnosticsBuilder&) calls these, and copies whatever status
+   * messages they produce into the builder.  This copy allocates every cycle, 
+   * new devices should override the DiagnosticsBuilder versions instead.
+   * Sub-classes that override either interface should add 
+   * "using EthercatDevice::diagnostics;" (and multiDiagnostics) to keep the other visible.
+   */
+  virtual void multiDiagnostics(vector<diagnostic_msgs::DiagnosticStatus> &vec, unsigned char *buffer);
+  virtual void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer);
   void ethercatDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned numPorts);
 
+  /**
+   * \brief Fills in raw health counters of device.  
+   * Called by diagnostics thread, so it can use same data diagnostics() does.
+   * Sub-classes that override this should call EthercatDevice::telemetry() first.
+   * \param t       Telemetry of this device.
+   */
+  virtual void telemetry(ethercat_hardware::DeviceTelemetry &t);
+
+  /**
+   * \brief Fills in device specific part of shared memory metrics.
+   * Called by realtime loop every cycle, so it must not block.
+   * \param m       Metrics of this device, static fields are already filled in.
+   */
+  virtual void metrics(ethercat_hardware::DeviceMetrics &m) { }
+
   virtual void collectDiagnostics(EthercatCom *com);
 
+  /**
+   * \brief Attaches device mailbox to scheduler that drives all mailbox traffic.
+   * Called once after devices are initialized, before scheduler is started.
+   * Devices without a mailbox have nothing to attach.
+   * \return Return false if mailbox could not be attached.
+   */
+  virtual bool attachMailboxScheduler(ethercat_hardware::WGMailboxScheduler &scheduler) {return true;}
+
   /** 
    * \brief Asks device to publish (motor) trace. Only works for devices that support it. 
    * \param reason Message to put in trace as reason. 
@@ -220,17 +270,19 @@ public:
   
   // The device diagnostics are collected with a non-readtime thread that calls collectDiagnostics()
   // The device published from the realtime loop by indirectly invoking ethercatDiagnostics()
-  // To avoid blocking of the realtime thread (for long) a double buffer is used the 
-  // The publisher thread will lock newDiagnosticsIndex when publishing data.
-  // The collection thread will lock deviceDiagnostics when updating deviceDiagnostics
-  // The collection thread will also lock newDiagnosticsIndex at end of update, just before swapping buffers.
-  unsigned newDiagnosticsIndex_;
-  pthread_mutex_t newDiagnosticsIndexLock_;  
-  EthercatDeviceDiagnostics deviceDiagnostics[2];
-  pthread_mutex_t diagnosticsLock_;
-
-  // Keep diagnostics status as cache.  Avoids a lot of construction/destruction of status object.
-  diagnostic_updater::DiagnosticStatusWrapper diagnostic_status_;
+  // Only the collection thread touches collectDiagnostics_, which holds the accumulated totals.
+  // After each collection, a copy is written to diagnosticsSnapshot_, which the publishing 
+  // thread reads into publishDiagnostics_.  Neither thread ever waits on a lock held by the other.
+  EthercatDeviceDiagnostics collectDiagnostics_;
+  ethercat_hardware::RealtimeSnapshot<EthercatDeviceDiagnostics> diagnosticsSnapshot_;
+  EthercatDeviceDiagnostics publishDiagnostics_;
+
+private:
+  //! Status and scratch vector used by the old DiagnosticStatusWrapper interface
+  diagnostic_updater::DiagnosticStatusWrapper legacy_status_;
+  vector<diagnostic_msgs::DiagnosticStatus> legacy_statuses_;
+  //! Cleared by default diagnostics(DiagnosticStatusWrapper&), meaning no sub-class uses old interface
+  bool legacy_diagnostics_;
 };
 
 #endif /* ETHERCAT_DEVICE_H */
@@ -45,7 +45,16 @@
 #include "ethercat_hardware/ethercat_com.h"
 #include "ethercat_hardware/ethernet_interface_info.h"
 
-#include <realtime_tools/realtime_publisher.h>
+#include "ethercat_hardware/shared_realtime_publisher.h"
+#include "ethercat_hardware/EthercatTelemetry.h"
+#include "ethercat_hardware/metrics_segment.h"
+#include "ethercat_hardware/packet_mmap_netif.h"
+#include "ethercat_hardware/multi_chain_netif.h"
+#include "ethercat_hardware/process_image_layout.h"
+#include "ethercat_hardware/timeout_tuner.h"
+#include "ethercat_hardware/ethercat_topology.h"
+#include "ethercat_hardware/realtime_snapshot.h"
+#include "ethercat_hardware/wg_mailbox.h"
 
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics/stats.hpp>
@@ -55,12 +64,13 @@
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <pluginlib/class_loader.h>
 
 #include <std_msgs/Bool.h>
 
-#include <boost/regex.hpp>
+#include <map>
 
 using namespace boost::accumulators;
  
@@ -77,6 +87,9 @@ struct EthercatHardwareDiagnostics
   double max_unpack_state_;
   double max_publish_;
   int txandrx_errors_;
+  //! Holds a 1 Hz diagnostics period of drops at 1 kHz with two tries per cycle, older drops are counted as unchecked
+  static const unsigned MAX_DROP_TIMES = 2048;
+  ros::Time drop_times_[MAX_DROP_TIMES];  //!< Ring of times process data attempt failed, indexed by txandrx_errors_
   unsigned device_count_;
   bool pd_error_;
   bool halt_after_reset_; //!< True if motor halt soon after motor reset 
@@ -85,6 +98,13 @@ struct EthercatHardwareDiagnostics
   unsigned halt_motors_error_count_;    //!< Number of transitions into halt state due to device error
   struct netif_counters counters_;
   bool input_thread_is_stopped_;
+  bool packet_mmap_;   //!< True if PACKET_MMAP transport is used, packet_mmap_stats_ is only valid then
+  ethercat_hardware::PacketMmapStats packet_mmap_stats_;
+  bool multi_chain_;   //!< True if devices are on more than one chain, multi_chain_stats_ is only valid then
+  ethercat_hardware::MultiChainStats multi_chain_stats_;
+  bool auto_timeout_;  //!< True if timeout and retries are picked by TimeoutTuner, timeout_tuning_ is only valid then
+  ethercat_hardware::TimeoutTuning timeout_tuning_;
+  ethercat_hardware::TopologySummary topology_;  //!< Result of latest chain topology measurement
   bool motors_halted_; //!< True if motors are halted  
   const char* motors_halted_reason_; //!< reason that motors first halted 
 
@@ -114,13 +134,14 @@ public:
 
   /*!
    * \brief Initializes hardware publish.
-   * \param buffer_size size of proccess data buffer
+   * \param layout offsets of device blocks in proccess data buffer, and size of buffer
    * \param number of EtherCAT slave devices
    */
-  void initialize(const string &interface, unsigned int buffer_size, 
+  void initialize(const string &interface, const ethercat_hardware::ProcessImageLayout &layout, 
                   const std::vector<boost::shared_ptr<EthercatDevice> > &slaves,
                   unsigned int num_ethercat_devices_,
-                  unsigned timeout, unsigned max_pd_retries);
+                  unsigned timeout, unsigned max_pd_retries, 
+                  bool publish_telemetry);
 
   /*!
    * \brief Triggers publishing of new diagnostics data
@@ -128,8 +149,9 @@ public:
    * Makes copy of diagnostics data and triggers internal thread to 
    * started conversion and publish of data.  
    * This function will not block.
+   * \param telemetry_only  only publish telemetry message, not string diagnostics
    */
-  void publish(const unsigned char *buffer, const EthercatHardwareDiagnostics &diagnostics);
+  void publish(const unsigned char *buffer, const EthercatHardwareDiagnostics &diagnostics, bool telemetry_only=false);
  
   /*!
    * \brief Stops publishing thread.  May block.
@@ -147,6 +169,14 @@ private:
    */
   void publishDiagnostics();
 
+  /*!
+   * \brief Publishes telemetry
+   *
+   * Fills in raw numbers from same data publishDiagnostics() uses.  
+   * Does no string formating, so it can be run much more often.
+   */
+  void publishTelemetry();
+
   /*!
    * \brief Publishing thread main loop
    *
@@ -159,16 +189,25 @@ private:
    * \brief Helper function for converting timing for diagnostics
    */  
   static void timingInformation(
-        diagnostic_updater::DiagnosticStatusWrapper &status, 
-        const string &key, 
+        ethercat_hardware::DiagnosticsBuilder &status, 
+        const char *key, 
         const accumulator_set<double, stats<tag::max, tag::mean> > &acc,
         double max);
 
+  /*!
+   * \brief Helper function for converting latency histogram for diagnostics
+   */  
+  static void latencyInformation(
+        ethercat_hardware::DiagnosticsBuilder &status, 
+        const char *key, 
+        const ethercat_hardware::MetricsHistogram &histogram);
+
   ros::NodeHandle node_;
 
   boost::mutex diagnostics_mutex_; //!< mutex protects all class data and cond variable
   boost::condition_variable diagnostics_cond_;
   bool diagnostics_ready_;
+  bool diagnostics_pending_; //!< true if string diagnostics should be published, not just telemetry
   boost::thread diagnostics_thread_;
 
   ros::Publisher publisher_;
@@ -176,6 +215,7 @@ private:
   EthercatHardwareDiagnostics diagnostics_; //!< Diagnostics information use by publish function
   unsigned char *diagnostics_buffer_;
   unsigned int buffer_size_;
+  ethercat_hardware::ProcessImageLayout layout_;
   std::vector<boost::shared_ptr<EthercatDevice> > slaves_;
   unsigned int num_ethercat_devices_;
   string interface_;
@@ -193,10 +233,14 @@ private:
   static const unsigned dropped_packet_warning_hold_time_ = 10;  //keep warning up for 10 seconds
 
   diagnostic_msgs::DiagnosticArray diagnostic_array_;
+  //! Fills in diagnostic_array_, re-using status messages from previous publish
+  ethercat_hardware::DiagnosticsBuilder status_;
+
+  bool publish_telemetry_;
+  ros::Publisher telemetry_publisher_;
+  ethercat_hardware::EthercatTelemetry telemetry_;
   //! Information about Ethernet interface used for EtherCAT communication
   EthernetInterfaceInfo ethernet_interface_info_;
-  vector<diagnostic_msgs::KeyValue> values_;
-  diagnostic_updater::DiagnosticStatusWrapper status_;
 };
 
 
@@ -229,6 +273,8 @@ public:
 
   /*!
    * \brief Collects diagnotics from all devices.
+   *
+   * Also re-measures chain topology and link delays, if it is time to.
    */
   void collectDiagnostics();
 
@@ -264,11 +310,22 @@ private:
 
   struct netif *ni_;
   string interface_;
+  //! True if ni_ uses PACKET_MMAP rings instead of EML socket driver
+  bool packet_mmap_;
+  //! Creates network interface, using transport selected with rosparam
+  struct netif *initNetif(const char *interface);
+  //! Interface of each chain.  With more than one chain, ni_ combines them, otherwise ni_ is only chain.
+  std::vector<struct netif*> chain_nis_;
+  bool initChains(const char *interface);
+  void setProcessData(bool process_data);
 
   EtherCAT_AL *al_;
   EtherCAT_Master *em_;
 
   boost::shared_ptr<EthercatDevice> configSlave(EtherCAT_SlaveHandler *sh);
+  void buildDeviceClassMap(const std::vector<EtherCAT_SlaveHandler*> &slave_handles);
+  //! Maps EtherCAT product code to name of device driver plugin class
+  std::map<unsigned, std::string> device_classes_;
   std::vector<boost::shared_ptr<EthercatDevice> > slaves_;
   unsigned int num_ethercat_devices_;
 
@@ -276,23 +333,56 @@ private:
   unsigned char *prev_buffer_;
   unsigned char *buffers_;
   unsigned int buffer_size_;
+  //! Where each device's command and status are in process data buffers
+  ethercat_hardware::ProcessImageLayout layout_;
 
   bool halt_motors_;
   unsigned int reset_state_;
 
   unsigned timeout_;        //!< Timeout (in microseconds) to used for sending/recieving packets once in realtime mode.
   unsigned max_pd_retries_; //!< Max number of times to retry sending process data before halting motors
+  int setNetifTimeout(unsigned timeout);
+
+  //! If true, timeout_ and max_pd_retries_ are adjusted to measured process data round trip times
+  bool auto_timeout_;
+  ethercat_hardware::TimeoutTuner timeout_tuner_;
+  uint64_t last_late_pkt_rtt_sum_;  //!< Used to find when interface has measured RTT of another late packet
+  void tuneTimeout();
 
   void publishDiagnostics();  //!< Collects raw diagnostics data and passes it to diagnostics_publisher
+  void publishTelemetry();    //!< Passes raw diagnostics data to diagnostics_publisher, for telemetry only
+  void copyInputThreadCounters();
   static void updateAccMax(double &max, const accumulator_set<double, stats<tag::max, tag::mean> > &acc);
   EthercatHardwareDiagnostics diagnostics_;
   EthercatHardwareDiagnosticsPublisher diagnostics_publisher_;
   ros::Time last_published_;
+  //! Period of telemetry publishing, zero if telemetry is disabled
+  ros::Duration telemetry_period_;
+  ros::Time last_telemetry_published_;
   ros::Time last_reset_;
 
-  realtime_tools::RealtimePublisher<std_msgs::Bool> motor_publisher_;
+  void initMetrics();
+  void updateMetrics(const ros::Time &update_start_time);  //!< Copies counters into shared memory metrics segment
+  //! Optional shared memory segment that external monitoring tools can read without ROS
+  ethercat_hardware::MetricsSegmentWriter metrics_segment_;
+  ethercat_hardware::MasterMetrics metrics_;
+  std::vector<ethercat_hardware::DeviceMetrics> device_metrics_;
+
+  ethercat_hardware::SharedRealtimePublisher<std_msgs::Bool> motor_publisher_;
 
   EthercatOobCom *oob_com_;  
+  //! Drives mailbox transactions of all devices over oob_com_, so transactions on different devices overlap
+  boost::scoped_ptr<ethercat_hardware::WGMailboxScheduler> mailbox_scheduler_;
+
+  //! Measures chain graph and link delays from collectDiagnostics(), and publishes them
+  void measureTopology();
+  ethercat_hardware::EthercatTopology topology_;
+  //! Period of topology measurements, zero if disabled
+  ros::Duration topology_period_;
+  ros::Time last_topology_;
+  ros::Publisher topology_publisher_;
+  //! Hands summary of latest measurement from diagnostics collection thread to realtime thread
+  ethercat_hardware::RealtimeSnapshot<ethercat_hardware::TopologySummary> topology_snapshot_;
 
   pluginlib::ClassLoader<EthercatDevice> device_loader_;
 };
@@ -0,0 +1,150 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include "ethercat_hardware/ethercat_com.h"
+#include "ethercat_hardware/ChainTopology.h"
+
+#include <al/ethercat_slave_handler.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace ethercat_hardware
+{
+
+
+/*!
+ * \brief One device in chain graph built by EthercatTopology.
+ */
+struct TopologyNode
+{
+  static const unsigned NUM_PORTS = 4;
+
+  TopologyNode();
+  bool isOpen(unsigned port) const {return open_ports_ & (1<<port);}
+
+  uint16_t station_address_;
+  bool valid_;                          //!< false if registers of device could not be read
+  uint8_t open_ports_;                  //!< bit N is set if port N has link and communication, and is not looped back
+  uint32_t receive_time_[NUM_PORTS];    //!< latched port receive times (ns), local clock of device
+  int parent_;                          //!< ring position of upstream device, -1 for device connected to master
+  unsigned parent_port_;                //!< port of upstream device that this device is connected to
+  uint32_t hop_delay_ns_;               //!< one-way propagation delay of link from upstream device
+  uint32_t delay_ns_;                   //!< one-way delay of frame from first device to this one
+};
+
+
+/*!
+ * \brief Result of latest topology measurement.  
+ *
+ * Trivially copyable, so it can be handed to realtime thread with RealtimeSnapshot.
+ */
+struct TopologySummary
+{
+  TopologySummary();
+  uint32_t measurements_;
+  uint32_t failures_;              //!< measurements where registers could not be read or ports did not form a tree
+  uint32_t changes_;               //!< number of times chain graph changed between measurements
+  bool valid_;                     //!< true if latest measurement succeeded
+  uint32_t round_trip_ns_;         //!< time frame spends in chain after entering first device
+  uint32_t max_hop_delay_ns_;
+  unsigned max_hop_position_;
+  uint32_t max_hop_increase_ns_;   //!< largest growth of any hop delay over lowest delay measured for that hop
+  unsigned max_increase_position_;
+};
+
+
+/*!
+ * \brief Measures chain graph and per-link propagation delay from ESC port receive times.
+ *
+ * A broadcast write to receive time register of port 0 makes each ESC latch 
+ * its local time as the frame passes each of its ports.  These times, and the 
+ * DL status of every port, are then read back with a few chained frames.
+ * Frames travel through ports of each device in order 0,3,1,2, so the open ports 
+ * of devices in ring order describe a depth-first walk of the chain tree.
+ * For each link, round trip time of frame through link and everything behind it
+ * is measured by upstream device, while time spent behind the link is measured by 
+ * downstream device.  Half of the difference is the one-way delay of the link 
+ * (including forwarding delay of the ESC).
+ *
+ * Chain graph is cached between measurements, so topology changes are counted,
+ * and lowest delay seen for each hop is remembered so slowly degrading links show up 
+ * as an increase before they start dropping frames.
+ */
+class EthercatTopology
+{
+public:
+  EthercatTopology();
+
+  /*!
+   * \brief Latches and reads port receive times of all devices and rebuilds chain graph.
+   * \param slave_handles EtherCAT devices, in ring order
+   * \return true for success, false if registers could not be read or chain graph is invalid
+   */
+  bool measure(EthercatCom *com, const std::vector<EtherCAT_SlaveHandler*> &slave_handles);
+
+  /*!
+   * \brief Finds parent, and link delay of each node from open ports and receive times.
+   *
+   * Nodes must be in ring order.  Returns false if a node is not valid, or if there 
+   * are more nodes than open ports to connect them.
+   */
+  static bool buildGraph(std::vector<TopologyNode> &nodes);
+
+  //! Fills in message from most recent measurement
+  void fillMessage(ChainTopology &msg) const;
+
+  const std::vector<TopologyNode> &nodes() const {return nodes_;}
+  const TopologySummary &summary() const {return summary_;}
+
+  static const EC_UINT RECEIVE_TIME_ADDR = 0x0900;
+  //! Each device needs two telegrams (~42 bytes), this keeps frames below ethernet MTU
+  static const unsigned SLAVES_PER_FRAME = 32;
+
+protected:
+  bool readRegisters(EthercatCom *com, const std::vector<EtherCAT_SlaveHandler*> &slave_handles,
+                     std::vector<TopologyNode> &nodes);
+  void updateSummary(bool valid, const std::vector<TopologyNode> &nodes);
+  static bool sameGraph(const std::vector<TopologyNode> &a, const std::vector<TopologyNode> &b);
+
+  std::vector<TopologyNode> nodes_;          //!< chain graph of last successful measurement
+  std::vector<uint32_t> min_hop_delay_ns_;   //!< lowest delay seen for each hop since graph last changed
+  TopologySummary summary_;
+};
+
+
+}; //end namespace ethercat_hardware
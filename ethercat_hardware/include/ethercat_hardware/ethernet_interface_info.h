@@ -36,9 +36,14 @@
 #define ETHERNET_INTERFACE_INFO_H
 
 #include <string>
+#include <vector>
 #include <stdint.h>
 
-#include <diagnostic_updater/DiagnosticStatusWrapper.h>
+#include <ros/time.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "ethercat_hardware/diagnostics_builder.h"
 
 struct EthtoolStats
 {
@@ -58,19 +63,46 @@ struct InterfaceState
   bool running_;
 };
 
+//! Interface counters and state at one point in time, collected through netlink
+struct InterfaceSample
+{
+  InterfaceSample();
+  ros::Time time_;
+  InterfaceState state_;
+  uint64_t rx_errors_;
+  uint64_t rx_crc_errors_;
+  uint64_t rx_frame_errors_;
+  uint64_t rx_missed_errors_;
+  unsigned link_changes_;   //!< Link change notifications received since start
+  unsigned lost_links_;     //!< Times link went from running to not running since start
+};
+
 class EthernetInterfaceInfo
 {
 public:
   EthernetInterfaceInfo();
-  void initialize(const std::string &interface);
+  /**
+   * \brief Sets up statistics collection for interface.
+   *
+   * \param interface   Name of network interface
+   * \param sample_rate Rate (Hz) that netlink statistics are sampled at, zero to only use ioctls once per publish
+   */
+  void initialize(const std::string &interface, double sample_rate = 0.0);
   ~EthernetInterfaceInfo();  
 
   /**
    * \brief Collect and append ethernet interface diagnostics
    *
-   * \param d       Diagnostics status wrapper.
+   * \param d          Diagnostics status wrapper.
+   * \param drop_times Ring of times process data was dropped, used to find drops that coincide with NIC errors or link loss
+   * \param num_drops  Total number of drops written into drop_times ring
+   * \param ring_size  Number of entries in drop_times ring
    */
-  void publishDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d);
+  void publishDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, 
+                          const ros::Time *drop_times = NULL, unsigned num_drops = 0, unsigned ring_size = 0);
+
+  //! Number of samples kept for correlating drops, 10 seconds at 100Hz
+  static const unsigned SAMPLE_HISTORY = 1000;
 
 protected:
   //! Get ethtool stats from interface
@@ -102,6 +134,36 @@ protected:
   //! Orignal statistics counts when initialize() was called.
   EthtoolStats orig_stats_;
   InterfaceState last_state_;
+
+  // Netlink statistics sampling.  
+  // RTM_GETSTATS only returns IFLA_STATS64 counters, which is much cheaper than full ethtool dump,
+  // and link changes are pushed by kernel instead of being polled.
+  bool initializeNetlink(double sample_rate);
+  bool getNetlinkStats(InterfaceSample &sample);
+  void readLinkEvents(InterfaceSample &sample);
+  void samplerThreadFunc();
+  //! Counts drops newer than last call that coincide with NIC errors or link changes, and drops that were lost from ring
+  void correlateDrops(const ros::Time *drop_times, unsigned num_drops, unsigned ring_size);
+
+  //! netlink socket for statistics requests
+  int netlink_sock_;
+  //! netlink socket subscribed to link change notifications
+  int netlink_events_sock_;
+  int ifindex_;
+  uint32_t netlink_seq_;
+  ros::Duration sample_period_;
+  boost::thread sampler_thread_;
+  boost::mutex samples_lock_;  //!< protects samples_ and next_sample_
+  std::vector<InterfaceSample> samples_;  //!< ring of SAMPLE_HISTORY samples
+  uint64_t next_sample_;
+  InterfaceSample orig_sample_;
+  InterfaceSample last_sample_;  //!< Only used by sampler thread
+
+  unsigned last_correlated_drop_;
+  unsigned drops_with_errors_;
+  unsigned drops_with_link_change_;
+  unsigned drops_unchecked_;  //!< Drops overwritten in drop_times ring before they could be correlated
+  ros::Time last_error_time_;
 };
 
 
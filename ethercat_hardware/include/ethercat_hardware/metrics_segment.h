@@ -0,0 +1,219 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+namespace ethercat_hardware
+{
+
+/*!
+ * \brief Log2 histogram of how long a stage of the realtime loop took.
+ *
+ * Bucket 0 counts durations under 1us, bucket N counts durations of 
+ * [2^(N-1)us, 2^N us), last bucket also counts everything slower.
+ * Counts are never reset, so readers can compute rates from differences.
+ */
+struct MetricsHistogram
+{
+  static const unsigned NUM_BUCKETS = 16;
+
+  void record(double seconds);
+
+  uint64_t count_;
+  uint64_t total_ns_;
+  uint64_t max_ns_;
+  uint64_t buckets_[NUM_BUCKETS];
+};
+
+
+//! Metrics of EtherCAT master, written by realtime loop every cycle
+struct MasterMetrics
+{
+  uint64_t cycle_count_;
+  uint64_t update_time_ns_;  //!< ROS time at start of last cycle
+
+  // Network interface counters (netif_counters)
+  uint64_t sent_;
+  uint64_t received_;
+  uint64_t collected_;
+  uint64_t dropped_;
+  uint64_t tx_error_;
+  uint64_t tx_net_down_;
+  uint64_t tx_would_block_;
+  uint64_t tx_no_bufs_;
+  uint64_t tx_full_;
+  uint64_t rx_runt_pkt_;
+  uint64_t rx_not_ecat_;
+  uint64_t rx_other_eml_;
+  uint64_t rx_bad_index_;
+  uint64_t rx_bad_seqnum_;
+  uint64_t rx_dup_seqnum_;
+  uint64_t rx_dup_pkt_;
+  uint64_t rx_bad_order_;
+  uint64_t rx_late_pkt_;
+
+  uint32_t txandrx_errors_;
+  uint32_t halt_motors_error_count_;
+  uint32_t halt_motors_service_count_;
+  uint32_t reset_motors_service_count_;
+  uint32_t motors_halted_;
+  uint32_t num_devices_;
+
+  MetricsHistogram pack_command_;
+  MetricsHistogram txandrx_;
+  MetricsHistogram unpack_state_;
+  MetricsHistogram publish_;
+
+  // Process data latency split from packet timestamps, only with packet_mmap transport
+  MetricsHistogram host_send_;
+  MetricsHistogram wire_;
+  MetricsHistogram host_wake_;
+};
+
+
+//! Metrics of one EtherCAT device
+struct DeviceMetrics
+{
+  uint32_t ring_position_;
+  uint32_t product_code_;
+  uint32_t serial_;
+  uint32_t drops_;                 //!< Cycles where device status was not updated 
+  uint32_t max_consecutive_drops_;
+  uint32_t pad_;
+};
+
+
+/*!
+ * \brief Start of shared memory metrics segment.
+ *
+ * Segment holds header, followed by MasterMetrics, followed by num_devices_ DeviceMetrics.
+ * Version is increased whenever layout changes in a way old readers cannot handle.  
+ * Fields may be appended to metrics structures without changing version, 
+ * readers must use master_size_ and device_size_ to find device records.
+ *
+ * Writer keeps sequence_ odd while it is updating metrics.  
+ * Reader copy is consistent if sequence_ was even and did not change during copy.
+ */
+struct MetricsSegmentHeader
+{
+  static const uint32_t VERSION = 1;
+
+  char magic_[8];  //!< "ECMETRIC"
+  uint32_t version_;
+  uint32_t header_size_;
+  uint32_t master_size_;
+  uint32_t device_size_;
+  uint32_t num_devices_;
+  uint32_t writer_pid_;
+  volatile uint32_t sequence_;
+  uint32_t pad_;
+};
+
+
+/*!
+ * \brief Creates metrics segment and copies metrics into it.
+ *
+ * After open(), write() does not block or make system calls, so it can be used by realtime loop.
+ * External processes can read segment with MetricsSegmentReader, without any ROS dependency 
+ * and without ever slowing down the writer.
+ */
+class MetricsSegmentWriter : private boost::noncopyable
+{
+public:
+  MetricsSegmentWriter();
+  ~MetricsSegmentWriter();
+
+  /*!
+   * \brief Creates (or replaces) shared memory segment.
+   * \param name POSIX shared memory name, for example "/ethercat_metrics"
+   * \return true for success
+   */
+  bool open(const std::string &name, unsigned num_devices);
+  //! Unmaps and removes segment
+  void close();
+  bool isOpen() const {return header_ != NULL;}
+
+  //! Copies metrics into segment.  devices must have num_devices entries.
+  void write(const MasterMetrics &master, const DeviceMetrics *devices);
+
+protected:
+  std::string name_;
+  void *segment_;
+  size_t size_;
+  MetricsSegmentHeader *header_;
+  MasterMetrics *master_;
+  DeviceMetrics *devices_;
+  unsigned num_devices_;
+};
+
+
+/*!
+ * \brief Reads metrics segment created by MetricsSegmentWriter, possibly from another process.
+ */
+class MetricsSegmentReader : private boost::noncopyable
+{
+public:
+  MetricsSegmentReader();
+  ~MetricsSegmentReader();
+
+  //! Maps existing segment read-only.  Fails if segment does not exist or has unknown layout.
+  bool open(const std::string &name);
+  void close();
+  bool isOpen() const {return header_ != NULL;}
+
+  unsigned numDevices() const;
+
+  /*!
+   * \brief Takes consistent copy of all metrics.
+   * \return false if writer was updating segment during every attempt
+   */
+  bool read(MasterMetrics &master, std::vector<DeviceMetrics> &devices);
+
+  static const unsigned MAX_READ_ATTEMPTS = 1000;
+
+protected:
+  void *segment_;
+  size_t size_;
+  const MetricsSegmentHeader *header_;
+};
+
+
+}; //end namespace ethercat_hardware
@@ -39,8 +39,9 @@
 #include "ethercat_hardware/MotorTraceSample.h"
 #include "ethercat_hardware/ActuatorInfo.h"
 
-#include "realtime_tools/realtime_publisher.h"
-#include "diagnostic_updater/DiagnosticStatusWrapper.h"
+#include "ethercat_hardware/shared_realtime_publisher.h"
+#include "ethercat_hardware/realtime_snapshot.h"
+#include "ethercat_hardware/diagnostics_builder.h"
 
 #include <boost/utility.hpp>
 #include <boost/thread/mutex.hpp>
@@ -239,7 +240,7 @@ public:
 
 
   //! Appends heating diagnostic data to status wrapper
-  void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d);
+  void diagnostics(ethercat_hardware::DiagnosticsBuilder &d);
 
 
 
@@ -275,22 +276,41 @@ protected:
   //! Last recorded ambient temperature : in Celcius
   double ambient_temperature_;
 
-  //! mutex protects values updates by realtime thread and used by diagnostics thread  
-  boost::mutex mutex_;
-
   //! True if most has overheat, once set, will only clear when reset() is called
   bool overheat_;
 
-  //! Sum of heat energy for last sample interval
-  double heating_energy_sum_;
-  //! Sum of (abient heat * time) over last sample interval
-  double ambient_temperature_sum_;
-  //! Time (in seconds) since late sample interval occurred
-  double duration_since_last_sample_;
+  //! Sum of all heat energy put into motor
+  double heating_energy_total_;
+  //! Sum of (abient heat * time) over all updates
+  double ambient_temperature_total_;
+  //! Time (in seconds) covered by all updates
+  double duration_total_;
+
+  /*! 
+   * Values used by diagnostics and save threads.  
+   * Written by thread calling update(), so it never waits for other threads.
+   * Totals are never reset, readers find averages from change in totals since their last read.
+   */
+  struct Snapshot
+  {
+    bool overheat_;
+    double winding_temperature_;
+    double housing_temperature_;
+    double ambient_temperature_;
+    double heating_energy_total_;
+    double ambient_temperature_total_;
+    double duration_total_;
+  };
+  void updateSnapshot();
+  RealtimeSnapshot<Snapshot> snapshot_;
+  //! Snapshot from last call to diagnostics(), only used by diagnostics thread
+  Snapshot last_diagnostics_snapshot_;
+  //! Average ambient temperature calculated by last call to diagnostics()
+  double average_ambient_temperature_;
   //! Sample interval for trace (in seconds)
   //double trace_sample_interval_;
   //! realtime publisher for MotorHeatingSample
-  realtime_tools::RealtimePublisher<ethercat_hardware::MotorTemperature> *publisher_;
+  ethercat_hardware::SharedRealtimePublisher<ethercat_hardware::MotorTemperature> *publisher_;
 
   MotorHeatingModelParameters motor_params_;
   std::string actuator_name_;  //!< name of actuator (ex. fl_caster_rotation_motor)
@@ -6,16 +6,16 @@
 #include <string>
 #include <vector>
 
-#include <realtime_tools/realtime_publisher.h>
+#include "ethercat_hardware/shared_realtime_publisher.h"
 #include <ethercat_hardware/MotorTraceSample.h>
 #include <ethercat_hardware/MotorTrace.h>
 #include <ethercat_hardware/ActuatorInfo.h>
 #include <ethercat_hardware/BoardInfo.h>
 
-#include <diagnostic_updater/DiagnosticStatusWrapper.h>
+#include "ethercat_hardware/diagnostics_builder.h"
+#include "ethercat_hardware/realtime_snapshot.h"
 
 #include <boost/utility.hpp>
-#include <boost/thread/mutex.hpp>
 
 class MotorModel : private boost::noncopyable
 {
@@ -25,7 +25,7 @@ public:
                   const ethercat_hardware::BoardInfo &board_info);
   void flagPublish(const std::string &reason, int level, int delay);
   void checkPublish();
-  void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d);
+  void diagnostics(ethercat_hardware::DiagnosticsBuilder &d);
   void sample(const ethercat_hardware::MotorTraceSample &s);
   bool verify();
   void reset();
@@ -38,7 +38,7 @@ protected:
   double backemf_constant_;
   bool previous_pwm_saturated_;
   std::vector<ethercat_hardware::MotorTraceSample> trace_buffer_;
-  realtime_tools::RealtimePublisher<ethercat_hardware::MotorTrace> *publisher_;
+  ethercat_hardware::SharedRealtimePublisher<ethercat_hardware::MotorTrace> *publisher_;
   double current_error_limit_;
   int publish_delay_;
   int publish_level_;
@@ -72,9 +72,26 @@ protected:
     double max_filtered_value_;
   };  
 
-  // Lock around values used for diagnostics, 
-  // filter updates and diagnostic publishing are called from same different threads
-  boost::mutex diagnostics_mutex_; 
+  // Filter updates and diagnostic publishing are called from different threads.
+  // Realtime thread copies values used by diagnostics into snapshot whenever they change.
+  struct DiagnosticsSnapshot
+  {
+    double motor_voltage_error_;
+    double motor_voltage_error_max_;
+    double abs_motor_voltage_error_;
+    double abs_motor_voltage_error_max_;
+    double current_error_;
+    double current_error_max_;
+    double abs_current_error_;
+    double abs_current_error_max_;
+    double est_motor_resistance_;
+    unsigned published_traces_;
+    int level_;
+    char reason_[128];
+  };
+  void updateDiagnosticsSnapshot();
+  ethercat_hardware::RealtimeSnapshot<DiagnosticsSnapshot> diagnostics_snapshot_;
+
   Filter motor_voltage_error_;
   Filter abs_motor_voltage_error_;
   Filter measured_voltage_error_;
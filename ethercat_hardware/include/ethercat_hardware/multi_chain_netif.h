@@ -0,0 +1,99 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <ethercat/ethercat_xenomai_drv.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace ethercat_hardware
+{
+
+
+struct MultiChainStats
+{
+  static const unsigned MAX_CHAINS = 4;
+
+  unsigned num_chains_;
+  uint64_t process_data_frames_;  //!< Process data frames sent to all chains at once
+  uint64_t forwarded_frames_;     //!< Other frames, passed through chains one after another
+  uint64_t chain_retries_[MAX_CHAINS];   //!< Process data frames sent again on just one chain
+  uint64_t chain_failures_[MAX_CHAINS];  //!< Process data frames that chain did not return, even after retries
+};
+
+
+/*!
+ * \brief Combines EtherCAT chains on several network interfaces into one interface.
+ *
+ * EML keeps master, data link layer and slave table in singletons, so a process can 
+ * only drive one chain.  This interface makes chains on separate NICs look like one 
+ * long chain to EML.  Frames are sent through first chain, and the returned frame is 
+ * sent through next chain, so auto-increment addresses and working counters carry 
+ * over from one chain to the next just like they would between devices of one chain.
+ * 
+ * Process data frames (see setMultiChainProcessData()) use logical addressing, which 
+ * does not depend on order of chains.  These are sent to all chains at once, so process 
+ * data round trip is that of slowest chain instead of sum of all chains.  Replies are 
+ * merged with mergeChainReply().  A chain that does not return its copy is retried 
+ * alone, up to max_chain_retries times, without sending frame to other chains again.
+ *
+ * Chains must already be created (with init_ec() or initPacketMmapNetif()), and 
+ * are still owned by caller : they have to be closed after closeMultiChainNetif().
+ * Returns NULL on failure.
+ */
+struct netif *initMultiChainNetif(const std::vector<struct netif*> &chains, unsigned max_chain_retries);
+
+//! Closes interface created by initMultiChainNetif(), but not its chains.  Returns 0 for success
+int closeMultiChainNetif(struct netif *ni);
+
+//! Marks frames sent by calling thread as process data, or stops doing so
+void setMultiChainProcessData(struct netif *ni, bool process_data);
+
+void getMultiChainStats(struct netif *ni, MultiChainStats &stats);
+
+/*!
+ * \brief Merges reply from one chain into combined process data reply.
+ *
+ * Devices only change the data they are mapped to, so every byte where reply differs from 
+ * sent frame is copied into merged frame.  Working counters of each datagram are added up.
+ * All buffers hold same frame, as dumped by framedump().  
+ * Returns false if datagrams of frame can not be parsed.
+ */
+bool mergeChainReply(unsigned char *merged, const unsigned char *sent, const unsigned char *reply, unsigned length);
+
+
+}; //end namespace ethercat_hardware
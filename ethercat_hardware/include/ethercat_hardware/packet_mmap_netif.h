@@ -0,0 +1,167 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <ethercat/ethercat_xenomai_drv.h>
+#include "ethercat_hardware/metrics_segment.h"
+
+#include <stdint.h>
+
+namespace ethercat_hardware
+{
+
+static const unsigned PACKET_MMAP_FRAME_SIZE = 2048;  //!< Size of each ring frame, large enough for any EtherCAT frame
+
+
+struct PacketMmapConfig
+{
+  PacketMmapConfig() : 
+    num_frames_(64), 
+    timeout_us_(20000), 
+    busy_poll_us_(0), 
+    spin_(false),
+    sleep_slice_us_(50),
+    early_resend_(false),
+    max_resends_(2),
+    min_resend_us_(50),
+    redundant_pd_(false),
+    timestamps_(false),
+    hardware_timestamps_(false)
+  { }
+
+  unsigned num_frames_;   //!< Number of frames in each of TX and RX rings
+  int64_t timeout_us_;    //!< Time to wait for frame to return before it is considered dropped
+  unsigned busy_poll_us_; //!< SO_BUSY_POLL time, zero to leave disabled
+  bool spin_;             //!< Spin on RX ring for whole wait, instead of only for expected round trip time
+  unsigned sleep_slice_us_; //!< Longest sleep while waiting for any frame
+  bool early_resend_;     //!< Send process data frame again once its reply is later than 99.9% of replies
+  unsigned max_resends_;  //!< Maximum number of times process data frame is sent again
+  unsigned min_resend_us_;  //!< Process data frames are never sent again sooner than this
+  bool redundant_pd_;     //!< Send second copy of every process data frame right after first one
+  bool timestamps_;       //!< Timestamp process data frames, to split round trip into host and wire latency
+  bool hardware_timestamps_;  //!< Use NIC timestamps if NIC supports them, instead of kernel software timestamps
+};
+
+
+struct PacketMmapStats
+{
+  uint64_t resends_;          //!< Process data frames that were sent again because reply was late
+  uint64_t duplicates_;       //!< Replies that arrived after reply to other copy of frame
+  uint64_t redundant_sent_;   //!< Redundant copies of process data frames that were sent
+  uint64_t redundant_used_;   //!< Process data replies that came from redundant copy, because first copy was lost or invalid
+  uint64_t invalid_replies_;  //!< Replies with a zero working counter that were skipped because another copy was outstanding
+
+  /*!
+   * Latencies of process data frames, only recorded when timestamps are enabled.
+   * host_send_ is time from tx() until kernel sent frame, wire_ is time until reply arrived, 
+   * and host_wake_ is time until waiting thread had reply.  With hardware timestamps, 
+   * NIC clock can not be compared to host clock : wire_ is time between NIC timestamps, 
+   * host_send_ is not recorded, and host_wake_ counts all the rest of the round trip.
+   */
+  bool hardware_timestamps_;
+  MetricsHistogram host_send_;
+  MetricsHistogram wire_;
+  MetricsHistogram host_wake_;
+  uint64_t timestamps_missing_;  //!< Frames without usable TX timestamp, whose wire_ latency also includes host_send_ 
+  unsigned expected_rtt_us_;  //!< Median round trip time of process data frames, zero until enough are measured
+  unsigned resend_after_us_;  //!< Process data frames are sent again after this time, zero if early resend is off
+};
+
+
+/*!
+ * \brief Creates EtherCAT network interface that uses memory mapped AF_PACKET rings.
+ *
+ * Alternative to EML's init_ec().  Frames are dumped directly into TX ring and built 
+ * directly from RX ring, so sending or receiving a frame does not copy it through a socket 
+ * buffer, and there is no input thread : the thread waiting for a frame drains RX ring itself.
+ * Frames that belong to other threads (OOB frames) are handed to them through pending slots.
+ *
+ * Returned interface can be attached to EtherCAT_DataLinkLayer like one from init_ec(),
+ * but must be closed with closePacketMmapNetif().  
+ * Returns NULL on failure.
+ */
+struct netif *initPacketMmapNetif(const char *interface, const PacketMmapConfig &config);
+
+/*!
+ * \brief Rings that stand in for kernel side of packet socket, see initPacketMmapTestNetif().
+ *
+ * Each ring holds num_frames_ TPACKET_V2 frames of PACKET_MMAP_FRAME_SIZE bytes.  
+ * kick_ is called wherever send() would be, once frames in TX ring are marked TP_STATUS_SEND_REQUEST.
+ * Like send(), it returns -1 and sets errno on failure.
+ */
+struct PacketMmapTestRings
+{
+  char *rx_ring_;
+  char *tx_ring_;
+  unsigned num_frames_;
+  int (*kick_)(void *arg);
+  void *kick_arg_;
+};
+
+/*!
+ * \brief Creates interface on caller's rings instead of a packet socket.
+ *
+ * Only meant for tests : sequence numbers, pending slots, resends and redundant copies 
+ * can be exercised with frames that the test delivers, drops or reorders itself.
+ * Rings still belong to caller after closePacketMmapNetif().
+ */
+struct netif *initPacketMmapTestNetif(const PacketMmapTestRings &rings, const unsigned char hwaddr[6], 
+                                      const PacketMmapConfig &config);
+
+//! Closes interface created by initPacketMmapNetif(), returns 0 for success
+int closePacketMmapNetif(struct netif *ni);
+
+//! Changes receive timeout of interface created by initPacketMmapNetif(), returns 0 for success
+int setPacketMmapTimeout(struct netif *ni, int64_t timeout_us);
+
+/*!
+ * \brief Marks frames sent by calling thread as process data, or stops doing so.
+ *
+ * Round trip time of process data frames is measured, and waiting for their reply spins for
+ * expected round trip time before sleeping.  With early resend, process data frame is sent again 
+ * when reply is late, so single dropped frame does not cost a whole timeout.  Other frames 
+ * (mailbox reads) are never sent twice, because doing that could lose data.
+ *
+ * With redundant_pd_, every process data frame is sent twice back to back.  The second copy 
+ * uses a different sequence number, and the first reply whose working counters are all 
+ * non-zero is used.  Reply that is handed to EML always comes from exactly one copy.
+ */
+void setPacketMmapProcessData(struct netif *ni, bool process_data);
+
+void getPacketMmapStats(struct netif *ni, PacketMmapStats &stats);
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,105 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace ethercat_hardware
+{
+
+
+/*!
+ * \brief Places every device's block in process data image, and keeps offsets of blocks.
+ *
+ * EML exchanges whole image with LRW datagrams, byte N of image going to logical address
+ * START_ADDRESS + N.  Each device block holds command followed by status (devices find 
+ * their status at command_size_ past start of block), so blocks can be moved but not split.  
+ * Blocks are packed back to back, so image has no holes and takes fewest datagrams.  
+ * With alignment above one, each block starts at a multiple of alignment, at the cost of 
+ * padding that is sent on wire.
+ * 
+ * Device claims logical addresses when it is constructed : nextAddress() gives start 
+ * address for construct(), and addDevice() checks that device mapped exactly its block.
+ */
+class ProcessImageLayout
+{
+public:
+  static const int START_ADDRESS = 0x00010000;
+
+  ProcessImageLayout();
+
+  //! Drops all blocks and sets alignment of new blocks, which must be a power of two
+  bool reset(unsigned alignment);
+
+  //! Logical address next device should be constructed at
+  int nextAddress() const;
+
+  /*!
+   * \brief Adds block of device that was constructed at nextAddress().
+   *
+   * end_address is start address after construct() returned.  
+   * Returns false if device mapped different amount of logical addresses than its 
+   * command and status take : then host buffer offsets of later devices would be wrong.
+   */
+  bool addDevice(int end_address, unsigned command_size, unsigned status_size);
+
+  //! Adds empty block, for device that is not on EtherCAT chain
+  void addEmptyDevice();
+
+  unsigned numDevices() const {return offsets_.size();}
+  //! Offset of block of device in process data buffer
+  unsigned offset(unsigned device) const {return offsets_[device];}
+  //! Size of image, including padding
+  unsigned size() const {return size_;}
+  unsigned commandBytes() const {return command_bytes_;}
+  unsigned statusBytes() const {return status_bytes_;}
+  unsigned paddingBytes() const {return padding_bytes_;}
+  unsigned alignment() const {return alignment_;}
+
+protected:
+  unsigned alignedSize() const;
+
+  unsigned alignment_;
+  std::vector<unsigned> offsets_;
+  unsigned size_;
+  unsigned command_bytes_;
+  unsigned status_bytes_;
+  unsigned padding_bytes_;
+};
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,106 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+#pragma once
+
+#include <boost/utility.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+#include <sched.h>
+
+namespace ethercat_hardware
+{
+
+/*!
+ * \brief Passes consistent copies of a value from one writer thread to any number of reader threads.
+ *
+ * Implemented as a sequence lock : writer bumps sequence number to an odd value, 
+ * copies in value, then bumps sequence to an even value.  Readers copy value and retry 
+ * if sequence changed or was odd during copy.  
+ *
+ * Writer never blocks and never fails, so it is safe to use from realtime thread.
+ * Readers only spin while a write is in progress, which takes a few hundred nanoseconds.
+ *
+ * Since readers may copy value while it is being written, T must be trivially copyable
+ * (no pointers to owned memory such as std::string or std::vector).
+ */
+template <class T>
+class RealtimeSnapshot : private boost::noncopyable
+{
+  BOOST_STATIC_ASSERT(boost::has_trivial_copy<T>::value && boost::has_trivial_destructor<T>::value);
+
+public:
+  RealtimeSnapshot() : sequence_(0) { }
+  explicit RealtimeSnapshot(const T &initial) : sequence_(0), value_(initial) { }
+
+  //! Stores new value.  Only one thread may write a snapshot.
+  void write(const T &value)
+  {
+    ++sequence_;
+    __sync_synchronize();
+    value_ = value;
+    __sync_synchronize();
+    ++sequence_;
+  }
+
+  //! Copies out most recently written value
+  void read(T &value) const
+  {
+    unsigned sequence;
+    do 
+    {
+      while ((sequence = sequence_) & 1)
+      {
+        sched_yield();
+      }
+      __sync_synchronize();
+      value = value_;
+      __sync_synchronize();
+    } while (sequence != sequence_);
+  }
+
+  T read() const
+  {
+    T value;
+    read(value);
+    return value;
+  }
+
+protected:
+  volatile unsigned sequence_;
+  T value_;
+};
+
+}; //end namespace ethercat_hardware
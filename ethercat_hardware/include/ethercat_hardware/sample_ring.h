@@ -0,0 +1,268 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/utility.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+
+namespace ethercat_hardware
+{
+
+
+/*!
+ * \brief Start of shared memory sample ring.
+ *
+ * Header is followed by capacity_ slots of slot_size_ bytes.  
+ * Each slot starts with SampleRingSlot, followed by sample_size_ bytes of sample data.
+ * Sample N (counting from 0) is stored in slot (N % capacity_).
+ */
+struct SampleRingHeader
+{
+  static const uint32_t VERSION = 1;
+
+  char magic_[8];      //!< "ECSAMPLE"
+  uint32_t version_;
+  uint32_t header_size_;
+  uint32_t slot_size_;
+  uint32_t sample_size_;
+  uint32_t capacity_;  //!< Number of slots, always a power of 2
+  uint32_t writer_pid_;
+  char type_[32];      //!< Name of sample type, so readers can check that they understand the data
+  volatile uint64_t write_count_;  //!< Number of samples that have been written
+};
+
+
+/*!
+ * \brief Per-slot sequence number.
+ *
+ * While sample N is being written, sequence_ is 2N+1.  After it is written, sequence_ is 2N+2.
+ * A reader copy of sample N is good if sequence_ was 2N+2 both before and after copying.
+ */
+struct SampleRingSlot
+{
+  volatile uint64_t sequence_;
+};
+
+
+/*!
+ * \brief Creates shared memory sample ring and appends samples to it.
+ *
+ * There is a single writer (the realtime loop) and any number of readers, in this or other processes.
+ * Readers never write to the ring, so a slow or dead reader cannot delay the writer.  
+ * Readers that fall more than capacity samples behind lose the oldest samples, and are told how many.
+ */
+class SampleRingWriterBase : private boost::noncopyable
+{
+public:
+  SampleRingWriterBase();
+  ~SampleRingWriterBase();
+
+  /*!
+   * \brief Creates (or replaces) shared memory ring.
+   * \param name      POSIX shared memory name, leading '/' is added if missing
+   * \param type      Name of sample type, at most 31 characters
+   * \param capacity  Number of samples ring holds, rounded up to power of 2
+   * \return true for success
+   */
+  bool open(const std::string &name, const char *type, unsigned sample_size, unsigned capacity);
+  //! Unmaps and removes ring
+  void close();
+  bool isOpen() const {return header_ != NULL;}
+  //! Number of samples written so far
+  uint64_t writeCount() const {return (header_ != NULL) ? header_->write_count_ : 0;}
+
+protected:
+  //! Appends sample.  Does not block or make system calls.
+  void writeSample(const void *sample);
+  /*!
+   * \brief Returns slot that next sample can be written into directly, NULL if ring is not open.
+   * Sample is not visible to readers until commitSample() is called.
+   */
+  void *beginSample();
+  void commitSample();
+
+  std::string name_;
+  void *segment_;
+  size_t size_;
+  SampleRingHeader *header_;
+  char *slots_;
+  unsigned slot_size_;
+  unsigned sample_size_;
+  uint64_t mask_;
+};
+
+
+/*!
+ * \brief Reads samples from shared memory ring.  
+ *
+ * Each reader keeps its own position in ring, so any number of readers can follow same ring.
+ */
+class SampleRingReaderBase : private boost::noncopyable
+{
+public:
+  SampleRingReaderBase();
+  ~SampleRingReaderBase();
+
+  /*!
+   * \brief Maps existing ring read-only.  
+   * Fails if ring does not exist, has unknown layout, or holds samples of a different type or size.
+   * Reading starts with the next sample written after open.
+   */
+  bool open(const std::string &name, const char *type, unsigned sample_size);
+  void close();
+  bool isOpen() const {return header_ != NULL;}
+
+  //! Moves read position back to oldest sample that is still in ring
+  void seekOldest();
+  //! Number of samples that have been written, but not read yet
+  uint64_t available() const;
+  //! Number of samples that were overwritten before this reader could read them
+  uint64_t lostCount() const {return lost_count_;}
+
+  static const unsigned MAX_READ_ATTEMPTS = 100;
+
+protected:
+  //! Copies next sample, returns false if there is no new sample
+  bool readSample(void *sample);
+
+  void *segment_;
+  size_t size_;
+  const SampleRingHeader *header_;
+  const char *slots_;
+  unsigned slot_size_;
+  unsigned sample_size_;
+  uint64_t mask_;
+  uint64_t next_;        //!< Number of next sample to read
+  uint64_t lost_count_;
+};
+
+
+/*!
+ * \brief Typed sample ring writer.
+ *
+ * Sample type must be a plain struct that can be copied with memcpy, 
+ * and it must have a static TYPE string that names it.
+ */
+template <class Sample>
+class SampleRingWriter : public SampleRingWriterBase
+{
+  BOOST_STATIC_ASSERT(boost::has_trivial_copy<Sample>::value);
+  BOOST_STATIC_ASSERT(boost::has_trivial_destructor<Sample>::value);
+public:
+  bool open(const std::string &name, unsigned capacity) 
+  {
+    return SampleRingWriterBase::open(name, Sample::TYPE, sizeof(Sample), capacity);
+  }
+  void write(const Sample &sample) {writeSample(&sample);}
+  //! Lets caller fill in next sample in place, instead of copying it.  Must be followed by commit().
+  Sample *beginWrite() {return static_cast<Sample*>(beginSample());}
+  void commit() {commitSample();}
+};
+
+
+//! Typed sample ring reader.
+template <class Sample>
+class SampleRingReader : public SampleRingReaderBase
+{
+public:
+  bool open(const std::string &name) 
+  {
+    return SampleRingReaderBase::open(name, Sample::TYPE, sizeof(Sample));
+  }
+  bool read(Sample &sample) {return readSample(&sample);}
+};
+
+
+/*!
+ * \brief Force/torque sample, as written to sample ring by WG06.
+ *
+ * WG06 delivers up to 4 F/T samples per realtime cycle, every one of them is written to ring.
+ */
+struct FTRingSample
+{
+  static const char TYPE[];
+
+  uint64_t sample_count_;     //!< Running count of F/T samples, gaps mean device produced samples that were never received
+  uint64_t cycle_time_ns_;    //!< ROS time of realtime cycle that received sample
+  uint64_t sample_time_ns_;   //!< Device timestamp converted to ROS time by DeviceClock
+  uint32_t device_time_us_;   //!< Device timestamp of cycle that received sample
+  uint16_t vhalf_;            //!< Vhalf reference ADC measurement
+  uint8_t sample_timestamp_;  //!< Timestamp of sample, from F/T soft processor
+  uint8_t good_;              //!< 1 if F/T sensor had no errors when sample was received
+  int16_t raw_[6];            //!< Raw ADC values
+  uint32_t pad_;
+  double wrench_[6];          //!< Force x,y,z (N) and torque x,y,z (Nm), calibrated with ft_params
+};
+
+
+//! Accelerometer sample, as written to sample ring by WG06
+struct AccelRingSample
+{
+  static const char TYPE[];
+
+  uint64_t sample_count_;     //!< Running count of accelerometer samples
+  uint64_t cycle_time_ns_;    //!< ROS time of realtime cycle that received sample
+  uint64_t sample_time_ns_;   //!< Device timestamp converted to ROS time by DeviceClock
+  uint32_t device_time_us_;   //!< Device timestamp of cycle that received sample
+  uint32_t raw_;              //!< Raw accelerometer register value
+  double x_, y_, z_;          //!< Acceleration in m/s^2
+};
+
+
+/*!
+ * \brief Raw fingertip pressure data, as written to sample ring by WG06.
+ *
+ * data_ holds the pressure region of the WG06 status exactly as the device sent it, including checksum.
+ */
+struct RawPressureRingSample
+{
+  static const char TYPE[];
+  static const unsigned MAX_SIZE = 513; //!< Size of largest (WG06BigPressure) pressure region
+
+  uint64_t cycle_time_ns_;    //!< ROS time of realtime cycle that received data
+  uint32_t device_time_us_;   //!< Pressure timestamp from device
+  uint16_t size_;             //!< Number of valid bytes in data_
+  uint16_t pad_;
+  uint8_t data_[MAX_SIZE];
+};
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,244 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+#pragma once
+
+#include <ros/ros.h>
+#include "ethercat_hardware/diagnostics_builder.h"
+
+#include <boost/utility.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+namespace ethercat_hardware
+{
+
+class PublisherExecutor;
+
+
+/*!
+ * \brief Non-template part of SharedRealtimePublisher.
+ *
+ * Message ownership is handed between realtime and publishing threads through
+ * turn_, which is only changed with atomic operations, so realtime side never blocks.
+ */
+class SharedPublisherBase : private boost::noncopyable
+{
+public:
+  SharedPublisherBase(const std::string &topic);
+  virtual ~SharedPublisherBase();
+
+  const std::string &getTopic() const {return topic_;}
+  //! Number of messages that have been published
+  uint64_t getPublishedCount() const {return published_count_;}
+  //! Number of times realtime side could not get message because previous one was still being published
+  uint64_t getDroppedCount() const {return dropped_count_;}
+
+protected:
+  friend class PublisherExecutor;
+
+  //! Called by executor thread, publishes message if realtime side has handed one over
+  bool publishPending();
+  //! Serializes and publishes message
+  virtual void publishMsg() = 0;
+
+  bool trylockBase();
+  void unlockBase();
+  void unlockAndPublishBase();
+
+  enum {REALTIME, LOCKED, NON_REALTIME};
+  volatile int turn_;
+
+  std::string topic_;
+  volatile uint64_t published_count_;
+  volatile uint64_t dropped_count_;
+  bool registered_;
+};
+
+
+/*!
+ * \brief Publishes messages of many SharedRealtimePublishers from small pool of threads.
+ *
+ * Each realtime_tools::RealtimePublisher owns a thread, and most of these sit idle.
+ * Instead, every SharedRealtimePublisher is assigned to one of a fixed number of
+ * executor threads.  Each thread polls its publishers for handed over messages,
+ * with same period realtime_tools uses.  Threads are started when first publisher
+ * is added, and stopped after last one is removed.
+ */
+class PublisherExecutor : private boost::noncopyable
+{
+public:
+  static PublisherExecutor *instance();
+
+  void add(SharedPublisherBase *publisher);
+  void remove(SharedPublisherBase *publisher);
+
+  //! Adds publisher counts and drop counters to diagnostics
+  void publishDiagnostics(ethercat_hardware::DiagnosticsBuilder &d);
+  //! Totals of all publishers
+  void getCounts(unsigned &num_publishers, uint64_t &published, uint64_t &dropped);
+
+  static const unsigned NUM_THREADS = 2;
+  static const unsigned POLL_PERIOD_US = 500;
+
+protected:
+  PublisherExecutor();
+
+  struct Worker
+  {
+    Worker() : running_(false) { }
+    void threadFunc();
+    boost::mutex mutex_; //!< protects publishers_
+    std::vector<SharedPublisherBase*> publishers_;
+    boost::thread thread_;
+    bool running_;
+  };
+
+  boost::mutex mutex_; //!< serializes add() and remove()
+  Worker workers_[NUM_THREADS];
+};
+
+
+/*!
+ * \brief Drop-in replacement for realtime_tools::RealtimePublisher without its own thread.
+ *
+ * Usage is the same : realtime code calls trylock(), fills in msg_, and calls unlockAndPublish().
+ */
+template <class Msg>
+class SharedRealtimePublisher : public SharedPublisherBase
+{
+public:
+  SharedRealtimePublisher(const ros::NodeHandle &node, const std::string &topic, int queue_size, bool latched=false) :
+    SharedPublisherBase(topic),
+    node_(node)
+  {
+    publisher_ = node_.advertise<Msg>(topic, queue_size, latched);
+    PublisherExecutor::instance()->add(this);
+  }
+
+  ~SharedRealtimePublisher()
+  {
+    stop();
+  }
+
+  //! Stops publishing.  May block while message is being published.
+  void stop()
+  {
+    PublisherExecutor::instance()->remove(this);
+  }
+
+  //! Returns true if msg_ can be filled in, does not block.  Failure is counted as dropped message.
+  bool trylock() 
+  {
+    if (trylockBase())
+    {
+      return true;
+    }
+    ++dropped_count_;
+    return false;
+  }
+  //! Waits until msg_ can be filled in, not realtime safe
+  void lock()
+  {
+    while (!trylockBase())
+    {
+      usleep(200);
+    }
+  }
+  void unlock() {unlockBase();}
+  //! Hands msg_ over to executor thread for publishing
+  void unlockAndPublish() {unlockAndPublishBase();}
+
+  Msg msg_;
+
+protected:
+  void publishMsg() {publisher_.publish(msg_);}
+
+  ros::NodeHandle node_;
+  ros::Publisher publisher_;
+};
+
+
+/*!
+ * \brief SharedRealtimePublisher for messages with a variable length samples array.
+ *
+ * msg_.samples is always kept at max_samples elements, each a copy of prototype, 
+ * so realtime side only assigns into existing samples and never allocates.
+ * Realtime side sets sample_count_ to number of samples it filled in.  
+ * Publishing thread trims array to sample_count_ before publishing, 
+ * and restores it to full size afterwards.  Sample is element type of msg_.samples.
+ */
+template <class Msg, class Sample>
+class SampleBatchPublisher : public SharedRealtimePublisher<Msg>
+{
+public:
+  SampleBatchPublisher(const ros::NodeHandle &node, const std::string &topic, int queue_size, 
+                       unsigned max_samples, const Sample &prototype = Sample()) :
+    SharedRealtimePublisher<Msg>(node, topic, queue_size),
+    sample_count_(0),
+    max_samples_(max_samples),
+    prototype_(prototype)
+  {
+    this->msg_.samples.resize(max_samples_, prototype_);
+  }
+
+  //! Stops publishing before members used by publishMsg() are destroyed
+  ~SampleBatchPublisher()
+  {
+    this->stop();
+  }
+
+  unsigned maxSamples() const {return max_samples_;}
+  const Sample &prototype() const {return prototype_;}
+
+  //! Number of samples at front of msg_.samples that will be published
+  unsigned sample_count_;
+
+protected:
+  void publishMsg()
+  {
+    this->msg_.samples.resize(sample_count_);
+    SharedRealtimePublisher<Msg>::publishMsg();
+    this->msg_.samples.resize(max_samples_, prototype_);
+  }
+
+  unsigned max_samples_;
+  Sample prototype_;
+};
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,129 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+
+namespace ethercat_hardware
+{
+
+/*!
+ * \brief Values chosen by TimeoutTuner, along with the measurements they are based on.
+ */
+struct TimeoutTuning
+{
+  TimeoutTuning();
+
+  uint64_t samples_;      //!< Round trip times measured since start
+  uint64_t late_samples_; //!< Round trip times of packets that returned after timeout
+  unsigned p50_us_;       //!< Percentiles of round trip times, zero until enough samples are measured
+  unsigned p999_us_;
+  unsigned p9999_us_;
+  unsigned timeout_us_;   //!< Chosen timeout for each attempt to send process data
+  unsigned retries_;      //!< Chosen number of attempts before motors are halted
+  unsigned tunings_;      //!< Number of times timeout and retries were changed
+};
+
+
+/*!
+ * \brief Picks process data timeout and retry count from measured round trip times.
+ *
+ * Round trip times are kept in a histogram with 8 buckets per octave.  Every 
+ * UPDATE_INTERVAL samples, timeout is set to SAFETY_FACTOR times the 99.99th 
+ * percentile, and retries to however many attempts fit in halt latency bound.  
+ * Counts are then halved, so old measurements slowly lose weight.
+ *
+ * Packets that never return are not counted : they say nothing about round trip 
+ * time, and counting them as slow would push timeout up every time a packet is lost.
+ * Packets that return after timeout are counted, since they are the tail that 
+ * the timeout must cover.
+ */
+class TimeoutTuner
+{
+public:
+  TimeoutTuner();
+
+  /*!
+   * \brief Sets limits of chosen values.
+   * \param halt_latency_us timeout times retries is never more than this
+   * \param min_timeout_us timeout is never shorter than this
+   * \param min_retries at least this many attempts are made, even if timeout must be shortened for it
+   * \param max_retries at most this many attempts are made
+   */
+  void configure(unsigned halt_latency_us, unsigned min_timeout_us, unsigned min_retries, unsigned max_retries);
+
+  //! Records round trip time of process data that returned in time
+  void recordRtt(unsigned rtt_us);
+  //! Records round trip time of packet that returned after it was declared dropped
+  void recordLateRtt(unsigned rtt_us);
+
+  /*!
+   * \brief Recalculates timeout and retries once enough new samples are available.
+   *
+   * Returns true, and sets timeout_us and retries, if they should be changed.
+   * Small changes are ignored, so timeout does not jitter.
+   */
+  bool update(unsigned &timeout_us, unsigned &retries);
+
+  const TimeoutTuning &tuning() const {return tuning_;}
+
+  static const unsigned BUCKETS_PER_OCTAVE = 8;
+  static const unsigned NUM_BUCKETS = 18 * BUCKETS_PER_OCTAVE;  //!< Up to 2^18us = 262ms
+  static const unsigned UPDATE_INTERVAL = 10000;
+  static const unsigned MIN_SAMPLES = 10000;  //!< 99.99th percentile needs at least this many samples
+  static const unsigned SAFETY_FACTOR = 2;
+  static const unsigned HYSTERESIS_PERCENT = 25;
+
+  //! Upper round trip time bound of histogram bucket, in microseconds
+  static unsigned bucketLimit(unsigned bucket);
+
+protected:
+  void record(unsigned rtt_us);
+  unsigned percentile(uint64_t count) const;
+
+  unsigned halt_latency_us_;
+  unsigned min_timeout_us_;
+  unsigned min_retries_;
+  unsigned max_retries_;
+
+  uint32_t counts_[NUM_BUCKETS];
+  uint64_t total_;
+  unsigned since_update_;
+  TimeoutTuning tuning_;
+};
+
+
+}; //end namespace ethercat_hardware
@@ -38,6 +38,7 @@
 #include <ethercat_hardware/wg0x.h>
 
 #include <ethercat_hardware/wg_soft_processor.h>
+#include <ethercat_hardware/sample_ring.h>
 
 #include <pr2_msgs/PressureState.h>
 #include <pr2_msgs/AccelerometerState.h>
@@ -171,7 +172,7 @@ public:
   void packCommand(unsigned char *buffer, bool halt, bool reset);
   bool unpackState(unsigned char *this_buffer, unsigned char *prev_buffer);
 
-  virtual void multiDiagnostics(vector<diagnostic_msgs::DiagnosticStatus> &vec, unsigned char *buffer);
+  virtual void multiDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer);
   enum
   {
     PRODUCT_CODE = 6805006
@@ -188,15 +189,17 @@ private:
   bool initializeAccel(pr2_hardware_interface::HardwareInterface *hw);
   bool initializeFT(pr2_hardware_interface::HardwareInterface *hw);
   bool initializeSoftProcessor();
+  void initializeSampleRing(ethercat_hardware::SampleRingWriterBase &ring, const char *sensor, 
+                            const char *type, unsigned sample_size, unsigned capacity);
 
   bool unpackPressure(unsigned char* pressure_buf);
   bool unpackAccel(WG06StatusWithAccel *status, WG06StatusWithAccel *last_status);
   bool unpackFT(WG06StatusWithAccelAndFT *status, WG06StatusWithAccelAndFT *last_status);
 
-  void diagnosticsWG06(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *);
-  void diagnosticsAccel(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer);
-  void diagnosticsFT(diagnostic_updater::DiagnosticStatusWrapper &d, WG06StatusWithAccelAndFT *status);
-  void diagnosticsPressure(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer);
+  void diagnosticsWG06(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *);
+  void diagnosticsAccel(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer);
+  void diagnosticsFT(ethercat_hardware::DiagnosticsBuilder &d, WG06StatusWithAccelAndFT *status);
+  void diagnosticsPressure(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer);
 
   //! True if device has accelerometer and force/torque sensor
   bool has_accel_and_ft_;
@@ -212,9 +215,9 @@ private:
 
   static const unsigned NUM_PRESSURE_REGIONS = 22;    
   uint32_t last_pressure_time_;
-  realtime_tools::RealtimePublisher<pr2_msgs::PressureState> *pressure_publisher_;
-  realtime_tools::RealtimePublisher<std_msgs::ByteMultiArray> *raw_pressure_publisher_; //For pretouch sensor
-  realtime_tools::RealtimePublisher<pr2_msgs::AccelerometerState> *accel_publisher_;
+  ethercat_hardware::SharedRealtimePublisher<pr2_msgs::PressureState> *pressure_publisher_;
+  ethercat_hardware::SharedRealtimePublisher<std_msgs::ByteMultiArray> *raw_pressure_publisher_; //For pretouch sensor
+  ethercat_hardware::SampleBatchPublisher<pr2_msgs::AccelerometerState, geometry_msgs::Vector3> *accel_publisher_;
 
   void convertFTDataSampleToWrench(const FTDataSample &sample, geometry_msgs::Wrench &wrench);
   static const unsigned MAX_FT_SAMPLES = 4;  
@@ -236,8 +239,39 @@ private:
   pr2_hardware_interface::ForceTorque force_torque_;
 
   //! Realtime Publisher of RAW F/T data 
-  realtime_tools::RealtimePublisher<ethercat_hardware::RawFTData> *raw_ft_publisher_;
-  realtime_tools::RealtimePublisher<geometry_msgs::WrenchStamped> *ft_publisher_;
+  ethercat_hardware::SampleBatchPublisher<ethercat_hardware::RawFTData, ethercat_hardware::RawFTDataSample> *raw_ft_publisher_;
+  ethercat_hardware::SharedRealtimePublisher<geometry_msgs::WrenchStamped> *ft_publisher_;
+
+  /** Every F/T and accelerometer sample is also written to shared memory rings, when enabled.
+   *  Unlike realtime publishers, rings never drop a cycle because a reader is busy, 
+   *  so local consumers can follow every sample without ROS serialization.
+   */
+  bool enable_sample_rings_;
+  static const unsigned SAMPLE_RING_CAPACITY = 8192; //!< About 2 seconds of F/T samples
+  ethercat_hardware::SampleRingWriter<ethercat_hardware::FTRingSample> ft_ring_;
+  ethercat_hardware::SampleRingWriter<ethercat_hardware::AccelRingSample> accel_ring_;
+  ethercat_hardware::SampleRingWriter<ethercat_hardware::RawPressureRingSample> raw_pressure_ring_;
+  static const unsigned RAW_PRESSURE_RING_CAPACITY = 1024;
+  //! Raw pressure data is published every raw_pressure_decimation_ cycles, zero disables raw_pressure topic
+  unsigned raw_pressure_decimation_;
+  unsigned raw_pressure_cycles_;  //!< Cycles since raw pressure data was last published
+  uint64_t accel_ring_sample_count_; //!< Running count of accelerometer samples, never reset
+
+  /** F/T and accelerometer samples are accumulated over sensor_batch_cycles_ cycles and published as one message.
+   *  If publisher is still busy when batch is complete, samples keep accumulating (up to 
+   *  BATCH_BACKLOG_FACTOR times normal batch size) and are handed off with next successful trylock.
+   *  Batches are kept at full size, and swapped with publisher message on handoff, 
+   *  so only first *_batch_count_ samples are valid.
+   */
+  unsigned sensor_batch_cycles_;
+  static const unsigned MAX_SENSOR_BATCH_CYCLES = 100;
+  static const unsigned BATCH_BACKLOG_FACTOR = 4;
+  unsigned accel_batch_cycles_;  //!< Cycles accumulated in accel_batch_
+  unsigned accel_batch_count_;   //!< Samples filled in accel_batch_
+  std::vector<geometry_msgs::Vector3> accel_batch_;
+  unsigned ft_batch_cycles_;     //!< Cycles accumulated in ft_batch_
+  unsigned ft_batch_count_;      //!< Samples filled in ft_batch_
+  std::vector<ethercat_hardware::RawFTDataSample> ft_batch_;
   //pr2_hardware_interface::AnalogIn ft_analog_in_;      //!< Provides
   FTParamsInternal ft_params_;
 
@@ -250,7 +284,8 @@ private:
    *  modified through use of service calls.   
    */
   bool enable_soft_processor_access_;
-  WGSoftProcessor soft_processor_;
+  //! Shared by all WG06 devices, NULL until soft processors of this device are added
+  boost::shared_ptr<WGSoftProcessor> soft_processor_;
 };
 
 #endif /* ETHERCAT_HARDWARE_WG06_H */
@@ -38,9 +38,11 @@
 #include "ethercat_hardware/ethercat_device.h"
 #include "ethercat_hardware/motor_model.h"
 #include "ethercat_hardware/motor_heating_model.h"
-#include "realtime_tools/realtime_publisher.h"
+#include "ethercat_hardware/shared_realtime_publisher.h"
 #include "ethercat_hardware/wg_mailbox.h"
 #include "ethercat_hardware/wg_eeprom.h"
+#include "ethercat_hardware/realtime_snapshot.h"
+#include "ethercat_hardware/device_clock.h"
 
 #include <boost/shared_ptr.hpp>
 
@@ -223,14 +225,21 @@ struct WG0XDiagnostics
   uint32_t operate_disable_total_;
   uint32_t watchdog_disable_total_;
 
-  uint32_t lock_errors_;
-  uint32_t checksum_errors_;
-
   // Hack, use diagnostic thread to push new offset values to device
-  double zero_offset_;
+  // Last offset written to device, new offset comes from WG0XRealtimeDiagnostics
   double cached_zero_offset_;
 };
 
+//! Diagnostics values updated by realtime thread
+struct WG0XRealtimeDiagnostics
+{
+  WG0XRealtimeDiagnostics();
+  uint32_t checksum_errors_;
+  double zero_offset_;
+  int drops_;
+  int max_consecutive_drops_;
+};
+
 class WG0X : public EthercatDevice
 {
 public:
@@ -249,11 +258,30 @@ public:
   bool readActuatorInfoFromEeprom(EthercatCom *com, WG0XActuatorInfo &actuator_info);
   bool readMotorHeatingModelParametersFromEeprom(EthercatCom *com, MotorHeatingModelParametersEepromConfig &config);
 
-  void diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *);
+  void diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *);
   virtual void collectDiagnostics(EthercatCom *com);
+  virtual void telemetry(ethercat_hardware::DeviceTelemetry &t);
+  virtual void metrics(ethercat_hardware::DeviceMetrics &m);
+  virtual bool attachMailboxScheduler(ethercat_hardware::WGMailboxScheduler &scheduler) {return scheduler.attach(&mailbox_);}
 
   bool publishTrace(const string &reason, unsigned level, unsigned delay);
 
+  //! Mailbox used for local bus access, exposed so tools can queue requests or dump statistics
+  ethercat_hardware::WGMailbox &mailbox() {return mailbox_;}
+  //! Access to device eeprom, for tools that backup or restore whole eeprom
+  ethercat_hardware::WGEeprom &eeprom() {return eeprom_;}
+
+  /*!
+   * \brief Host time that device sampled its most recent status at.
+   *
+   * Device timestamp is converted with deviceClock(), so it is free of host scheduling jitter 
+   * and device clock drift, and can be compared between devices.  
+   * Only valid in realtime thread, after unpackState().
+   */
+  ros::Time sampleHostTime() const {return sample_host_time_;}
+  //! Alignment of device timestamps with host clock, only valid in realtime thread
+  const ethercat_hardware::DeviceClock &deviceClock() const {return device_clock_;}
+
 protected:
   uint8_t fw_major_;
   uint8_t fw_minor_;
@@ -312,6 +340,15 @@ protected:
    * ros::Duration (int32_t secs, int32_t nsecs) should overflow will overflow after 68 years
    */
   ros::Duration sample_timestamp_;
+
+  //! Pairs device timestamp of newest status with time it was received, and updates sample_host_time_
+  void alignSampleTime(uint32_t device_time_us);
+  //! Provides receive time of process data, NULL when device is used by tools
+  pr2_hardware_interface::HardwareInterface *hw_;
+  //! Owned by realtime thread
+  ethercat_hardware::DeviceClock device_clock_;
+  RealtimeSnapshot<ethercat_hardware::DeviceClockEstimate> device_clock_snapshot_;
+  ros::Time sample_host_time_;
   
   //! Different possible states for application ram on device. 
   //  Application ram is non-volitile memory that application can use to store temporary
@@ -330,8 +367,8 @@ protected:
   int writeMailbox(EthercatCom *com, unsigned address, void const *data, unsigned length);
   int readMailbox(EthercatCom *com, unsigned address, void *data, unsigned length);  
 
-  void publishGeneralDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d);
-  void publishMailboxDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d);
+  void publishGeneralDiagnostics(ethercat_hardware::DiagnosticsBuilder &d);
+  void publishMailboxDiagnostics(ethercat_hardware::DiagnosticsBuilder &d);
 
   bool initializeMotorModel(pr2_hardware_interface::HardwareInterface *hw, 
                             const string &device_description,
@@ -399,12 +436,16 @@ protected:
   int consecutive_drops_;
   int max_consecutive_drops_;
 
-  bool lockWG0XDiagnostics();
-  bool tryLockWG0XDiagnostics();
-  void unlockWG0XDiagnostics();
-  pthread_mutex_t wg0x_diagnostics_lock_;
-  WG0XDiagnostics wg0x_publish_diagnostics_;
+  // Each diagnostics structure is only changed by one thread, and passed to 
+  // others through a snapshot, so realtime thread never waits for (or skips) an update
+  //! Owned by realtime thread
+  WG0XRealtimeDiagnostics realtime_diagnostics_;
+  RealtimeSnapshot<WG0XRealtimeDiagnostics> realtime_diagnostics_snapshot_;
+  //! Owned by thread calling collectDiagnostics()
   WG0XDiagnostics wg0x_collect_diagnostics_;
+  RealtimeSnapshot<WG0XDiagnostics> wg0x_diagnostics_snapshot_;
+  //! Owned by diagnostics publishing thread
+  WG0XDiagnostics wg0x_publish_diagnostics_;
 
 public:
   static int32_t timestampDiff(uint32_t new_timestamp, uint32_t old_timestamp);
@@ -52,13 +52,27 @@ public:
   bool readEepromPage(EthercatCom *com, WGMailbox *mbx, unsigned page, void* data, unsigned length);
   bool writeEepromPage(EthercatCom *com, WGMailbox *mbx, unsigned page, const void* data, unsigned length);  
 
-protected:
+  /*!
+   * \brief Bulk versions of readEepromPage() and writeEepromPage().
+   *
+   * Data holds num_pages consecutive pages of MAX_EEPROM_PAGE_SIZE bytes each.
+   * Eeprom lock is held for whole transfer and redundant SPI state machine 
+   * checks between pages are skipped, so these need far fewer mailbox 
+   * round-trips per page than repeated single page calls.
+   */
+  bool readEepromPages(EthercatCom *com, WGMailbox *mbx, unsigned first_page, unsigned num_pages, void* data);
+  bool writeEepromPages(EthercatCom *com, WGMailbox *mbx, unsigned first_page, unsigned num_pages, const void* data);
+
   static const unsigned NUM_EEPROM_PAGES   = 4096;
   static const unsigned MAX_EEPROM_PAGE_SIZE = 264;
 
+protected:
+  bool checkPageRange(unsigned first_page, unsigned num_pages, const char *op);
+
   // SPI Eeprom State machine helper functions
   bool readSpiEepromCmd(EthercatCom *com, WGMailbox *mbx, WG0XSpiEepromCmd &cmd);
   bool sendSpiEepromCmd(EthercatCom *com, WGMailbox *mbx, const WG0XSpiEepromCmd &cmd);
+  bool issueSpiEepromCmd(EthercatCom *com, WGMailbox *mbx, const WG0XSpiEepromCmd &cmd);
   bool waitForSpiEepromReady(EthercatCom *com, WGMailbox *mbx);
 
   // Eeprom helper functions
@@ -35,12 +35,49 @@
 #pragma once
 
 #include "ethercat_hardware/ethercat_com.h"
-#include <diagnostic_updater/DiagnosticStatusWrapper.h>
+#include "ethercat_hardware/diagnostics_builder.h"
+
+#include <boost/utility.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+#include <vector>
+#include <ostream>
 
 namespace ethercat_hardware
 {
 
 
+/*!
+ * \brief Latency and frame statistics for one phase of a mailbox transaction.
+ *
+ * Latencies are kept in a log2 histogram : bucket 0 counts operations that took 
+ * less than 64us, bucket N counts operations taking [32us<<N, 64us<<N), and last
+ * bucket counts everything slower.
+ */
+struct MbxPhaseStats
+{
+  static const unsigned NUM_BUCKETS = 14;
+  static const unsigned FIRST_BUCKET_US = 64;
+
+  MbxPhaseStats();
+  void record(unsigned latency_us, unsigned frames, unsigned dropped);
+  //! Upper latency bound of histogram bucket, in microseconds
+  static unsigned bucketLimit(unsigned bucket) {return FIRST_BUCKET_US << bucket;}
+
+  uint32_t count_;              //!< number of times phase was run
+  uint64_t total_latency_us_;
+  uint32_t max_latency_us_;
+  uint32_t frames_;             //!< number of (OOB) frames sent during phase
+  uint32_t dropped_frames_;     //!< number of frames that did not return
+  uint32_t histogram_[NUM_BUCKETS];
+};
+
+
 struct MbxDiagnostics 
 {
   MbxDiagnostics();
@@ -49,8 +86,71 @@ struct MbxDiagnostics
   uint32_t lock_errors_;
   uint32_t retries_;
   uint32_t retry_errors_;
+
+  //! Phases of mailbox transaction that statistics are kept for
+  enum Phase {CLEAR_READ, WRITE_CMD, WAIT_WRITE_EMPTY, WAIT_READ_READY, READ_RESULT, 
+              REPEAT_REQUEST, READ_TRANSACTION, WRITE_TRANSACTION, NUM_PHASES};
+  static const char* phaseName(Phase phase);
+  MbxPhaseStats phases_[NUM_PHASES];
+  uint64_t total_frames_;         //!< frames sent by all phases, used to find frames per transaction
+  uint64_t total_dropped_frames_;
+};
+
+class MbxPhaseTimer;
+
+
+class WGMailbox;
+class WGMailboxScheduler;
+
+
+/*!
+ * \brief Single queued (non-blocking) mailbox read or write.
+ *
+ * Returned by WGMailbox::readMailboxAsync() and WGMailbox::writeMailboxAsync().
+ * Caller can either block on wait() or provide a callback that is run by the
+ * scheduler thread once the request is complete.
+ */
+class WGMailboxRequest : private boost::noncopyable
+{
+public:
+  enum Type {READ, WRITE};
+  typedef boost::function<void (WGMailboxRequest &request)> Callback;
+
+  WGMailboxRequest(Type type, unsigned address, void *read_data, void const *write_data, 
+                   unsigned length, const Callback &callback);
+
+  //! Returns true once request has completed (successfully or not)
+  bool done();
+  //! Blocks until request completes.  Returns zero for success, non-zero for failure
+  int wait();
+  //! Result of request, only valid after done() returns true
+  int result() const {return result_;}
+
+  Type type() const {return type_;}
+  unsigned address() const {return address_;}
+  unsigned length() const {return length_;}
+  //! Data that was written, or data that was read after successful completion
+  void const *data() const {return &buffer_[0];}
+
+protected:
+  friend class WGMailbox;
+  void complete(int result);
+
+  Type type_;
+  unsigned address_;
+  unsigned length_;
+  void *read_data_;               //!< Optional caller buffer that read result is copied into
+  std::vector<uint8_t> buffer_;   //!< Internal copy of write data or read result
+  Callback callback_;
+
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  bool done_;
+  int result_;
 };
 
+typedef boost::shared_ptr<WGMailboxRequest> WGMailboxRequestPtr;
+
 
 class WGMailbox
 {
@@ -58,9 +158,41 @@ public:
   WGMailbox();
 
   bool initialize(EtherCAT_SlaveHandler *sh);
+  /*!
+   * \brief Blocking mailbox write and read.
+   *
+   * While mailbox is attached to a WGMailboxScheduler, these queue an asynchronous 
+   * request and wait for it, and the scheduler's com is used instead of com.
+   * That way blocking callers on different devices still share the scheduler's interleaving.
+   */
   int writeMailbox(EthercatCom *com, unsigned address, void const *data, unsigned length);
   int readMailbox(EthercatCom *com, unsigned address, void *data, unsigned length);
-  void publishMailboxDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d);
+  void publishMailboxDiagnostics(ethercat_hardware::DiagnosticsBuilder &d);
+  //! Copies current mailbox statistics, for use by diagnostics thread only.  May block during mailbox transaction.
+  const MbxDiagnostics &snapshotMailboxDiagnostics();
+  /*!
+   * \brief Writes per-phase latency histograms and frame counts in YAML format.
+   * 
+   * Uses snapshot taken by last call to publishMailboxDiagnostics(), or takes new snapshot if snapshot is true.
+   */
+  void dumpMailboxStatistics(std::ostream &out, const std::string &indent = "", bool snapshot = true);
+
+  /*!
+   * \brief Queues read of WG0X local bus, does not block.
+   *
+   * Mailbox must first be attached to a WGMailboxScheduler.
+   * If data is not NULL, result is copied into it before request completes,
+   * so it must stay valid until then.  Result is also available from request->data().
+   */
+  WGMailboxRequestPtr readMailboxAsync(unsigned address, void *data, unsigned length, 
+                                       const WGMailboxRequest::Callback &callback = WGMailboxRequest::Callback());
+  /*!
+   * \brief Queues write to WG0X local bus, does not block.
+   *
+   * Data is copied into request, so caller buffer can be re-used immediately.
+   */
+  WGMailboxRequestPtr writeMailboxAsync(unsigned address, void const *data, unsigned length, 
+                                        const WGMailboxRequest::Callback &callback = WGMailboxRequest::Callback());
 
   static const unsigned MBX_COMMAND_PHY_ADDR = 0x1400;
   static const unsigned MBX_COMMAND_SIZE = 512;
@@ -70,6 +202,10 @@ public:
   static const unsigned MBX_COMMAND_SYNCMAN_NUM = 2;
   static const unsigned MBX_STATUS_SYNCMAN_NUM  = 3;
 
+  //! Largest amount of local bus data that a single mailbox read or write can transfer
+  static const unsigned MBX_MAX_READ_LENGTH  = 511;
+  static const unsigned MBX_MAX_WRITE_LENGTH = 506;
+
 protected:
   // Each WG0X device can only support one mailbox operation at a time
   bool lockMailbox();
@@ -86,12 +222,80 @@ protected:
   bool waitForReadMailboxReady(EthercatCom *com);
   bool waitForWriteMailboxReady(EthercatCom *com);
   bool readMailboxRepeatRequest(EthercatCom *com);
-  bool _readMailboxRepeatRequest(EthercatCom *com);
+  bool _readMailboxRepeatRequest(EthercatCom *com, MbxPhaseTimer &timer);
   bool writeMailboxInternal(EthercatCom *com, void const *data, unsigned length);
   bool readMailboxInternal(EthercatCom *com, void *data, unsigned length);
   void diagnoseMailboxError(EthercatCom *com);
+  bool readSyncManStatus(EthercatCom *com, unsigned syncman_num, uint8_t &status);
   
   EtherCAT_SlaveHandler *sh_;
+
+  // Asynchronous request handling.  
+  // Only the scheduler thread touches active request and phase.
+  friend class WGMailboxScheduler;
+  enum AsyncPhase {ASYNC_IDLE, ASYNC_CLEAR, ASYNC_WRITE_CMD, ASYNC_WAIT_READ_READY, 
+                   ASYNC_READ_RESULT, ASYNC_WAIT_WRITE_EMPTY};
+  enum StepResult {STEP_IDLE, STEP_PROGRESS, STEP_POLLING};
+  WGMailboxRequestPtr queueRequest(const WGMailboxRequestPtr &request);
+  //! True if blocking calls from this thread should be passed to scheduler
+  bool useScheduler();
+  //! Virtual so scheduler can be tested without a device
+  virtual StepResult stepAsyncRequest(EthercatCom *com);
+  void finishAsyncRequest(int result);
+  void cancelAsyncRequests();
+  void detachScheduler();
+
+  WGMailboxScheduler *scheduler_;
+  boost::mutex request_queue_lock_;
+  std::deque<WGMailboxRequestPtr> request_queue_;
+  WGMailboxRequestPtr active_request_;
+  AsyncPhase async_phase_;
+  timespec async_start_time_;
+  timespec async_request_start_time_;
+  unsigned async_poll_frames_;
+  unsigned async_poll_dropped_;
+  uint64_t async_request_start_frames_;
+  uint64_t async_request_start_dropped_;
+};
+
+
+/*!
+ * \brief Drives asynchronous mailbox requests of many devices from one thread.
+ *
+ * Each attached mailbox keeps its own request queue.  The scheduler thread 
+ * round-robins between devices, advancing each device's active transaction by 
+ * one frame at a time.  This way the polling phases of transactions on 
+ * different devices overlap on the (single frame in flight) OOB channel instead 
+ * of each caller thread sleeping through its own transaction.
+ *
+ * All mailboxes must be attached before start() is called.  stop() detaches every mailbox 
+ * and fails any requests that are still queued, so mailboxes only need to outlive stop().
+ */
+class WGMailboxScheduler : private boost::noncopyable
+{
+public:
+  WGMailboxScheduler(EthercatCom *com);
+  ~WGMailboxScheduler();
+
+  //! Returns false if mailbox is already driven by another scheduler
+  bool attach(WGMailbox *mbx);
+  void start();
+  //! Stops scheduler thread, then detaches all mailboxes and fails their queued requests.  May block.
+  void stop();
+  //! Wakes scheduler thread when new requests are queued
+  void notify();
+  //! True if called from scheduler thread, which must not wait on its own requests
+  bool inSchedulerThread() const;
+
+protected:
+  void schedulerThreadFunc();
+
+  EthercatCom *com_;
+  std::vector<WGMailbox*> mailboxes_;
+  boost::mutex mutex_; //!< protects work_pending_ and cond variable
+  boost::condition_variable cond_;
+  bool work_pending_;
+  boost::thread thread_;
 };
 
 
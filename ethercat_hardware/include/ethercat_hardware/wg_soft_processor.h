@@ -36,12 +36,20 @@
 #define ETHERCAT_HARDWARE__WG_SOFT_PROCESSOR_H
 
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include "ethercat_hardware/ethercat_com.h"
 #include "ethercat_hardware/wg_mailbox.h"
 #include "ethercat_hardware/SoftProcessorFirmwareWrite.h"
 #include "ethercat_hardware/SoftProcessorFirmwareRead.h"
 #include "ethercat_hardware/SoftProcessorReset.h"
 
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <list>
+#include <set>
 #include <vector>
 #include <ostream>
 #include <string>
@@ -58,6 +66,17 @@ class WGSoftProcessor
 {
 public:
   WGSoftProcessor();
+  ~WGSoftProcessor();
+
+  /*!
+   * \brief Returns soft processor shared by all devices, creating it if needed.
+   *
+   * Services can only be advertised once, so soft processors of all devices are reached 
+   * through one instance.  It goes away when last device releases it.
+   */
+  static boost::shared_ptr<WGSoftProcessor> shared();
+
+  //! Advertises services, only first call does anything
   bool initialize(EthercatCom *com);
 
   struct Info 
@@ -78,12 +97,42 @@ public:
 
   void add(WGMailbox *mbx, const std::string &actuator_name, const std::string &processor_name, 
            unsigned iram_address, unsigned ctrl_address);  
+  //! Removes all soft processors of device with mailbox, after waiting for any transfer to it to finish
+  void remove(WGMailbox *mbx);
 
 protected:
 
   static const unsigned IRAM_INSTRUCTION_LENGTH = 1024;
+  //! Instructions transfered per mailbox operation : as many 4-byte instructions as fit in one mailbox write
+  static const unsigned INSTRUCTION_CHUNK = WGMailbox::MBX_MAX_WRITE_LENGTH / 4;
+
+  //! List, so entries stay put while other devices are removed
+  std::list<Info> processors_;
+
+  /*!
+   * \brief Marks device of a soft processor as in use while it exists.
+   *
+   * Service calls for different devices run at the same time, so their mailbox 
+   * transfers overlap on the shared mailbox scheduler.  Calls for the same device 
+   * wait for each other, so their IRAM transfers never interleave.
+   */
+  class DeviceLock : private boost::noncopyable
+  {
+  public:
+    DeviceLock(WGSoftProcessor &owner) : owner_(owner), mbx_(NULL) {}
+    ~DeviceLock();
+    WGSoftProcessor &owner_;
+    WGMailbox *mbx_;
+  };
+  boost::mutex mutex_;  //!< protects processors_, busy_devices_ and initialized_
+  boost::condition_variable busy_cond_;
+  std::set<WGMailbox*> busy_devices_;
+  bool initialized_;
 
-  std::vector<Info> processors_;
+  //! Service callbacks have their own queue and threads, so long firmware transfers don't block each other
+  static const unsigned SERVICE_THREADS = 4;
+  ros::CallbackQueue callback_queue_;
+  boost::scoped_ptr<ros::AsyncSpinner> spinner_;
 
   bool writeFirmwareCB(ethercat_hardware::SoftProcessorFirmwareWrite::Request &request, 
                        ethercat_hardware::SoftProcessorFirmwareWrite::Response &response);
@@ -102,8 +151,29 @@ protected:
   //! Takes soft processor out of reset
   bool releaseReset(const Info &info, std::ostream &err_msg);
 
-  //! Get pointer to soft processor by name. Returns NULL if processor d/n exist and create message in err_out
-  const WGSoftProcessor::Info* get(const std::string &actuator_name, const std::string &processor_name, std::ostream &err_out) const;
+  //! Sets or clears bit 0 of soft processor control register
+  bool writeReset(const Info &info, bool reset, std::ostream &err_msg);
+
+  /*! \brief Reads complete IRAM of soft processor
+   *
+   * All chunk reads are queued at once, so scheduler runs them back-to-back.
+   */
+  bool readIram(const Info &info, std::vector<uint32_t> &instructions, std::ostream &err_msg);
+
+  /*! \brief Writes chunks of IRAM that are flagged as changed
+   *
+   * \param instructions  complete IRAM image, IRAM_INSTRUCTION_LENGTH long
+   * \param changed       one flag per INSTRUCTION_CHUNK sized chunk of IRAM
+   */
+  bool writeIramChunks(const Info &info, const std::vector<uint32_t> &instructions, 
+                       const std::vector<bool> &changed, std::ostream &err_msg);
+
+  /*!
+   * \brief Get pointer to soft processor by name, and lock its device. 
+   * Returns NULL if processor d/n exist and create message in err_out
+   */
+  const WGSoftProcessor::Info* get(const std::string &actuator_name, const std::string &processor_name, 
+                                   DeviceLock &lock, std::ostream &err_out);
     
   EthercatCom *com_;
 };
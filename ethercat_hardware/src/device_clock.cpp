@@ -0,0 +1,201 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/device_clock.h"
+
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+namespace ethercat_hardware
+{
+
+
+DeviceClockEstimate::DeviceClockEstimate() :
+  aligned_(false),
+  resets_(0),
+  windows_(0),
+  drift_ppm_(0.0),
+  fit_error_us_(0.0),
+  latency_us_(0.0)
+{
+
+}
+
+
+DeviceClock::DeviceClock()
+{
+  reset();
+}
+
+
+void DeviceClock::reset()
+{
+  started_ = false;
+  last_device_time_us_ = 0;
+  device_us_ = 0;
+  host_base_ns_ = 0;
+  last_diff_ns_ = 0;
+  num_points_ = 0;
+  next_point_ = 0;
+  offset_ns_ = 0.0;
+  drift_ = 0.0;
+  estimate_ = DeviceClockEstimate();
+  startWindow();
+}
+
+
+void DeviceClock::startWindow()
+{
+  window_count_ = 0;
+  window_min_ns_ = std::numeric_limits<int64_t>::max();
+  window_min_device_us_ = 0;
+  window_latency_sum_ns_ = 0.0;
+}
+
+
+bool DeviceClock::update(uint32_t device_time_us, const ros::Time &host_time)
+{
+  int64_t host_ns = host_time.toNSec();
+  if (!started_)
+  {
+    started_ = true;
+    last_device_time_us_ = device_time_us;
+    device_us_ = 0;
+    host_base_ns_ = host_ns;
+  }
+  else 
+  {
+    int32_t step = int32_t(device_time_us - last_device_time_us_);
+    if (step == 0)
+    {
+      return false;
+    }
+    int64_t device_us = device_us_ + step;
+    int64_t diff_ns = (host_ns - host_base_ns_) - device_us * 1000;
+    bool host_jumped = estimate_.aligned_ && (fabs(double(diff_ns) - fitted(device_us)) > double(MAX_STEP_US) * 1e3);
+    if ((step < 0) || (uint32_t(step) > MAX_STEP_US) || host_jumped)
+    {
+      // Device was probably reset, or host clock was stepped.  Start over with this timestamp.
+      uint32_t resets = estimate_.resets_ + 1;
+      reset();
+      estimate_.resets_ = resets;
+      return update(device_time_us, host_time);
+    }
+    last_device_time_us_ = device_time_us;
+    device_us_ = device_us;
+  }
+
+  int64_t diff_ns = (host_ns - host_base_ns_) - device_us_ * 1000;
+  last_diff_ns_ = diff_ns;
+  if (diff_ns < window_min_ns_)
+  {
+    window_min_ns_ = diff_ns;
+    window_min_device_us_ = device_us_;
+  }
+  if (estimate_.aligned_)
+  {
+    window_latency_sum_ns_ += double(diff_ns) - fitted(device_us_);
+  }
+
+  if (++window_count_ < WINDOW_SIZE)
+  {
+    return false;
+  }
+
+  point_device_us_[next_point_] = double(window_min_device_us_);
+  point_diff_ns_[next_point_] = double(window_min_ns_);
+  next_point_ = (next_point_ + 1) % NUM_WINDOWS;
+  num_points_ = std::min(num_points_ + 1, unsigned(NUM_WINDOWS));
+
+  estimate_.latency_us_ = estimate_.aligned_ ? (window_latency_sum_ns_ / WINDOW_SIZE * 1e-3) : 0.0;
+  fit();
+  startWindow();
+  return true;
+}
+
+
+void DeviceClock::fit()
+{
+  double mean_t = 0.0, mean_d = 0.0;
+  for (unsigned i = 0; i < num_points_; ++i)
+  {
+    mean_t += point_device_us_[i];
+    mean_d += point_diff_ns_[i];
+  }
+  mean_t /= num_points_;
+  mean_d /= num_points_;
+
+  double sum_tt = 0.0, sum_td = 0.0;
+  for (unsigned i = 0; i < num_points_; ++i)
+  {
+    double dt = point_device_us_[i] - mean_t;
+    sum_tt += dt * dt;
+    sum_td += dt * (point_diff_ns_[i] - mean_d);
+  }
+
+  // Slope is in nanoseconds per microsecond of device time
+  drift_ = (sum_tt > 0.0) ? (sum_td / sum_tt * 1e-3) : 0.0;
+  offset_ns_ = mean_d - drift_ * mean_t * 1e3;
+
+  double sum_sq = 0.0;
+  for (unsigned i = 0; i < num_points_; ++i)
+  {
+    double error = point_diff_ns_[i] - fitted(int64_t(point_device_us_[i]));
+    sum_sq += error * error;
+  }
+
+  estimate_.aligned_ = (num_points_ >= MIN_WINDOWS);
+  estimate_.windows_ = num_points_;
+  estimate_.drift_ppm_ = drift_ * 1e6;
+  estimate_.fit_error_us_ = sqrt(sum_sq / num_points_) * 1e-3;
+}
+
+
+ros::Time DeviceClock::toHostTime(uint32_t device_time_us) const
+{
+  ros::Time host_time;
+  if (!started_)
+  {
+    return host_time;
+  }
+  int64_t device_us = device_us_ + int32_t(device_time_us - last_device_time_us_);
+  int64_t diff_ns = estimate_.aligned_ ? int64_t(fitted(device_us)) : last_diff_ns_;
+  host_time.fromNSec(host_base_ns_ + device_us * 1000 + diff_ns);
+  return host_time;
+}
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,269 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/diagnostics_builder.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+namespace ethercat_hardware
+{
+
+
+DiagnosticsBuilder::DiagnosticsBuilder(std::vector<diagnostic_msgs::DiagnosticStatus> &statuses) :
+  statuses_(statuses),
+  status_(NULL),
+  status_count_(0),
+  value_count_(0),
+  changed_count_(0),
+  level_(OK),
+  message_length_(0)
+{
+  message_[0] = '\0';
+}
+
+
+void DiagnosticsBuilder::begin()
+{
+  status_ = NULL;
+  status_count_ = 0;
+  changed_count_ = 0;
+}
+
+
+void DiagnosticsBuilder::beginStatus()
+{
+  finishStatus();
+  if (status_count_ == statuses_.size())
+  {
+    statuses_.push_back(diagnostic_msgs::DiagnosticStatus());
+  }
+  status_ = &statuses_[status_count_];
+  ++status_count_;
+  value_count_ = 0;
+  clearSummary();
+}
+
+
+void DiagnosticsBuilder::end()
+{
+  finishStatus();
+  status_ = NULL;
+  if (statuses_.size() > status_count_)
+  {
+    statuses_.resize(status_count_);
+  }
+}
+
+
+void DiagnosticsBuilder::finishStatus()
+{
+  if (status_ == NULL)
+  {
+    return;
+  }
+
+  std::vector<diagnostic_msgs::KeyValue> &values(status_->values);
+  if (values.size() > value_count_)
+  {
+    values.resize(value_count_);
+  }
+  status_->level = level_;
+  update(status_->message, message_);
+}
+
+
+void DiagnosticsBuilder::update(std::string &dest, const char *str)
+{
+  if (dest != str)
+  {
+    // Assigning to existing string re-uses its buffer when it is large enough
+    dest.assign(str);
+    ++changed_count_;
+  }
+}
+
+
+void DiagnosticsBuilder::setName(const char *name)
+{
+  assert(status_ != NULL);
+  update(status_->name, name);
+}
+
+
+void DiagnosticsBuilder::setNamef(const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buffer_, sizeof(buffer_), format, ap);
+  va_end(ap);
+  setName(buffer_);
+}
+
+
+void DiagnosticsBuilder::setHardwareId(const char *hardware_id)
+{
+  assert(status_ != NULL);
+  update(status_->hardware_id, hardware_id);
+}
+
+
+void DiagnosticsBuilder::setHardwareIdf(const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buffer_, sizeof(buffer_), format, ap);
+  va_end(ap);
+  setHardwareId(buffer_);
+}
+
+
+void DiagnosticsBuilder::clearSummary()
+{
+  level_ = OK;
+  message_[0] = '\0';
+  message_length_ = 0;
+}
+
+
+void DiagnosticsBuilder::summary(unsigned char lvl, const char *s)
+{
+  clearSummary();
+  level_ = lvl;
+  appendMessage(s);
+}
+
+
+void DiagnosticsBuilder::summaryf(unsigned char lvl, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buffer_, sizeof(buffer_), format, ap);
+  va_end(ap);
+  summary(lvl, buffer_);
+}
+
+
+void DiagnosticsBuilder::mergeSummary(unsigned char lvl, const char *s)
+{
+  if ((lvl > 0) && (level_ > 0))
+  {
+    if (message_length_ > 0)
+    {
+      appendMessage("; ");
+    }
+    appendMessage(s);
+  }
+  else if (lvl > level_)
+  {
+    message_length_ = 0;
+    message_[0] = '\0';
+    appendMessage(s);
+  }
+
+  if (lvl > level_)
+  {
+    level_ = lvl;
+  }
+}
+
+
+void DiagnosticsBuilder::mergeSummaryf(unsigned char lvl, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buffer_, sizeof(buffer_), format, ap);
+  va_end(ap);
+  mergeSummary(lvl, buffer_);
+}
+
+
+void DiagnosticsBuilder::appendMessage(const char *s)
+{
+  // Silently truncate overly long messages
+  unsigned len = strlen(s);
+  if (len > (MAX_MESSAGE_LENGTH - 1 - message_length_))
+  {
+    len = MAX_MESSAGE_LENGTH - 1 - message_length_;
+  }
+  memcpy(message_ + message_length_, s, len);
+  message_length_ += len;
+  message_[message_length_] = '\0';
+}
+
+
+void DiagnosticsBuilder::add(const char *key, const char *value)
+{
+  assert(status_ != NULL);
+  std::vector<diagnostic_msgs::KeyValue> &values(status_->values);
+  if (value_count_ == values.size())
+  {
+    values.push_back(diagnostic_msgs::KeyValue());
+  }
+  diagnostic_msgs::KeyValue &kv(values[value_count_]);
+  ++value_count_;
+  update(kv.key, key);
+  update(kv.value, value);
+}
+
+
+void DiagnosticsBuilder::vaddf(const char *key, const char *format, va_list ap)
+{
+  vsnprintf(buffer_, sizeof(buffer_), format, ap);
+  add(key, buffer_);
+}
+
+
+void DiagnosticsBuilder::addf(const char *key, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vaddf(key, format, ap);
+  va_end(ap);
+}
+
+
+void DiagnosticsBuilder::addf(const std::string &key, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vaddf(key.c_str(), format, ap);
+  va_end(ap);
+}
+
+
+}; //end namespace ethercat_hardware
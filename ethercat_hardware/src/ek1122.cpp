@@ -57,15 +57,13 @@ int EK1122::initialize(pr2_hardware_interface::HardwareInterface *, bool)
   ROS_DEBUG("Device #%02d: EK1122 (%#08x)", sh_->get_ring_position(), sh_->get_product_code());
   return 0;
 }
-void EK1122::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *)
+void EK1122::diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *)
 {
-  stringstream str;
-  str << "EtherCAT Device #" << setw(2) << setfill('0') << sh_->get_ring_position() << " (EK1122)";
-  d.name = str.str();
+  d.setNamef("EtherCAT Device #%02d (EK1122)", sh_->get_ring_position());
   d.summary(0, "OK");
   char serial[32];
   snprintf(serial, sizeof(serial), "%d-%05d-%05d", sh_->get_product_code()/ 100000 , sh_->get_product_code() % 100000, sh_->get_serial());
-  d.hardware_id = serial;
+  d.setHardwareId(serial);
 
   d.clear();
   d.addf("Product code", "EK1122 (%u)", sh_->get_product_code());
@@ -270,7 +270,7 @@ void EthercatDeviceDiagnostics::collect(EthercatCom *com, EtherCAT_SlaveHandler
   return;
 }
 
-void EthercatDeviceDiagnostics::publish(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned numPorts) const
+void EthercatDeviceDiagnostics::publish(ethercat_hardware::DiagnosticsBuilder &d, unsigned numPorts) const
 {
   if (numPorts>4) {
     assert(numPorts<4);
@@ -281,25 +281,24 @@ void EthercatDeviceDiagnostics::publish(diagnostic_updater::DiagnosticStatusWrap
   d.addf("Reset detected", "%s", (resetDetected_ ? "Yes" : "No"));
   d.addf("Valid", "%s", (diagnosticsValid_ ? "Yes" : "No"));
 
-  d.addf("EPU Errors", "%lld", epuErrorTotal_);
-  d.addf("PDI Errors", "%lld", pdiErrorTotal_);
-  ostringstream os, port;
+  d.addf("EPU Errors", "%llu", (unsigned long long)epuErrorTotal_);
+  d.addf("PDI Errors", "%llu", (unsigned long long)pdiErrorTotal_);
+  char key[32];
   for (unsigned i=0; i<numPorts; ++i) {
     const EthercatPortDiagnostics &pt(portDiagnostics_[i]);
-    port.str(""); port << " Port " << i;
-    os.str(""); os << "Status" << port.str();
-    d.addf(os.str(), "%s Link, %s, %s Comm", 
+    snprintf(key, sizeof(key), "Status Port %u", i);
+    d.addf(key, "%s Link, %s, %s Comm", 
            pt.hasLink ? "Has":"No",
            pt.isClosed ? "Closed":"Open",
            pt.hasCommunication ? "Has":"No"); 
-    os.str(""); os << "RX Error" << port.str();
-    d.addf(os.str(), "%lld", pt.rxErrorTotal); 
-    os.str(""); os << "Forwarded RX Error" << port.str();
-    d.addf(os.str(), "%lld", pt.forwardedRxErrorTotal); 
-    os.str(""); os << "Invalid Frame" << port.str();
-    d.addf(os.str(), "%lld", pt.invalidFrameTotal);
-    os.str(""); os << "Lost Link" << port.str();
-    d.addf(os.str(), "%lld", pt.lostLinkTotal);
+    snprintf(key, sizeof(key), "RX Error Port %u", i);
+    d.addf(key, "%llu", (unsigned long long)pt.rxErrorTotal); 
+    snprintf(key, sizeof(key), "Forwarded RX Error Port %u", i);
+    d.addf(key, "%llu", (unsigned long long)pt.forwardedRxErrorTotal); 
+    snprintf(key, sizeof(key), "Invalid Frame Port %u", i);
+    d.addf(key, "%llu", (unsigned long long)pt.invalidFrameTotal);
+    snprintf(key, sizeof(key), "Lost Link Port %u", i);
+    d.addf(key, "%llu", (unsigned long long)pt.lostLinkTotal);
   }
   
   if (resetDetected_) 
@@ -328,6 +327,22 @@ void EthercatDeviceDiagnostics::publish(diagnostic_updater::DiagnosticStatusWrap
   }
 }
 
+void EthercatDeviceDiagnostics::telemetry(ethercat_hardware::DeviceTelemetry &t) const
+{
+  t.valid = diagnosticsValid_;
+  t.reset_detected = resetDetected_;
+  t.epu_errors = epuErrorTotal_;
+  t.pdi_errors = pdiErrorTotal_;
+  for (unsigned i=0; i<4; ++i) {
+    const EthercatPortDiagnostics &pt(portDiagnostics_[i]);
+    t.has_link[i] = pt.hasLink;
+    t.rx_errors[i] = pt.rxErrorTotal;
+    t.forwarded_rx_errors[i] = pt.forwardedRxErrorTotal;
+    t.invalid_frames[i] = pt.invalidFrameTotal;
+    t.lost_links[i] = pt.lostLinkTotal;
+  }
+}
+
 void EthercatDevice::construct(EtherCAT_SlaveHandler *sh, int &start_address)
 {
   sh_ = sh;
@@ -339,26 +354,12 @@ void EthercatDevice::construct(ros::NodeHandle &nh)
 }
 
 
-EthercatDevice::EthercatDevice() : use_ros_(true)
+EthercatDevice::EthercatDevice() : use_ros_(true), legacy_diagnostics_(false)
 {
   sh_ = NULL;
   command_size_ = 0;
   status_size_ = 0;
-  newDiagnosticsIndex_ = 0;
-
-  int error = pthread_mutex_init(&newDiagnosticsIndexLock_, NULL);
-  if (error != 0) {
-    ROS_FATAL("Initializing indexLock failed : %s", strerror(error));
-    sleep(1); // wait for ros to flush rosconsole output
-    exit(EXIT_FAILURE);
-  }
-
-  error = pthread_mutex_init(&diagnosticsLock_, NULL);
-  if (error != 0) {
-    ROS_FATAL("Initializing diagnositcsLock failed : %s", strerror(error));
-    sleep(1); // wait for ros to flush rosconsole output
-    exit(EXIT_FAILURE);
-  }    
+  diagnosticsSnapshot_.write(collectDiagnostics_);
 }
 
 EthercatDevice::~EthercatDevice()
@@ -368,30 +369,10 @@ EthercatDevice::~EthercatDevice()
 
 void EthercatDevice::collectDiagnostics(EthercatCom *com)
 {
-  // Really, should not need this lock, since there should only be one thread updating diagnostics.
-  pthread_mutex_lock(&diagnosticsLock_);  
-  
-  // Get references to diagnostics... code is easier to read
-  unsigned oldDiagnosticsIndex = (newDiagnosticsIndex_+1)&1;
-  const EthercatDeviceDiagnostics &newDiag = deviceDiagnostics[newDiagnosticsIndex_];
-  EthercatDeviceDiagnostics &oldDiag = deviceDiagnostics[oldDiagnosticsIndex];
-
-  // copy new diagnostics values in old diagnostics, because diagnostic data use accumumlators
-  oldDiag = newDiag; 
-
-  // Collect diagnostics data into "old" buffer.  
-  // This way the "new" buffer is never changed while the publishing thread may be using it.
-  oldDiag.collect(com, sh_);
-
-  // Got new diagnostics... swap buffers.  
-  // Publisher thread uses "new" buffer.  New to lock while swapping buffers.  
-  // Note : this is just changing an integer value, so it only takes a couple of instructions.  
-  pthread_mutex_lock(&newDiagnosticsIndexLock_);    
-  newDiagnosticsIndex_=oldDiagnosticsIndex;
-  pthread_mutex_unlock(&newDiagnosticsIndexLock_);
-  
-  // Done, unlock
-  pthread_mutex_unlock(&diagnosticsLock_);
+  // Only collection thread uses collectDiagnostics_, so it can be updated in place 
+  // (diagnostic data use accumulators).  Publishing thread only sees copies made here.
+  collectDiagnostics_.collect(com, sh_);
+  diagnosticsSnapshot_.write(collectDiagnostics_);
 }
 
 
@@ -535,36 +516,38 @@ int EthercatDevice::writeData(EthercatCom *com, EtherCAT_SlaveHandler *sh,  EC_U
 }
 
 
-void EthercatDevice::ethercatDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned numPorts)
+void EthercatDevice::ethercatDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned numPorts)
 {
   if (numPorts>4) {
     assert(numPorts<4);
     numPorts=4;
   }
 
-  // By locking index, diagnostics double-buffer cannot be swapped.
-  // Update thread is only allowed to change 'old' diagnostics buffer, 
-  //  so new buffer data cannot be changed while index lock is held.
-  pthread_mutex_lock(&newDiagnosticsIndexLock_);
+  // Copy out last collected diagnostics, this never waits on collection thread.
+  diagnosticsSnapshot_.read(publishDiagnostics_);
+  publishDiagnostics_.publish(d, numPorts);
+}
 
-  const EthercatDeviceDiagnostics &newDiag = deviceDiagnostics[newDiagnosticsIndex_];
-  newDiag.publish(d, numPorts);
 
-  pthread_mutex_unlock(&newDiagnosticsIndexLock_);
+void EthercatDevice::telemetry(ethercat_hardware::DeviceTelemetry &t)
+{
+  t.ring_position = sh_->get_ring_position();
+  t.product_code = sh_->get_product_code();
+  t.serial = sh_->get_serial();
+
+  diagnosticsSnapshot_.read(publishDiagnostics_);
+  publishDiagnostics_.telemetry(t);
+
+  t.wg0x.clear();
 }
 
 
-void EthercatDevice::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer)
+void EthercatDevice::diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
 {
-  stringstream str;
-  str << "EtherCAT Device (" << std::setw(2) << std::setfill('0') << sh_->get_ring_position() << ")";
-  d.name = str.str();
-  str.str("");
-  str << sh_->get_product_code() << '-' << sh_->get_serial();
-  d.hardware_id = str.str();
+  d.setNamef("EtherCAT Device (%02d)", sh_->get_ring_position());
+  d.setHardwareIdf("%u-%u", sh_->get_product_code(), sh_->get_serial());
 
-  d.message = "";
-  d.level = 0;
+  d.clearSummary();
 
   d.clear();
   d.addf("Position", "%02d", sh_->get_ring_position());
@@ -575,13 +558,60 @@ void EthercatDevice::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d,
   this->ethercatDiagnostics(d, 4); //assume unknown device has 4 ports
 }
 
+void EthercatDevice::multiDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
+{
+  // Give child-class written against old DiagnosticStatusWrapper interface a chance first.
+  // Default old diagnostics() clears legacy_diagnostics_ when it is not overridden.
+  legacy_statuses_.clear();
+  legacy_diagnostics_ = true;
+  multiDiagnostics(legacy_statuses_, buffer);
+  if (legacy_diagnostics_) {
+    for (unsigned i=0; i<legacy_statuses_.size(); ++i) {
+      const diagnostic_msgs::DiagnosticStatus &status(legacy_statuses_[i]);
+      d.beginStatus();
+      d.setName(status.name);
+      d.setHardwareId(status.hardware_id);
+      d.summary(status.level, status.message);
+      for (unsigned j=0; j<status.values.size(); ++j) {
+        d.add(status.values[j].key, status.values[j].value);
+      }
+    }
+    return;
+  }
+
+  // If child-class does not implement multiDiagnostics(), fall back to using slave's diagnostic() function
+  d.beginStatus();
+  diagnostics(d, buffer);
+}
+
 void EthercatDevice::multiDiagnostics(vector<diagnostic_msgs::DiagnosticStatus> &vec, unsigned char *buffer)
 {
   // Clean up recycled status object before reusing it.
-  diagnostic_status_.clearSummary();
-  diagnostic_status_.clear();
+  legacy_status_.clearSummary();
+  legacy_status_.clear();
 
-  // If child-class does not implement multiDiagnostics(), fall back to using slave's diagnostic() function
-  diagnostics(diagnostic_status_, buffer);
-  vec.push_back(diagnostic_status_);
+  diagnostics(legacy_status_, buffer);
+  if (legacy_diagnostics_) {
+    vec.push_back(legacy_status_);
+  }
+}
+
+void EthercatDevice::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer)
+{
+  // Not overridden : DiagnosticsBuilder version of diagnostics() is used instead
+  legacy_diagnostics_ = false;
+}
+
+void EthercatDevice::ethercatDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned numPorts)
+{
+  // Build port diagnostics into scratch status, then append its values
+  std::vector<diagnostic_msgs::DiagnosticStatus> statuses;
+  ethercat_hardware::DiagnosticsBuilder builder(statuses);
+  builder.begin();
+  builder.beginStatus();
+  ethercatDiagnostics(builder, numPorts);
+  builder.end();
+  if (!statuses.empty()) {
+    d.values.insert(d.values.end(), statuses[0].values.begin(), statuses[0].values.end());
+  }
 }
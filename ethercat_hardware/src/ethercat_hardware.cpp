@@ -39,11 +39,11 @@
 #include <dll/ethercat_device_addressed_telegram.h>
 
 #include <sstream>
+#include <set>
 
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <boost/foreach.hpp>
-#include <boost/regex.hpp>
 
 EthercatHardwareDiagnostics::EthercatHardwareDiagnostics() :
 
@@ -54,6 +54,9 @@ EthercatHardwareDiagnostics::EthercatHardwareDiagnostics() :
   reset_motors_service_count_(0), 
   halt_motors_service_count_(0),
   halt_motors_error_count_(0),
+  packet_mmap_(false),
+  multi_chain_(false),
+  auto_timeout_(false),
   motors_halted_(false),
   motors_halted_reason_("")
 {
@@ -70,8 +73,10 @@ void EthercatHardwareDiagnostics::resetMaxTiming()
 
 EthercatHardware::EthercatHardware(const std::string& name) :
   hw_(0), node_(ros::NodeHandle(name)),
-  ni_(0), this_buffer_(0), prev_buffer_(0), buffer_size_(0), halt_motors_(true), reset_state_(0), 
+  ni_(0), packet_mmap_(false), this_buffer_(0), prev_buffer_(0), buffer_size_(0), halt_motors_(true), reset_state_(0), 
   max_pd_retries_(10),
+  auto_timeout_(false),
+  last_late_pkt_rtt_sum_(0),
   diagnostics_publisher_(node_), 
   motor_publisher_(node_, "motors_halted", 1, true), 
   device_loader_("ethercat_hardware", "EthercatDevice")
@@ -81,6 +86,8 @@ EthercatHardware::EthercatHardware(const std::string& name) :
 
 EthercatHardware::~EthercatHardware()
 {
+  // Fails queued mailbox requests and detaches device mailboxes, before devices and oob_com_ go away
+  mailbox_scheduler_.reset();
   diagnostics_publisher_.stop();
   for (uint32_t i = 0; i < slaves_.size(); ++i)
   {
@@ -88,9 +95,16 @@ EthercatHardware::~EthercatHardware()
     EtherCAT_SlaveHandler *sh = em_->get_slave_handler(fsa);
     if (sh) sh->to_state(EC_PREOP_STATE);
   }
-  if (ni_)
+  if (ni_ && (chain_nis_.size() > 1))
   {
-    close_socket(ni_);
+    ethercat_hardware::closeMultiChainNetif(ni_);
+  }
+  for (unsigned i = 0; i < chain_nis_.size(); ++i)
+  {
+    if (packet_mmap_)
+      ethercat_hardware::closePacketMmapNetif(chain_nis_[i]);
+    else
+      close_socket(chain_nis_[i]);
   }
   delete[] buffers_;
   delete hw_;
@@ -153,9 +167,8 @@ void EthercatHardware::init(char *interface, bool allow_unprogrammed)
 
   // Initialize network interface
   interface_ = interface;
-  if ((ni_ = init_ec(interface)) == NULL)
+  if (!initChains(interface))
   {
-    ROS_FATAL("Unable to initialize interface: %s", interface);
     sleep(1);
     exit(EXIT_FAILURE);
   }
@@ -205,6 +218,19 @@ void EthercatHardware::init(char *interface, bool allow_unprogrammed)
     slave_handles.push_back(sh);
   }
 
+  // Find driver class of every product code once, instead of once per slave
+  buildDeviceClassMap(slave_handles);
+
+  { // Device blocks of process data image can be aligned, so devices see aligned buffers.
+    // Padding is exchanged with devices too, so by default blocks are packed.
+    int alignment = 1;
+    node_.getParam("process_image_alignment", alignment);
+    if (!layout_.reset(std::max(1, alignment)))
+    {
+      ROS_WARN("Process image alignment %d is not a power of two, blocks will not be aligned", alignment);
+    }
+  }
+
   // Configure EtherCAT slaves
   BOOST_FOREACH(EtherCAT_SlaveHandler *sh, slave_handles)
   {    
@@ -215,11 +241,13 @@ void EthercatHardware::init(char *interface, bool allow_unprogrammed)
       sleep(1);
       exit(EXIT_FAILURE);
     }
-    buffer_size_ += slaves_[slave]->command_size_ + slaves_[slave]->status_size_;
   }
 
   // Configure any non-ethercat slaves (appends devices to slaves_ vector)
   loadNonEthercatDevices();
+  buffer_size_ = layout_.size();
+  ROS_INFO("Process data image : %u bytes, %u command, %u status, %u padding", 
+           layout_.size(), layout_.commandBytes(), layout_.statusBytes(), layout_.paddingBytes());
 
   // Move slave from INIT to PREOP
   BOOST_FOREACH(EtherCAT_SlaveHandler *sh, slave_handles)
@@ -261,6 +289,7 @@ void EthercatHardware::init(char *interface, bool allow_unprogrammed)
   hw_ = new pr2_hardware_interface::HardwareInterface();
   hw_->current_time_ = ros::Time::now();
   last_published_ = hw_->current_time_;
+  last_telemetry_published_ = hw_->current_time_;
 
   // Initialize slaves
   //set<string> actuator_names;
@@ -283,6 +312,18 @@ void EthercatHardware::init(char *interface, bool allow_unprogrammed)
     }
   }
 
+  // Devices are done with direct mailbox access, from now on all mailbox traffic goes through one scheduler
+  mailbox_scheduler_.reset(new ethercat_hardware::WGMailboxScheduler(oob_com_));
+  for (unsigned int slave = 0; slave < slaves_.size(); ++slave)
+  {
+    if (!slaves_[slave]->attachMailboxScheduler(*mailbox_scheduler_))
+    {
+      ROS_FATAL("Unable to attach mailbox of slave #%d to mailbox scheduler", slave);
+      exit(EXIT_FAILURE);
+    }
+  }
+  mailbox_scheduler_->start();
+
 
   { // Initialization is now complete. Reduce timeout of EtherCAT txandrx for better realtime performance
     // Allow timeout to be configured at program load time with rosparam.  
@@ -300,7 +341,8 @@ void EthercatHardware::init(char *interface, bool allow_unprogrammed)
       timeout = std::max(1, std::min(MAX_TIMEOUT, timeout));
       ROS_WARN("Invalid timeout (%d) for socket, using %d", old_timeout, timeout);
     }
-    if (set_socket_timeout(ni_, timeout))
+    int error = setNetifTimeout(timeout);
+    if (error)
     {
       ROS_FATAL("Error setting socket timeout to %d", timeout);      
       sleep(1);
@@ -333,19 +375,204 @@ void EthercatHardware::init(char *interface, bool allow_unprogrammed)
     }
     max_pd_retries = std::max(MIN_RETRIES,std::min(MAX_RETRIES,max_pd_retries));
     max_pd_retries_ = max_pd_retries;
+
+    // Instead of hand tuning above values for each robot, they can be learned from measured 
+    // process data round trip times.  Values above are used until enough samples are measured.
+    node_.getParam("auto_tune_timeout", auto_timeout_);
+    if (auto_timeout_)
+    {
+      static const int DEFAULT_MIN_TIMEOUT = 1000;
+      static const int DEFAULT_MIN_RETRIES = 4;
+      int min_timeout = DEFAULT_MIN_TIMEOUT;
+      int min_retries = DEFAULT_MIN_RETRIES;
+      node_.getParam("auto_tune_timeout_min_us", min_timeout);
+      node_.getParam("auto_tune_timeout_min_retries", min_retries);
+      min_timeout = std::max(1, std::min(MAX_TIMEOUT, min_timeout));
+      min_retries = std::max(MIN_RETRIES, std::min(MAX_RETRIES, min_retries));
+      timeout_tuner_.configure(MAX_TIMEOUT, min_timeout, min_retries, MAX_RETRIES);
+      last_late_pkt_rtt_sum_ = ni_->counters.rx_late_pkt_rtt_us_sum;
+    }
   }
 
-  diagnostics_publisher_.initialize(interface_, buffer_size_, slaves_, num_ethercat_devices_, timeout_, max_pd_retries_);
+  { // Telemetry is a raw numeric copy of diagnostics data, that is cheap enough to publish more often.
+    // Rate (in Hz) can be configured with rosparam, zero or negative rate disables telemetry.
+    static const double DEFAULT_TELEMETRY_RATE = 10.0;
+    static const double MAX_TELEMETRY_RATE = 100.0;
+    double telemetry_rate = DEFAULT_TELEMETRY_RATE;
+    node_.getParam("telemetry_rate", telemetry_rate);
+    if (telemetry_rate > MAX_TELEMETRY_RATE)
+    {
+      ROS_WARN("Limiting telemetry rate to %f Hz", MAX_TELEMETRY_RATE);
+      telemetry_rate = MAX_TELEMETRY_RATE;
+    }
+    telemetry_period_ = (telemetry_rate > 0.0) ? ros::Duration(1.0 / telemetry_rate) : ros::Duration(0.0);
+  }
+
+  { // Chain topology and per-link delays are re-measured by diagnostics collection thread.
+    // Period (in seconds) can be configured with rosparam, zero or negative period disables measurements.
+    static const double DEFAULT_TOPOLOGY_PERIOD = 10.0;
+    double topology_period = DEFAULT_TOPOLOGY_PERIOD;
+    node_.getParam("topology_period", topology_period);
+    topology_period_ = (topology_period > 0.0) ? ros::Duration(topology_period) : ros::Duration(0.0);
+    if (!topology_period_.isZero() && (chain_nis_.size() > 1))
+    {
+      // Receive times of different chains come from unrelated clocks, and do not form one graph
+      ROS_WARN("Chain topology is not measured when there is more than one chain");
+      topology_period_ = ros::Duration(0.0);
+    }
+    if (!topology_period_.isZero())
+    {
+      topology_publisher_ = node_.advertise<ethercat_hardware::ChainTopology>("chain_topology", 1, true);
+    }
+  }
+
+  diagnostics_publisher_.initialize(interface_, layout_, slaves_, num_ethercat_devices_, timeout_, max_pd_retries_, 
+                                    !telemetry_period_.isZero());
+
+  initMetrics();
+}
+
+
+/*!
+ * \brief Creates network interface used for all EtherCAT communication.
+ *
+ * By default EML's socket driver is used.  Setting rosparam "transport" to "packet_mmap"
+ * selects memory mapped AF_PACKET rings instead, which avoid per-frame copies and the input thread.
+ * With "packet_mmap_early_resend", late process data frames are sent again once the 
+ * 99.9th percentile of measured round trip times has passed, instead of waiting out the full timeout.
+ * With "packet_mmap_redundant_pd", every process data frame is sent twice, so single dropped frame
+ * does not cause a retry at all.
+ * With "packet_mmap_timestamps", kernel (or NIC) timestamps of process data frames split 
+ * round trip time into host send, wire and host wake-up latency.
+ */
+struct netif *EthercatHardware::initNetif(const char *interface)
+{
+  std::string transport("socket");
+  node_.getParam("transport", transport);
+  if (transport == "packet_mmap")
+  {
+    ethercat_hardware::PacketMmapConfig config;
+    int busy_poll_us = 0;
+    node_.getParam("packet_mmap_busy_poll_us", busy_poll_us);
+    config.busy_poll_us_ = std::max(0, busy_poll_us);
+    node_.getParam("packet_mmap_spin", config.spin_);
+    node_.getParam("packet_mmap_early_resend", config.early_resend_);
+    node_.getParam("packet_mmap_redundant_pd", config.redundant_pd_);
+    node_.getParam("packet_mmap_timestamps", config.timestamps_);
+    node_.getParam("packet_mmap_hardware_timestamps", config.hardware_timestamps_);
+    int max_resends = config.max_resends_;
+    node_.getParam("packet_mmap_max_resends", max_resends);
+    config.max_resends_ = std::max(0, max_resends);
+    int sleep_slice_us = config.sleep_slice_us_;
+    node_.getParam("packet_mmap_sleep_slice_us", sleep_slice_us);
+    config.sleep_slice_us_ = std::max(1, sleep_slice_us);
+    packet_mmap_ = true;
+    return ethercat_hardware::initPacketMmapNetif(interface, config);
+  }
+  else if (transport != "socket")
+  {
+    ROS_WARN("Unknown transport '%s', using 'socket'", transport.c_str());
+  }
+  packet_mmap_ = false;
+  return init_ec(interface);
+}
+
+
+/*!
+ * \brief Creates interface of every chain, and combines them when there is more than one.
+ *
+ * Rosparam "extra_interfaces" lists interfaces of further chains, whose devices come after 
+ * devices of first chain.  EML only supports one master per process, so instead of each chain 
+ * getting its own master, chains are combined into a single interface (see initMultiChainNetif()).
+ * Process data goes to all chains at once, and "max_chain_retries" limits how many times 
+ * a single chain that dropped process data is sent it again.
+ */
+bool EthercatHardware::initChains(const char *interface)
+{
+  struct netif *ni = initNetif(interface);
+  if (ni == NULL)
+  {
+    ROS_FATAL("Unable to initialize interface: %s", interface);
+    return false;
+  }
+  chain_nis_.push_back(ni);
+
+  std::vector<std::string> extra_interfaces;
+  node_.getParam("extra_interfaces", extra_interfaces);
+  for (unsigned i = 0; i < extra_interfaces.size(); ++i)
+  {
+    if ((ni = initNetif(extra_interfaces[i].c_str())) == NULL)
+    {
+      ROS_FATAL("Unable to initialize interface: %s", extra_interfaces[i].c_str());
+      return false;
+    }
+    chain_nis_.push_back(ni);
+  }
+
+  if (chain_nis_.size() == 1)
+  {
+    ni_ = chain_nis_[0];
+    return true;
+  }
+
+  static const int DEFAULT_CHAIN_RETRIES = 1;
+  int max_chain_retries = DEFAULT_CHAIN_RETRIES;
+  node_.getParam("max_chain_retries", max_chain_retries);
+  if ((ni_ = ethercat_hardware::initMultiChainNetif(chain_nis_, std::max(0, max_chain_retries))) == NULL)
+  {
+    ROS_FATAL("Unable to combine %u EtherCAT chains", unsigned(chain_nis_.size()));
+    return false;
+  }
+  ROS_INFO("Using %u EtherCAT chains", unsigned(chain_nis_.size()));
+  return true;
+}
+
+
+void EthercatHardware::initMetrics()
+{
+  // Shared memory metrics are only written if a segment name is given
+  std::string metrics_shm_name;
+  node_.getParam("metrics_shm_name", metrics_shm_name);
+  if (metrics_shm_name.empty())
+  {
+    return;
+  }
+
+  if (!metrics_segment_.open(metrics_shm_name, slaves_.size()))
+  {
+    ROS_WARN("Shared memory metrics are disabled");
+    return;
+  }
+
+  memset(&metrics_, 0, sizeof(metrics_));
+  metrics_.num_devices_ = slaves_.size();
+  ethercat_hardware::DeviceMetrics blank;
+  memset(&blank, 0, sizeof(blank));
+  device_metrics_.assign(slaves_.size(), blank);
+  for (unsigned s = 0; s < slaves_.size(); ++s)
+  {
+    EtherCAT_SlaveHandler *sh = slaves_[s]->sh_;
+    if (sh != NULL)
+    {
+      device_metrics_[s].ring_position_ = sh->get_ring_position();
+      device_metrics_[s].product_code_ = sh->get_product_code();
+      device_metrics_[s].serial_ = sh->get_serial();
+    }
+  }
+  metrics_segment_.write(metrics_, device_metrics_.empty() ? NULL : &device_metrics_[0]);
 }
 
 
 EthercatHardwareDiagnosticsPublisher::EthercatHardwareDiagnosticsPublisher(ros::NodeHandle &node) :
   node_(node),
   diagnostics_ready_(false),
+  diagnostics_pending_(false),
   publisher_(node_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1)),
   diagnostics_buffer_(NULL),
   last_dropped_packet_count_(0),
-  last_dropped_packet_time_(0)
+  last_dropped_packet_time_(0),
+  status_(diagnostic_array_.status),
+  publish_telemetry_(false)
 {
 }
 
@@ -354,13 +581,16 @@ EthercatHardwareDiagnosticsPublisher::~EthercatHardwareDiagnosticsPublisher()
   delete[] diagnostics_buffer_;
 }
 
-void EthercatHardwareDiagnosticsPublisher::initialize(const string &interface, unsigned int buffer_size, 
+void EthercatHardwareDiagnosticsPublisher::initialize(const string &interface, 
+                                                      const ethercat_hardware::ProcessImageLayout &layout, 
                                                       const std::vector<boost::shared_ptr<EthercatDevice> > &slaves, 
                                                       unsigned int num_ethercat_devices, 
-                                                      unsigned timeout, unsigned max_pd_retries)
+                                                      unsigned timeout, unsigned max_pd_retries,
+                                                      bool publish_telemetry)
 {
   interface_ = interface;
-  buffer_size_ = buffer_size;
+  layout_ = layout;
+  buffer_size_ = layout.size();
   slaves_ = slaves;
   num_ethercat_devices_ = num_ethercat_devices;
   timeout_ = timeout;
@@ -370,16 +600,27 @@ void EthercatHardwareDiagnosticsPublisher::initialize(const string &interface, u
 
   // Initialize diagnostic data structures
   diagnostic_array_.status.reserve(slaves_.size() + 1);
-  values_.reserve(10);
 
-  ethernet_interface_info_.initialize(interface);
+  // Netlink statistics are sampled often, so NIC errors and link changes can be matched to dropped process data
+  static const double DEFAULT_INTERFACE_STATS_RATE = 100.0;
+  double interface_stats_rate = DEFAULT_INTERFACE_STATS_RATE;
+  node_.getParam("interface_stats_rate", interface_stats_rate);
+  ethernet_interface_info_.initialize(interface, std::max(0.0, interface_stats_rate));
+
+  publish_telemetry_ = publish_telemetry;
+  if (publish_telemetry_)
+  {
+    telemetry_.devices.resize(slaves_.size());
+    telemetry_publisher_ = node_.advertise<ethercat_hardware::EthercatTelemetry>("telemetry", 1);
+  }
 
   diagnostics_thread_ = boost::thread(boost::bind(&EthercatHardwareDiagnosticsPublisher::diagnosticsThreadFunc, this));
 }
 
 void EthercatHardwareDiagnosticsPublisher::publish(
          const unsigned char *buffer, 
-         const EthercatHardwareDiagnostics &diagnostics)
+         const EthercatHardwareDiagnostics &diagnostics,
+         bool telemetry_only)
 {
   boost::try_to_lock_t try_lock;
   boost::unique_lock<boost::mutex> lock(diagnostics_mutex_, try_lock);
@@ -390,6 +631,10 @@ void EthercatHardwareDiagnosticsPublisher::publish(
     diagnostics_ = diagnostics;
     // Trigger diagnostics publish thread
     diagnostics_ready_ = true;
+    if (!telemetry_only)
+    {
+      diagnostics_pending_ = true;
+    }
     diagnostics_cond_.notify_one();
   }
 }
@@ -410,7 +655,15 @@ void EthercatHardwareDiagnosticsPublisher::diagnosticsThreadFunc()
         diagnostics_cond_.wait(lock);
       }
       diagnostics_ready_ = false;
-      publishDiagnostics();
+      if (diagnostics_pending_)
+      {
+        diagnostics_pending_ = false;
+        publishDiagnostics();
+      }
+      if (publish_telemetry_)
+      {
+        publishTelemetry();
+      }
     }
   } catch (boost::thread_interrupted const&) {
     return;
@@ -418,35 +671,48 @@ void EthercatHardwareDiagnosticsPublisher::diagnosticsThreadFunc()
 }
 
 void EthercatHardwareDiagnosticsPublisher::timingInformation(
-        diagnostic_updater::DiagnosticStatusWrapper &status, 
-        const string &key, 
+        ethercat_hardware::DiagnosticsBuilder &status, 
+        const char *key, 
         const accumulator_set<double, stats<tag::max, tag::mean> > &acc,
         double max)
 {
-  status.addf(key + " Avg (us)",       "%5.4f", extract_result<tag::mean>(acc) * 1e6); // Average over last 1 second
-  status.addf(key + " 1 Sec Max (us)", "%5.4f", extract_result<tag::max>(acc) * 1e6);  // Max over last 1 second
-  status.addf(key + " Max (us)",       "%5.4f", max * 1e6);                            // Max since start
+  char name[128];
+  snprintf(name, sizeof(name), "%s Avg (us)", key);
+  status.addf(name, "%5.4f", extract_result<tag::mean>(acc) * 1e6); // Average over last 1 second
+  snprintf(name, sizeof(name), "%s 1 Sec Max (us)", key);
+  status.addf(name, "%5.4f", extract_result<tag::max>(acc) * 1e6);  // Max over last 1 second
+  snprintf(name, sizeof(name), "%s Max (us)", key);
+  status.addf(name, "%5.4f", max * 1e6);                            // Max since start
+}
+
+void EthercatHardwareDiagnosticsPublisher::latencyInformation(
+        ethercat_hardware::DiagnosticsBuilder &status, 
+        const char *key, 
+        const ethercat_hardware::MetricsHistogram &histogram)
+{
+  char name[128];
+  double avg = (histogram.count_ > 0) ? (double(histogram.total_ns_) / histogram.count_) : 0.0;
+  snprintf(name, sizeof(name), "%s Avg (us)", key);
+  status.addf(name, "%5.4f", avg * 1e-3);                          // Average since start
+  snprintf(name, sizeof(name), "%s Max (us)", key);
+  status.addf(name, "%5.4f", double(histogram.max_ns_) * 1e-3);    // Max since start
 }
 
 void EthercatHardwareDiagnosticsPublisher::publishDiagnostics()
 {  
   ros::Time now(ros::Time::now());
 
-  // Publish status of EtherCAT master
-  status_.clearSummary();
-  status_.clear();    
+  // Publish status of EtherCAT master.  
+  // Status messages from last publish are re-used, only values that changed get copied.
+  status_.begin();
+  status_.beginStatus();
 
-  status_.name = "EtherCAT Master";
+  status_.setName("EtherCAT Master");
   if (diagnostics_.motors_halted_)
   {
-    std::ostringstream desc;
-    desc << "Motors halted";
-    if (diagnostics_.halt_after_reset_)
-    {
-      desc << " soon after reset";
-    }
-    desc << " (" << diagnostics_.motors_halted_reason_ << ")";
-    status_.summary(status_.ERROR, desc.str());      
+    status_.summaryf(status_.ERROR, "Motors halted%s (%s)", 
+                     diagnostics_.halt_after_reset_ ? " soon after reset" : "",
+                     diagnostics_.motors_halted_reason_);
   } else {
     status_.summary(status_.OK, "OK");
   }
@@ -459,11 +725,41 @@ void EthercatHardwareDiagnosticsPublisher::publishDiagnostics()
   status_.add("Motors halted", diagnostics_.motors_halted_ ? "true" : "false");
   status_.addf("EtherCAT devices (expected)", "%d", num_ethercat_devices_); 
   status_.addf("EtherCAT devices (current)",  "%d", diagnostics_.device_count_); 
-  ethernet_interface_info_.publishDiagnostics(status_);
+  ethernet_interface_info_.publishDiagnostics(status_, diagnostics_.drop_times_, diagnostics_.txandrx_errors_, 
+                                              diagnostics_.MAX_DROP_TIMES);
   //status_.addf("Reset state", "%d", reset_state_);
 
+  if (diagnostics_.auto_timeout_ && (diagnostics_.timeout_tuning_.tunings_ > 0))
+  {
+    timeout_ = diagnostics_.timeout_tuning_.timeout_us_;
+    max_pd_retries_ = diagnostics_.timeout_tuning_.retries_;
+  }
   status_.addf("Timeout (us)", "%d", timeout_);
   status_.addf("Max PD Retries", "%d", max_pd_retries_);
+  if (diagnostics_.auto_timeout_)
+  {
+    const ethercat_hardware::TimeoutTuning &t(diagnostics_.timeout_tuning_);
+    status_.add("Timeout Tuning", (t.tunings_ > 0) ? "Auto" : "Auto (measuring)");
+    status_.addf("Timeout Tunings", "%u", t.tunings_);
+    status_.addf("PD RTT Samples", "%llu", (unsigned long long)t.samples_);
+    status_.addf("PD RTT Late Samples", "%llu", (unsigned long long)t.late_samples_);
+    status_.addf("PD RTT Median (us)", "%u", t.p50_us_);
+    status_.addf("PD RTT 99.9% (us)", "%u", t.p999_us_);
+    status_.addf("PD RTT 99.99% (us)", "%u", t.p9999_us_);
+  }
+
+  if (diagnostics_.topology_.measurements_ > 0)
+  {
+    const ethercat_hardware::TopologySummary &t(diagnostics_.topology_);
+    status_.add("Chain Topology", t.valid_ ? "Valid" : "Measurement Failed");
+    status_.addf("Chain Round Trip (ns)", "%u", t.round_trip_ns_);
+    status_.addf("Max Hop Delay (ns)", "%u", t.max_hop_delay_ns_);
+    status_.addf("Max Hop Delay Device", "%u", t.max_hop_position_);
+    status_.addf("Max Hop Delay Increase (ns)", "%u", t.max_hop_increase_ns_);
+    status_.addf("Max Hop Delay Increase Device", "%u", t.max_increase_position_);
+    status_.addf("Chain Topology Changes", "%u", t.changes_);
+    status_.addf("Chain Topology Failures", "%u", t.failures_);
+  }
 
   // Produce warning if number of devices changed after device initalization
   if (num_ethercat_devices_ != diagnostics_.device_count_) {
@@ -513,6 +809,42 @@ void EthercatHardwareDiagnosticsPublisher::publishDiagnostics()
     }
     status_.addf("RX Late Packet Avg RTT", "%f", rx_late_pkt_rtt_us_avg);
 
+    if (diagnostics_.packet_mmap_)
+    {
+      const ethercat_hardware::PacketMmapStats &s(diagnostics_.packet_mmap_stats_);
+      status_.addf("Early Resends",       "%llu", (unsigned long long)s.resends_);
+      status_.addf("Resend Duplicates",   "%llu", (unsigned long long)s.duplicates_);
+      status_.addf("Expected RTT (us)",   "%u", s.expected_rtt_us_);
+      status_.addf("Resend After (us)",   "%u", s.resend_after_us_);
+      status_.addf("Redundant Frames Sent", "%llu", (unsigned long long)s.redundant_sent_);
+      status_.addf("Redundant Frames Used", "%llu", (unsigned long long)s.redundant_used_);
+      status_.addf("Invalid Replies Skipped", "%llu", (unsigned long long)s.invalid_replies_);
+      if (s.wire_.count_ > 0)
+      {
+        status_.add("Timestamps", s.hardware_timestamps_ ? "Hardware" : "Software");
+        latencyInformation(status_, "Host send latency", s.host_send_);
+        latencyInformation(status_, "Wire latency", s.wire_);
+        latencyInformation(status_, "Host wake latency", s.host_wake_);
+        status_.addf("Frames Without TX Timestamp", "%llu", (unsigned long long)s.timestamps_missing_);
+      }
+    }
+
+    if (diagnostics_.multi_chain_)
+    {
+      const ethercat_hardware::MultiChainStats &m(diagnostics_.multi_chain_stats_);
+      status_.addf("Chains", "%u", m.num_chains_);
+      status_.addf("Parallel Process Data Frames", "%llu", (unsigned long long)m.process_data_frames_);
+      status_.addf("Forwarded Frames", "%llu", (unsigned long long)m.forwarded_frames_);
+      for (unsigned i = 0; i < m.num_chains_; ++i)
+      {
+        char name[64];
+        snprintf(name, sizeof(name), "Chain %u Retries", i);
+        status_.addf(name, "%llu", (unsigned long long)m.chain_retries_[i]);
+        snprintf(name, sizeof(name), "Chain %u Failures", i);
+        status_.addf(name, "%llu", (unsigned long long)m.chain_failures_[i]);
+      }
+    }
+
     // Check for newly dropped packets
     if (c->dropped > last_dropped_packet_count_)
     {
@@ -527,32 +859,71 @@ void EthercatHardwareDiagnosticsPublisher::publishDiagnostics()
     status_.mergeSummaryf(status_.WARN, "Dropped packets in last %d seconds", dropped_packet_warning_hold_time_);
   }
 
-  diagnostic_array_.status.clear();
-  diagnostic_array_.status.push_back(status_);
+  ethercat_hardware::PublisherExecutor::instance()->publishDiagnostics(status_);
 
   // Also, collect diagnostic statuses of all EtherCAT device
-  unsigned char *current = diagnostics_buffer_;
   for (unsigned int s = 0; s < slaves_.size(); ++s)
   {
-    slaves_[s]->multiDiagnostics(diagnostic_array_.status, current);
-    current += slaves_[s]->command_size_ + slaves_[s]->status_size_;
+    slaves_[s]->multiDiagnostics(status_, diagnostics_buffer_ + layout_.offset(s));
   }
+  status_.end();
 
   // Publish status of each EtherCAT device
   diagnostic_array_.header.stamp = ros::Time::now();
   publisher_.publish(diagnostic_array_);
 }
 
+void EthercatHardwareDiagnosticsPublisher::publishTelemetry()
+{
+  ethercat_hardware::EthercatTelemetry &t(telemetry_);
+  t.stamp = ros::Time::now();
+  t.motors_halted = diagnostics_.motors_halted_;
+  t.input_thread_is_stopped = diagnostics_.input_thread_is_stopped_;
+  t.expected_device_count = num_ethercat_devices_;
+  t.device_count = diagnostics_.device_count_;
+  t.txandrx_errors = diagnostics_.txandrx_errors_;
+  t.halt_motors_error_count = diagnostics_.halt_motors_error_count_;
+
+  t.roundtrip_avg = extract_result<tag::mean>(diagnostics_.txandrx_acc_);
+  t.roundtrip_max = extract_result<tag::max>(diagnostics_.txandrx_acc_);
+  t.roundtrip_max_since_start = std::max(diagnostics_.max_txandrx_, t.roundtrip_max);
+
+  const struct netif_counters &c(diagnostics_.counters_);
+  t.sent_packets          = c.sent;
+  t.received_packets      = c.received;
+  t.collected_packets     = c.collected;
+  t.dropped_packets       = c.dropped;
+  t.tx_errors             = c.tx_error;
+  t.tx_net_down           = c.tx_net_down;
+  t.tx_would_block        = c.tx_would_block;
+  t.tx_no_buffers         = c.tx_no_bufs;
+  t.tx_queue_full         = c.tx_full;
+  t.rx_runt_packets       = c.rx_runt_pkt;
+  t.rx_not_ethercat       = c.rx_not_ecat;
+  t.rx_other_eml          = c.rx_other_eml;
+  t.rx_bad_index          = c.rx_bad_index;
+  t.rx_bad_sequence       = c.rx_bad_seqnum;
+  t.rx_duplicate_sequence = c.rx_dup_seqnum;
+  t.rx_duplicate_packets  = c.rx_dup_pkt;
+  t.rx_bad_order          = c.rx_bad_order;
+  t.rx_late_packets       = c.rx_late_pkt;
+
+  unsigned num_publishers;
+  ethercat_hardware::PublisherExecutor::instance()->getCounts(num_publishers, t.published_messages, t.dropped_messages);
+
+  for (unsigned int s = 0; s < slaves_.size(); ++s)
+  {
+    slaves_[s]->telemetry(t.devices[s]);
+  }
+
+  telemetry_publisher_.publish(t);
+}
+
 void EthercatHardware::update(bool reset, bool halt)
 {
   // Update current time
   ros::Time update_start_time(ros::Time::now());
 
-  unsigned char *this_buffer, *prev_buffer;
-
-  // Convert HW Interface commands to MCB-specific buffers
-  this_buffer = this_buffer_;
-
   if (halt)
   {
     ++diagnostics_.halt_motors_service_count_;
@@ -584,19 +955,26 @@ void EthercatHardware::update(bool reset, bool halt)
     // Pack the command structures into the EtherCAT buffer
     // Disable the motor if they are halted or coming out of reset
     bool halt_device = halt_motors_ || ((s*CYCLES_PER_HALT_RELEASE+1) < reset_state_);
-    slaves_[s]->packCommand(this_buffer, halt_device, reset_devices);
-    this_buffer += slaves_[s]->command_size_ + slaves_[s]->status_size_;
+    slaves_[s]->packCommand(this_buffer_ + layout_.offset(s), halt_device, reset_devices);
   }
 
   // Transmit process data
   ros::Time txandrx_start_time(ros::Time::now()); // Also end time for pack_command_stage
   diagnostics_.pack_command_acc_((txandrx_start_time-update_start_time).toSec());
+  if (metrics_segment_.isOpen())
+  {
+    metrics_.pack_command_.record((txandrx_start_time-update_start_time).toSec());
+  }
 
   // Send/receive device proccess data
   bool success = txandrx_PD(buffer_size_, this_buffer_, max_pd_retries_);
 
   ros::Time txandrx_end_time(ros::Time::now());  // Also begining of unpack_state 
   diagnostics_.txandrx_acc_((txandrx_end_time - txandrx_start_time).toSec());
+  if (metrics_segment_.isOpen())
+  {
+    metrics_.txandrx_.record((txandrx_end_time - txandrx_start_time).toSec());
+  }
 
   hw_->current_time_ = txandrx_end_time;
 
@@ -609,16 +987,13 @@ void EthercatHardware::update(bool reset, bool halt)
   else
   {
     // Convert status back to HW Interface
-    this_buffer = this_buffer_;
-    prev_buffer = prev_buffer_;
     for (unsigned int s = 0; s < slaves_.size(); ++s)
     {
-      if (!slaves_[s]->unpackState(this_buffer, prev_buffer) && !reset_devices)
+      unsigned offset = layout_.offset(s);
+      if (!slaves_[s]->unpackState(this_buffer_ + offset, prev_buffer_ + offset) && !reset_devices)
       {
         haltMotors(true /*error*/, "device error");
       }
-      this_buffer += slaves_[s]->command_size_ + slaves_[s]->status_size_;
-      prev_buffer += slaves_[s]->command_size_ + slaves_[s]->status_size_;
     }
     
     if (reset_state_)
@@ -634,25 +1009,95 @@ void EthercatHardware::update(bool reset, bool halt)
   {
     unpack_end_time = ros::Time::now();  // also start of publish time                            
     diagnostics_.unpack_state_acc_((unpack_end_time - txandrx_end_time).toSec());
+    if (metrics_segment_.isOpen())
+    {
+      metrics_.unpack_state_.record((unpack_end_time - txandrx_end_time).toSec());
+    }
   }
 
   if ((update_start_time - last_published_) > ros::Duration(1.0))
   {
     last_published_ = update_start_time;
+    last_telemetry_published_ = update_start_time;
     publishDiagnostics();
     motor_publisher_.lock();
     motor_publisher_.msg_.data = halt_motors_;
     motor_publisher_.unlockAndPublish();
   }
+  else if (!telemetry_period_.isZero() && ((update_start_time - last_telemetry_published_) > telemetry_period_))
+  {
+    last_telemetry_published_ = update_start_time;
+    publishTelemetry();
+  }
 
   if (diagnostics_.collect_extra_timing_)
   {
     ros::Time publish_end_time(ros::Time::now());  
     diagnostics_.publish_acc_((publish_end_time - unpack_end_time).toSec());
+    if (metrics_segment_.isOpen())
+    {
+      metrics_.publish_.record((publish_end_time - unpack_end_time).toSec());
+    }
+  }
+
+  if (metrics_segment_.isOpen())
+  {
+    updateMetrics(update_start_time);
   }
 }
 
 
+void EthercatHardware::updateMetrics(const ros::Time &update_start_time)
+{
+  ethercat_hardware::MasterMetrics &m(metrics_);
+  ++m.cycle_count_;
+  m.update_time_ns_ = update_start_time.toNSec();
+
+  // Input thread updates counters without locking, copy them one at a time
+  const struct netif_counters &c(ni_->counters);
+  m.sent_           = c.sent;
+  m.received_       = c.received;
+  m.collected_      = c.collected;
+  m.dropped_        = c.dropped;
+  m.tx_error_       = c.tx_error;
+  m.tx_net_down_    = c.tx_net_down;
+  m.tx_would_block_ = c.tx_would_block;
+  m.tx_no_bufs_     = c.tx_no_bufs;
+  m.tx_full_        = c.tx_full;
+  m.rx_runt_pkt_    = c.rx_runt_pkt;
+  m.rx_not_ecat_    = c.rx_not_ecat;
+  m.rx_other_eml_   = c.rx_other_eml;
+  m.rx_bad_index_   = c.rx_bad_index;
+  m.rx_bad_seqnum_  = c.rx_bad_seqnum;
+  m.rx_dup_seqnum_  = c.rx_dup_seqnum;
+  m.rx_dup_pkt_     = c.rx_dup_pkt;
+  m.rx_bad_order_   = c.rx_bad_order;
+  m.rx_late_pkt_    = c.rx_late_pkt;
+
+  m.txandrx_errors_             = diagnostics_.txandrx_errors_;
+  m.halt_motors_error_count_    = diagnostics_.halt_motors_error_count_;
+  m.halt_motors_service_count_  = diagnostics_.halt_motors_service_count_;
+  m.reset_motors_service_count_ = diagnostics_.reset_motors_service_count_;
+  m.motors_halted_              = halt_motors_;
+
+  if (packet_mmap_)
+  {
+    ethercat_hardware::PacketMmapStats stats;
+    ethercat_hardware::getPacketMmapStats(chain_nis_[0], stats);
+    m.host_send_ = stats.host_send_;
+    m.wire_      = stats.wire_;
+    m.host_wake_ = stats.host_wake_;
+  }
+
+  for (unsigned s = 0; s < slaves_.size(); ++s)
+  {
+    slaves_[s]->metrics(device_metrics_[s]);
+  }
+
+  metrics_segment_.write(m, device_metrics_.empty() ? NULL : &device_metrics_[0]);
+}
+
+
 void EthercatHardware::haltMotors(bool error, const char* reason)
 {
   if (!halt_motors_)
@@ -684,6 +1129,38 @@ void EthercatHardware::updateAccMax(double &max, const accumulator_set<double, s
   max = std::max(max, extract_result<tag::max>(acc));
 }
 
+void EthercatHardware::copyInputThreadCounters()
+{
+  // Grab stats and counters from input thread
+  diagnostics_.counters_ = ni_->counters;
+  diagnostics_.input_thread_is_stopped_ = bool(ni_->is_stopped);
+  diagnostics_.packet_mmap_ = packet_mmap_;
+  diagnostics_.auto_timeout_ = auto_timeout_;
+  if (auto_timeout_)
+  {
+    diagnostics_.timeout_tuning_ = timeout_tuner_.tuning();
+  }
+  if (packet_mmap_)
+  {
+    // With several chains, only first chain's transport statistics are shown
+    ethercat_hardware::getPacketMmapStats(chain_nis_[0], diagnostics_.packet_mmap_stats_);
+  }
+  diagnostics_.multi_chain_ = chain_nis_.size() > 1;
+  if (diagnostics_.multi_chain_)
+  {
+    ethercat_hardware::getMultiChainStats(ni_, diagnostics_.multi_chain_stats_);
+  }
+  topology_snapshot_.read(diagnostics_.topology_);
+
+  diagnostics_.motors_halted_ = halt_motors_;
+}
+
+void EthercatHardware::publishTelemetry()
+{
+  copyInputThreadCounters();
+  diagnostics_publisher_.publish(this_buffer_, diagnostics_, true /*telemetry only*/);
+}
+
 void EthercatHardware::publishDiagnostics()
 {
   // Update max timing values
@@ -692,11 +1169,7 @@ void EthercatHardware::publishDiagnostics()
   updateAccMax(diagnostics_.max_unpack_state_, diagnostics_.unpack_state_acc_);
   updateAccMax(diagnostics_.max_publish_,      diagnostics_.publish_acc_);
 
-  // Grab stats and counters from input thread
-  diagnostics_.counters_ = ni_->counters;
-  diagnostics_.input_thread_is_stopped_ = bool(ni_->is_stopped);
-
-  diagnostics_.motors_halted_ = halt_motors_;
+  copyInputThreadCounters();
 
   // Pass diagnostic data to publisher thread
   diagnostics_publisher_.publish(this_buffer_, diagnostics_);
@@ -710,65 +1183,106 @@ void EthercatHardware::publishDiagnostics()
 }
 
 
+/*!
+ * \brief Builds map of EtherCAT product code to device driver class name.
+ *
+ * The point of this code to find a class whose name matches the EtherCAT
+ * product ID for a given device.  
+ * Thus device plugins would register themselves with PLUGIN_REGISTER_CLASS
+ *
+ *    PLUGINLIB_EXPORT_CLASS(class_type, base_class_type)
+ *
+ * and in the plugin.xml, specify name="" inside the <class> tag:
+ *
+ *    <class name="package/serial"
+ *           base_class_type="ethercat_hardware::EthercatDevice" />
+ *
+ * 
+ * For the WG05 driver (productID = 6805005), this statement would look
+ * something like:
+ *
+ *    PLUGINLIB_EXPORT_CLASS(WG05, EthercatDevice)
+ *
+ * and in the plugin.xml:
+ *
+ *    <class name="ethercat_hardware/6805005" type="WG05"
+ *           base_class_type="EthercatDevice">
+ *      <description>
+ *        WG05 - Generic Motor Control Board
+ *      </description>
+ *    </class>
+ *
+ *
+ * Unfortunately, we don't know which ROS package that a particular driver is defined in.
+ * To account for this, the list of declared classes is scanned once, and every class name 
+ * whose last part is a decimal number is entered into map under that product code.
+ *
+ * Afterwards, plugin libraries needed by devices on chain are loaded up-front, 
+ * so each library is only loaded once and problems are reported before any device is configured.
+ */
+void EthercatHardware::buildDeviceClassMap(const std::vector<EtherCAT_SlaveHandler*> &slave_handles)
+{
+  device_classes_.clear();
+  BOOST_FOREACH(const std::string &class_name, device_loader_.getDeclaredClasses())
+  {
+    size_t start = class_name.rfind('/');
+    start = (start == std::string::npos) ? 0 : start+1;
+    if ((start == class_name.size()) || 
+        (class_name.find_first_not_of("0123456789", start) != std::string::npos))
+    {
+      continue;
+    }
+
+    unsigned product_code = strtoul(class_name.c_str()+start, NULL, 10);
+    std::map<unsigned, std::string>::iterator it = device_classes_.find(product_code);
+    if (it != device_classes_.end())
+    {
+      ROS_ERROR("Found more than 1 EtherCAT driver for device with product code : %d", product_code);
+      ROS_ERROR("First class name = '%s'.  Second class name = '%s'",
+                it->second.c_str(), class_name.c_str());
+    }
+    device_classes_[product_code] = class_name;
+  }
+
+  std::set<std::string> needed_classes;
+  BOOST_FOREACH(EtherCAT_SlaveHandler *sh, slave_handles)
+  {
+    std::map<unsigned, std::string>::const_iterator it = device_classes_.find(sh->get_product_code());
+    if (it != device_classes_.end())
+    {
+      needed_classes.insert(it->second);
+    }
+  }
+
+  BOOST_FOREACH(const std::string &class_name, needed_classes)
+  {
+    try {
+      device_loader_.loadLibraryForClass(class_name);
+    }
+    catch (pluginlib::PluginlibException &e)
+    {
+      // Error is reported again with slave details when device is configured
+      ROS_ERROR("Unable to preload plugin library for class '%s' : %s", class_name.c_str(), e.what());
+    }
+  }
+}
+
+
 boost::shared_ptr<EthercatDevice>
 EthercatHardware::configSlave(EtherCAT_SlaveHandler *sh)
 {
-  static int start_address = 0x00010000;
   boost::shared_ptr<EthercatDevice> p;
   unsigned product_code = sh->get_product_code();
   unsigned serial = sh->get_serial();
   uint32_t revision = sh->get_revision();
   unsigned slave = sh->get_station_address()-1;
 
-  // The point of this code to find a class whose name matches the EtherCAT
-  // product ID for a given device.  
-  // Thus device plugins would register themselves with PLUGIN_REGISTER_CLASS
-  //
-  //    PLUGINLIB_EXPORT_CLASS(class_type, base_class_type)
-  //
-  // and in the plugin.xml, specify name="" inside the <class> tag:
-  //
-  //    <class name="package/serial"
-  //           base_class_type="ethercat_hardware::EthercatDevice" />
-  //
-  // 
-  // For the WG05 driver (productID = 6805005), this statement would look
-  // something like:
-  //
-  //    PLUGINLIB_EXPORT_CLASS(WG05, EthercatDevice)
-  //
-  // and in the plugin.xml:
-  //
-  //    <class name="ethercat_hardware/6805005" type="WG05"
-  //           base_class_type="EthercatDevice">
-  //      <description>
-  //        WG05 - Generic Motor Control Board
-  //      </description>
-  //    </class>
-  //
-  //
-  // Unfortunately, we don't know which ROS package that a particular driver is defined in.
-  // To account for this, we search through the list of class names, one-by-one and find string where
-  // last part of string matches product ID of device.  
-  stringstream class_name_regex_str;
-  class_name_regex_str << "(.*/)?" << product_code;
-  boost::regex class_name_regex(class_name_regex_str.str(), boost::regex::extended);
-
-  std::vector<std::string> classes = device_loader_.getDeclaredClasses();
+  // Driver class is found using map built by buildDeviceClassMap()
   std::string matching_class_name;
-
-  BOOST_FOREACH(const std::string &class_name, classes)
+  std::map<unsigned, std::string>::const_iterator it = device_classes_.find(product_code);
+  if (it != device_classes_.end())
   {
-    if (regex_match(class_name, class_name_regex))
-    {
-      if (matching_class_name.size() != 0)
-      {
-        ROS_ERROR("Found more than 1 EtherCAT driver for device with product code : %d", product_code);
-        ROS_ERROR("First class name = '%s'.  Second class name = '%s'",
-                  class_name.c_str(), matching_class_name.c_str());
-      }
-      matching_class_name = class_name;
-    }
+    matching_class_name = it->second;
   }
 
   if (matching_class_name.size() != 0)
@@ -798,7 +1312,7 @@ EthercatHardware::configSlave(EtherCAT_SlaveHandler *sh)
       ROS_ERROR("Unable to load plugin for slave #%d, product code: %u (0x%X), serial: %u (0x%X), revision: %d (0x%X)",
                 slave, product_code, product_code, serial, serial, revision, revision);
       ROS_ERROR("Possible classes:");
-      BOOST_FOREACH(const std::string &class_name, classes)
+      BOOST_FOREACH(const std::string &class_name, device_loader_.getDeclaredClasses())
       {
         ROS_ERROR("  %s", class_name.c_str());
       }
@@ -810,7 +1324,12 @@ EthercatHardware::configSlave(EtherCAT_SlaveHandler *sh)
 
   if (p != NULL)
   {
+    int start_address = layout_.nextAddress();
     p->construct(sh, start_address);
+    if (!layout_.addDevice(start_address, p->command_size_, p->status_size_))
+    {
+      p.reset();
+    }
   }
 
   return p;
@@ -910,6 +1429,7 @@ void EthercatHardware::loadNonEthercatDevices()
     if (new_device != NULL)
     {
       slaves_.push_back(new_device);
+      layout_.addEmptyDevice();
     }
   }
 }
@@ -946,6 +1466,44 @@ void EthercatHardware::collectDiagnostics()
     boost::shared_ptr<EthercatDevice> d(slaves_[i]);
     d->collectDiagnostics(oob_com_);
   }
+
+  if (!topology_period_.isZero() && ((ros::Time::now() - last_topology_) > topology_period_))
+  {
+    measureTopology();
+  }
+}
+
+
+void EthercatHardware::measureTopology()
+{
+  std::vector<EtherCAT_SlaveHandler*> slave_handles;
+  for (unsigned i = 0; i < slaves_.size(); ++i)
+  {
+    if (slaves_[i]->sh_ != NULL)
+    {
+      slave_handles.push_back(slaves_[i]->sh_);
+    }
+  }
+
+  bool was_valid = topology_.summary().valid_;
+  uint32_t changes = topology_.summary().changes_;
+  if (!topology_.measure(oob_com_, slave_handles))
+  {
+    if (was_valid || (topology_.summary().measurements_ == 1))
+    {
+      ROS_WARN("Unable to measure EtherCAT chain topology");
+    }
+  }
+  else if (topology_.summary().changes_ != changes)
+  {
+    ROS_WARN("EtherCAT chain topology changed");
+  }
+  last_topology_ = ros::Time::now();
+  topology_snapshot_.write(topology_.summary());
+
+  ethercat_hardware::ChainTopology msg;
+  topology_.fillMessage(msg);
+  topology_publisher_.publish(msg);
 }
 
 
@@ -981,17 +1539,85 @@ bool EthercatHardware::txandrx_PD(unsigned buffer_size, unsigned char* buffer, u
   bool success = false;
   for (unsigned i=0; i<tries && !success; ++i) {
     // Try transmitting process data
+    setProcessData(true);
+    ros::Time start(auto_timeout_ ? ros::Time::now() : ros::Time());
     success = em_->txandrx_PD(buffer_size_, this_buffer_);
+    if (auto_timeout_ && success)
+      timeout_tuner_.recordRtt((ros::Time::now() - start).toNSec() / 1000);
+    setProcessData(false);
     if (!success) {
+      diagnostics_.drop_times_[diagnostics_.txandrx_errors_ % diagnostics_.MAX_DROP_TIMES] = ros::Time::now();
       ++diagnostics_.txandrx_errors_;
     } 
     // Transmit new OOB data
     oob_com_->tx();
   }
+  if (auto_timeout_)
+    tuneTimeout();
   return success;
 }
 
 
+void EthercatHardware::setProcessData(bool process_data)
+{
+  if (packet_mmap_)
+  {
+    for (unsigned i = 0; i < chain_nis_.size(); ++i)
+    {
+      ethercat_hardware::setPacketMmapProcessData(chain_nis_[i], process_data);
+    }
+  }
+  if (chain_nis_.size() > 1)
+  {
+    ethercat_hardware::setMultiChainProcessData(ni_, process_data);
+  }
+}
+
+
+//! Timeout applies to each chain on its own
+int EthercatHardware::setNetifTimeout(unsigned timeout)
+{
+  int error = 0;
+  for (unsigned i = 0; i < chain_nis_.size(); ++i)
+  {
+    struct netif *ni = chain_nis_[i];
+    int result = packet_mmap_ ? ethercat_hardware::setPacketMmapTimeout(ni, timeout) : set_socket_timeout(ni, timeout);
+    if (result != 0)
+    {
+      error = result;
+    }
+  }
+  return error;
+}
+
+
+/*!
+ * \brief Applies timeout and retries picked by timeout_tuner_, once it has enough samples.
+ *
+ * Packets that return after timeout are recorded too, when interface measured their RTT.
+ */
+void EthercatHardware::tuneTimeout()
+{
+  const struct netif_counters &c(ni_->counters);
+  // Late packet count alone is not enough : RTT is only known when interface measured it
+  if (c.rx_late_pkt_rtt_us_sum != last_late_pkt_rtt_sum_)
+  {
+    last_late_pkt_rtt_sum_ = c.rx_late_pkt_rtt_us_sum;
+    timeout_tuner_.recordLateRtt(c.rx_late_pkt_rtt_us);
+  }
+
+  unsigned timeout, retries;
+  if (timeout_tuner_.update(timeout, retries))
+  {
+    if (setNetifTimeout(timeout) == 0)
+    {
+      timeout_ = timeout;
+      max_pd_retries_ = retries;
+    }
+  }
+}
+
+
 bool EthercatHardware::publishTrace(int position, const string &reason, unsigned level, unsigned delay)
 {
   if (position >= (int)slaves_.size())
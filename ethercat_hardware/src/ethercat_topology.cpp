@@ -0,0 +1,385 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/ethercat_topology.h"
+#include "ethercat_hardware/ethercat_device.h"
+
+#include <dll/ethercat_device_addressed_telegram.h>
+#include <dll/ethercat_frame.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+namespace ethercat_hardware
+{
+
+
+//! Order that frame passes through ports of an ESC
+static const unsigned PORT_ORDER[TopologyNode::NUM_PORTS] = {0, 3, 1, 2};
+
+//! Port receive time registers, starting at EthercatTopology::RECEIVE_TIME_ADDR
+struct ReceiveTimes
+{
+  uint32_t time_[TopologyNode::NUM_PORTS];
+} __attribute__ ((__packed__));
+
+//! Upstream device whose open ports have not all been assigned a child yet
+struct Branch
+{
+  unsigned node_;
+  unsigned next_;  //!< index into PORT_ORDER of next port to look for child on
+};
+
+//! Difference of two ESC times, handles wrap of 32bit clock
+static inline int32_t timeDiff(uint32_t later, uint32_t earlier)
+{
+  return int32_t(later - earlier);
+}
+
+//! Returns last open port that frame passes before it leaves device through port 0 
+static unsigned lastOpenPort(const TopologyNode &node)
+{
+  unsigned last = 0;
+  for (unsigned i = 1; i < TopologyNode::NUM_PORTS; ++i)
+  {
+    if (node.isOpen(PORT_ORDER[i]))
+    {
+      last = PORT_ORDER[i];
+    }
+  }
+  return last;
+}
+
+
+TopologyNode::TopologyNode() :
+  station_address_(0),
+  valid_(false),
+  open_ports_(0),
+  parent_(-1),
+  parent_port_(0),
+  hop_delay_ns_(0),
+  delay_ns_(0)
+{
+  memset(receive_time_, 0, sizeof(receive_time_));
+}
+
+
+TopologySummary::TopologySummary() :
+  measurements_(0),
+  failures_(0),
+  changes_(0),
+  valid_(false),
+  round_trip_ns_(0),
+  max_hop_delay_ns_(0),
+  max_hop_position_(0),
+  max_hop_increase_ns_(0),
+  max_increase_position_(0)
+{
+
+}
+
+
+EthercatTopology::EthercatTopology()
+{
+
+}
+
+
+bool EthercatTopology::measure(EthercatCom *com, const std::vector<EtherCAT_SlaveHandler*> &slave_handles)
+{
+  std::vector<TopologyNode> nodes;
+  bool valid = readRegisters(com, slave_handles, nodes) && buildGraph(nodes);
+  updateSummary(valid, nodes);
+  return valid;
+}
+
+
+bool EthercatTopology::readRegisters(EthercatCom *com, const std::vector<EtherCAT_SlaveHandler*> &slave_handles,
+                                     std::vector<TopologyNode> &nodes)
+{
+  EC_Logic *logic = EC_Logic::instance();
+
+  // Any write to receive time register of port 0 makes every ESC latch 
+  // its local time as the frame passes each of its ports
+  uint32_t latch = 0;
+  BWR_Telegram bwr_telegram(logic->get_idx(), 
+                            0,                 // Broadcast address
+                            RECEIVE_TIME_ADDR, // ESC physical memory address
+                            logic->get_wkc(), 
+                            sizeof(latch), 
+                            (unsigned char*) &latch);
+  EC_Ethernet_Frame bwr_frame(&bwr_telegram);
+  if (!com->txandrx(&bwr_frame))
+  {
+    return false;
+  }
+  // Times of devices that missed the latch would be meaningless
+  if (bwr_telegram.get_wkc() != slave_handles.size())
+  {
+    return false;
+  }
+
+  nodes.assign(slave_handles.size(), TopologyNode());
+  std::vector<ReceiveTimes> times(slave_handles.size());
+  std::vector<et1x00_dl_status> status(slave_handles.size());
+  for (unsigned first = 0; first < slave_handles.size(); first += SLAVES_PER_FRAME)
+  {
+    unsigned last = std::min(first + SLAVES_PER_FRAME, unsigned(slave_handles.size()));
+    std::vector<boost::shared_ptr<NPRD_Telegram> > telegrams;
+    for (unsigned i = first; i < last; ++i)
+    {
+      memset(&times[i], 0, sizeof(times[i]));
+      memset(&status[i], 0, sizeof(status[i]));
+      uint16_t station_address = slave_handles[i]->get_station_address();
+      telegrams.push_back(boost::shared_ptr<NPRD_Telegram>(
+                             new NPRD_Telegram(logic->get_idx(), 
+                                               station_address,
+                                               RECEIVE_TIME_ADDR, 
+                                               logic->get_wkc(), 
+                                               sizeof(times[i]), 
+                                               (unsigned char*) &times[i])));
+      telegrams.push_back(boost::shared_ptr<NPRD_Telegram>(
+                             new NPRD_Telegram(logic->get_idx(), 
+                                               station_address,
+                                               et1x00_dl_status::BASE_ADDR, 
+                                               logic->get_wkc(), 
+                                               sizeof(status[i]), 
+                                               (unsigned char*) &status[i])));
+    }
+    for (unsigned j = 1; j < telegrams.size(); ++j)
+    {
+      telegrams[j-1]->attach(telegrams[j].get());
+    }
+
+    EC_Ethernet_Frame frame(telegrams.front().get());
+    if (!com->txandrx(&frame))
+    {
+      return false;
+    }
+
+    for (unsigned i = first; i < last; ++i)
+    {
+      TopologyNode &node(nodes[i]);
+      unsigned j = 2 * (i - first);
+      node.station_address_ = slave_handles[i]->get_station_address();
+      node.valid_ = (telegrams[j]->get_wkc() == 1) && (telegrams[j+1]->get_wkc() == 1);
+      for (unsigned port = 0; port < TopologyNode::NUM_PORTS; ++port)
+      {
+        node.receive_time_[port] = times[i].time_[port];
+        if (status[i].hasLink(port) && status[i].hasCommunication(port) && !status[i].isClosed(port))
+        {
+          node.open_ports_ |= (1<<port);
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+
+bool EthercatTopology::buildGraph(std::vector<TopologyNode> &nodes)
+{
+  // Frame returns through ports in reverse order, so open branches behave like a stack
+  std::vector<Branch> branches;
+
+  for (unsigned i = 0; i < nodes.size(); ++i)
+  {
+    TopologyNode &node(nodes[i]);
+    if (!node.valid_)
+    {
+      return false;
+    }
+    node.parent_ = -1;
+    node.parent_port_ = 0;
+    node.hop_delay_ns_ = 0;
+    node.delay_ns_ = 0;
+
+    if (i > 0)
+    {
+      // Find nearest upstream device with an unused open port
+      unsigned order = TopologyNode::NUM_PORTS;
+      while (!branches.empty())
+      {
+        Branch &b(branches.back());
+        for (order = b.next_; order < TopologyNode::NUM_PORTS; ++order)
+        {
+          if (nodes[b.node_].isOpen(PORT_ORDER[order]))
+            break;
+        }
+        if (order < TopologyNode::NUM_PORTS)
+          break;
+        branches.pop_back();
+      }
+      if (branches.empty())
+      {
+        return false;
+      }
+
+      Branch &b(branches.back());
+      const TopologyNode &parent(nodes[b.node_]);
+      unsigned port = PORT_ORDER[order];
+      b.next_ = order + 1;
+
+      // Port that frame left parent through before it was sent to this branch
+      unsigned prev = 0;
+      for (unsigned k = 1; k < order; ++k)
+      {
+        if (parent.isOpen(PORT_ORDER[k]))
+          prev = PORT_ORDER[k];
+      }
+
+      // Round trip through link and everything behind it, minus time spent behind it
+      int32_t branch_time = timeDiff(parent.receive_time_[port], parent.receive_time_[prev]);
+      int32_t behind_time = timeDiff(node.receive_time_[lastOpenPort(node)], node.receive_time_[0]);
+      int32_t hop = std::max(int32_t(0), branch_time - behind_time) / 2;
+      int32_t before = std::max(int32_t(0), timeDiff(parent.receive_time_[prev], parent.receive_time_[0]));
+
+      node.parent_ = b.node_;
+      node.parent_port_ = port;
+      node.hop_delay_ns_ = hop;
+      node.delay_ns_ = parent.delay_ns_ + before + hop;
+    }
+
+    Branch branch = {i, 1};
+    branches.push_back(branch);
+  }
+
+  return true;
+}
+
+
+bool EthercatTopology::sameGraph(const std::vector<TopologyNode> &a, const std::vector<TopologyNode> &b)
+{
+  if (a.size() != b.size())
+  {
+    return false;
+  }
+  for (unsigned i = 0; i < a.size(); ++i)
+  {
+    if ((a[i].station_address_ != b[i].station_address_) || 
+        (a[i].open_ports_ != b[i].open_ports_) ||
+        (a[i].parent_ != b[i].parent_) || 
+        (a[i].parent_port_ != b[i].parent_port_))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void EthercatTopology::updateSummary(bool valid, const std::vector<TopologyNode> &nodes)
+{
+  ++summary_.measurements_;
+  summary_.valid_ = valid;
+  if (!valid)
+  {
+    ++summary_.failures_;
+    return;
+  }
+
+  if (!sameGraph(nodes_, nodes))
+  {
+    if (!nodes_.empty())
+    {
+      ++summary_.changes_;
+    }
+    min_hop_delay_ns_.assign(nodes.size(), std::numeric_limits<uint32_t>::max());
+  }
+  nodes_ = nodes;
+
+  summary_.round_trip_ns_ = 0;
+  summary_.max_hop_delay_ns_ = 0;
+  summary_.max_hop_position_ = 0;
+  summary_.max_hop_increase_ns_ = 0;
+  summary_.max_increase_position_ = 0;
+  if (nodes_.empty())
+  {
+    return;
+  }
+
+  const TopologyNode &first(nodes_[0]);
+  summary_.round_trip_ns_ = std::max(int32_t(0), timeDiff(first.receive_time_[lastOpenPort(first)], first.receive_time_[0]));
+  for (unsigned i = 1; i < nodes_.size(); ++i)
+  {
+    uint32_t hop = nodes_[i].hop_delay_ns_;
+    if (hop > summary_.max_hop_delay_ns_)
+    {
+      summary_.max_hop_delay_ns_ = hop;
+      summary_.max_hop_position_ = i;
+    }
+    min_hop_delay_ns_[i] = std::min(min_hop_delay_ns_[i], hop);
+    uint32_t increase = hop - min_hop_delay_ns_[i];
+    if (increase > summary_.max_hop_increase_ns_)
+    {
+      summary_.max_hop_increase_ns_ = increase;
+      summary_.max_increase_position_ = i;
+    }
+  }
+}
+
+
+void EthercatTopology::fillMessage(ChainTopology &msg) const
+{
+  msg.stamp = ros::Time::now();
+  msg.valid = summary_.valid_;
+  msg.round_trip = summary_.round_trip_ns_;
+  msg.max_hop_delay = summary_.max_hop_delay_ns_;
+  msg.changes = summary_.changes_;
+  msg.nodes.resize(nodes_.size());
+  for (unsigned i = 0; i < nodes_.size(); ++i)
+  {
+    const TopologyNode &node(nodes_[i]);
+    ChainNode &n(msg.nodes[i]);
+    n.ring_position = i;
+    n.station_address = node.station_address_;
+    n.parent = node.parent_;
+    n.parent_port = node.parent_port_;
+    for (unsigned port = 0; port < TopologyNode::NUM_PORTS; ++port)
+    {
+      n.port_open[port] = node.isOpen(port);
+      n.receive_time[port] = node.receive_time_[port];
+    }
+    n.hop_delay = node.hop_delay_ns_;
+    n.delay = node.delay_ns_;
+  }
+}
+
+
+}; //end namespace ethercat_hardware
@@ -3,7 +3,14 @@
 #include <linux/sockios.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
 #include <errno.h>
+#include <poll.h>
+
+#include <boost/bind.hpp>
 
 EthtoolStats::EthtoolStats():
   rx_errors_(0),
@@ -23,6 +30,17 @@ EthtoolStats& EthtoolStats::operator-=(const EthtoolStats& right)
   return *this;
 }
 
+InterfaceSample::InterfaceSample() :
+  rx_errors_(0),
+  rx_crc_errors_(0),
+  rx_frame_errors_(0),
+  rx_missed_errors_(0),
+  link_changes_(0),
+  lost_links_(0)
+{
+
+}
+
 EthernetInterfaceInfo::EthernetInterfaceInfo() :
   sock_(-1),
   n_stats_(0),
@@ -30,20 +48,36 @@ EthernetInterfaceInfo::EthernetInterfaceInfo() :
   rx_error_index_(-1),
   rx_crc_error_index_(-1),
   rx_frame_error_index_(-1),
-  rx_align_error_index_(-1)
+  rx_align_error_index_(-1),
+  lost_link_count_(0),
+  netlink_sock_(-1),
+  netlink_events_sock_(-1),
+  ifindex_(0),
+  netlink_seq_(0),
+  next_sample_(0),
+  last_correlated_drop_(0),
+  drops_with_errors_(0),
+  drops_with_link_change_(0),
+  drops_unchecked_(0)
 {
   
 }
 
 EthernetInterfaceInfo::~EthernetInterfaceInfo()
 {
+  sampler_thread_.interrupt();
+  sampler_thread_.join();
+  if (netlink_sock_ >= 0)
+    close(netlink_sock_);
+  if (netlink_events_sock_ >= 0)
+    close(netlink_events_sock_);
   delete[] ethtool_stats_buf_;
   ethtool_stats_buf_ = NULL;
   if (sock_ >= 0)
     close(sock_);
 }
 
-void EthernetInterfaceInfo::initialize(const std::string &interface)
+void EthernetInterfaceInfo::initialize(const std::string &interface, double sample_rate)
 {
   interface_ = interface;
 
@@ -58,6 +92,13 @@ void EthernetInterfaceInfo::initialize(const std::string &interface)
   // Get initial interface state
   getInterfaceState(last_state_);
 
+  if ((sample_rate > 0.0) && initializeNetlink(sample_rate))
+  {
+    // Netlink provides all error counters except alignment errors, 
+    // so ethtool dump is only needed if driver has alignment error counter
+    sampler_thread_ = boost::thread(boost::bind(&EthernetInterfaceInfo::samplerThreadFunc, this));
+  }
+
   struct ifreq ifr;
   memset(&ifr, 0, sizeof(ifr));
   strncpy(ifr.ifr_name, interface_.c_str(), sizeof(ifr.ifr_name));
@@ -140,6 +181,250 @@ void EthernetInterfaceInfo::initialize(const std::string &interface)
 }
 
 
+bool EthernetInterfaceInfo::initializeNetlink(double sample_rate)
+{
+  ifindex_ = if_nametoindex(interface_.c_str());
+  if (ifindex_ == 0)
+  {
+    ROS_WARN("Cannot get index of interface %s : %s", interface_.c_str(), strerror(errno));
+    return false;
+  }
+
+  netlink_sock_ = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  netlink_events_sock_ = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+  if ((netlink_sock_ < 0) || (netlink_events_sock_ < 0))
+  {
+    ROS_WARN("Cannot open netlink socket : %s", strerror(errno));
+    return false;
+  }
+
+  struct sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK;
+  if (bind(netlink_events_sock_, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+  {
+    ROS_WARN("Cannot subscribe to link changes : %s", strerror(errno));
+    return false;
+  }
+
+  // Reply must not block sampler thread forever
+  struct timeval tv = {0, 100000};
+  setsockopt(netlink_sock_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  InterfaceSample sample;
+  sample.state_ = last_state_;
+  if (!getNetlinkStats(sample))
+  {
+    ROS_WARN("Cannot get netlink statistics for %s, using ethtool", interface_.c_str());
+    return false;
+  }
+  orig_sample_ = sample;
+  last_sample_ = sample;
+  samples_.assign(SAMPLE_HISTORY, sample);
+  next_sample_ = 1;
+  sample_period_ = ros::Duration(1.0 / sample_rate);
+  return true;
+}
+
+
+//! Requests IFLA_STATS_LINK_64 counters of interface with RTM_GETSTATS
+bool EthernetInterfaceInfo::getNetlinkStats(InterfaceSample &sample)
+{
+  struct
+  {
+    struct nlmsghdr nlh;
+    struct if_stats_msg ifsm;
+  } req;
+  memset(&req, 0, sizeof(req));
+  req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifsm));
+  req.nlh.nlmsg_type = RTM_GETSTATS;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST;
+  req.nlh.nlmsg_seq = ++netlink_seq_;
+  req.ifsm.family = AF_UNSPEC;
+  req.ifsm.ifindex = ifindex_;
+  req.ifsm.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+  if (send(netlink_sock_, &req, req.nlh.nlmsg_len, 0) < 0)
+  {
+    return false;
+  }
+
+  char buf[1024];
+  for (;;)
+  {
+    int len = recv(netlink_sock_, buf, sizeof(buf), 0);
+    if (len < 0)
+    {
+      return false;
+    }
+    for (struct nlmsghdr *nlh = (struct nlmsghdr*) buf; NLMSG_OK(nlh, unsigned(len)); nlh = NLMSG_NEXT(nlh, len))
+    {
+      if (nlh->nlmsg_seq != netlink_seq_)
+      {
+        // Reply to earlier request that timed out
+        continue;
+      }
+      if (nlh->nlmsg_type == NLMSG_ERROR)
+      {
+        return false;
+      }
+      if (nlh->nlmsg_type != RTM_NEWSTATS)
+      {
+        continue;
+      }
+      struct if_stats_msg *ifsm = (struct if_stats_msg*) NLMSG_DATA(nlh);
+      int attr_len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm));
+      for (struct rtattr *rta = (struct rtattr*) ((char*) ifsm + NLMSG_ALIGN(sizeof(*ifsm))); 
+           RTA_OK(rta, attr_len); rta = RTA_NEXT(rta, attr_len))
+      {
+        if ((rta->rta_type == IFLA_STATS_LINK_64) && (RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats64)))
+        {
+          struct rtnl_link_stats64 stats;
+          memcpy(&stats, RTA_DATA(rta), sizeof(stats));
+          sample.rx_errors_        = stats.rx_errors;
+          sample.rx_crc_errors_    = stats.rx_crc_errors;
+          sample.rx_frame_errors_  = stats.rx_frame_errors;
+          sample.rx_missed_errors_ = stats.rx_missed_errors;
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+}
+
+
+//! Applies link change notifications that kernel has queued since last call
+void EthernetInterfaceInfo::readLinkEvents(InterfaceSample &sample)
+{
+  char buf[4096];
+  int len;
+  while ((len = recv(netlink_events_sock_, buf, sizeof(buf), 0)) > 0)
+  {
+    for (struct nlmsghdr *nlh = (struct nlmsghdr*) buf; NLMSG_OK(nlh, unsigned(len)); nlh = NLMSG_NEXT(nlh, len))
+    {
+      if ((nlh->nlmsg_type != RTM_NEWLINK) && (nlh->nlmsg_type != RTM_DELLINK))
+      {
+        continue;
+      }
+      struct ifinfomsg *ifi = (struct ifinfomsg*) NLMSG_DATA(nlh);
+      if (ifi->ifi_index != ifindex_)
+      {
+        continue;
+      }
+      InterfaceState state;
+      state.up_      = (nlh->nlmsg_type == RTM_NEWLINK) && (ifi->ifi_flags & IFF_UP);
+      state.running_ = (nlh->nlmsg_type == RTM_NEWLINK) && (ifi->ifi_flags & IFF_RUNNING);
+      if ((state.up_ != sample.state_.up_) || (state.running_ != sample.state_.running_))
+      {
+        ++sample.link_changes_;
+        if (sample.state_.running_ && !state.running_)
+        {
+          ++sample.lost_links_;
+        }
+      }
+      sample.state_ = state;
+    }
+  }
+}
+
+
+void EthernetInterfaceInfo::samplerThreadFunc()
+{
+  try {
+    ros::Time next = ros::Time::now();
+    while (true)
+    {
+      InterfaceSample sample(last_sample_);
+      readLinkEvents(sample);
+      // On failure, sample keeps last counter values and link state still comes from notifications
+      getNetlinkStats(sample);
+      sample.time_ = ros::Time::now();
+      {
+        boost::mutex::scoped_lock lock(samples_lock_);
+        if ((sample.rx_errors_ != last_sample_.rx_errors_) || 
+            (sample.rx_crc_errors_ != last_sample_.rx_crc_errors_) ||
+            (sample.rx_frame_errors_ != last_sample_.rx_frame_errors_) ||
+            (sample.rx_missed_errors_ != last_sample_.rx_missed_errors_))
+        {
+          last_error_time_ = sample.time_;
+        }
+        samples_[next_sample_ % SAMPLE_HISTORY] = sample;
+        ++next_sample_;
+      }
+      last_sample_ = sample;
+
+      next += sample_period_;
+      ros::Time now = ros::Time::now();
+      if (next < now)
+      {
+        next = now;
+      }
+      // Wakes early when link changes
+      struct pollfd pfd;
+      pfd.fd = netlink_events_sock_;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      poll(&pfd, 1, (next - now).toNSec() / 1000000);
+      boost::this_thread::interruption_point();
+    }
+  } catch (boost::thread_interrupted const&) {
+    return;
+  }
+}
+
+
+/*!
+ * \brief Counts process data drops that coincide with NIC errors or link changes.
+ *
+ * Drop is matched against samples just before and just after it.  Counters
+ * are only updated by NIC driver every so often, so one extra sample period
+ * before drop is also included.  Drops newer than last sample are left for next call.
+ */
+void EthernetInterfaceInfo::correlateDrops(const ros::Time *drop_times, unsigned num_drops, unsigned ring_size)
+{
+  if ((drop_times == NULL) || (ring_size == 0))
+  {
+    return;
+  }
+  if (num_drops - last_correlated_drop_ > ring_size)
+  {
+    // Oldest times were overwritten before they were looked at
+    drops_unchecked_ += (num_drops - ring_size) - last_correlated_drop_;
+    last_correlated_drop_ = num_drops - ring_size;
+  }
+
+  boost::mutex::scoped_lock lock(samples_lock_);
+  uint64_t oldest = (next_sample_ > SAMPLE_HISTORY) ? (next_sample_ - SAMPLE_HISTORY) : 0;
+  for (; last_correlated_drop_ != num_drops; ++last_correlated_drop_)
+  {
+    const ros::Time &t(drop_times[last_correlated_drop_ % ring_size]);
+    if (samples_[(next_sample_-1) % SAMPLE_HISTORY].time_ < t)
+    {
+      break;
+    }
+    // Find first sample taken after drop
+    uint64_t after = next_sample_-1;
+    while ((after > oldest) && (samples_[(after-1) % SAMPLE_HISTORY].time_ >= t))
+    {
+      --after;
+    }
+    uint64_t before = (after >= oldest+2) ? (after-2) : oldest;
+    const InterfaceSample &a(samples_[after % SAMPLE_HISTORY]);
+    const InterfaceSample &b(samples_[before % SAMPLE_HISTORY]);
+    if ((a.rx_errors_ != b.rx_errors_) || (a.rx_crc_errors_ != b.rx_crc_errors_) || 
+        (a.rx_frame_errors_ != b.rx_frame_errors_) || (a.rx_missed_errors_ != b.rx_missed_errors_))
+    {
+      ++drops_with_errors_;
+    }
+    if ((a.link_changes_ != b.link_changes_) || !a.state_.running_ || !b.state_.running_)
+    {
+      ++drops_with_link_change_;
+    }
+  }
+}
+
+
 bool EthernetInterfaceInfo::getInterfaceState(InterfaceState &state)
 {
   struct ifreq ifr;
@@ -196,10 +481,62 @@ bool EthernetInterfaceInfo::getEthtoolStats(EthtoolStats &s)
   return true;
 }
 
-void EthernetInterfaceInfo::publishDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d)
+void EthernetInterfaceInfo::publishDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, 
+                                               const ros::Time *drop_times, unsigned num_drops, unsigned ring_size)
 {
   d.add("Interface", interface_);
 
+  if (!samples_.empty())
+  {
+    InterfaceSample sample;
+    ros::Time last_error_time;
+    {
+      boost::mutex::scoped_lock lock(samples_lock_);
+      sample = samples_[(next_sample_-1) % SAMPLE_HISTORY];
+      last_error_time = last_error_time_;
+    }
+    correlateDrops(drop_times, num_drops, ring_size);
+
+    const InterfaceState &state(sample.state_);
+    if (state.up_ && !state.running_)
+    {
+      d.mergeSummary(d.ERROR, "No link");
+    }
+    else if (!state.up_)
+    {
+      d.mergeSummary(d.ERROR, "Interface down");
+    }
+    d.addf("Interface State", "%s UP, %s RUNNING", state.up_?"":"NOT", state.running_?"":"NOT");
+    d.addf("Lost Links", "%u", sample.lost_links_);
+    d.addf("Link Changes", "%u", sample.link_changes_);
+    d.addf("RX Errors", "%llu", (unsigned long long)(sample.rx_errors_ - orig_sample_.rx_errors_));
+    d.addf("RX CRC Errors", "%llu", (unsigned long long)(sample.rx_crc_errors_ - orig_sample_.rx_crc_errors_));
+    d.addf("RX Frame Errors", "%llu", (unsigned long long)(sample.rx_frame_errors_ - orig_sample_.rx_frame_errors_));
+    d.addf("RX Missed Errors", "%llu", (unsigned long long)(sample.rx_missed_errors_ - orig_sample_.rx_missed_errors_));
+    if (rx_align_error_index_ >= 0)
+    {
+      EthtoolStats stats;
+      if (getEthtoolStats(stats))
+      {
+        stats -= orig_stats_;
+        d.addf("RX Align Errors", "%llu", (unsigned long long)stats.rx_align_errors_);
+      }
+    }
+    else
+    {
+      d.add("RX Align Errors", "N/A");
+    }
+    d.addf("Interface Sample Period (ms)", "%.1f", sample_period_.toSec() * 1000.0);
+    if (!last_error_time.isZero())
+    {
+      d.addf("Last NIC Error Age (s)", "%.3f", (ros::Time::now() - last_error_time).toSec());
+    }
+    d.addf("Drops With NIC Errors", "%u", drops_with_errors_);
+    d.addf("Drops With Link Change", "%u", drops_with_link_change_);
+    d.addf("Drops Not Checked", "%u", drops_unchecked_);
+    return;
+  }
+
   // TODO : collect and publish information on whether interface is up/running
   InterfaceState state;
   if (getInterfaceState(state))
@@ -225,29 +562,29 @@ void EthernetInterfaceInfo::publishDiagnostics(diagnostic_updater::DiagnosticSta
   {
     d.add("Iface State", "ERROR");
   }
-  d.add("Lost Links", lost_link_count_);
+  d.addf("Lost Links", "%u", lost_link_count_);
 
   EthtoolStats stats;
   bool have_stats = getEthtoolStats(stats);
   stats-=orig_stats_;  //subtract off orignal counter values
 
   if (have_stats && (rx_error_index_>=0))
-    d.addf("RX Errors", "%llu", stats.rx_errors_);
+    d.addf("RX Errors", "%llu", (unsigned long long)stats.rx_errors_);
   else
     d.add( "RX Errors", "N/A");
 
   if (have_stats && (rx_crc_error_index_>=0))
-    d.addf("RX CRC Errors", "%llu", stats.rx_crc_errors_);
+    d.addf("RX CRC Errors", "%llu", (unsigned long long)stats.rx_crc_errors_);
   else
     d.add( "RX CRC Errors", "N/A");
 
   if (have_stats && (rx_frame_error_index_>=0))
-    d.addf("RX Frame Errors", "%llu", stats.rx_frame_errors_);
+    d.addf("RX Frame Errors", "%llu", (unsigned long long)stats.rx_frame_errors_);
   else
     d.add( "RX Frame Errors", "N/A");
 
   if (have_stats && (rx_align_error_index_>=0))
-    d.addf("RX Align Errors", "%llu", stats.rx_align_errors_);
+    d.addf("RX Align Errors", "%llu", (unsigned long long)stats.rx_align_errors_);
   else
     d.add( "RX Align Errors", "N/A");
 
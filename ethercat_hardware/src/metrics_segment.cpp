@@ -0,0 +1,304 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/metrics_segment.h"
+
+#include <ros/console.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+
+namespace ethercat_hardware
+{
+
+static const char METRICS_MAGIC[8] = {'E','C','M','E','T','R','I','C'};
+
+// POSIX shared memory names need a leading slash
+static std::string shmName(const std::string &name)
+{
+  return ((!name.empty()) && (name[0] == '/')) ? name : ("/" + name);
+}
+
+
+void MetricsHistogram::record(double seconds)
+{
+  uint64_t ns = (seconds > 0.0) ? uint64_t(seconds * 1e9) : 0;
+  ++count_;
+  total_ns_ += ns;
+  if (ns > max_ns_)
+  {
+    max_ns_ = ns;
+  }
+
+  unsigned bucket = 0;
+  for (uint64_t us = ns / 1000; (us != 0) && (bucket < NUM_BUCKETS-1); us >>= 1)
+  {
+    ++bucket;
+  }
+  ++buckets_[bucket];
+}
+
+
+MetricsSegmentWriter::MetricsSegmentWriter() :
+  segment_(NULL),
+  size_(0),
+  header_(NULL),
+  master_(NULL),
+  devices_(NULL),
+  num_devices_(0)
+{
+
+}
+
+
+MetricsSegmentWriter::~MetricsSegmentWriter()
+{
+  close();
+}
+
+
+bool MetricsSegmentWriter::open(const std::string &name, unsigned num_devices)
+{
+  close();
+
+  name_ = shmName(name);
+  size_t size = sizeof(MetricsSegmentHeader) + sizeof(MasterMetrics) + num_devices * sizeof(DeviceMetrics);
+
+  int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    ROS_ERROR("Could not create metrics segment '%s' : %s", name_.c_str(), strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, size) != 0)
+  {
+    ROS_ERROR("Could not size metrics segment '%s' : %s", name_.c_str(), strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (segment == MAP_FAILED)
+  {
+    ROS_ERROR("Could not map metrics segment '%s' : %s", name_.c_str(), strerror(errno));
+    return false;
+  }
+
+  // Realtime loop writes segment every cycle, it should never page fault
+  if (mlock(segment, size) != 0)
+  {
+    ROS_WARN("Could not lock metrics segment '%s' in memory : %s", name_.c_str(), strerror(errno));
+  }
+
+  // Keep sequence odd until header is filled in, so readers wait for it
+  MetricsSegmentHeader *header = (MetricsSegmentHeader*) segment;
+  header->sequence_ = 1;
+  __sync_synchronize();
+  memset((char*)segment + sizeof(MetricsSegmentHeader), 0, size - sizeof(MetricsSegmentHeader));
+  header->version_ = MetricsSegmentHeader::VERSION;
+  header->header_size_ = sizeof(MetricsSegmentHeader);
+  header->master_size_ = sizeof(MasterMetrics);
+  header->device_size_ = sizeof(DeviceMetrics);
+  header->num_devices_ = num_devices;
+  header->writer_pid_ = getpid();
+  header->pad_ = 0;
+  memcpy(header->magic_, METRICS_MAGIC, sizeof(header->magic_));
+  __sync_synchronize();
+  header->sequence_ = 2;
+
+  segment_ = segment;
+  size_ = size;
+  header_ = header;
+  master_ = (MasterMetrics*) (header + 1);
+  devices_ = (DeviceMetrics*) (master_ + 1);
+  num_devices_ = num_devices;
+  return true;
+}
+
+
+void MetricsSegmentWriter::close()
+{
+  if (segment_ != NULL)
+  {
+    munmap(segment_, size_);
+    shm_unlink(name_.c_str());
+  }
+  segment_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+  master_ = NULL;
+  devices_ = NULL;
+  num_devices_ = 0;
+}
+
+
+void MetricsSegmentWriter::write(const MasterMetrics &master, const DeviceMetrics *devices)
+{
+  if (header_ == NULL)
+  {
+    return;
+  }
+
+  // Only one writer, so sequence does not need atomic increment
+  header_->sequence_ = header_->sequence_ + 1;
+  __sync_synchronize();
+  memcpy(master_, &master, sizeof(MasterMetrics));
+  memcpy(devices_, devices, num_devices_ * sizeof(DeviceMetrics));
+  __sync_synchronize();
+  header_->sequence_ = header_->sequence_ + 1;
+}
+
+
+MetricsSegmentReader::MetricsSegmentReader() :
+  segment_(NULL),
+  size_(0),
+  header_(NULL)
+{
+
+}
+
+
+MetricsSegmentReader::~MetricsSegmentReader()
+{
+  close();
+}
+
+
+bool MetricsSegmentReader::open(const std::string &name)
+{
+  close();
+
+  std::string shm_name(shmName(name));
+  int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || (size_t(st.st_size) < sizeof(MetricsSegmentHeader)))
+  {
+    ::close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *segment = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (segment == MAP_FAILED)
+  {
+    return false;
+  }
+
+  const MetricsSegmentHeader *header = (const MetricsSegmentHeader*) segment;
+  bool good = 
+    (memcmp(header->magic_, METRICS_MAGIC, sizeof(header->magic_)) == 0) &&
+    (header->version_ == MetricsSegmentHeader::VERSION) &&
+    (header->header_size_ >= sizeof(MetricsSegmentHeader)) &&
+    (header->master_size_ >= sizeof(MasterMetrics)) &&
+    (header->device_size_ >= sizeof(DeviceMetrics)) &&
+    (size >= header->header_size_ + header->master_size_ + size_t(header->num_devices_) * header->device_size_);
+  if (!good)
+  {
+    munmap(segment, size);
+    return false;
+  }
+
+  segment_ = segment;
+  size_ = size;
+  header_ = header;
+  return true;
+}
+
+
+void MetricsSegmentReader::close()
+{
+  if (segment_ != NULL)
+  {
+    munmap(segment_, size_);
+  }
+  segment_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+}
+
+
+unsigned MetricsSegmentReader::numDevices() const
+{
+  return (header_ != NULL) ? header_->num_devices_ : 0;
+}
+
+
+bool MetricsSegmentReader::read(MasterMetrics &master, std::vector<DeviceMetrics> &devices)
+{
+  if (header_ == NULL)
+  {
+    return false;
+  }
+
+  const char *base = (const char*) segment_;
+  const char *master_src = base + header_->header_size_;
+  const char *devices_src = master_src + header_->master_size_;
+  unsigned num_devices = header_->num_devices_;
+  devices.resize(num_devices);
+
+  for (unsigned attempt=0; attempt<MAX_READ_ATTEMPTS; ++attempt)
+  {
+    uint32_t sequence = header_->sequence_;
+    if (sequence & 1)
+    {
+      sched_yield();
+      continue;
+    }
+    __sync_synchronize();
+    memcpy(&master, master_src, sizeof(MasterMetrics));
+    for (unsigned i=0; i<num_devices; ++i)
+    {
+      memcpy(&devices[i], devices_src + i * header_->device_size_, sizeof(DeviceMetrics));
+    }
+    __sync_synchronize();
+    if (sequence == header_->sequence_)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+}; //end namespace ethercat_hardware
@@ -217,9 +217,9 @@ MotorHeatingModel::MotorHeatingModel(const MotorHeatingModelParameters &motor_pa
                                      const std::string &save_directory
                                      ) :  
   overheat_(false),
-  heating_energy_sum_(0.0),
-  ambient_temperature_sum_(0.0),
-  duration_since_last_sample_(0.0),
+  heating_energy_total_(0.0),
+  ambient_temperature_total_(0.0),
+  duration_total_(0.0),
   publisher_(NULL),
   motor_params_(motor_params),
   actuator_name_(actuator_name),
@@ -248,6 +248,10 @@ MotorHeatingModel::MotorHeatingModel(const MotorHeatingModelParameters &motor_pa
     motor_params_.winding_to_housing_thermal_resistance_ / motor_params_.winding_thermal_time_constant_;
   housing_thermal_mass_inverse_ = 
     motor_params_.housing_to_ambient_thermal_resistance_ / motor_params_.housing_thermal_time_constant_; 
+
+  updateSnapshot();
+  snapshot_.read(last_diagnostics_snapshot_);
+  average_ambient_temperature_ = ambient_temperature_;
 }
 
 
@@ -257,7 +261,7 @@ bool MotorHeatingModel::startTemperaturePublisher()
   if (!actuator_name_.empty())
   {
     topic = topic + "/" + actuator_name_;
-    publisher_ = new realtime_tools::RealtimePublisher<ethercat_hardware::MotorTemperature>(ros::NodeHandle(), topic, 1, true);
+    publisher_ = new ethercat_hardware::SharedRealtimePublisher<ethercat_hardware::MotorTemperature>(ros::NodeHandle(), topic, 1, true);
     if (publisher_ == NULL)
     {
       ROS_ERROR("Could not allocate realtime publisher");
@@ -320,19 +324,33 @@ bool MotorHeatingModel::update(double heating_power, double ambient_temperature,
   winding_temperature_ += (heating_energy      - winding_energy_loss) * winding_thermal_mass_inverse_;
   housing_temperature_ += (winding_energy_loss - housing_energy_loss) * housing_thermal_mass_inverse_;
 
-  { // LOCKED
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    heating_energy_sum_ += heating_energy;
-    ambient_temperature_sum_ += (ambient_temperature * duration);
-    duration_since_last_sample_ += duration;
-    if (winding_temperature_ > motor_params_.max_winding_temperature_)
-      overheat_ = true;
-  } // LOCKED
+  ambient_temperature_ = ambient_temperature;
+  heating_energy_total_ += heating_energy;
+  ambient_temperature_total_ += (ambient_temperature * duration);
+  duration_total_ += duration;
+  if (winding_temperature_ > motor_params_.max_winding_temperature_)
+    overheat_ = true;
+
+  updateSnapshot();
    
   return !overheat_;
 }
 
 
+void MotorHeatingModel::updateSnapshot()
+{
+  Snapshot snapshot;
+  snapshot.overheat_ = overheat_;
+  snapshot.winding_temperature_ = winding_temperature_;
+  snapshot.housing_temperature_ = housing_temperature_;
+  snapshot.ambient_temperature_ = ambient_temperature_;
+  snapshot.heating_energy_total_ = heating_energy_total_;
+  snapshot.ambient_temperature_total_ = ambient_temperature_total_;
+  snapshot.duration_total_ = duration_total_;
+  snapshot_.write(snapshot);
+}
+
+
 
 double MotorHeatingModel::updateFromDowntimeWithInterval(double downtime, 
                                                          double saved_ambient_temperature, 
@@ -378,6 +396,7 @@ void MotorHeatingModel::updateFromDowntime(double downtime, double saved_ambient
     ROS_DEBUG("Downtime too long, using ambient temperature as final motor temperature");
     winding_temperature_ = saved_ambient_temperature;
     housing_temperature_ = saved_ambient_temperature;
+    updateSnapshot();
   }
 
   ROS_DEBUG("Took %f milliseconds to sim %f seconds", timer.elapsed()*1000., saved_downtime);
@@ -387,52 +406,39 @@ void MotorHeatingModel::updateFromDowntime(double downtime, double saved_ambient
 
 void MotorHeatingModel::reset()
 { 
-  { // LOCKED
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    overheat_ = false;
-  } // LOCKED
+  overheat_ = false;
+  updateSnapshot();
 }
 
 
-void MotorHeatingModel::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d)
+void MotorHeatingModel::diagnostics(ethercat_hardware::DiagnosticsBuilder &d)
 {
   // Sample motor temperature and heating energy every so often, this way the 
   // heating of the motor can be published when there is a problem
-  bool overheat;
-  double winding_temperature;
-  double housing_temperature;
-  double ambient_temperature_sum;
-  double duration_since_last_sample;
-  double average_ambient_temperature;
+  Snapshot snapshot;
+  snapshot_.read(snapshot);
+  const Snapshot &last(last_diagnostics_snapshot_);
+
+  bool overheat = snapshot.overheat_;
+  double winding_temperature = snapshot.winding_temperature_;
+  double housing_temperature = snapshot.housing_temperature_;
+  double duration_since_last_sample = snapshot.duration_total_ - last.duration_total_;
   double average_heating_power;
 
-  { // LOCKED
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    overheat = overheat_;
-    winding_temperature = winding_temperature_;
-    housing_temperature = housing_temperature_;
-    ambient_temperature_sum = ambient_temperature_sum_;
-    duration_since_last_sample = duration_since_last_sample_;
-
-    if (duration_since_last_sample > 0.0)
-    {
-      average_ambient_temperature = ambient_temperature_sum / duration_since_last_sample;
-      ambient_temperature_ = average_ambient_temperature;
-      average_heating_power = heating_energy_sum_ / duration_since_last_sample;
-    }
-    else 
-    {
-      //ROS_WARN("Duration == 0");
-      average_ambient_temperature = ambient_temperature_;
-      average_heating_power = 0.0;
-    }
-    
-    ambient_temperature_sum_ = 0.0;
-    heating_energy_sum_  = 0.0;
-    duration_since_last_sample_ = 0.0;
-  } // LOCKED
-
+  if (duration_since_last_sample > 0.0)
+  {
+    average_ambient_temperature_ = 
+      (snapshot.ambient_temperature_total_ - last.ambient_temperature_total_) / duration_since_last_sample;
+    average_heating_power = (snapshot.heating_energy_total_ - last.heating_energy_total_) / duration_since_last_sample;
+  }
+  else 
+  {
+    //ROS_WARN("Duration == 0");
+    average_heating_power = 0.0;
+  }
+  double average_ambient_temperature = average_ambient_temperature_;
 
+  last_diagnostics_snapshot_ = snapshot;
 
   const int ERROR = 2;
   const int WARN = 1;
@@ -659,6 +665,9 @@ bool MotorHeatingModel::loadTemperatureState()
   saturateTemperature(housing_temperature_, "(2) Housing");
   saturateTemperature(winding_temperature_, "(2) Winding");
 
+  updateSnapshot();
+  average_ambient_temperature_ = ambient_temperature_;
+
   return true;
 }
 
@@ -674,15 +683,11 @@ bool MotorHeatingModel::saveTemperatureState()
    */
   std::string tmp_filename = save_filename_ + ".tmp";
 
-  double winding_temperature;
-  double housing_temperature;
-  double ambient_temperature;
-  { // LOCKED
-    boost::lock_guard<boost::mutex> lock(mutex_);
-    winding_temperature = winding_temperature_;
-    housing_temperature = housing_temperature_;
-    ambient_temperature = ambient_temperature_;
-  } // LOCKED
+  Snapshot snapshot;
+  snapshot_.read(snapshot);
+  double winding_temperature = snapshot.winding_temperature_;
+  double housing_temperature = snapshot.housing_temperature_;
+  double ambient_temperature = snapshot.ambient_temperature_;
 
   TiXmlDocument xml;
   TiXmlDeclaration *decl = new TiXmlDeclaration( "1.0", "", "" );
@@ -26,7 +26,6 @@ MotorModel::MotorModel(unsigned trace_size) :
 
 void MotorModel::reset()
 {
-  diagnostics_mutex_.lock();
   {
     motor_voltage_error_.reset();
     abs_motor_voltage_error_.reset();
@@ -41,11 +40,32 @@ void MotorModel::reset()
     diagnostics_level_ = 0;
     diagnostics_reason_ = "OK";
   }
-  diagnostics_mutex_.unlock();
   previous_pwm_saturated_ = false;
   publish_delay_ = -1;
   publish_level_ = -1;
   publish_reason_ = "OK";
+  updateDiagnosticsSnapshot();
+}
+
+/**  \brief Copies values used by diagnostics() into snapshot.  Called from realtime thread.
+ */
+void MotorModel::updateDiagnosticsSnapshot()
+{
+  DiagnosticsSnapshot d;
+  d.motor_voltage_error_         = motor_voltage_error_.filter(); 
+  d.motor_voltage_error_max_     = motor_voltage_error_.filter_max(); 
+  d.abs_motor_voltage_error_     = abs_motor_voltage_error_.filter(); 
+  d.abs_motor_voltage_error_max_ = abs_motor_voltage_error_.filter_max(); 
+  d.current_error_               = current_error_.filter();  
+  d.current_error_max_           = current_error_.filter_max(); 
+  d.abs_current_error_           = abs_current_error_.filter(); 
+  d.abs_current_error_max_       = abs_current_error_.filter_max(); 
+  d.est_motor_resistance_        = motor_resistance_.filter();
+  d.published_traces_            = published_traces_;
+  d.level_                       = diagnostics_level_;
+  strncpy(d.reason_, diagnostics_reason_.c_str(), sizeof(d.reason_));
+  d.reason_[sizeof(d.reason_)-1] = '\0';
+  diagnostics_snapshot_.write(d);
 }
 
 /**  \brief Initializes motor trace publisher
@@ -56,7 +76,7 @@ bool MotorModel::initialize(const ethercat_hardware::ActuatorInfo &actuator_info
   std::string topic("motor_trace");
   if (!actuator_info.name.empty())
     topic = topic + "/" + actuator_info.name;
-  publisher_ = new realtime_tools::RealtimePublisher<ethercat_hardware::MotorTrace>(ros::NodeHandle(), topic, 1, true);
+  publisher_ = new ethercat_hardware::SharedRealtimePublisher<ethercat_hardware::MotorTrace>(ros::NodeHandle(), topic, 1, true);
   if (publisher_ == NULL) 
     return false;
 
@@ -93,6 +113,7 @@ void MotorModel::checkPublish()
     return;
 
   ++published_traces_;
+  updateDiagnosticsSnapshot();
 
   assert(publisher_ != NULL);
   if ((publisher_==NULL) || (!publisher_->trylock())) 
@@ -140,39 +161,23 @@ void MotorModel::flagPublish(const std::string &reason, int level, int delay)
 
 /**  \brief Collects and publishes device diagnostics
  */
-void MotorModel::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d)
+void MotorModel::diagnostics(ethercat_hardware::DiagnosticsBuilder &d)
 {
-  // Should perform locking.. publishing of diagnostics is done from separate thread
-  double motor_voltage_error; 
-  double motor_voltage_error_max; 
-  double abs_motor_voltage_error; 
-  double abs_motor_voltage_error_max; 
-  double current_error; 
-  double current_error_max; 
-  double abs_current_error; 
-  double abs_current_error_max;
-  double est_motor_resistance;
-  std::string reason;
-  int level;
-
-  diagnostics_mutex_.lock(); 
-  {
-    motor_voltage_error         = motor_voltage_error_.filter(); 
-    motor_voltage_error_max     = motor_voltage_error_.filter_max(); 
-    abs_motor_voltage_error     = abs_motor_voltage_error_.filter(); 
-    abs_motor_voltage_error_max = abs_motor_voltage_error_.filter_max(); 
-    current_error               = current_error_.filter();  
-    current_error_max           = current_error_.filter_max(); 
-    abs_current_error           = abs_current_error_.filter(); 
-    abs_current_error_max       = abs_current_error_.filter_max(); 
-    est_motor_resistance        = motor_resistance_.filter();
-    reason                      = diagnostics_reason_;
-    level                       = diagnostics_level_;
-  }
-  diagnostics_mutex_.unlock();
-
-  if (level > 0)
-    d.mergeSummary(level, reason);
+  // Publishing of diagnostics is done from separate thread, use snapshot of realtime values
+  DiagnosticsSnapshot snapshot;
+  diagnostics_snapshot_.read(snapshot);
+  double motor_voltage_error         = snapshot.motor_voltage_error_;
+  double motor_voltage_error_max     = snapshot.motor_voltage_error_max_;
+  double abs_motor_voltage_error     = snapshot.abs_motor_voltage_error_;
+  double abs_motor_voltage_error_max = snapshot.abs_motor_voltage_error_max_;
+  double current_error               = snapshot.current_error_;
+  double current_error_max           = snapshot.current_error_max_;
+  double abs_current_error           = snapshot.abs_current_error_;
+  double abs_current_error_max       = snapshot.abs_current_error_max_;
+  double est_motor_resistance        = snapshot.est_motor_resistance_;
+
+  if (snapshot.level_ > 0)
+    d.mergeSummary(snapshot.level_, snapshot.reason_);
 
   d.addf("Motor Voltage Error %", "%f",        100.0 * motor_voltage_error);
   d.addf("Max Motor Voltage Error %", "%f",    100.0 * motor_voltage_error_max);
@@ -187,7 +192,7 @@ void MotorModel::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d)
 
   d.addf("Motor Resistance Estimate", "%f", est_motor_resistance);
 
-  d.addf("# Published traces", "%d", published_traces_);
+  d.addf("# Published traces", "%d", snapshot.published_traces_);
 }
 
 
@@ -231,8 +236,6 @@ void MotorModel::sample(const ethercat_hardware::MotorTraceSample &s)
 
   // Don't update filters if MCB is not enabled (halted)
   if (s.enabled) {
-    diagnostics_mutex_.lock();
-    
     // Compare measured voltage to motor voltage.  Identify errors with broken inductor leads, etc
     measured_voltage_error_.sample(s.measured_motor_voltage - board_voltage);
     abs_measured_voltage_error_.sample( fabs(measured_voltage_error_.filter()) );
@@ -276,7 +279,7 @@ void MotorModel::sample(const ethercat_hardware::MotorTraceSample &s)
     // Update filtered resistance estimate with resistance calculated this cycle
     motor_resistance_.sample(est_motor_resistance, 0.005 * est_motor_resistance_accuracy);
 
-    diagnostics_mutex_.unlock();
+    updateDiagnosticsSnapshot();
   }
 
   { // Add motor trace sample to trace buffer
@@ -391,10 +394,9 @@ bool MotorModel::verify()
   {
     if (level == ERROR)      
       flagPublish(reason, level, 100);
-    diagnostics_mutex_.lock();
     diagnostics_level_ = level;
     diagnostics_reason_ = reason;
-    diagnostics_mutex_.unlock();
+    updateDiagnosticsSnapshot();
   }    
 
   return rv;
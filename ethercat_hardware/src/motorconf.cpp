@@ -33,9 +33,12 @@
  *********************************************************************/
 
 #include <map>
+#include <iostream>
 #include <stdio.h>
+#include <climits>
 #include <getopt.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <tinyxml.h>
 
@@ -54,6 +57,10 @@
 
 #include <boost/crc.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -205,6 +212,21 @@ void init(char *interface)
     device->use_ros_ = false;
     device->initialize(NULL, true);
   }
+
+  // Mailbox operations of all devices go through one scheduler, so jobs on different devices overlap.
+  // Devices are never deleted, so they outlive scheduler.
+  static EthercatDirectCom com(EtherCAT_DataLinkLayer::instance());
+  static WGMailboxScheduler scheduler(&com);
+  BOOST_FOREACH(EthercatDevice *device, devices)
+  {
+    if (!device) continue;
+    if (!device->attachMailboxScheduler(scheduler))
+    {
+      fprintf(stderr, "Unable to attach mailbox of device %d to scheduler\n", device->sh_->get_ring_position());
+      exit(-1);
+    }
+  }
+  scheduler.start();
 }
 
 string boardName(EthercatDevice *d)
@@ -246,6 +268,112 @@ WG0X* getWGDevice(int device)
 }
 
 
+// Overloads that let programIfChanged() work with either EEPROM configuration page
+static bool readFromEeprom(WG0X *wg, EthercatCom *com, WG0XActuatorInfo &actuator_info)
+{
+  return wg->readActuatorInfoFromEeprom(com, actuator_info);
+}
+
+static bool readFromEeprom(WG0X *wg, EthercatCom *com, MotorHeatingModelParametersEepromConfig &heating_config)
+{
+  return wg->readMotorHeatingModelParametersFromEeprom(com, heating_config);
+}
+
+static bool sameCRC(const WG0XActuatorInfo &a, const WG0XActuatorInfo &b)
+{
+  return a.crc32_264_ == b.crc32_264_;
+}
+
+static bool sameCRC(const MotorHeatingModelParametersEepromConfig &a, const MotorHeatingModelParametersEepromConfig &b)
+{
+  return a.crc32_ == b.crc32_;
+}
+
+
+/*!
+ * \brief Writes configuration page to device EEPROM, only if it differs from what is already stored.
+ *
+ * Skipping unchanged pages saves a full page program cycle and reduces EEPROM wear.
+ * Page is considered unchanged if stored copy has valid CRC, same CRC as new configuration, 
+ * and identical contents.
+ *
+ * \param config  configuration to store, CRC must already be generated
+ * \param written set to true if page was actually programmed
+ * \return        false if there was an error reading or programming EEPROM
+ */
+template <class ConfigT>
+bool programIfChanged(WG0X *wg, EthercatCom *com, int device, const ConfigT &config, const char *what, bool &written)
+{
+  written = false;
+
+  ConfigT current;
+  if (!readFromEeprom(wg, com, current))
+  {
+    ROS_WARN("Could not read %s from device #%d, programming anyway", what, device);
+  }
+  else if (current.verifyCRC() && sameCRC(current, config) && (memcmp(&current, &config, sizeof(config)) == 0))
+  {
+    ROS_INFO("Device #%d %s is already up-to-date", device, what);
+    return true;
+  }
+
+  if (!wg->program(com, config))
+  {
+    return false;
+  }
+  written = true;
+  return true;
+}
+
+
+/*!
+ * \brief Runs func for every device, using up to 'jobs' threads.
+ *
+ * Each device has its own mailbox and EEPROM lock, and the EtherCAT driver 
+ * allows multiple frames in flight, so devices can be worked on in parallel.
+ *
+ * \return number of devices where func returned false
+ */
+unsigned forEachDevice(boost::function<bool (int)> func, unsigned jobs)
+{
+  boost::mutex mutex;
+  unsigned next_device = 0;
+  unsigned failures = 0;
+
+  struct Worker
+  {
+    static void run(boost::function<bool (int)> func, boost::mutex *mutex, unsigned *next_device, unsigned *failures)
+    {
+      while (true)
+      {
+        unsigned device;
+        { // LOCKED
+          boost::lock_guard<boost::mutex> lock(*mutex);
+          if (*next_device >= devices.size())
+            return;
+          device = (*next_device)++;
+        } // UNLOCKED
+        if (!func(device))
+        {
+          boost::lock_guard<boost::mutex> lock(*mutex);
+          ++(*failures);
+        }
+      }
+    }
+  };
+
+  jobs = std::max(1U, std::min(jobs, unsigned(devices.size())));
+  boost::thread_group threads;
+  for (unsigned i=0; i<jobs; ++i)
+  {
+    threads.create_thread(boost::bind(&Worker::run, func, &mutex, &next_device, &failures));
+  }
+  threads.join_all();
+
+  return failures;
+}
+
+
 bool programDevice(int device, 
                    const Config &config, 
                    char *name, string expected_board, bool enforce_heating_model)
@@ -276,7 +404,8 @@ bool programDevice(int device,
            int(actuator_info.major_), int(actuator_info.minor_));
 
   EthercatDirectCom com(EtherCAT_DataLinkLayer::instance());
-  if (!wg->program(&com, actuator_info))
+  bool written;
+  if (!programIfChanged(wg, &com, device, actuator_info, "actuator info", written))
   {
     ROS_FATAL("Error writing actuator info to device #%d", device);
     return false;
@@ -285,7 +414,7 @@ bool programDevice(int device,
   MotorHeatingModelParametersEepromConfig heating_config = config.heating_config_;
   heating_config.enforce_ = enforce_heating_model;
   heating_config.generateCRC();
-  if (!wg->program(&com, config.heating_config_))
+  if (!programIfChanged(wg, &com, device, heating_config, "heating model config", written))
   {
     ROS_FATAL("Writing heating model config to device #%d", device);
     return false;
@@ -351,30 +480,344 @@ bool updateHeatingConfig(int device)
   MotorHeatingModelParametersEepromConfig heating_config = config.heating_config_;
   heating_config.enforce_ = enforce_heating_model;
   heating_config.generateCRC(); 
-  if (!wg->program(&com, heating_config))
+  bool written;
+  if (!programIfChanged(wg, &com, device, heating_config, "heating model config", written))
   {
     ROS_FATAL("Writing heating model config to device #%d", device);
     return false;
   }
 
-  ROS_INFO("Updated device %d (%s) with heating config for motor '%s'", 
-           device, actuator_info.name_, config.actuator_info_.motor_model_);
+  if (written)
+  {
+    ROS_INFO("Updated device %d (%s) with heating config for motor '%s'", 
+             device, actuator_info.name_, config.actuator_info_.motor_model_);
+  }
 
   return true;
 }
 
 
-// Updates heating configuration of all devices
-bool updateAllHeatingConfig()
+// Runs func on device only if it is a WG0X, other devices are skipped and count as success
+static bool onlyWGDevices(boost::function<bool (int)> func, int device)
 {
-  for (unsigned device=0; device<devices.size(); ++device)
+  if (dynamic_cast<WG0X *>(devices[device]) == NULL)
   {
-    updateHeatingConfig(device);
+    return true;
+  }
+  return func(device);
+}
+
+
+// Updates heating configuration of all WG0X devices, 'jobs' devices at a time
+bool updateAllHeatingConfig(unsigned jobs)
+{
+  unsigned num_wg_devices = 0;
+  for (unsigned i = 0; i < devices.size(); ++i)
+  {
+    if (dynamic_cast<WG0X *>(devices[i]) != NULL)
+    {
+      ++num_wg_devices;
+    }
+  }
+  unsigned failures = forEachDevice(boost::bind(&onlyWGDevices, &updateHeatingConfig, _1), jobs);
+  ROS_INFO("Updated heating config of %d devices, %d could not be updated", 
+           int(num_wg_devices-failures), failures);
+  return failures == 0;
+}
+
+
+/*!
+ * \brief Header of EEPROM image file written by --backup
+ *
+ * Header is followed by num_pages_*page_size_ bytes of EEPROM data.
+ */
+struct EepromImageHeader
+{
+  static const unsigned VERSION = 1;
+
+  char magic_[8];           //!< "WGEEPROM", no null terminator
+  uint32_t version_;
+  uint32_t product_code_;
+  uint32_t serial_;
+  uint32_t num_pages_;
+  uint32_t page_size_;
+  uint32_t data_crc32_;     //!< CRC32 of all EEPROM data following header
+  uint32_t header_crc32_;   //!< CRC32 of header, up to this field
+
+  uint32_t computeCRC() const
+  {
+    boost::crc_32_type crc32;
+    crc32.process_bytes(this, offsetof(EepromImageHeader, header_crc32_));
+    return crc32.checksum();
+  }
+} __attribute__ ((__packed__));
+
+static const char EEPROM_IMAGE_MAGIC[8] = {'W','G','E','E','P','R','O','M'};
+
+
+static uint32_t imageCRC(const std::vector<uint8_t> &image)
+{
+  boost::crc_32_type crc32;
+  crc32.process_bytes(&image[0], image.size());
+  return crc32.checksum();
+}
+
+
+// Image files are named after board type and serial number, so one directory can hold backups of a whole robot
+static string eepromImageFilename(const string &dir, EthercatDevice *d)
+{
+  char serial[32];
+  snprintf(serial, sizeof(serial), "%u", d->sh_->get_serial());
+  return dir + "/" + boardName(d) + "_" + serial + ".eeprom";
+}
+
+
+// Reads whole EEPROM of device, a block at a time so progress can be shown
+static bool readEepromImage(WG0X *wg, EthercatCom *com, int device, std::vector<uint8_t> &image)
+{
+  static const unsigned PAGES_PER_BLOCK = 512;
+  const unsigned page_size = WGEeprom::MAX_EEPROM_PAGE_SIZE;
+  image.resize(WGEeprom::NUM_EEPROM_PAGES * page_size);
+  for (unsigned page=0; page<WGEeprom::NUM_EEPROM_PAGES; page+=PAGES_PER_BLOCK)
+  {
+    if (!wg->eeprom().readEepromPages(com, &wg->mailbox(), page, PAGES_PER_BLOCK, &image[page*page_size]))
+    {
+      ROS_ERROR("Device #%d : could not read EEPROM pages %d-%d", device, page, page+PAGES_PER_BLOCK-1);
+      return false;
+    }
+    ROS_DEBUG("Device #%d : read %d of %d EEPROM pages", device, page+PAGES_PER_BLOCK, WGEeprom::NUM_EEPROM_PAGES);
   }
   return true;
 }
 
 
+// Saves whole EEPROM of device to file in given directory
+bool backupEeprom(int device, const string &dir)
+{
+  WG0X *wg = getWGDevice(device);
+  if (wg == NULL)
+  {
+    return false;
+  }
+
+  EthercatDirectCom com(EtherCAT_DataLinkLayer::instance());
+  std::vector<uint8_t> image;
+  if (!readEepromImage(wg, &com, device, image))
+  {
+    return false;
+  }
+
+  EepromImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, EEPROM_IMAGE_MAGIC, sizeof(header.magic_));
+  header.version_ = EepromImageHeader::VERSION;
+  header.product_code_ = wg->sh_->get_product_code();
+  header.serial_ = wg->sh_->get_serial();
+  header.num_pages_ = WGEeprom::NUM_EEPROM_PAGES;
+  header.page_size_ = WGEeprom::MAX_EEPROM_PAGE_SIZE;
+  header.data_crc32_ = imageCRC(image);
+  header.header_crc32_ = header.computeCRC();
+
+  // Write to temporary file first, so an interrupted backup never leaves a truncated image behind
+  string filename = eepromImageFilename(dir, wg);
+  string tmp_filename = filename + ".tmp";
+  FILE *f = fopen(tmp_filename.c_str(), "wb");
+  if (f == NULL)
+  {
+    ROS_ERROR("Device #%d : could not open '%s' : %s", device, tmp_filename.c_str(), strerror(errno));
+    return false;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, f) == 1) && (fwrite(&image[0], image.size(), 1, f) == 1);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || (rename(tmp_filename.c_str(), filename.c_str()) != 0))
+  {
+    ROS_ERROR("Device #%d : could not write '%s' : %s", device, filename.c_str(), strerror(errno));
+    unlink(tmp_filename.c_str());
+    return false;
+  }
+
+  ROS_INFO("Device #%d : saved EEPROM to '%s' (crc32 0x%08X)", device, filename.c_str(), header.data_crc32_);
+  return true;
+}
+
+
+// Loads and checks EEPROM image file
+static bool loadEepromImage(const string &filename, EepromImageHeader &header, std::vector<uint8_t> &image)
+{
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == NULL)
+  {
+    ROS_ERROR("Could not open '%s' : %s", filename.c_str(), strerror(errno));
+    return false;
+  }
+
+  bool ok = false;
+  if (fread(&header, sizeof(header), 1, f) != 1)
+  {
+    ROS_ERROR("'%s' is too short to be an EEPROM image", filename.c_str());
+  }
+  else if ((memcmp(header.magic_, EEPROM_IMAGE_MAGIC, sizeof(header.magic_)) != 0) || 
+           (header.header_crc32_ != header.computeCRC()))
+  {
+    ROS_ERROR("'%s' is not an EEPROM image or has a corrupted header", filename.c_str());
+  }
+  else if ((header.version_ != EepromImageHeader::VERSION) || 
+           (header.num_pages_ != WGEeprom::NUM_EEPROM_PAGES) || 
+           (header.page_size_ != WGEeprom::MAX_EEPROM_PAGE_SIZE))
+  {
+    ROS_ERROR("'%s' has unsupported version %d or layout %dx%d", filename.c_str(), 
+              header.version_, header.num_pages_, header.page_size_);
+  }
+  else
+  {
+    image.resize(header.num_pages_ * header.page_size_);
+    if (fread(&image[0], image.size(), 1, f) != 1)
+    {
+      ROS_ERROR("'%s' is truncated", filename.c_str());
+    }
+    else if (imageCRC(image) != header.data_crc32_)
+    {
+      ROS_ERROR("'%s' has bad checksum", filename.c_str());
+    }
+    else
+    {
+      ok = true;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+
+/*!
+ * \brief Writes EEPROM image back to device.
+ *
+ * Path can be a directory, in which case image is found using device type and serial number, 
+ * or (when a single device is selected) an image file.  Only pages that differ from current 
+ * EEPROM contents are written.  Afterwards whole EEPROM is read back and checked against image CRC.
+ */
+bool restoreEeprom(int device, const string &path)
+{
+  WG0X *wg = getWGDevice(device);
+  if (wg == NULL)
+  {
+    return false;
+  }
+
+  string filename = path;
+  struct stat st;
+  if ((stat(path.c_str(), &st) == 0) && S_ISDIR(st.st_mode))
+  {
+    filename = eepromImageFilename(path, wg);
+  }
+
+  EepromImageHeader header;
+  std::vector<uint8_t> image;
+  if (!loadEepromImage(filename, header, image))
+  {
+    return false;
+  }
+
+  if (header.product_code_ != wg->sh_->get_product_code())
+  {
+    ROS_ERROR("Device #%d : image '%s' is for product code %d, but device is %d", 
+              device, filename.c_str(), header.product_code_, wg->sh_->get_product_code());
+    return false;
+  }
+  if (header.serial_ != wg->sh_->get_serial())
+  {
+    ROS_WARN("Device #%d : image '%s' was taken from serial %d, restoring to serial %d", 
+             device, filename.c_str(), header.serial_, wg->sh_->get_serial());
+  }
+
+  EthercatDirectCom com(EtherCAT_DataLinkLayer::instance());
+  std::vector<uint8_t> current;
+  if (!readEepromImage(wg, &com, device, current))
+  {
+    return false;
+  }
+
+  // Write runs of consecutive changed pages
+  const unsigned page_size = WGEeprom::MAX_EEPROM_PAGE_SIZE;
+  unsigned pages_written = 0;
+  unsigned page = 0;
+  while (page < WGEeprom::NUM_EEPROM_PAGES)
+  {
+    if (memcmp(&image[page*page_size], &current[page*page_size], page_size) == 0)
+    {
+      ++page;
+      continue;
+    }
+    unsigned first = page;
+    while ((page < WGEeprom::NUM_EEPROM_PAGES) && 
+           (memcmp(&image[page*page_size], &current[page*page_size], page_size) != 0))
+    {
+      ++page;
+    }
+    if (!wg->eeprom().writeEepromPages(&com, &wg->mailbox(), first, page-first, &image[first*page_size]))
+    {
+      ROS_ERROR("Device #%d : could not write EEPROM pages %d-%d", device, first, page-1);
+      return false;
+    }
+    pages_written += page-first;
+  }
+
+  if (pages_written > 0)
+  {
+    if (!readEepromImage(wg, &com, device, current))
+    {
+      return false;
+    }
+  }
+  uint32_t crc = imageCRC(current);
+  if (crc != header.data_crc32_)
+  {
+    ROS_ERROR("Device #%d : EEPROM verify failed, crc32 0x%08X, expected 0x%08X", device, crc, header.data_crc32_);
+    return false;
+  }
+
+  ROS_INFO("Device #%d : restored '%s', wrote %d of %d pages (crc32 0x%08X)", 
+           device, filename.c_str(), pages_written, WGEeprom::NUM_EEPROM_PAGES, crc);
+  return true;
+}
+
+
+// Runs EEPROM backup or restore on selected device, or on every WG0X device when none is selected
+bool forSelectedDevices(boost::function<bool (int)> func, int device, unsigned jobs, const char *what)
+{
+  if (device != -1)
+  {
+    return func(device);
+  }
+  unsigned failures = forEachDevice(boost::bind(&onlyWGDevices, func, _1), jobs);
+  if (failures > 0)
+  {
+    ROS_ERROR("EEPROM %s failed for %d devices", what, failures);
+    return false;
+  }
+  return true;
+}
+
+
+// Prints mailbox statistics of every WG0X device to stdout as YAML
+void dumpMailboxStatistics()
+{
+  std::cout << "devices:" << std::endl;
+  for (unsigned device=0; device<devices.size(); ++device)
+  {
+    WG0X *wg = dynamic_cast<WG0X *>(devices[device]);
+    if (wg == NULL)
+    {
+      continue;
+    }
+    std::cout << "  - position: " << device << std::endl;
+    std::cout << "    board: " << boardName(wg) << std::endl;
+    std::cout << "    mailbox:" << std::endl;
+    wg->mailbox().dumpMailboxStatistics(std::cout, "      ");
+  }
+}
+
+
 static struct
 {
   char *program_name_;
@@ -388,6 +831,10 @@ static struct
   string board_;
   bool update_motor_heating_config_;
   bool enforce_heating_model_;
+  bool mailbox_stats_;
+  unsigned jobs_;
+  string backup_;
+  string restore_;
 } g_options;
 
 void Usage(string msg = "")
@@ -414,6 +861,11 @@ void Usage(string msg = "")
     const WG0XActuatorInfo &info(p.second.actuator_info_);
     fprintf(stderr, "        %s - %s %s\n", name.c_str(), info.motor_make_, info.motor_model_);
   }
+  fprintf(stderr, " -B, --backup <dir>     Save whole EEPROM of selected device (default: all boards) into <dir>\n");
+  fprintf(stderr, " -R, --restore <path>   Restore whole EEPROM of selected device (default: all boards) from\n");
+  fprintf(stderr, "                        images in directory <path>, or from image file <path> when -d is given\n");
+  fprintf(stderr, " -j, --jobs <n>         With -U, -B or -R, work on at most <n> devices at once (default: all)\n");
+  fprintf(stderr, " -s, --mailbox_stats   Print mailbox latency statistics of all boards (YAML) before exiting\n");
   fprintf(stderr, " -h, --help    Print this message and exit\n");
   if (msg != "")
   {
@@ -652,6 +1104,8 @@ int main(int argc, char *argv[])
   g_options.board_ = "";
   g_options.update_motor_heating_config_ = false;
   g_options.enforce_heating_model_ = false;
+  g_options.mailbox_stats_ = false;
+  g_options.jobs_ = UINT_MAX;
   while (1)
   {
     static struct option long_options[] = {
@@ -665,9 +1119,13 @@ int main(int argc, char *argv[])
       {"actuators", required_argument, 0, 'a'},
       {"update_heating_config", no_argument, 0, 'U'},
       {"enforce_heating_model", no_argument, 0, 'H'},
+      {"mailbox_stats", no_argument, 0, 's'},
+      {"jobs", required_argument, 0, 'j'},
+      {"backup", required_argument, 0, 'B'},
+      {"restore", required_argument, 0, 'R'},
     };
     int option_index = 0;
-    int c = getopt_long(argc, argv, "d:b:hi:m:n:pa:UH", long_options, &option_index);
+    int c = getopt_long(argc, argv, "d:b:hi:m:n:pa:UHsj:B:R:", long_options, &option_index);
     if (c == -1) break;
     switch (c)
     {
@@ -701,6 +1159,18 @@ int main(int argc, char *argv[])
       case 'H':
         g_options.enforce_heating_model_ = true;
         break;
+      case 's':
+        g_options.mailbox_stats_ = true;
+        break;
+      case 'j':
+        g_options.jobs_ = std::max(1, atoi(optarg));
+        break;
+      case 'B':
+        g_options.backup_ = optarg;
+        break;
+      case 'R':
+        g_options.restore_ = optarg;
+        break;
     }
   }
 
@@ -747,11 +1217,35 @@ int main(int argc, char *argv[])
     ROS_WARN("mlockall failed : %s", strerror(errno));
   }
 
+  if ((g_options.backup_ != "") && (g_options.restore_ != ""))
+    Usage("Backup and restore cannot be done at the same time");
+
   init(g_options.interface_);
 
+  if (g_options.backup_ != "")
+  {
+    if (!forSelectedDevices(boost::bind(&backupEeprom, _1, g_options.backup_), 
+                            g_options.device_, g_options.jobs_, "backup"))
+    {
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (g_options.restore_ != "")
+  {
+    if (!forSelectedDevices(boost::bind(&restoreEeprom, _1, g_options.restore_), 
+                            g_options.device_, g_options.jobs_, "restore"))
+    {
+      exit(EXIT_FAILURE);
+    }
+  }
+
   if (g_options.update_motor_heating_config_)
   {
-    updateAllHeatingConfig();
+    if (!updateAllHeatingConfig(g_options.jobs_))
+    {
+      exit(EXIT_FAILURE);
+    }
   }
 
   if (g_options.program_)
@@ -781,6 +1275,11 @@ int main(int argc, char *argv[])
     programDevice(g_options.device_, motors[g_options.motor_], g_options.name_, board, enforce_heating_model);
   }
 
+  if (g_options.mailbox_stats_)
+  {
+    dumpMailboxStatistics();
+  }
+
   return 0;
 }
 
@@ -0,0 +1,560 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/multi_chain_netif.h"
+
+#include <dll/ethercat_frame.h>
+#include <ros/console.h>
+
+#include <pthread.h>
+#include <string.h>
+
+namespace ethercat_hardware
+{
+
+static const unsigned FRAME_SIZE = 2048;   //!< Large enough for any EtherCAT frame
+static const unsigned MAX_PENDING = 16;    //!< Frames that can be in flight at once
+static const unsigned MAX_TXANDRX_TRIES = 10;  //!< Times txandrx() sends frame before giving up, same as EML socket driver
+
+
+/*!
+ * \brief State of interface that combines several chains.
+ *
+ * Each frame in flight has a pending slot, whose index is handle returned by tx().
+ * Slot holds handles the chains returned for frame.  Forwarded frames are only on 
+ * one chain at a time, stage_ is index of that chain.
+ */
+struct MultiChainNetif
+{
+  struct netif ni_;  //!< Must be first member, EML only knows about netif pointer
+
+  std::vector<struct netif*> chains_;
+  unsigned max_chain_retries_;
+  struct netif_counters own_counters_;  //!< Errors found by combined interface itself, added to counters of chains.  Only changed atomically.
+  pthread_mutex_t counters_lock_;       //!< Serializes updateCounters()
+
+  volatile bool process_data_;
+  pthread_t process_data_thread_;
+
+  volatile uint64_t process_data_frames_;
+  volatile uint64_t forwarded_frames_;
+  volatile uint64_t chain_retries_[MultiChainStats::MAX_CHAINS];
+  volatile uint64_t chain_failures_[MultiChainStats::MAX_CHAINS];
+  uint64_t late_rtt_sums_[MultiChainStats::MAX_CHAINS];  //!< Late packet RTT sum of each chain, when counters were last added up
+
+  enum PendingState {FREE, IN_USE};
+  struct Pending
+  {
+    volatile int state_;
+    bool process_data_;
+    unsigned stage_;
+    int handles_[MultiChainStats::MAX_CHAINS];
+    unsigned tx_length_;
+    unsigned char tx_data_[FRAME_SIZE];      //!< Process data frame as it was sent
+    unsigned char reply_data_[FRAME_SIZE];   //!< Reply from one chain
+    unsigned char merged_data_[FRAME_SIZE];  //!< Replies of all chains merged so far
+  };
+  Pending pending_[MAX_PENDING];
+};
+
+
+static MultiChainNetif *getMultiChainNetif(struct netif *ni)
+{
+  return reinterpret_cast<MultiChainNetif*>(ni);
+}
+
+
+static uint16_t getUint16(const unsigned char *data)
+{
+  return uint16_t(data[0]) | (uint16_t(data[1]) << 8);
+}
+
+
+static void putUint16(unsigned char *data, uint16_t value)
+{
+  data[0] = value & 0xFF;
+  data[1] = (value >> 8) & 0xFF;
+}
+
+
+bool mergeChainReply(unsigned char *merged, const unsigned char *sent, const unsigned char *reply, unsigned length)
+{
+  static const unsigned FRAME_HEADER_SIZE = 2;
+  static const unsigned DATAGRAM_HEADER_SIZE = 10;
+  static const unsigned WKC_SIZE = 2;
+  unsigned offset = FRAME_HEADER_SIZE;
+  for (;;)
+  {
+    if (offset + DATAGRAM_HEADER_SIZE + WKC_SIZE > length)
+    {
+      return false;
+    }
+    uint16_t len_field = getUint16(sent + offset + 6);
+    unsigned data_length = len_field & 0x7FF;
+    bool more = len_field & 0x8000;
+    unsigned wkc_offset = offset + DATAGRAM_HEADER_SIZE + data_length;
+    if (wkc_offset + WKC_SIZE > length)
+    {
+      return false;
+    }
+    for (unsigned i = offset; i < wkc_offset; ++i)
+    {
+      if (reply[i] != sent[i])
+      {
+        merged[i] = reply[i];
+      }
+    }
+    uint16_t wkc = getUint16(merged + wkc_offset) + getUint16(reply + wkc_offset) - getUint16(sent + wkc_offset);
+    putUint16(merged + wkc_offset, wkc);
+    offset = wkc_offset + WKC_SIZE;
+    if (!more)
+    {
+      return true;
+    }
+  }
+}
+
+
+/*!
+ * \brief Copies counters of all chains into counters of combined interface.
+ *
+ * Every chain counts its own frames, so a forwarded frame is counted once per chain.
+ * Called after each frame completes, so counters only lag chains by frames in flight.
+ * Frames can complete in several threads at once : one of them adds up counters, 
+ * and others skip it rather than wait, since next frame to complete catches up anyway.
+ * Totals are added up in a local copy, so readers never see half-summed counters.
+ */
+static void updateCounters(MultiChainNetif *mc)
+{
+  if (pthread_mutex_trylock(&mc->counters_lock_) != 0)
+  {
+    return;
+  }
+  struct netif_counters &c(mc->ni_.counters);
+  struct netif_counters total(mc->own_counters_);
+  total.rx_late_pkt_rtt_us = c.rx_late_pkt_rtt_us;
+  bool is_stopped = false;
+  for (unsigned i = 0; i < mc->chains_.size(); ++i)
+  {
+    const struct netif_counters &cc(mc->chains_[i]->counters);
+    total.sent           += cc.sent;
+    total.received       += cc.received;
+    total.collected      += cc.collected;
+    total.dropped        += cc.dropped;
+    total.tx_error       += cc.tx_error;
+    total.tx_net_down    += cc.tx_net_down;
+    total.tx_would_block += cc.tx_would_block;
+    total.tx_no_bufs     += cc.tx_no_bufs;
+    total.tx_full        += cc.tx_full;
+    total.rx_runt_pkt    += cc.rx_runt_pkt;
+    total.rx_not_ecat    += cc.rx_not_ecat;
+    total.rx_other_eml   += cc.rx_other_eml;
+    total.rx_bad_index   += cc.rx_bad_index;
+    total.rx_bad_seqnum  += cc.rx_bad_seqnum;
+    total.rx_dup_seqnum  += cc.rx_dup_seqnum;
+    total.rx_dup_pkt     += cc.rx_dup_pkt;
+    total.rx_bad_order   += cc.rx_bad_order;
+    total.rx_late_pkt    += cc.rx_late_pkt;
+    total.rx_late_pkt_rtt_us_sum += cc.rx_late_pkt_rtt_us_sum;
+    // Only RTT of last late packet is kept, take it from chain that measured one since last time
+    if (cc.rx_late_pkt_rtt_us_sum != mc->late_rtt_sums_[i])
+    {
+      mc->late_rtt_sums_[i] = cc.rx_late_pkt_rtt_us_sum;
+      total.rx_late_pkt_rtt_us = cc.rx_late_pkt_rtt_us;
+    }
+    is_stopped = is_stopped || mc->chains_[i]->is_stopped;
+  }
+  c = total;
+  mc->ni_.is_stopped = is_stopped;
+  pthread_mutex_unlock(&mc->counters_lock_);
+}
+
+
+static void freePending(MultiChainNetif *mc, unsigned handle)
+{
+  __sync_synchronize();
+  mc->pending_[handle].state_ = MultiChainNetif::FREE;
+}
+
+
+static int multiChainTx(struct EtherCAT_Frame *frame, struct netif *ni)
+{
+  MultiChainNetif *mc = getMultiChainNetif(ni);
+  int handle = -1;
+  for (unsigned i = 0; i < MAX_PENDING; ++i)
+  {
+    if (__sync_bool_compare_and_swap(&mc->pending_[i].state_, MultiChainNetif::FREE, MultiChainNetif::IN_USE))
+    {
+      handle = i;
+      break;
+    }
+  }
+  if (handle < 0)
+  {
+    __sync_fetch_and_add(&mc->own_counters_.tx_full, 1);
+    return -1;
+  }
+
+  MultiChainNetif::Pending &p(mc->pending_[handle]);
+  p.process_data_ = mc->process_data_ && pthread_equal(mc->process_data_thread_, pthread_self());
+  p.stage_ = 0;
+  if (!p.process_data_)
+  {
+    struct netif *chain = mc->chains_[0];
+    p.handles_[0] = chain->tx(frame, chain);
+    if (p.handles_[0] < 0)
+    {
+      freePending(mc, handle);
+      return -1;
+    }
+    ++mc->forwarded_frames_;
+    return handle;
+  }
+
+  int length = framedump(frame, p.tx_data_, sizeof(p.tx_data_));
+  if (length <= 0)
+  {
+    __sync_fetch_and_add(&mc->own_counters_.tx_error, 1);
+    freePending(mc, handle);
+    return -1;
+  }
+  p.tx_length_ = length;
+  for (unsigned i = 0; i < mc->chains_.size(); ++i)
+  {
+    struct netif *chain = mc->chains_[i];
+    p.handles_[i] = chain->tx(frame, chain);
+    if (p.handles_[i] < 0)
+    {
+      for (unsigned j = 0; j < i; ++j)
+      {
+        mc->chains_[j]->drop(mc->chains_[j], p.handles_[j]);
+      }
+      freePending(mc, handle);
+      return -1;
+    }
+  }
+  ++mc->process_data_frames_;
+  return handle;
+}
+
+
+/*!
+ * \brief Collects reply to process data frame from every chain, and merges them.
+ *
+ * Chains are waited for one after another.  Chain that did not return frame 
+ * is sent a fresh copy, without sending frame to other chains again.
+ */
+static bool receiveProcessData(MultiChainNetif *mc, struct EtherCAT_Frame *frame, unsigned handle)
+{
+  MultiChainNetif::Pending &p(mc->pending_[handle]);
+  memcpy(p.merged_data_, p.tx_data_, p.tx_length_);
+  for (unsigned i = 0; i < mc->chains_.size(); ++i)
+  {
+    struct netif *chain = mc->chains_[i];
+    bool success = chain->rx(frame, chain, p.handles_[i]);
+    for (unsigned retry = 0; !success && (retry < mc->max_chain_retries_); ++retry)
+    {
+      // Frame may hold reply from other chain, restore it to what was sent
+      if (!framebuild(frame, p.tx_data_))
+      {
+        break;
+      }
+      ++mc->chain_retries_[i];
+      p.handles_[i] = chain->tx(frame, chain);
+      if (p.handles_[i] < 0)
+      {
+        break;
+      }
+      success = chain->rx(frame, chain, p.handles_[i]);
+    }
+
+    if (!success)
+    {
+      ++mc->chain_failures_[i];
+      for (unsigned j = i+1; j < mc->chains_.size(); ++j)
+      {
+        mc->chains_[j]->drop(mc->chains_[j], p.handles_[j]);
+      }
+      return false;
+    }
+
+    int length = framedump(frame, p.reply_data_, sizeof(p.reply_data_));
+    if ((length != int(p.tx_length_)) || !mergeChainReply(p.merged_data_, p.tx_data_, p.reply_data_, p.tx_length_))
+    {
+      __sync_fetch_and_add(&mc->own_counters_.rx_runt_pkt, 1);
+      for (unsigned j = i+1; j < mc->chains_.size(); ++j)
+      {
+        mc->chains_[j]->drop(mc->chains_[j], p.handles_[j]);
+      }
+      return false;
+    }
+  }
+  return framebuild(frame, p.merged_data_);
+}
+
+
+/*!
+ * \brief Waits for forwarded frame to return from its current chain, and sends it through next one.
+ *
+ * Without wait, returns false as soon as current chain has not returned frame yet.
+ */
+static bool receiveForwarded(MultiChainNetif *mc, struct EtherCAT_Frame *frame, unsigned handle, bool wait, bool &done)
+{
+  MultiChainNetif::Pending &p(mc->pending_[handle]);
+  for (;;)
+  {
+    struct netif *chain = mc->chains_[p.stage_];
+    bool success = wait ? chain->rx(frame, chain, p.handles_[p.stage_]) : 
+      chain->rx_nowait(frame, chain, p.handles_[p.stage_]);
+    if (!success)
+    {
+      // Frame that was waited for is dropped by chain
+      done = wait;
+      return false;
+    }
+    if (++p.stage_ >= mc->chains_.size())
+    {
+      done = true;
+      return true;
+    }
+    chain = mc->chains_[p.stage_];
+    p.handles_[p.stage_] = chain->tx(frame, chain);
+    if (p.handles_[p.stage_] < 0)
+    {
+      done = true;
+      return false;
+    }
+  }
+}
+
+
+static bool multiChainReceive(struct EtherCAT_Frame *frame, struct netif *ni, int handle, bool wait)
+{
+  MultiChainNetif *mc = getMultiChainNetif(ni);
+  if ((handle < 0) || (handle >= int(MAX_PENDING)) || (mc->pending_[handle].state_ != MultiChainNetif::IN_USE))
+  {
+    __sync_fetch_and_add(&mc->own_counters_.rx_bad_index, 1);
+    return false;
+  }
+
+  bool success;
+  bool done = true;
+  if (mc->pending_[handle].process_data_)
+  {
+    // Chains are not polled, process data is always waited for
+    success = receiveProcessData(mc, frame, handle);
+  }
+  else
+  {
+    success = receiveForwarded(mc, frame, handle, wait, done);
+  }
+  if (done)
+  {
+    freePending(mc, handle);
+    updateCounters(mc);
+  }
+  return success;
+}
+
+
+static bool multiChainRx(struct EtherCAT_Frame *frame, struct netif *ni, int handle)
+{
+  return multiChainReceive(frame, ni, handle, true);
+}
+
+
+static bool multiChainRxNowait(struct EtherCAT_Frame *frame, struct netif *ni, int handle)
+{
+  return multiChainReceive(frame, ni, handle, false);
+}
+
+
+/*!
+ * \brief Sends frame through chains and waits for it to return.
+ *
+ * Used by EtherCAT_DataLinkLayer::txandrx(), so EML init and EthercatDirectCom work on 
+ * combined interface.  Frame goes through same path as with tx() and rx() : forwarded 
+ * through chains, or sent to all chains and merged, with per-chain retries.  
+ * Like EML socket driver, exchange that still fails is started over.
+ */
+static bool multiChainTxandrx(struct EtherCAT_Frame *frame, struct netif *ni)
+{
+  // Failed exchange can leave reply from some of the chains in frame
+  unsigned char sent[FRAME_SIZE];
+  if (framedump(frame, sent, sizeof(sent)) <= 0)
+  {
+    __sync_fetch_and_add(&getMultiChainNetif(ni)->own_counters_.tx_error, 1);
+    return false;
+  }
+
+  for (unsigned tries = 0; tries < MAX_TXANDRX_TRIES; ++tries)
+  {
+    if ((tries > 0) && !framebuild(frame, sent))
+    {
+      return false;
+    }
+    int handle = multiChainTx(frame, ni);
+    if (handle < 0)
+    {
+      return false;
+    }
+    if (multiChainRx(frame, ni, handle))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static int multiChainDrop(struct netif *ni, int handle)
+{
+  MultiChainNetif *mc = getMultiChainNetif(ni);
+  if ((handle < 0) || (handle >= int(MAX_PENDING)) || (mc->pending_[handle].state_ != MultiChainNetif::IN_USE))
+  {
+    return -1;
+  }
+  MultiChainNetif::Pending &p(mc->pending_[handle]);
+  if (p.process_data_)
+  {
+    for (unsigned i = 0; i < mc->chains_.size(); ++i)
+    {
+      mc->chains_[i]->drop(mc->chains_[i], p.handles_[i]);
+    }
+  }
+  else
+  {
+    mc->chains_[p.stage_]->drop(mc->chains_[p.stage_], p.handles_[p.stage_]);
+  }
+  freePending(mc, handle);
+  updateCounters(mc);
+  return 0;
+}
+
+
+struct netif *initMultiChainNetif(const std::vector<struct netif*> &chains, unsigned max_chain_retries)
+{
+  if (chains.empty() || (chains.size() > MultiChainStats::MAX_CHAINS))
+  {
+    ROS_ERROR("Can not combine %u chains, at most %u are supported", 
+              unsigned(chains.size()), unsigned(MultiChainStats::MAX_CHAINS));
+    return NULL;
+  }
+  for (unsigned i = 0; i < chains.size(); ++i)
+  {
+    if (chains[i] == NULL)
+    {
+      ROS_ERROR("Chain %u has no network interface", i);
+      return NULL;
+    }
+  }
+
+  MultiChainNetif *mc = new MultiChainNetif;
+  memset(&mc->ni_, 0, sizeof(mc->ni_));
+  memset(&mc->own_counters_, 0, sizeof(mc->own_counters_));
+  pthread_mutex_init(&mc->counters_lock_, NULL);
+  mc->ni_.tx = multiChainTx;
+  mc->ni_.rx = multiChainRx;
+  mc->ni_.rx_nowait = multiChainRxNowait;
+  mc->ni_.txandrx = multiChainTxandrx;
+  mc->ni_.drop = multiChainDrop;
+  memcpy(mc->ni_.hwaddr, chains[0]->hwaddr, sizeof(mc->ni_.hwaddr));
+  mc->ni_.is_stopped = 0;
+
+  mc->chains_ = chains;
+  mc->max_chain_retries_ = max_chain_retries;
+  mc->process_data_ = false;
+  mc->process_data_thread_ = pthread_self();
+  mc->process_data_frames_ = 0;
+  mc->forwarded_frames_ = 0;
+  for (unsigned i = 0; i < MultiChainStats::MAX_CHAINS; ++i)
+  {
+    mc->chain_retries_[i] = 0;
+    mc->chain_failures_[i] = 0;
+    mc->late_rtt_sums_[i] = (i < chains.size()) ? chains[i]->counters.rx_late_pkt_rtt_us_sum : 0;
+  }
+  for (unsigned i = 0; i < MAX_PENDING; ++i)
+  {
+    mc->pending_[i].state_ = MultiChainNetif::FREE;
+    mc->pending_[i].process_data_ = false;
+    mc->pending_[i].stage_ = 0;
+    mc->pending_[i].tx_length_ = 0;
+  }
+  updateCounters(mc);
+
+  return &mc->ni_;
+}
+
+
+int closeMultiChainNetif(struct netif *ni)
+{
+  if (ni == NULL)
+  {
+    return -1;
+  }
+  MultiChainNetif *mc = getMultiChainNetif(ni);
+  pthread_mutex_destroy(&mc->counters_lock_);
+  delete mc;
+  return 0;
+}
+
+
+void setMultiChainProcessData(struct netif *ni, bool process_data)
+{
+  MultiChainNetif *mc = getMultiChainNetif(ni);
+  if (process_data)
+  {
+    mc->process_data_thread_ = pthread_self();
+  }
+  __sync_synchronize();
+  mc->process_data_ = process_data;
+}
+
+
+void getMultiChainStats(struct netif *ni, MultiChainStats &stats)
+{
+  MultiChainNetif *mc = getMultiChainNetif(ni);
+  stats.num_chains_ = mc->chains_.size();
+  stats.process_data_frames_ = mc->process_data_frames_;
+  stats.forwarded_frames_ = mc->forwarded_frames_;
+  for (unsigned i = 0; i < MultiChainStats::MAX_CHAINS; ++i)
+  {
+    stats.chain_retries_[i] = mc->chain_retries_[i];
+    stats.chain_failures_[i] = mc->chain_failures_[i];
+  }
+}
+
+
+}; //end namespace ethercat_hardware
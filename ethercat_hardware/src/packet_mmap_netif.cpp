@@ -0,0 +1,1189 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/packet_mmap_netif.h"
+
+#include <dll/ethercat_frame.h>
+#include <ros/console.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace ethercat_hardware
+{
+
+static const uint16_t ETHERCAT_ETHERTYPE = 0x88A4;
+static const unsigned FRAME_SIZE = PACKET_MMAP_FRAME_SIZE;
+//! Flipped in sequence number of redundant copy of process data frame, so copy maps to same pending slot
+static const uint16_t REDUNDANT_SEQNUM_BIT = 0x8000;
+static const unsigned MAX_PENDING = 16;           //!< Frames that can be in flight at once, must be power of 2
+static const unsigned MIN_ETHERNET_FRAME = 60;    //!< Minimum ethernet frame size, without FCS
+static const unsigned MAX_TXANDRX_TRIES = 10;     //!< Times txandrx() sends frame before giving up, same as EML socket driver
+
+
+/*!
+ * \brief Histogram of process data round trip times, used to find median and 99.9th percentile.
+ *
+ * Percentiles are recalculated every UPDATE_INTERVAL samples, after which counts are halved, 
+ * so estimates follow changes in network timing.
+ */
+struct RttHistogram
+{
+  static const unsigned BUCKET_US = 4;
+  static const unsigned NUM_BUCKETS = 256;        //!< Last bucket counts everything slower
+  static const unsigned UPDATE_INTERVAL = 1024;
+  static const unsigned MIN_SAMPLES = 1000;       //!< Percentiles are not used until this many samples are seen
+
+  RttHistogram() : total_(0), since_update_(0), median_us_(0), p999_us_(0) 
+  { 
+    memset(counts_, 0, sizeof(counts_));
+  }
+
+  void record(int64_t rtt_us)
+  {
+    unsigned bucket = (rtt_us < 0) ? 0 : unsigned(rtt_us / BUCKET_US);
+    if (bucket >= NUM_BUCKETS)
+    {
+      bucket = NUM_BUCKETS-1;
+    }
+    ++counts_[bucket];
+    ++total_;
+    if (++since_update_ >= UPDATE_INTERVAL)
+    {
+      update();
+    }
+  }
+
+  void update()
+  {
+    since_update_ = 0;
+    if (total_ < MIN_SAMPLES)
+    {
+      return;
+    }
+    uint32_t median_count = total_ / 2;
+    uint32_t p999_count = total_ - total_ / 1000;
+    uint32_t sum = 0;
+    unsigned median = 0, p999 = 0;
+    bool median_found = false;
+    for (unsigned i=0; i<NUM_BUCKETS; ++i)
+    {
+      sum += counts_[i];
+      if (!median_found && (sum >= median_count))
+      {
+        median = (i+1) * BUCKET_US;
+        median_found = true;
+      }
+      if (sum >= p999_count)
+      {
+        // 99.9th percentile beyond histogram range means replies are too unpredictable to resend early
+        p999 = (i == NUM_BUCKETS-1) ? 0 : (i+1) * BUCKET_US;
+        break;
+      }
+    }
+    median_us_ = median;
+    p999_us_ = p999;
+
+    uint32_t total = 0;
+    for (unsigned i=0; i<NUM_BUCKETS; ++i)
+    {
+      counts_[i] /= 2;
+      total += counts_[i];
+    }
+    total_ = total;
+  }
+
+  uint32_t counts_[NUM_BUCKETS];
+  uint32_t total_;
+  unsigned since_update_;
+  volatile unsigned median_us_;  //!< Upper bound of bucket holding median, zero if unknown
+  volatile unsigned p999_us_;    //!< Upper bound of bucket holding 99.9th percentile, zero if unknown
+};
+
+
+/*!
+ * \brief State of PACKET_MMAP network interface.
+ *
+ * Sequence number of each sent frame is stored in last two bytes of source MAC address,
+ * which devices return unchanged.  Sequence number also selects pending slot that tracks frame.
+ */
+struct PacketMmapNetif
+{
+  struct netif ni_;  //!< Must be first member, EML only knows about netif pointer
+
+  int fd_;               //!< -1 for test interface
+  int (*kick_)(void *arg);  //!< Replaces send() on test interface
+  void *kick_arg_;
+  char *ring_;           //!< Mapped rings, NULL for test interface
+  size_t ring_size_;
+  char *rx_ring_;
+  char *tx_ring_;
+  unsigned num_frames_;
+  unsigned rx_next_;     //!< Next RX ring frame to look at, protected by rx_lock_
+  unsigned tx_next_;     //!< Next TX ring frame to fill in, protected by tx_lock_
+  uint16_t seqnum_;      //!< Sequence number of next frame, protected by tx_lock_
+  volatile int64_t timeout_us_;
+  bool spin_;
+  unsigned sleep_slice_us_;
+  pthread_mutex_t tx_lock_;
+  pthread_mutex_t rx_lock_;
+
+  // Process data frames, see setPacketMmapProcessData()
+  volatile bool process_data_;
+  pthread_t process_data_thread_;
+  bool early_resend_;
+  unsigned max_resends_;
+  unsigned min_resend_us_;
+  RttHistogram rtt_;       //!< Only updated by thread receiving process data
+  bool redundant_pd_;
+  volatile uint64_t resends_;
+  volatile uint64_t duplicates_;
+  volatile uint64_t redundant_sent_;
+  volatile uint64_t redundant_used_;
+  volatile uint64_t invalid_replies_;
+
+  // Timestamping, see PacketMmapStats
+  bool timestamps_;
+  bool hardware_timestamps_;
+  MetricsHistogram host_send_;   //!< Only updated by thread receiving process data
+  MetricsHistogram wire_;
+  MetricsHistogram host_wake_;
+  volatile uint64_t timestamps_missing_;
+
+  enum PendingState {FREE, WAITING, FILLING, RECEIVED};
+  struct Pending
+  {
+    volatile int state_;
+    uint16_t seqnum_;
+    unsigned length_;
+    unsigned char data_[FRAME_SIZE];  //!< Frame received by thread that did not send it
+
+    bool process_data_;
+    bool redundant_;                  //!< Copy with REDUNDANT_SEQNUM_BIT flipped was also sent
+    volatile int outstanding_;        //!< Copies sent that have not returned yet
+    unsigned resends_;
+    int64_t sent_us_;                 //!< Time frame was last sent
+    timespec tx_start_;               //!< CLOCK_REALTIME when tx() was called, only kept with timestamps
+    unsigned tx_slot_;                //!< TX ring frame that frame was sent from, holds its TX timestamp
+    timespec rx_timestamp_;           //!< RX timestamp of reply
+    bool rx_timestamp_valid_;
+    unsigned tx_length_;
+    unsigned char tx_data_[FRAME_SIZE];  //!< Copy of sent process data frame, for sending it again
+  };
+  Pending pending_[MAX_PENDING];
+};
+
+
+static PacketMmapNetif *getPacketMmapNetif(struct netif *ni)
+{
+  return reinterpret_cast<PacketMmapNetif*>(ni);
+}
+
+
+static int64_t monotonicUs()
+{
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+
+//! Frees pending slot of frame that will not be waited for any longer
+static void dropPending(PacketMmapNetif *pm, unsigned handle)
+{
+  PacketMmapNetif::Pending &p(pm->pending_[handle]);
+  for (;;)
+  {
+    int state = p.state_;
+    if ((state == PacketMmapNetif::FREE) || 
+        ((state != PacketMmapNetif::FILLING) && __sync_bool_compare_and_swap(&p.state_, state, PacketMmapNetif::FREE)))
+    {
+      return;
+    }
+    // Another thread is copying frame into slot, this only takes a moment
+  }
+}
+
+
+//! Asks kernel to send frames queued in TX ring
+static int kickTx(PacketMmapNetif *pm)
+{
+  if (pm->kick_ != NULL)
+  {
+    return pm->kick_(pm->kick_arg_);
+  }
+  return send(pm->fd_, NULL, 0, MSG_DONTWAIT);
+}
+
+
+//! Returns true if kernel is done with TX ring frame.  Sent frames may also have timestamp flags set.
+static bool txFrameAvailable(const tpacket2_hdr *hdr)
+{
+  return !(hdr->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING | TP_STATUS_WRONG_FORMAT));
+}
+
+
+static int packetMmapTx(struct EtherCAT_Frame *frame, struct netif *ni)
+{
+  PacketMmapNetif *pm = getPacketMmapNetif(ni);
+  pthread_mutex_lock(&pm->tx_lock_);
+
+  // Find sequence number whose pending slot is free
+  int handle = -1;
+  uint16_t seqnum = 0;
+  for (unsigned i=0; i<MAX_PENDING; ++i)
+  {
+    seqnum = pm->seqnum_++;
+    unsigned h = seqnum & (MAX_PENDING-1);
+    if (__sync_bool_compare_and_swap(&pm->pending_[h].state_, PacketMmapNetif::FREE, PacketMmapNetif::WAITING))
+    {
+      pm->pending_[h].seqnum_ = seqnum;
+      handle = h;
+      break;
+    }
+  }
+  if (handle < 0)
+  {
+    ++ni->counters.tx_full;
+    pthread_mutex_unlock(&pm->tx_lock_);
+    return -1;
+  }
+
+  tpacket2_hdr *hdr = (tpacket2_hdr*) (pm->tx_ring_ + (pm->tx_next_ % pm->num_frames_) * FRAME_SIZE);
+  if (!txFrameAvailable(hdr))
+  {
+    ++ni->counters.tx_full;
+    dropPending(pm, handle);
+    pthread_mutex_unlock(&pm->tx_lock_);
+    return -1;
+  }
+
+  PacketMmapNetif::Pending &p(pm->pending_[handle]);
+  p.process_data_ = pm->process_data_ && pthread_equal(pm->process_data_thread_, pthread_self());
+  if (p.process_data_ && pm->timestamps_)
+  {
+    clock_gettime(CLOCK_REALTIME, &p.tx_start_);
+    p.tx_slot_ = pm->tx_next_ % pm->num_frames_;
+    p.rx_timestamp_valid_ = false;
+  }
+
+  // Frame is built in place in TX ring
+  unsigned data_offset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+  unsigned char *data = (unsigned char*) hdr + data_offset;
+  struct ether_header *eh = (struct ether_header*) data;
+  memset(eh->ether_dhost, 0xFF, ETH_ALEN);
+  memcpy(eh->ether_shost, ni->hwaddr, ETH_ALEN);
+  eh->ether_shost[4] = seqnum >> 8;
+  eh->ether_shost[5] = seqnum & 0xFF;
+  eh->ether_type = htons(ETHERCAT_ETHERTYPE);
+  int length = framedump(frame, data + sizeof(struct ether_header), FRAME_SIZE - data_offset - sizeof(struct ether_header));
+  if (length <= 0)
+  {
+    ++ni->counters.tx_error;
+    dropPending(pm, handle);
+    pthread_mutex_unlock(&pm->tx_lock_);
+    return -1;
+  }
+  length += sizeof(struct ether_header);
+  if (length < int(MIN_ETHERNET_FRAME))
+  {
+    memset(data + length, 0, MIN_ETHERNET_FRAME - length);
+    length = MIN_ETHERNET_FRAME;
+  }
+
+  p.redundant_ = false;
+  p.outstanding_ = 1;
+  p.resends_ = 0;
+  p.sent_us_ = monotonicUs();
+  if (p.process_data_ && (pm->early_resend_ || pm->redundant_pd_))
+  {
+    memcpy(p.tx_data_, data, length);
+    p.tx_length_ = length;
+  }
+
+  hdr->tp_len = length;
+  __sync_synchronize();
+  hdr->tp_status = TP_STATUS_SEND_REQUEST;
+  ++pm->tx_next_;
+
+  // Redundant copy goes out in same send() call, so it follows first copy on the wire
+  if (p.process_data_ && pm->redundant_pd_)
+  {
+    tpacket2_hdr *copy_hdr = (tpacket2_hdr*) (pm->tx_ring_ + (pm->tx_next_ % pm->num_frames_) * FRAME_SIZE);
+    if (!txFrameAvailable(copy_hdr))
+    {
+      ++ni->counters.tx_full;
+    }
+    else
+    {
+      unsigned char *copy_data = (unsigned char*) copy_hdr + data_offset;
+      memcpy(copy_data, data, length);
+      struct ether_header *copy_eh = (struct ether_header*) copy_data;
+      copy_eh->ether_shost[4] ^= (REDUNDANT_SEQNUM_BIT >> 8);
+      p.redundant_ = true;
+      p.outstanding_ = 2;
+      copy_hdr->tp_len = length;
+      __sync_synchronize();
+      copy_hdr->tp_status = TP_STATUS_SEND_REQUEST;
+      ++pm->tx_next_;
+      ++pm->redundant_sent_;
+    }
+  }
+
+  if (kickTx(pm) < 0)
+  {
+    if (errno == ENETDOWN)
+      ++ni->counters.tx_net_down;
+    else if (errno == EAGAIN)
+      ++ni->counters.tx_would_block;
+    else if (errno == ENOBUFS)
+      ++ni->counters.tx_no_bufs;
+    else
+      ++ni->counters.tx_error;
+    dropPending(pm, handle);
+    pthread_mutex_unlock(&pm->tx_lock_);
+    return -1;
+  }
+
+  ++ni->counters.sent;
+  if (p.redundant_)
+  {
+    ++ni->counters.sent;
+  }
+  pthread_mutex_unlock(&pm->tx_lock_);
+  return handle;
+}
+
+
+//! Sends process data frame again, with same sequence number.  First reply to arrive is used.
+static void resendPending(PacketMmapNetif *pm, int handle)
+{
+  struct netif *ni = &pm->ni_;
+  PacketMmapNetif::Pending &p(pm->pending_[handle]);
+  pthread_mutex_lock(&pm->tx_lock_);
+  ++p.resends_;
+  p.sent_us_ = monotonicUs();
+  tpacket2_hdr *hdr = (tpacket2_hdr*) (pm->tx_ring_ + (pm->tx_next_ % pm->num_frames_) * FRAME_SIZE);
+  if (!txFrameAvailable(hdr))
+  {
+    ++ni->counters.tx_full;
+    pthread_mutex_unlock(&pm->tx_lock_);
+    return;
+  }
+  unsigned char *data = (unsigned char*) hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+  memcpy(data, p.tx_data_, p.tx_length_);
+  hdr->tp_len = p.tx_length_;
+  // Only count copy once it is queued, so reply of first copy is not held back waiting for it
+  __sync_fetch_and_add(&p.outstanding_, 1);
+  __sync_synchronize();
+  hdr->tp_status = TP_STATUS_SEND_REQUEST;
+  ++pm->tx_next_;
+  if (kickTx(pm) < 0)
+  {
+    ++ni->counters.tx_error;
+  }
+  else
+  {
+    ++ni->counters.sent;
+    ++pm->resends_;
+  }
+  pthread_mutex_unlock(&pm->tx_lock_);
+}
+
+
+//! Time after which process data frame is sent again, zero if it should not be
+static int64_t resendAfterUs(const PacketMmapNetif *pm)
+{
+  unsigned p999 = pm->rtt_.p999_us_;
+  if (!pm->early_resend_ || (p999 == 0))
+  {
+    return 0;
+  }
+  return std::max(p999, pm->min_resend_us_);
+}
+
+
+//! Hardware TX timestamps are also queued to socket error queue, which must be kept from filling up
+static void drainErrorQueue(PacketMmapNetif *pm)
+{
+  char buf[64];
+  char control[256];
+  for (unsigned i=0; i<MAX_PENDING; ++i)
+  {
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(pm->fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+    {
+      break;
+    }
+  }
+}
+
+
+//! Keeps RX timestamp of reply to process data frame, for recordLatency()
+static void keepRxTimestamp(const PacketMmapNetif *pm, const tpacket2_hdr *hdr, PacketMmapNetif::Pending &p)
+{
+  unsigned required = pm->hardware_timestamps_ ? TP_STATUS_TS_RAW_HARDWARE : (TP_STATUS_TS_SOFTWARE | TP_STATUS_TS_RAW_HARDWARE);
+  p.rx_timestamp_valid_ = p.process_data_ && pm->timestamps_ && (hdr->tp_status & required);
+  p.rx_timestamp_.tv_sec = hdr->tp_sec;
+  p.rx_timestamp_.tv_nsec = hdr->tp_nsec;
+}
+
+
+static double toSec(const timespec &ts)
+{
+  return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+}
+
+
+/*!
+ * \brief Splits round trip time of process data frame into host and wire latency.
+ *
+ * Kernel stores TX timestamp in TX ring frame once frame has been sent.
+ * That frame might already hold a newer frame, so its sequence number is checked.
+ */
+static void recordLatency(PacketMmapNetif *pm, PacketMmapNetif::Pending &p)
+{
+  if (!p.process_data_ || !pm->timestamps_)
+  {
+    return;
+  }
+  timespec wake;
+  clock_gettime(CLOCK_REALTIME, &wake);
+  if (pm->hardware_timestamps_)
+  {
+    drainErrorQueue(pm);
+  }
+  if (!p.rx_timestamp_valid_)
+  {
+    ++pm->timestamps_missing_;
+    return;
+  }
+
+  bool tx_valid = false;
+  timespec tx;
+  pthread_mutex_lock(&pm->tx_lock_);
+  const tpacket2_hdr *hdr = (const tpacket2_hdr*) (pm->tx_ring_ + p.tx_slot_ * FRAME_SIZE);
+  unsigned status = hdr->tp_status;
+  unsigned required = pm->hardware_timestamps_ ? TP_STATUS_TS_RAW_HARDWARE : (TP_STATUS_TS_SOFTWARE | TP_STATUS_TS_RAW_HARDWARE);
+  if (!(status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) && (status & required))
+  {
+    const unsigned char *data = (const unsigned char*) hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+    const struct ether_header *eh = (const struct ether_header*) data;
+    uint16_t seqnum = (uint16_t(eh->ether_shost[4]) << 8) | eh->ether_shost[5];
+    if (seqnum == p.seqnum_)
+    {
+      tx.tv_sec = hdr->tp_sec;
+      tx.tv_nsec = hdr->tp_nsec;
+      tx_valid = true;
+    }
+  }
+  pthread_mutex_unlock(&pm->tx_lock_);
+
+  double rx_time = toSec(p.rx_timestamp_);
+  if (pm->hardware_timestamps_)
+  {
+    if (!tx_valid)
+    {
+      ++pm->timestamps_missing_;
+      return;
+    }
+    double wire = rx_time - toSec(tx);
+    pm->wire_.record(wire);
+    pm->host_wake_.record(toSec(wake) - toSec(p.tx_start_) - wire);
+    return;
+  }
+
+  double tx_time = toSec(p.tx_start_);
+  if (tx_valid)
+  {
+    tx_time = toSec(tx);
+    pm->host_send_.record(tx_time - toSec(p.tx_start_));
+  }
+  else
+  {
+    ++pm->timestamps_missing_;
+  }
+  pm->wire_.record(rx_time - tx_time);
+  pm->host_wake_.record(toSec(wake) - rx_time);
+}
+
+
+/*!
+ * \brief Returns false if any datagram of EtherCAT frame has a zero working counter.
+ *
+ * Process data datagrams are handled by every device, so a zero working counter
+ * means the frame never reached the devices (or was corrupted on the way).
+ */
+static bool workingCountersValid(const unsigned char *data, unsigned length)
+{
+  static const unsigned FRAME_HEADER_SIZE = 2;
+  static const unsigned DATAGRAM_HEADER_SIZE = 10;
+  static const unsigned WKC_SIZE = 2;
+  unsigned offset = sizeof(struct ether_header) + FRAME_HEADER_SIZE;
+  for (;;)
+  {
+    if (offset + DATAGRAM_HEADER_SIZE + WKC_SIZE > length)
+    {
+      return false;
+    }
+    const unsigned char *datagram = data + offset;
+    uint16_t len_field = uint16_t(datagram[6]) | (uint16_t(datagram[7]) << 8);
+    unsigned data_length = len_field & 0x7FF;
+    bool more = len_field & 0x8000;
+    offset += DATAGRAM_HEADER_SIZE + data_length;
+    if (offset + WKC_SIZE > length)
+    {
+      return false;
+    }
+    uint16_t wkc = uint16_t(data[offset]) | (uint16_t(data[offset+1]) << 8);
+    if (wkc == 0)
+    {
+      return false;
+    }
+    offset += WKC_SIZE;
+    if (!more)
+    {
+      return true;
+    }
+  }
+}
+
+
+enum RxResult {RX_EMPTY, RX_OTHER, RX_MINE, RX_MINE_BAD};
+
+/*!
+ * \brief Takes next frame from RX ring.  Caller must hold rx_lock_.
+ *
+ * Frame for handle is built directly from ring.  
+ * Frames for other pending handles are copied to their pending slot.
+ */
+static RxResult receiveOne(PacketMmapNetif *pm, int handle, struct EtherCAT_Frame *frame)
+{
+  struct netif *ni = &pm->ni_;
+  tpacket2_hdr *hdr = (tpacket2_hdr*) (pm->rx_ring_ + (pm->rx_next_ % pm->num_frames_) * FRAME_SIZE);
+  if (!(hdr->tp_status & TP_STATUS_USER))
+  {
+    return RX_EMPTY;
+  }
+  __sync_synchronize();
+
+  RxResult result = RX_OTHER;
+  const unsigned char *data = (const unsigned char*) hdr + hdr->tp_mac;
+  unsigned length = hdr->tp_snaplen;
+  const struct sockaddr_ll *sll = (const struct sockaddr_ll*) ((const char*) hdr + TPACKET_ALIGN(sizeof(tpacket2_hdr)));
+  const struct ether_header *eh = (const struct ether_header*) data;
+
+  if (sll->sll_pkttype == PACKET_OUTGOING)
+  {
+    // Frame sent by this or another socket on interface
+  }
+  else if ((length < sizeof(struct ether_header) + 2) || (length > FRAME_SIZE))
+  {
+    ++ni->counters.rx_runt_pkt;
+  }
+  else if (ntohs(eh->ether_type) != ETHERCAT_ETHERTYPE)
+  {
+    ++ni->counters.rx_not_ecat;
+  }
+  else 
+  {
+    uint16_t seqnum = (uint16_t(eh->ether_shost[4]) << 8) | eh->ether_shost[5];
+    unsigned h = seqnum & (MAX_PENDING-1);
+    PacketMmapNetif::Pending &p(pm->pending_[h]);
+    bool is_copy = p.redundant_ && (seqnum == (p.seqnum_ ^ REDUNDANT_SEQNUM_BIT));
+    if (is_copy)
+    {
+      seqnum = p.seqnum_;
+    }
+    if ((p.state_ != PacketMmapNetif::WAITING) && (p.seqnum_ == seqnum) && ((p.resends_ > 0) || p.redundant_))
+    {
+      // Reply to other copy of process data frame that was sent again
+      ++ni->counters.rx_dup_pkt;
+      ++pm->duplicates_;
+    }
+    else if (p.state_ != PacketMmapNetif::WAITING)
+    {
+      // Frame came back after it was dropped, or was duplicated
+      ++ni->counters.rx_late_pkt;
+      if (p.seqnum_ == seqnum)
+      {
+        // Slot has not been reused yet, so its send time is still that of this frame
+        uint64_t rtt_us = monotonicUs() - p.sent_us_;
+        ni->counters.rx_late_pkt_rtt_us = rtt_us;
+        ni->counters.rx_late_pkt_rtt_us_sum += rtt_us;
+      }
+    }
+    else if (p.seqnum_ != seqnum)
+    {
+      ++ni->counters.rx_bad_seqnum;
+    }
+    else if ((__sync_sub_and_fetch(&p.outstanding_, 1) > 0) && !workingCountersValid(data, length))
+    {
+      // Another copy of process data frame might still return with valid working counters
+      ++pm->invalid_replies_;
+    }
+    else if (int(h) == handle)
+    {
+      bool success = framebuild(frame, data + sizeof(struct ether_header));
+      keepRxTimestamp(pm, hdr, p);
+      recordLatency(pm, p);
+      p.state_ = PacketMmapNetif::FREE;
+      if (p.process_data_ && (p.resends_ == 0))
+      {
+        pm->rtt_.record(monotonicUs() - p.sent_us_);
+      }
+      if (is_copy)
+      {
+        ++pm->redundant_used_;
+      }
+      if (success)
+      {
+        ++ni->counters.received;
+        result = RX_MINE;
+      }
+      else
+      {
+        ++ni->counters.dropped;
+        result = RX_MINE_BAD;
+      }
+    }
+    else if (__sync_bool_compare_and_swap(&p.state_, PacketMmapNetif::WAITING, PacketMmapNetif::FILLING))
+    {
+      if (is_copy)
+      {
+        ++pm->redundant_used_;
+      }
+      keepRxTimestamp(pm, hdr, p);
+      memcpy(p.data_, data, length);
+      p.length_ = length;
+      __sync_synchronize();
+      p.state_ = PacketMmapNetif::RECEIVED;
+    }
+  }
+
+  __sync_synchronize();
+  hdr->tp_status = TP_STATUS_KERNEL;
+  ++pm->rx_next_;
+  return result;
+}
+
+
+static bool packetMmapReceive(struct EtherCAT_Frame *frame, struct netif *ni, int handle, bool wait)
+{
+  PacketMmapNetif *pm = getPacketMmapNetif(ni);
+  if ((handle < 0) || (handle >= int(MAX_PENDING)))
+  {
+    return false;
+  }
+  PacketMmapNetif::Pending &p(pm->pending_[handle]);
+
+  int64_t deadline = monotonicUs() + pm->timeout_us_;
+  for (;;)
+  {
+    // Frame might have been received by another thread
+    if (p.state_ == PacketMmapNetif::RECEIVED)
+    {
+      bool success = framebuild(frame, p.data_ + sizeof(struct ether_header));
+      recordLatency(pm, p);
+      p.state_ = PacketMmapNetif::FREE;
+      if (success)
+        ++ni->counters.received;
+      else
+        ++ni->counters.dropped;
+      return success;
+    }
+
+    if (pthread_mutex_trylock(&pm->rx_lock_) == 0)
+    {
+      RxResult result = RX_OTHER;
+      for (unsigned i=0; (i<pm->num_frames_) && (result == RX_OTHER); ++i)
+      {
+        result = receiveOne(pm, handle, frame);
+      }
+      pthread_mutex_unlock(&pm->rx_lock_);
+      if (result == RX_MINE)
+        return true;
+      if (result == RX_MINE_BAD)
+        return false;
+      if (p.state_ == PacketMmapNetif::RECEIVED)
+        continue;
+    }
+
+    if (!wait)
+    {
+      return false;
+    }
+
+    int64_t now = monotonicUs();
+    int64_t remaining = deadline - now;
+    if (remaining <= 0)
+    {
+      dropPending(pm, handle);
+      ++ni->counters.dropped;
+      return false;
+    }
+
+    // Process data reply is late, send frame again instead of waiting out whole timeout
+    int64_t sleep_us = remaining;
+    if (p.process_data_)
+    {
+      int64_t elapsed = now - p.sent_us_;
+      int64_t resend_after = resendAfterUs(pm);
+      if ((resend_after > 0) && (p.resends_ < pm->max_resends_))
+      {
+        if (elapsed >= resend_after)
+        {
+          resendPending(pm, handle);
+          continue;
+        }
+        sleep_us = std::min(sleep_us, resend_after - elapsed);
+      }
+      // Reply is probably about to arrive, waking up from sleep would take longer than spinning
+      if (elapsed < int64_t(pm->rtt_.median_us_))
+      {
+        continue;
+      }
+    }
+    // Thread holding rx_lock_ may take this reply off ring and put it in pending slot, 
+    // which does not wake ppoll(), so never sleep longer than one slice
+    sleep_us = std::min(sleep_us, int64_t(pm->sleep_slice_us_));
+
+    if (!pm->spin_)
+    {
+      struct pollfd pfd;
+      pfd.fd = pm->fd_;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      timespec timeout;
+      timeout.tv_sec = sleep_us / 1000000;
+      timeout.tv_nsec = (sleep_us % 1000000) * 1000;
+      ppoll(&pfd, 1, &timeout, NULL);
+    }
+  }
+}
+
+
+static bool packetMmapRx(struct EtherCAT_Frame *frame, struct netif *ni, int handle)
+{
+  return packetMmapReceive(frame, ni, handle, true);
+}
+
+
+static bool packetMmapRxNowait(struct EtherCAT_Frame *frame, struct netif *ni, int handle)
+{
+  return packetMmapReceive(frame, ni, handle, false);
+}
+
+
+/*!
+ * \brief Sends frame and waits for its reply.
+ *
+ * Used by EtherCAT_DataLinkLayer::txandrx() and so by EML init and EthercatDirectCom.
+ * Like EML socket driver, frame that is dropped or comes back bad is sent again.
+ */
+static bool packetMmapTxandrx(struct EtherCAT_Frame *frame, struct netif *ni)
+{
+  for (unsigned tries=0; tries<MAX_TXANDRX_TRIES; ++tries)
+  {
+    int handle = packetMmapTx(frame, ni);
+    if (handle < 0)
+    {
+      return false;
+    }
+    if (packetMmapRx(frame, ni, handle))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static int packetMmapDrop(struct netif *ni, int handle)
+{
+  if ((handle < 0) || (handle >= int(MAX_PENDING)))
+  {
+    return -1;
+  }
+  dropPending(getPacketMmapNetif(ni), handle);
+  ++ni->counters.dropped;
+  return 0;
+}
+
+
+/*!
+ * \brief Enables timestamps in RX and TX ring frames.
+ *
+ * Software timestamps need SO_TIMESTAMPING with RX_SOFTWARE : this makes kernel timestamp 
+ * every packet, and these timestamps are then copied into ring frames.  Hardware timestamps 
+ * also need timestamping enabled in NIC, and TX_HARDWARE so NIC timestamps sent frames.
+ * Returns false if hardware timestamps were asked for but could not be enabled.
+ */
+static bool enableTimestamps(int fd, const char *interface, bool hardware)
+{
+  if (hardware)
+  {
+    struct hwtstamp_config hwconfig;
+    memset(&hwconfig, 0, sizeof(hwconfig));
+    hwconfig.tx_type = HWTSTAMP_TX_ON;
+    hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ-1);
+    ifr.ifr_data = (char*) &hwconfig;
+    int so_flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE | 
+      SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+    int packet_flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (ioctl(fd, SIOCSHWTSTAMP, &ifr) < 0)
+    {
+      ROS_WARN("Could not enable hardware timestamps on %s : %s", interface, strerror(errno));
+    }
+    else if ((setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &so_flags, sizeof(so_flags)) < 0) ||
+             (setsockopt(fd, SOL_PACKET, PACKET_TIMESTAMP, &packet_flags, sizeof(packet_flags)) < 0))
+    {
+      ROS_WARN("Could not enable hardware timestamps : %s", strerror(errno));
+    }
+    else
+    {
+      return true;
+    }
+  }
+
+  int so_flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+  int packet_flags = SOF_TIMESTAMPING_SOFTWARE;
+  if ((setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &so_flags, sizeof(so_flags)) < 0) ||
+      (setsockopt(fd, SOL_PACKET, PACKET_TIMESTAMP, &packet_flags, sizeof(packet_flags)) < 0))
+  {
+    ROS_WARN("Could not enable software timestamps : %s", strerror(errno));
+  }
+  return false;
+}
+
+
+//! Allocates interface state, caller fills in socket and rings
+static PacketMmapNetif *newPacketMmapNetif(const PacketMmapConfig &config, const unsigned char *hwaddr)
+{
+  PacketMmapNetif *pm = new PacketMmapNetif;
+  memset(&pm->ni_, 0, sizeof(pm->ni_));
+  pm->ni_.tx = packetMmapTx;
+  pm->ni_.rx = packetMmapRx;
+  pm->ni_.rx_nowait = packetMmapRxNowait;
+  pm->ni_.txandrx = packetMmapTxandrx;
+  pm->ni_.drop = packetMmapDrop;
+  memcpy(pm->ni_.hwaddr, hwaddr, ETH_ALEN);
+  pm->ni_.is_stopped = 0;
+
+  pm->fd_ = -1;
+  pm->kick_ = NULL;
+  pm->kick_arg_ = NULL;
+  pm->ring_ = NULL;
+  pm->ring_size_ = 0;
+  pm->rx_ring_ = NULL;
+  pm->tx_ring_ = NULL;
+  pm->num_frames_ = 0;
+  pm->rx_next_ = 0;
+  pm->tx_next_ = 0;
+  pm->seqnum_ = 0;
+  pm->timeout_us_ = config.timeout_us_;
+  pm->spin_ = config.spin_;
+  pm->sleep_slice_us_ = std::max(1u, config.sleep_slice_us_);
+  pm->process_data_ = false;
+  pm->process_data_thread_ = pthread_self();
+  pm->early_resend_ = config.early_resend_;
+  pm->max_resends_ = config.max_resends_;
+  pm->min_resend_us_ = config.min_resend_us_;
+  pm->redundant_pd_ = config.redundant_pd_;
+  pm->resends_ = 0;
+  pm->duplicates_ = 0;
+  pm->redundant_sent_ = 0;
+  pm->redundant_used_ = 0;
+  pm->invalid_replies_ = 0;
+  pm->timestamps_ = config.timestamps_;
+  pm->hardware_timestamps_ = false;
+  memset(&pm->host_send_, 0, sizeof(pm->host_send_));
+  memset(&pm->wire_, 0, sizeof(pm->wire_));
+  memset(&pm->host_wake_, 0, sizeof(pm->host_wake_));
+  pm->timestamps_missing_ = 0;
+  pthread_mutex_init(&pm->tx_lock_, NULL);
+  pthread_mutex_init(&pm->rx_lock_, NULL);
+  for (unsigned i=0; i<MAX_PENDING; ++i)
+  {
+    pm->pending_[i].state_ = PacketMmapNetif::FREE;
+    pm->pending_[i].seqnum_ = 0;
+    pm->pending_[i].length_ = 0;
+    pm->pending_[i].process_data_ = false;
+    pm->pending_[i].redundant_ = false;
+    pm->pending_[i].outstanding_ = 0;
+    pm->pending_[i].resends_ = 0;
+    pm->pending_[i].sent_us_ = 0;
+    pm->pending_[i].tx_length_ = 0;
+    pm->pending_[i].tx_slot_ = 0;
+    pm->pending_[i].rx_timestamp_valid_ = false;
+  }
+
+  return pm;
+}
+
+
+struct netif *initPacketMmapNetif(const char *interface, const PacketMmapConfig &config)
+{
+  int fd = socket(AF_PACKET, SOCK_RAW, htons(ETHERCAT_ETHERTYPE));
+  if (fd < 0)
+  {
+    ROS_ERROR("Could not create packet socket : %s", strerror(errno));
+    return NULL;
+  }
+
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, interface, IFNAMSIZ-1);
+  if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+  {
+    ROS_ERROR("Could not get index of interface %s : %s", interface, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  int ifindex = ifr.ifr_ifindex;
+  if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0)
+  {
+    ROS_ERROR("Could not get MAC address of interface %s : %s", interface, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  // TPACKET_V3 RX blocks are only handed to user space when full or when block timer 
+  // (at least 1ms) expires, which is too slow for single frame round trips.  
+  // V2 hands over each frame as soon as it arrives.
+  int version = TPACKET_V2;
+  if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+  {
+    ROS_ERROR("Could not select TPACKET_V2 : %s", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  // Malformed frames in TX ring are skipped, instead of stopping transmission
+  int one = 1;
+  setsockopt(fd, SOL_PACKET, PACKET_LOSS, &one, sizeof(one));
+#ifdef PACKET_QDISC_BYPASS
+  setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#endif
+
+  unsigned block_size = getpagesize();
+  if (block_size < FRAME_SIZE)
+  {
+    block_size = FRAME_SIZE;
+  }
+  unsigned frames_per_block = block_size / FRAME_SIZE;
+  unsigned num_blocks = (config.num_frames_ + frames_per_block - 1) / frames_per_block;
+  if (num_blocks == 0)
+  {
+    num_blocks = 1;
+  }
+  struct tpacket_req req;
+  req.tp_block_size = block_size;
+  req.tp_block_nr = num_blocks;
+  req.tp_frame_size = FRAME_SIZE;
+  req.tp_frame_nr = num_blocks * frames_per_block;
+  if ((setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) ||
+      (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0))
+  {
+    ROS_ERROR("Could not set up packet rings : %s", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  size_t ring_size = 2 * size_t(block_size) * num_blocks;
+  void *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ring == MAP_FAILED)
+  {
+    ROS_ERROR("Could not map packet rings : %s", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  if (mlock(ring, ring_size) != 0)
+  {
+    ROS_WARN("Could not lock packet rings in memory : %s", strerror(errno));
+  }
+
+  struct sockaddr_ll addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETHERCAT_ETHERTYPE);
+  addr.sll_ifindex = ifindex;
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+  {
+    ROS_ERROR("Could not bind packet socket to %s : %s", interface, strerror(errno));
+    munmap(ring, ring_size);
+    close(fd);
+    return NULL;
+  }
+
+  if (config.busy_poll_us_ > 0)
+  {
+#ifdef SO_BUSY_POLL
+    int busy_poll = config.busy_poll_us_;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0)
+    {
+      ROS_WARN("Could not enable busy polling : %s", strerror(errno));
+    }
+#else
+    ROS_WARN("Busy polling is not supported");
+#endif
+  }
+
+  bool hardware_timestamps = false;
+  if (config.timestamps_)
+  {
+    hardware_timestamps = enableTimestamps(fd, interface, config.hardware_timestamps_);
+  }
+
+  PacketMmapNetif *pm = newPacketMmapNetif(config, (const unsigned char*) ifr.ifr_hwaddr.sa_data);
+  pm->fd_ = fd;
+  pm->ring_ = (char*) ring;
+  pm->ring_size_ = ring_size;
+  pm->rx_ring_ = pm->ring_;
+  pm->tx_ring_ = pm->ring_ + size_t(block_size) * num_blocks;
+  pm->num_frames_ = req.tp_frame_nr;
+  pm->hardware_timestamps_ = hardware_timestamps;
+  return &pm->ni_;
+}
+
+
+struct netif *initPacketMmapTestNetif(const PacketMmapTestRings &rings, const unsigned char hwaddr[6], 
+                                      const PacketMmapConfig &config)
+{
+  if ((rings.rx_ring_ == NULL) || (rings.tx_ring_ == NULL) || (rings.num_frames_ == 0) || (rings.kick_ == NULL))
+  {
+    ROS_ERROR("Test rings are not set up");
+    return NULL;
+  }
+  PacketMmapNetif *pm = newPacketMmapNetif(config, hwaddr);
+  pm->kick_ = rings.kick_;
+  pm->kick_arg_ = rings.kick_arg_;
+  pm->rx_ring_ = rings.rx_ring_;
+  pm->tx_ring_ = rings.tx_ring_;
+  pm->num_frames_ = rings.num_frames_;
+  return &pm->ni_;
+}
+
+
+int closePacketMmapNetif(struct netif *ni)
+{
+  if (ni == NULL)
+  {
+    return -1;
+  }
+  PacketMmapNetif *pm = getPacketMmapNetif(ni);
+  if (pm->ring_ != NULL)
+  {
+    munmap(pm->ring_, pm->ring_size_);
+  }
+  if (pm->fd_ >= 0)
+  {
+    close(pm->fd_);
+  }
+  pthread_mutex_destroy(&pm->tx_lock_);
+  pthread_mutex_destroy(&pm->rx_lock_);
+  delete pm;
+  return 0;
+}
+
+
+int setPacketMmapTimeout(struct netif *ni, int64_t timeout_us)
+{
+  if ((ni == NULL) || (timeout_us <= 0))
+  {
+    return -1;
+  }
+  getPacketMmapNetif(ni)->timeout_us_ = timeout_us;
+  return 0;
+}
+
+
+void setPacketMmapProcessData(struct netif *ni, bool process_data)
+{
+  PacketMmapNetif *pm = getPacketMmapNetif(ni);
+  if (process_data)
+  {
+    pm->process_data_thread_ = pthread_self();
+  }
+  __sync_synchronize();
+  pm->process_data_ = process_data;
+}
+
+
+void getPacketMmapStats(struct netif *ni, PacketMmapStats &stats)
+{
+  PacketMmapNetif *pm = getPacketMmapNetif(ni);
+  stats.resends_ = pm->resends_;
+  stats.duplicates_ = pm->duplicates_;
+  stats.redundant_sent_ = pm->redundant_sent_;
+  stats.redundant_used_ = pm->redundant_used_;
+  stats.invalid_replies_ = pm->invalid_replies_;
+  stats.hardware_timestamps_ = pm->hardware_timestamps_;
+  stats.host_send_ = pm->host_send_;
+  stats.wire_ = pm->wire_;
+  stats.host_wake_ = pm->host_wake_;
+  stats.timestamps_missing_ = pm->timestamps_missing_;
+  stats.expected_rtt_us_ = pm->rtt_.median_us_;
+  stats.resend_after_us_ = resendAfterUs(pm);
+}
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,113 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/process_image_layout.h"
+
+#include <ros/console.h>
+
+namespace ethercat_hardware
+{
+
+
+ProcessImageLayout::ProcessImageLayout()
+{
+  reset(1);
+}
+
+
+bool ProcessImageLayout::reset(unsigned alignment)
+{
+  offsets_.clear();
+  size_ = 0;
+  command_bytes_ = 0;
+  status_bytes_ = 0;
+  padding_bytes_ = 0;
+  if ((alignment == 0) || ((alignment & (alignment - 1)) != 0))
+  {
+    alignment_ = 1;
+    return false;
+  }
+  alignment_ = alignment;
+  return true;
+}
+
+
+//! Size image will have once it is padded for next block
+unsigned ProcessImageLayout::alignedSize() const
+{
+  return (size_ + alignment_ - 1) & ~(alignment_ - 1);
+}
+
+
+int ProcessImageLayout::nextAddress() const
+{
+  return START_ADDRESS + alignedSize();
+}
+
+
+bool ProcessImageLayout::addDevice(int end_address, unsigned command_size, unsigned status_size)
+{
+  unsigned offset = alignedSize();
+  unsigned block_size = command_size + status_size;
+  if (end_address != int(START_ADDRESS + offset + block_size))
+  {
+    ROS_ERROR("Device #%u mapped %d bytes of logical addresses, but its command and status take %u bytes", 
+              unsigned(offsets_.size()), end_address - int(START_ADDRESS + offset), block_size);
+    return false;
+  }
+  // Empty blocks need no alignment, and would only add padding for next block
+  if (block_size > 0)
+  {
+    padding_bytes_ += offset - size_;
+    size_ = offset + block_size;
+  }
+  else
+  {
+    offset = size_;
+  }
+  offsets_.push_back(offset);
+  command_bytes_ += command_size;
+  status_bytes_ += status_size;
+  return true;
+}
+
+
+void ProcessImageLayout::addEmptyDevice()
+{
+  offsets_.push_back(size_);
+}
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,381 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/sample_ring.h"
+
+#include <ros/console.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace ethercat_hardware
+{
+
+static const char SAMPLE_RING_MAGIC[8] = {'E','C','S','A','M','P','L','E'};
+
+const char FTRingSample::TYPE[] = "FTRingSample";
+const char AccelRingSample::TYPE[] = "AccelRingSample";
+const char RawPressureRingSample::TYPE[] = "RawPressureRingSample";
+
+// POSIX shared memory names need a leading slash
+static std::string shmName(const std::string &name)
+{
+  return ((!name.empty()) && (name[0] == '/')) ? name : ("/" + name);
+}
+
+// Slots are kept 8 byte aligned so sequence numbers can be read and written in one access
+static unsigned slotSize(unsigned sample_size)
+{
+  return (sizeof(SampleRingSlot) + sample_size + 7) & ~7u;
+}
+
+
+SampleRingWriterBase::SampleRingWriterBase() :
+  segment_(NULL),
+  size_(0),
+  header_(NULL),
+  slots_(NULL),
+  slot_size_(0),
+  sample_size_(0),
+  mask_(0)
+{
+
+}
+
+
+SampleRingWriterBase::~SampleRingWriterBase()
+{
+  close();
+}
+
+
+bool SampleRingWriterBase::open(const std::string &name, const char *type, unsigned sample_size, unsigned capacity)
+{
+  close();
+
+  if (strlen(type) >= sizeof(header_->type_))
+  {
+    ROS_ERROR("Sample ring type name '%s' is too long", type);
+    return false;
+  }
+
+  unsigned rounded_capacity = 1;
+  while (rounded_capacity < capacity)
+  {
+    rounded_capacity <<= 1;
+  }
+
+  name_ = shmName(name);
+  unsigned slot_size = slotSize(sample_size);
+  size_t size = sizeof(SampleRingHeader) + size_t(rounded_capacity) * slot_size;
+
+  int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    ROS_ERROR("Could not create sample ring '%s' : %s", name_.c_str(), strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, size) != 0)
+  {
+    ROS_ERROR("Could not size sample ring '%s' : %s", name_.c_str(), strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (segment == MAP_FAILED)
+  {
+    ROS_ERROR("Could not map sample ring '%s' : %s", name_.c_str(), strerror(errno));
+    return false;
+  }
+
+  // Realtime loop writes ring every cycle, it should never page fault
+  if (mlock(segment, size) != 0)
+  {
+    ROS_WARN("Could not lock sample ring '%s' in memory : %s", name_.c_str(), strerror(errno));
+  }
+
+  // A reader might still have old ring with same name mapped, clear magic first so it is not trusted
+  SampleRingHeader *header = (SampleRingHeader*) segment;
+  memset(header->magic_, 0, sizeof(header->magic_));
+  __sync_synchronize();
+  memset((char*)segment + sizeof(SampleRingHeader), 0, size - sizeof(SampleRingHeader));
+  header->version_ = SampleRingHeader::VERSION;
+  header->header_size_ = sizeof(SampleRingHeader);
+  header->slot_size_ = slot_size;
+  header->sample_size_ = sample_size;
+  header->capacity_ = rounded_capacity;
+  header->writer_pid_ = getpid();
+  memset(header->type_, 0, sizeof(header->type_));
+  strncpy(header->type_, type, sizeof(header->type_)-1);
+  header->write_count_ = 0;
+  __sync_synchronize();
+  memcpy(header->magic_, SAMPLE_RING_MAGIC, sizeof(header->magic_));
+
+  segment_ = segment;
+  size_ = size;
+  header_ = header;
+  slots_ = (char*) segment + sizeof(SampleRingHeader);
+  slot_size_ = slot_size;
+  sample_size_ = sample_size;
+  mask_ = rounded_capacity - 1;
+  return true;
+}
+
+
+void SampleRingWriterBase::close()
+{
+  if (segment_ != NULL)
+  {
+    munmap(segment_, size_);
+    shm_unlink(name_.c_str());
+  }
+  segment_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+  slots_ = NULL;
+  slot_size_ = 0;
+  sample_size_ = 0;
+  mask_ = 0;
+}
+
+
+void SampleRingWriterBase::writeSample(const void *sample)
+{
+  void *dest = beginSample();
+  if (dest != NULL)
+  {
+    memcpy(dest, sample, sample_size_);
+    commitSample();
+  }
+}
+
+
+void *SampleRingWriterBase::beginSample()
+{
+  if (header_ == NULL)
+  {
+    return NULL;
+  }
+
+  // Only one writer, so counts do not need atomic increments
+  uint64_t n = header_->write_count_;
+  char *slot_ptr = slots_ + (n & mask_) * slot_size_;
+  SampleRingSlot *slot = (SampleRingSlot*) slot_ptr;
+  slot->sequence_ = 2*n + 1;
+  __sync_synchronize();
+  return slot_ptr + sizeof(SampleRingSlot);
+}
+
+
+void SampleRingWriterBase::commitSample()
+{
+  if (header_ == NULL)
+  {
+    return;
+  }
+
+  uint64_t n = header_->write_count_;
+  SampleRingSlot *slot = (SampleRingSlot*) (slots_ + (n & mask_) * slot_size_);
+  __sync_synchronize();
+  slot->sequence_ = 2*n + 2;
+  __sync_synchronize();
+  header_->write_count_ = n + 1;
+}
+
+
+SampleRingReaderBase::SampleRingReaderBase() :
+  segment_(NULL),
+  size_(0),
+  header_(NULL),
+  slots_(NULL),
+  slot_size_(0),
+  sample_size_(0),
+  mask_(0),
+  next_(0),
+  lost_count_(0)
+{
+
+}
+
+
+SampleRingReaderBase::~SampleRingReaderBase()
+{
+  close();
+}
+
+
+bool SampleRingReaderBase::open(const std::string &name, const char *type, unsigned sample_size)
+{
+  close();
+
+  std::string shm_name(shmName(name));
+  int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || (size_t(st.st_size) < sizeof(SampleRingHeader)))
+  {
+    ::close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *segment = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (segment == MAP_FAILED)
+  {
+    return false;
+  }
+
+  const SampleRingHeader *header = (const SampleRingHeader*) segment;
+  uint32_t capacity = header->capacity_;
+  bool good = 
+    (memcmp(header->magic_, SAMPLE_RING_MAGIC, sizeof(header->magic_)) == 0) &&
+    (header->version_ == SampleRingHeader::VERSION) &&
+    (header->header_size_ >= sizeof(SampleRingHeader)) &&
+    (header->sample_size_ == sample_size) &&
+    (header->slot_size_ >= slotSize(sample_size)) &&
+    (capacity != 0) && ((capacity & (capacity-1)) == 0) &&
+    (strncmp(header->type_, type, sizeof(header->type_)) == 0) &&
+    (size >= header->header_size_ + size_t(capacity) * header->slot_size_);
+  if (!good)
+  {
+    munmap(segment, size);
+    return false;
+  }
+
+  segment_ = segment;
+  size_ = size;
+  header_ = header;
+  slots_ = (const char*) segment + header->header_size_;
+  slot_size_ = header->slot_size_;
+  sample_size_ = sample_size;
+  mask_ = capacity - 1;
+  next_ = header->write_count_;
+  lost_count_ = 0;
+  return true;
+}
+
+
+void SampleRingReaderBase::close()
+{
+  if (segment_ != NULL)
+  {
+    munmap(segment_, size_);
+  }
+  segment_ = NULL;
+  size_ = 0;
+  header_ = NULL;
+  slots_ = NULL;
+  mask_ = 0;
+  next_ = 0;
+  lost_count_ = 0;
+}
+
+
+void SampleRingReaderBase::seekOldest()
+{
+  if (header_ != NULL)
+  {
+    uint64_t written = header_->write_count_;
+    // Oldest slot might be in the middle of being overwritten, readSample() handles that
+    next_ = (written > mask_+1) ? (written - (mask_+1)) : 0;
+  }
+}
+
+
+uint64_t SampleRingReaderBase::available() const
+{
+  return (header_ != NULL) ? (header_->write_count_ - next_) : 0;
+}
+
+
+bool SampleRingReaderBase::readSample(void *sample)
+{
+  if (header_ == NULL)
+  {
+    return false;
+  }
+
+  for (unsigned attempt=0; attempt<MAX_READ_ATTEMPTS; ++attempt)
+  {
+    uint64_t written = header_->write_count_;
+    if (next_ >= written)
+    {
+      return false;
+    }
+
+    // Skip over samples that have already been overwritten
+    uint64_t capacity = mask_ + 1;
+    if ((written - next_) > capacity)
+    {
+      lost_count_ += (written - capacity) - next_;
+      next_ = written - capacity;
+    }
+
+    const char *slot_ptr = slots_ + (next_ & mask_) * slot_size_;
+    const SampleRingSlot *slot = (const SampleRingSlot*) slot_ptr;
+    uint64_t expected = 2*next_ + 2;
+    if (slot->sequence_ == expected)
+    {
+      __sync_synchronize();
+      memcpy(sample, slot_ptr + sizeof(SampleRingSlot), sample_size_);
+      __sync_synchronize();
+      if (slot->sequence_ == expected)
+      {
+        ++next_;
+        return true;
+      }
+    }
+
+    // Writer wrapped around and is overwriting this slot.  Sample is lost, 
+    // unless write count has moved far enough that next attempt skips ahead anyway
+    if (header_->write_count_ - next_ <= capacity)
+    {
+      ++lost_count_;
+      ++next_;
+    }
+  }
+  return false;
+}
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,264 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+#include "ethercat_hardware/shared_realtime_publisher.h"
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+#include <algorithm>
+
+namespace ethercat_hardware
+{
+
+
+SharedPublisherBase::SharedPublisherBase(const std::string &topic) :
+  turn_(REALTIME),
+  topic_(topic),
+  published_count_(0),
+  dropped_count_(0),
+  registered_(false)
+{
+  
+}
+
+
+SharedPublisherBase::~SharedPublisherBase()
+{
+  
+}
+
+
+bool SharedPublisherBase::trylockBase()
+{
+  return __sync_bool_compare_and_swap(&turn_, REALTIME, LOCKED);
+}
+
+
+void SharedPublisherBase::unlockBase()
+{
+  __sync_synchronize();
+  turn_ = REALTIME;
+}
+
+
+void SharedPublisherBase::unlockAndPublishBase()
+{
+  // Barrier makes sure all writes to message are visible before executor thread sees new turn
+  __sync_synchronize();
+  turn_ = NON_REALTIME;
+}
+
+
+bool SharedPublisherBase::publishPending()
+{
+  if (turn_ != NON_REALTIME)
+  {
+    return false;
+  }
+  __sync_synchronize();
+  publishMsg();
+  ++published_count_;
+  __sync_synchronize();
+  turn_ = REALTIME;
+  return true;
+}
+
+
+const unsigned PublisherExecutor::NUM_THREADS;
+const unsigned PublisherExecutor::POLL_PERIOD_US;
+
+PublisherExecutor::PublisherExecutor()
+{
+
+}
+
+
+PublisherExecutor *PublisherExecutor::instance()
+{
+  // Never deleted, publishers may be destroyed during static destruction
+  static PublisherExecutor *instance = new PublisherExecutor();
+  return instance;
+}
+
+
+void PublisherExecutor::add(SharedPublisherBase *publisher)
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  if (publisher->registered_)
+  {
+    return;
+  }
+
+  // Give publisher to least loaded worker
+  Worker *worker = &workers_[0];
+  for (unsigned i=1; i<NUM_THREADS; ++i)
+  {
+    if (workers_[i].publishers_.size() < worker->publishers_.size())
+    {
+      worker = &workers_[i];
+    }
+  }
+
+  { // LOCKED
+    boost::lock_guard<boost::mutex> worker_lock(worker->mutex_);
+    worker->publishers_.push_back(publisher);
+  } // UNLOCKED
+  publisher->registered_ = true;
+
+  if (!worker->running_)
+  {
+    worker->thread_ = boost::thread(boost::bind(&Worker::threadFunc, worker));
+    worker->running_ = true;
+  }
+}
+
+
+void PublisherExecutor::remove(SharedPublisherBase *publisher)
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  if (!publisher->registered_)
+  {
+    return;
+  }
+
+  for (unsigned i=0; i<NUM_THREADS; ++i)
+  {
+    Worker &worker(workers_[i]);
+    bool empty;
+    { // LOCKED
+      boost::lock_guard<boost::mutex> worker_lock(worker.mutex_);
+      std::vector<SharedPublisherBase*>::iterator it = 
+        std::find(worker.publishers_.begin(), worker.publishers_.end(), publisher);
+      if (it == worker.publishers_.end())
+      {
+        continue;
+      }
+      worker.publishers_.erase(it);
+      empty = worker.publishers_.empty();
+    } // UNLOCKED
+
+    // Stop idle worker, so no threads are left behind once all publishers are gone
+    if (empty && worker.running_)
+    {
+      worker.thread_.interrupt();
+      worker.thread_.join();
+      worker.running_ = false;
+    }
+    break;
+  }
+
+  // Any message that was never published is dropped, so lock() cannot wait forever.
+  // Only a handed over message is released : while realtime side holds LOCKED, msg_ is its own,
+  // and it gives it back with unlock() or unlockAndPublish().
+  publisher->registered_ = false;
+  __sync_bool_compare_and_swap(&publisher->turn_, SharedPublisherBase::NON_REALTIME, SharedPublisherBase::REALTIME);
+}
+
+
+void PublisherExecutor::Worker::threadFunc()
+{
+  try 
+  {
+    while (true)
+    {
+      { // LOCKED
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        for (unsigned i=0; i<publishers_.size(); ++i)
+        {
+          publishers_[i]->publishPending();
+        }
+      } // UNLOCKED
+      boost::this_thread::sleep(boost::posix_time::microseconds(POLL_PERIOD_US));
+    }
+  }
+  catch (boost::thread_interrupted const&) 
+  {
+    return;
+  }
+}
+
+
+void PublisherExecutor::getCounts(unsigned &num_publishers, uint64_t &published, uint64_t &dropped)
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  num_publishers = 0;
+  published = 0;
+  dropped = 0;
+  for (unsigned i=0; i<NUM_THREADS; ++i)
+  {
+    Worker &worker(workers_[i]);
+    boost::lock_guard<boost::mutex> worker_lock(worker.mutex_);
+    num_publishers += worker.publishers_.size();
+    BOOST_FOREACH(SharedPublisherBase *publisher, worker.publishers_)
+    {
+      published += publisher->getPublishedCount();
+      dropped += publisher->getDroppedCount();
+    }
+  }
+}
+
+
+void PublisherExecutor::publishDiagnostics(ethercat_hardware::DiagnosticsBuilder &d)
+{
+  unsigned num_publishers;
+  uint64_t published;
+  uint64_t dropped;
+  getCounts(num_publishers, published, dropped);
+
+  d.addf("Realtime Publishers", "%d", num_publishers);
+  d.addf("Realtime Publisher Threads", "%d", NUM_THREADS);
+  d.addf("Published Messages", "%llu", (unsigned long long)published);
+  d.addf("Dropped Messages", "%llu", (unsigned long long)dropped);
+
+  // Only list publishers that have dropped messages, a full robot has over a hundred of them
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  char key[256];
+  for (unsigned i=0; i<NUM_THREADS; ++i)
+  {
+    Worker &worker(workers_[i]);
+    boost::lock_guard<boost::mutex> worker_lock(worker.mutex_);
+    BOOST_FOREACH(SharedPublisherBase *publisher, worker.publishers_)
+    {
+      if (publisher->getDroppedCount() > 0)
+      {
+        snprintf(key, sizeof(key), "Dropped Messages %s", publisher->getTopic().c_str());
+        d.addf(key, "%llu", (unsigned long long)publisher->getDroppedCount());
+      }
+    }
+  }
+}
+
+
+}; //end namespace ethercat_hardware
@@ -0,0 +1,180 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2008, Willow Garage, Inc.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the Willow Garage nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+
+#include "ethercat_hardware/timeout_tuner.h"
+
+#include <string.h>
+#include <math.h>
+
+namespace ethercat_hardware
+{
+
+
+TimeoutTuning::TimeoutTuning() :
+  samples_(0),
+  late_samples_(0),
+  p50_us_(0),
+  p999_us_(0),
+  p9999_us_(0),
+  timeout_us_(0),
+  retries_(0),
+  tunings_(0)
+{
+
+}
+
+
+TimeoutTuner::TimeoutTuner() :
+  halt_latency_us_(100000),
+  min_timeout_us_(1000),
+  min_retries_(4),
+  max_retries_(50),
+  total_(0),
+  since_update_(0)
+{
+  memset(counts_, 0, sizeof(counts_));
+}
+
+
+void TimeoutTuner::configure(unsigned halt_latency_us, unsigned min_timeout_us, unsigned min_retries, unsigned max_retries)
+{
+  halt_latency_us_ = halt_latency_us;
+  min_retries_ = (min_retries < 1) ? 1 : min_retries;
+  max_retries_ = (max_retries < min_retries_) ? min_retries_ : max_retries;
+  min_timeout_us_ = (min_timeout_us < 1) ? 1 : min_timeout_us;
+}
+
+
+unsigned TimeoutTuner::bucketLimit(unsigned bucket)
+{
+  return unsigned(ceil(pow(2.0, double(bucket+1) / BUCKETS_PER_OCTAVE)));
+}
+
+
+void TimeoutTuner::record(unsigned rtt_us)
+{
+  unsigned bucket = 0;
+  if (rtt_us > 0)
+  {
+    bucket = unsigned(log2(double(rtt_us)) * BUCKETS_PER_OCTAVE);
+  }
+  if (bucket >= NUM_BUCKETS)
+  {
+    bucket = NUM_BUCKETS-1;
+  }
+  ++counts_[bucket];
+  ++total_;
+  ++since_update_;
+}
+
+
+void TimeoutTuner::recordRtt(unsigned rtt_us)
+{
+  record(rtt_us);
+  ++tuning_.samples_;
+}
+
+
+void TimeoutTuner::recordLateRtt(unsigned rtt_us)
+{
+  record(rtt_us);
+  ++tuning_.samples_;
+  ++tuning_.late_samples_;
+}
+
+
+//! Returns upper bound of bucket that contains count-th smallest sample
+unsigned TimeoutTuner::percentile(uint64_t count) const
+{
+  uint64_t sum = 0;
+  for (unsigned i=0; i<NUM_BUCKETS; ++i)
+  {
+    sum += counts_[i];
+    if (sum >= count)
+    {
+      return bucketLimit(i);
+    }
+  }
+  return bucketLimit(NUM_BUCKETS-1);
+}
+
+
+bool TimeoutTuner::update(unsigned &timeout_us, unsigned &retries)
+{
+  if ((since_update_ < UPDATE_INTERVAL) || (total_ < MIN_SAMPLES))
+  {
+    return false;
+  }
+  since_update_ = 0;
+
+  tuning_.p50_us_ = percentile(total_ - total_ / 2);
+  tuning_.p999_us_ = percentile(total_ - total_ / 1000);
+  tuning_.p9999_us_ = percentile(total_ - total_ / 10000);
+
+  // Timeout must still allow min_retries_ attempts within halt latency bound
+  unsigned max_timeout = halt_latency_us_ / min_retries_;
+  unsigned timeout = SAFETY_FACTOR * tuning_.p9999_us_;
+  timeout = (timeout < min_timeout_us_) ? min_timeout_us_ : timeout;
+  timeout = (timeout > max_timeout) ? max_timeout : timeout;
+  unsigned new_retries = halt_latency_us_ / timeout;
+  new_retries = (new_retries > max_retries_) ? max_retries_ : new_retries;
+  new_retries = (new_retries < min_retries_) ? min_retries_ : new_retries;
+
+  // Older samples lose weight
+  uint64_t total = 0;
+  for (unsigned i=0; i<NUM_BUCKETS; ++i)
+  {
+    counts_[i] /= 2;
+    total += counts_[i];
+  }
+  total_ = total;
+
+  unsigned old_timeout = tuning_.timeout_us_;
+  unsigned difference = (timeout > old_timeout) ? (timeout - old_timeout) : (old_timeout - timeout);
+  if ((tuning_.tunings_ > 0) && (difference * 100 < old_timeout * HYSTERESIS_PERCENT))
+  {
+    return false;
+  }
+
+  tuning_.timeout_us_ = timeout;
+  tuning_.retries_ = new_retries;
+  ++tuning_.tunings_;
+  timeout_us = timeout;
+  retries = new_retries;
+  return true;
+}
+
+
+}; //end namespace ethercat_hardware
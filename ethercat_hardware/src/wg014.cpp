@@ -63,15 +63,13 @@ int WG014::initialize(pr2_hardware_interface::HardwareInterface *, bool)
   return 0;
 }
 
-void WG014::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *)
+void WG014::diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *)
 {
-  stringstream str;
-  str << "EtherCAT Device #" << setw(2) << setfill('0') << sh_->get_ring_position() << " (WG014)";
-  d.name = str.str();
+  d.setNamef("EtherCAT Device #%02d (WG014)", sh_->get_ring_position());
   d.summary(0, "OK");
   char serial[32];
   snprintf(serial, sizeof(serial), "%d-%05d-%05d", sh_->get_product_code()/ 100000 , sh_->get_product_code() % 100000, sh_->get_serial());
-  d.hardware_id = serial;
+  d.setHardwareId(serial);
 
   d.clear();
   d.addf("Product code", "WG014 (%d), Ports %s, PCB Revision %c.%02d",
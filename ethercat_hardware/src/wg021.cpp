@@ -205,6 +205,9 @@ bool WG021::unpackState(unsigned char *this_buffer, unsigned char *prev_buffer)
 
   digital_out_.state_.data_ = this_status->digital_out_;
 
+  // Keeps sampleHostTime() valid, so output edge timestamps can be converted to host time
+  alignSampleTime(this_status->timestamp_);
+
   state.timestamp_us_ = this_status->timestamp_;
   state.falling_timestamp_us_ = this_status->output_stop_timestamp_;
   state.rising_timestamp_us_ = this_status->output_start_timestamp_;
@@ -240,16 +243,14 @@ end:
 
 
 
-void WG021::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer)
+void WG021::diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
 {
   WG021Status *status = (WG021Status *)(buffer + command_size_);
 
-  stringstream str;
-  str << "EtherCAT Device (" << actuator_info_.name_ << ")";
-  d.name = str.str();
+  d.setNamef("EtherCAT Device (%s)", actuator_info_.name_);
   char serial[32];
   snprintf(serial, sizeof(serial), "%d-%05d-%05d", config_info_.product_id_ / 100000 , config_info_.product_id_ % 100000, config_info_.device_serial_number_);
-  d.hardware_id = serial;
+  d.setHardwareId(serial);
 
   d.summary(d.OK, "OK");
 
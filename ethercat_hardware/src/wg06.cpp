@@ -60,6 +60,7 @@ WG06::WG06() :
   first_publish_(true),
   last_pressure_time_(0),
   pressure_publisher_(NULL),
+  raw_pressure_publisher_(NULL),
   accel_publisher_(NULL),
   ft_overload_limit_(31100),
   ft_overload_flags_(0),
@@ -71,6 +72,15 @@ WG06::WG06() :
   diag_last_ft_sample_count_(0),
   raw_ft_publisher_(NULL),
   ft_publisher_(NULL),
+  enable_sample_rings_(false),
+  raw_pressure_decimation_(1),
+  raw_pressure_cycles_(0),
+  accel_ring_sample_count_(0),
+  sensor_batch_cycles_(1),
+  accel_batch_cycles_(0),
+  accel_batch_count_(0),
+  ft_batch_cycles_(0),
+  ft_batch_count_(0),
   enable_pressure_sensor_(true),
   enable_ft_sensor_(false),
   enable_soft_processor_access_(true)
@@ -81,6 +91,7 @@ WG06::WG06() :
   
 WG06::~WG06()
 {
+  if (soft_processor_) soft_processor_->remove(&mailbox_);
   if (pressure_publisher_) delete pressure_publisher_;
   if (accel_publisher_) delete accel_publisher_;
 }
@@ -230,6 +241,21 @@ int WG06::initialize(pr2_hardware_interface::HardwareInterface *hw, bool allow_u
     {
       enable_ft_sensor_ = false; //default to to false
     }
+    if (!nh.getParam("enable_sample_rings", enable_sample_rings_))
+    {
+      enable_sample_rings_ = false; //default to to false
+    }
+    int sensor_batch_cycles = 1; // default to one message per cycle
+    nh.getParam("sensor_batch_cycles", sensor_batch_cycles);
+    if ((sensor_batch_cycles < 1) || (sensor_batch_cycles > int(MAX_SENSOR_BATCH_CYCLES)))
+    {
+      sensor_batch_cycles = std::max(1, std::min(int(MAX_SENSOR_BATCH_CYCLES), sensor_batch_cycles));
+      ROS_WARN("Limiting sensor batch cycles to %d", sensor_batch_cycles);
+    }
+    sensor_batch_cycles_ = sensor_batch_cycles;
+    int raw_pressure_decimation = 1; // default to publishing raw pressure every cycle
+    nh.getParam("raw_pressure_decimation", raw_pressure_decimation);
+    raw_pressure_decimation_ = std::max(0, raw_pressure_decimation);
 
     if (enable_ft_sensor_ && (fw_major_ < 2))
     {
@@ -301,7 +327,7 @@ bool WG06::initializePressure(pr2_hardware_interface::HardwareInterface *hw)
   string topic = "pressure";
   if (!actuator_.name_.empty())
     topic = topic + "/" + string(actuator_.name_);
-  pressure_publisher_ = new realtime_tools::RealtimePublisher<pr2_msgs::PressureState>(ros::NodeHandle(), topic, 1);
+  pressure_publisher_ = new ethercat_hardware::SharedRealtimePublisher<pr2_msgs::PressureState>(ros::NodeHandle(), topic, 1);
   
   // Register pressure sensor with pr2_hardware_interface::HardwareInterface
   for (int i = 0; i < 2; ++i) 
@@ -315,14 +341,24 @@ bool WG06::initializePressure(pr2_hardware_interface::HardwareInterface *hw)
     }
   }
 
-  // For development purposes publish a ROS message with raw values of pressure data
-  topic = "raw_pressure";
-  if (!actuator_.name_.empty())
-    topic = topic + "/" + string(actuator_.name_);
-  raw_pressure_publisher_ = 
-    new realtime_tools::RealtimePublisher<std_msgs::ByteMultiArray>(ros::NodeHandle(), topic, 2);
-  // reserve room sure there is room for pressure data in message
-  raw_pressure_publisher_->msg_.data.reserve(pressure_size_);  
+  // For development purposes publish a ROS message with raw values of pressure data.
+  // Every cycle of raw data is also available from shared memory ring, so topic can be decimated or disabled.
+  if (raw_pressure_decimation_ > 0)
+  {
+    topic = "raw_pressure";
+    if (!actuator_.name_.empty())
+      topic = topic + "/" + string(actuator_.name_);
+    raw_pressure_publisher_ = 
+      new ethercat_hardware::SharedRealtimePublisher<std_msgs::ByteMultiArray>(ros::NodeHandle(), topic, 2);
+    // reserve room sure there is room for pressure data in message
+    raw_pressure_publisher_->msg_.data.reserve(pressure_size_);  
+  }
+
+  if (enable_sample_rings_)
+  {
+    initializeSampleRing(raw_pressure_ring_, "pressure", ethercat_hardware::RawPressureRingSample::TYPE, 
+                         sizeof(ethercat_hardware::RawPressureRingSample), RAW_PRESSURE_RING_CAPACITY);
+  }
 
   return true;
 }
@@ -335,7 +371,10 @@ bool WG06::initializeAccel(pr2_hardware_interface::HardwareInterface *hw)
   {
     topic = topic + "/" + string(actuator_.name_);
   }
-  accel_publisher_ = new realtime_tools::RealtimePublisher<pr2_msgs::AccelerometerState>(ros::NodeHandle(), topic, 1);
+  // Accelerometer provides up to 4 samples per cycle.  Batch and message are swapped on handoff, so both need room
+  unsigned max_batch_samples = 4 * sensor_batch_cycles_ * BATCH_BACKLOG_FACTOR;
+  accel_publisher_ = new ethercat_hardware::SampleBatchPublisher<pr2_msgs::AccelerometerState, geometry_msgs::Vector3>(ros::NodeHandle(), topic, 1, max_batch_samples);
+  accel_batch_.resize(max_batch_samples);
   
   // Register accelerometer with pr2_hardware_interface::HardwareInterface
   accelerometer_.name_ = actuator_info_.name_;
@@ -344,10 +383,35 @@ bool WG06::initializeAccel(pr2_hardware_interface::HardwareInterface *hw)
     ROS_FATAL("An accelerometer of the name '%s' already exists.  Device #%02d has a duplicate name", accelerometer_.name_.c_str(), sh_->get_ring_position());
     return false;
   }
+
+  if (enable_sample_rings_)
+  {
+    initializeSampleRing(accel_ring_, "accel", ethercat_hardware::AccelRingSample::TYPE, sizeof(ethercat_hardware::AccelRingSample), SAMPLE_RING_CAPACITY);
+  }
   return true;
 }
 
 
+/*!
+ * \brief Creates shared memory ring for sensor samples.
+ *
+ * Ring is named /ethercat_<actuator>_<sensor>.  Failure is not fatal, sensor data is still published normally.
+ */
+void WG06::initializeSampleRing(ethercat_hardware::SampleRingWriterBase &ring, const char *sensor, 
+                                const char *type, unsigned sample_size, unsigned capacity)
+{
+  string name = string("/ethercat_") + actuator_info_.name_ + "_" + sensor;
+  if (ring.open(name, type, sample_size, capacity))
+  {
+    ROS_INFO("Writing %s samples of device #%02d to shared memory ring '%s'", sensor, sh_->get_ring_position(), name.c_str());
+  }
+  else
+  {
+    ROS_WARN("Could not create %s sample ring for device #%02d", sensor, sh_->get_ring_position());
+  }
+}
+
+
 bool WG06::initializeFT(pr2_hardware_interface::HardwareInterface *hw)
 {
   ft_raw_analog_in_.name_ = actuator_.name_ + "_ft_raw";
@@ -368,14 +432,22 @@ bool WG06::initializeFT(pr2_hardware_interface::HardwareInterface *hw)
   std::string topic = "raw_ft";
   if (!actuator_.name_.empty())
     topic = topic + "/" + string(actuator_.name_);
-  raw_ft_publisher_ = new realtime_tools::RealtimePublisher<ethercat_hardware::RawFTData>(ros::NodeHandle(), topic, 1);
+  // Allocate space for raw f/t data values.  Batch and message are swapped on handoff, so both need room
+  unsigned max_batch_samples = MAX_FT_SAMPLES * sensor_batch_cycles_ * BATCH_BACKLOG_FACTOR;
+  ethercat_hardware::RawFTDataSample prototype;
+  prototype.data.resize(NUM_FT_CHANNELS);
+  raw_ft_publisher_ = new ethercat_hardware::SampleBatchPublisher<ethercat_hardware::RawFTData, ethercat_hardware::RawFTDataSample>(ros::NodeHandle(), topic, 1, max_batch_samples, prototype);
   if (raw_ft_publisher_ == NULL)
   {
     ROS_FATAL("Could not allocate raw_ft publisher");
     return false;
   }
-  // Allocate space for raw f/t data values
-  raw_ft_publisher_->msg_.samples.reserve(MAX_FT_SAMPLES);
+  ft_batch_.resize(max_batch_samples, prototype);
+
+  if (enable_sample_rings_)
+  {
+    initializeSampleRing(ft_ring_, "ft", ethercat_hardware::FTRingSample::TYPE, sizeof(ethercat_hardware::FTRingSample), SAMPLE_RING_CAPACITY);
+  }
 
   force_torque_.command_.halt_on_error_ = false;
   force_torque_.state_.good_ = true;
@@ -393,7 +465,7 @@ bool WG06::initializeFT(pr2_hardware_interface::HardwareInterface *hw)
       topic = "ft";
       if (!actuator_.name_.empty())
         topic = topic + "/" + string(actuator_.name_);
-      ft_publisher_ = new realtime_tools::RealtimePublisher<geometry_msgs::WrenchStamped>(ros::NodeHandle(), topic, 1);
+      ft_publisher_ = new ethercat_hardware::SharedRealtimePublisher<geometry_msgs::WrenchStamped>(ros::NodeHandle(), topic, 1);
       if (ft_publisher_ == NULL)
       {
         ROS_FATAL("Could not allocate ft publisher");
@@ -416,16 +488,17 @@ bool WG06::initializeFT(pr2_hardware_interface::HardwareInterface *hw)
 
 bool WG06::initializeSoftProcessor()
 {
-  // TODO: do not use direct access to device.  Not safe while realtime loop is running
-  // ALSO, this leaks memory
-  EthercatDirectCom *com = new EthercatDirectCom(EtherCAT_DataLinkLayer::instance());
+  // Direct access is only used while mailbox is not attached to a scheduler, 
+  // once attached mailbox traffic goes through scheduler's OOB com instead.
+  static EthercatDirectCom com(EtherCAT_DataLinkLayer::instance());
 
   // Add soft-processors to list
-  soft_processor_.add(&mailbox_, actuator_.name_, "pressure", 0xA000, 0x249);
-  soft_processor_.add(&mailbox_, actuator_.name_, "accel", 0xB000, 0x24A);
+  soft_processor_ = WGSoftProcessor::shared();
+  soft_processor_->add(&mailbox_, actuator_.name_, "pressure", 0xA000, 0x249);
+  soft_processor_->add(&mailbox_, actuator_.name_, "accel", 0xB000, 0x24A);
 
   // Start services
-  if (!soft_processor_.initialize(com))
+  if (!soft_processor_->initialize(&com))
   {
     return false;
   }
@@ -484,6 +557,10 @@ bool WG06::unpackState(unsigned char *this_buffer, unsigned char *prev_buffer)
     goto end;
   }
 
+  // Accelerometer and F/T samples are stamped with host-aligned time of status, 
+  // so clock must be updated before they are unpacked
+  alignSampleTime(((WG0XStatus *)this_status)->timestamp_);
+
   if (!unpackPressure(pressure_buf))
   {
     rv = false;
@@ -581,10 +658,24 @@ bool WG06::unpackPressure(unsigned char *pressure_buf)
     }
     last_pressure_time_ = p->timestamp_;
 
-    // Also publish raw pressure sensor data new message every realtime cycle
-    // NOTE : this will product a lot of data to ROS, might not be a good idea 
+    // Raw pressure data goes into shared memory ring every cycle, with a single copy
+    ethercat_hardware::RawPressureRingSample *ring_sample = raw_pressure_ring_.beginWrite();
+    if (ring_sample != NULL)
+    {
+      static const unsigned MAX_SIZE = ethercat_hardware::RawPressureRingSample::MAX_SIZE;
+      unsigned size = (pressure_size_ < MAX_SIZE) ? pressure_size_ : MAX_SIZE;
+      ring_sample->cycle_time_ns_ = ros::Time::now().toNSec();
+      ring_sample->device_time_us_ = p->timestamp_;
+      ring_sample->size_ = size;
+      ring_sample->pad_ = 0;
+      memcpy(ring_sample->data_, pressure_buf, size);
+      raw_pressure_ring_.commit();
+    }
+
+    // Also publish raw pressure sensor data as ROS message every raw_pressure_decimation_ cycles
+    // NOTE : at full rate this will product a lot of data to ROS, might not be a good idea 
     // to do this for things other than development
-    if (raw_pressure_publisher_ != NULL) 
+    if ((raw_pressure_publisher_ != NULL) && (++raw_pressure_cycles_ >= raw_pressure_decimation_))
     {
       if (!raw_pressure_publisher_->trylock())
       {
@@ -600,10 +691,8 @@ bool WG06::unpackPressure(unsigned char *pressure_buf)
         // First copy data into "data" element of ByteMultiArray.  
         // For C++ the the data element ends up being a std::vector<uint8_t>
         raw_pressure_publisher_->msg_.data.resize(pressure_size_);        
-        for (unsigned ii=0; ii<pressure_size_; ++ii)
-        {
-          raw_pressure_publisher_->msg_.data[ii] = pressure_buf[ii];
-        }
+        memcpy(&raw_pressure_publisher_->msg_.data[0], pressure_buf, pressure_size_);
+        raw_pressure_cycles_ = 0;
 
         // The std_msgs::ByteMultiArray has a complex "format" element 
         // that describes how to convert a 1D data array into
@@ -650,17 +739,50 @@ bool WG06::unpackAccel(WG06StatusWithAccel *status, WG06StatusWithAccel *last_st
     accelerometer_.state_.samples_[i].z = 9.81 * ((((acc >> 20) & 0x3ff) << 22) >> 22) / d;
   }
 
-  if (accel_publisher_->trylock())
+  // Samples are written to ring oldest first.  Missed samples show up as gap in sample count.
+  accel_ring_sample_count_ += uint8_t(status->accel_count_ - last_status->accel_count_);
+  if (accel_ring_.isOpen())
   {
-    accel_publisher_->msg_.header.frame_id = accelerometer_.state_.frame_id_;
-    accel_publisher_->msg_.header.stamp = ros::Time::now();
-    accel_publisher_->msg_.samples.resize(count);
+    ethercat_hardware::AccelRingSample ring_sample;
+    ring_sample.cycle_time_ns_ = ros::Time::now().toNSec();
+    ring_sample.sample_time_ns_ = sample_host_time_.toNSec();
+    ring_sample.device_time_us_ = status->timestamp_;
     for (int i = 0; i < count; ++i)
     {
-      accel_publisher_->msg_.samples[i].x = accelerometer_.state_.samples_[i].x;
-      accel_publisher_->msg_.samples[i].y = accelerometer_.state_.samples_[i].y;
-      accel_publisher_->msg_.samples[i].z = accelerometer_.state_.samples_[i].z;
+      ring_sample.sample_count_ = accel_ring_sample_count_ - (count - i - 1);
+      ring_sample.raw_ = status->accel_[count - i - 1];
+      ring_sample.x_ = accelerometer_.state_.samples_[i].x;
+      ring_sample.y_ = accelerometer_.state_.samples_[i].y;
+      ring_sample.z_ = accelerometer_.state_.samples_[i].z;
+      accel_ring_.write(ring_sample);
     }
+  }
+
+  // Accumulate samples into batch, oldest first
+  for (int i = 0; i < count; ++i)
+  {
+    if (accel_batch_count_ >= accel_batch_.size())
+    {
+      // Publisher has been busy for too long, batch is full
+      ++accelerometer_missed_samples_;
+      continue;
+    }
+    geometry_msgs::Vector3 &sample(accel_batch_[accel_batch_count_++]);
+    sample.x = accelerometer_.state_.samples_[i].x;
+    sample.y = accelerometer_.state_.samples_[i].y;
+    sample.z = accelerometer_.state_.samples_[i].z;
+  }
+  ++accel_batch_cycles_;
+
+  // Hand off complete batch.  If publisher is busy, batch keeps growing and is handed off next cycle
+  if ((accel_batch_cycles_ >= sensor_batch_cycles_) && accel_publisher_->trylock())
+  {
+    accel_publisher_->msg_.header.frame_id = accelerometer_.state_.frame_id_;
+    accel_publisher_->msg_.header.stamp = sample_host_time_;  // Sample time of newest sample in batch
+    accel_publisher_->msg_.samples.swap(accel_batch_);
+    accel_publisher_->sample_count_ = accel_batch_count_;
+    accel_batch_count_ = 0;
+    accel_batch_cycles_ = 0;
     accel_publisher_->unlockAndPublish();
   }
   return true;
@@ -797,6 +919,37 @@ bool WG06::unpackFT(WG06StatusWithAccelAndFT *status, WG06StatusWithAccelAndFT *
     convertFTDataSampleToWrench(sample, wrench);
   }
 
+  // Write every new sample to ring, oldest first
+  if (ft_ring_.isOpen())
+  {
+    ethercat_hardware::FTRingSample ring_sample;
+    ring_sample.cycle_time_ns_ = current_time.toNSec();
+    ring_sample.sample_time_ns_ = sample_host_time_.toNSec();
+    ring_sample.device_time_us_ = status->timestamp_;
+    ring_sample.good_ = ft_state.good_ ? 1 : 0;
+    ring_sample.pad_ = 0;
+    for (unsigned sample_index=0; sample_index<usable_samples; ++sample_index)
+    {
+      unsigned status_sample_index = usable_samples-sample_index-1;
+      const FTDataSample &sample(status->ft_samples_[status_sample_index]); 
+      const geometry_msgs::Wrench &wrench(ft_state.samples_[sample_index]);
+      ring_sample.sample_count_ = ft_sample_count_ - status_sample_index;
+      ring_sample.vhalf_ = sample.vhalf_;
+      ring_sample.sample_timestamp_ = sample.timestamp_;
+      for (unsigned ch_num=0; ch_num<NUM_FT_CHANNELS; ++ch_num)
+      {
+        ring_sample.raw_[ch_num] = sample.data_[ch_num];
+      }
+      ring_sample.wrench_[0] = wrench.force.x;
+      ring_sample.wrench_[1] = wrench.force.y;
+      ring_sample.wrench_[2] = wrench.force.z;
+      ring_sample.wrench_[3] = wrench.torque.x;
+      ring_sample.wrench_[4] = wrench.torque.y;
+      ring_sample.wrench_[5] = wrench.torque.z;
+      ft_ring_.write(ring_sample);
+    }
+  }
+
   // Put newest sample into analog vector for controllers (deprecated)
   if (usable_samples > 0)
   {
@@ -809,33 +962,47 @@ bool WG06::unpackFT(WG06StatusWithAccelAndFT *status, WG06StatusWithAccelAndFT *
     ft_analog_in_.state_.state_[5] = wrench.torque.z;
   }
 
-  // Put all new samples in buffer and publish it
-  if ((raw_ft_publisher_ != NULL) && (raw_ft_publisher_->trylock()))
+  // Put all new samples in batch, so oldest data is first element
+  if (raw_ft_publisher_ != NULL)
   {
-    raw_ft_publisher_->msg_.samples.resize(usable_samples);
-    raw_ft_publisher_->msg_.sample_count = ft_sample_count_;
-    raw_ft_publisher_->msg_.missed_samples = ft_missed_samples_;
-    for (unsigned sample_num=0; sample_num<usable_samples; ++sample_num)
+    for (unsigned sample_index=0; sample_index<usable_samples; ++sample_index)
     {
-      // put data into message so oldest data is first element
-      const FTDataSample &sample(status->ft_samples_[sample_num]);
-      ethercat_hardware::RawFTDataSample &msg_sample(raw_ft_publisher_->msg_.samples[usable_samples-sample_num-1]);
-      msg_sample.sample_count = ft_sample_count_ - sample_num;
-      msg_sample.data.resize(NUM_FT_CHANNELS);
+      unsigned status_sample_index = usable_samples-sample_index-1;
+      if (ft_batch_count_ >= ft_batch_.size())
+      {
+        // Publisher has been busy for too long, batch is full
+        ++ft_missed_samples_;
+        continue;
+      }
+      const FTDataSample &sample(status->ft_samples_[status_sample_index]);
+      // Data of every batch sample already has NUM_FT_CHANNELS values
+      ethercat_hardware::RawFTDataSample &msg_sample(ft_batch_[ft_batch_count_++]);
+      msg_sample.sample_count = ft_sample_count_ - status_sample_index;
       for (unsigned ch_num=0; ch_num<NUM_FT_CHANNELS; ++ch_num)
       {
         msg_sample.data[ch_num] = sample.data_[ch_num];
       }
       msg_sample.vhalf = sample.vhalf_;
     }
-    raw_ft_publisher_->msg_.sample_count = ft_sample_count_;
-    raw_ft_publisher_->unlockAndPublish();
+    ++ft_batch_cycles_;
+
+    // Hand off complete batch.  If publisher is busy, batch keeps growing and is handed off next cycle
+    if ((ft_batch_cycles_ >= sensor_batch_cycles_) && raw_ft_publisher_->trylock())
+    {
+      raw_ft_publisher_->msg_.samples.swap(ft_batch_);
+      raw_ft_publisher_->sample_count_ = ft_batch_count_;
+      ft_batch_count_ = 0;
+      ft_batch_cycles_ = 0;
+      raw_ft_publisher_->msg_.sample_count = ft_sample_count_;
+      raw_ft_publisher_->msg_.missed_samples = ft_missed_samples_;
+      raw_ft_publisher_->unlockAndPublish();
+    }
   }
 
   // Put newest sample in realtime publisher
   if ( (usable_samples > 0) && (ft_publisher_ != NULL) && (ft_publisher_->trylock()) )
   {
-    ft_publisher_->msg_.header.stamp = current_time;
+    ft_publisher_->msg_.header.stamp = sample_host_time_;
     ft_publisher_->msg_.wrench = ft_state.samples_[usable_samples-1];
     ft_publisher_->unlockAndPublish();
   }
@@ -846,22 +1013,21 @@ bool WG06::unpackFT(WG06StatusWithAccelAndFT *status, WG06StatusWithAccelAndFT *
 }
 
 
-void WG06::multiDiagnostics(vector<diagnostic_msgs::DiagnosticStatus> &vec, unsigned char *buffer)
+void WG06::multiDiagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
 {
-  diagnostic_updater::DiagnosticStatusWrapper &d(diagnostic_status_);
+  d.beginStatus();
   diagnosticsWG06(d, buffer);  
-  vec.push_back(d);
+  d.beginStatus();
   diagnosticsAccel(d, buffer);
-  vec.push_back(d);  
+  d.beginStatus();
   diagnosticsPressure(d, buffer);
-  vec.push_back(d);
 
   if (has_accel_and_ft_ && enable_ft_sensor_)
   {
     WG06StatusWithAccelAndFT *status = (WG06StatusWithAccelAndFT *)(buffer + command_size_);
     // perform f/t sample
+    d.beginStatus();
     diagnosticsFT(d, status);
-    vec.push_back(d);
   }
 
   last_publish_time_ = ros::Time::now();
@@ -869,14 +1035,12 @@ void WG06::multiDiagnostics(vector<diagnostic_msgs::DiagnosticStatus> &vec, unsi
 }
 
 
-void WG06::diagnosticsAccel(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer)
+void WG06::diagnosticsAccel(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
 {
-  stringstream str;
-  str << "Accelerometer (" << actuator_info_.name_ << ")";
-  d.name = str.str();
+  d.setNamef("Accelerometer (%s)", actuator_info_.name_);
   char serial[32];
   snprintf(serial, sizeof(serial), "%d-%05d-%05d", config_info_.product_id_ / 100000 , config_info_.product_id_ % 100000, config_info_.device_serial_number_);
-  d.hardware_id = serial;
+  d.setHardwareId(serial);
 
   d.summary(d.OK, "OK");
   d.clear();
@@ -923,13 +1087,13 @@ void WG06::diagnosticsAccel(diagnostic_updater::DiagnosticStatusWrapper &d, unsi
 }
 
 
-void WG06::diagnosticsWG06(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer)
+void WG06::diagnosticsWG06(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
 {
   WG0X::diagnostics(d, buffer);
   // nothing else to do here 
 }
 
-void WG06::diagnosticsPressure(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer)
+void WG06::diagnosticsPressure(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
 {
   int status_bytes = 
     has_accel_and_ft_  ? sizeof(WG06StatusWithAccelAndFT) :  // Has FT sensor and accelerometer
@@ -937,12 +1101,10 @@ void WG06::diagnosticsPressure(diagnostic_updater::DiagnosticStatusWrapper &d, u
                          sizeof(WG0XStatus);
   WG06Pressure *pressure = (WG06Pressure *)(buffer + command_size_ + status_bytes);
 
-  stringstream str;
-  str << "Pressure sensors (" << actuator_info_.name_ << ")";
-  d.name = str.str();
+  d.setNamef("Pressure sensors (%s)", actuator_info_.name_);
   char serial[32];
   snprintf(serial, sizeof(serial), "%d-%05d-%05d", config_info_.product_id_ / 100000 , config_info_.product_id_ % 100000, config_info_.device_serial_number_);
-  d.hardware_id = serial;
+  d.setHardwareId(serial);
   d.clear();
 
   if (enable_pressure_sensor_)
@@ -1014,40 +1176,35 @@ void WG06::diagnosticsPressure(diagnostic_updater::DiagnosticStatusWrapper &d, u
     d.addf("Checksum error count", "%u", pressure_checksum_error_count_);
 
     { // put right and left finger data in dianostics
-      std::stringstream ss;
-
+      // Each region is 4 hex digits and a space, with a newline after every 8 regions
+      char data[NUM_PRESSURE_REGIONS * 6 + 1];
+      unsigned len = 0;
       for (unsigned region_num=0; region_num<NUM_PRESSURE_REGIONS; ++region_num)
       {
-        ss << std::uppercase << std::hex << std::setw(4) << std::setfill('0') 
-           << pressure->r_finger_tip_[region_num] << " ";
-        if (region_num%8 == 7) 
-          ss << std::endl;      
+        len += snprintf(data + len, sizeof(data) - len, (region_num%8 == 7) ? "%04X \n" : "%04X ", 
+                        unsigned(pressure->r_finger_tip_[region_num]));
       }
-      d.add("Right finger data",  ss.str());
-
-      ss.str("");
+      d.add("Right finger data", data);
 
+      len = 0;
       for (unsigned region_num=0; region_num<NUM_PRESSURE_REGIONS; ++region_num)
       {
-        ss << std::uppercase << std::hex << std::setw(4) << std::setfill('0') 
-           << pressure->l_finger_tip_[region_num] << " ";
-        if (region_num%8 == 7) ss << std::endl;      
+        len += snprintf(data + len, sizeof(data) - len, (region_num%8 == 7) ? "%04X \n" : "%04X ", 
+                        unsigned(pressure->l_finger_tip_[region_num]));
       }
-      d.add("Left finger data",  ss.str());
+      d.add("Left finger data", data);
     }
   }
 
 }
 
 
-void WG06::diagnosticsFT(diagnostic_updater::DiagnosticStatusWrapper &d, WG06StatusWithAccelAndFT *status)
+void WG06::diagnosticsFT(ethercat_hardware::DiagnosticsBuilder &d, WG06StatusWithAccelAndFT *status)
 {
-  stringstream str;
-  str << "Force/Torque sensor (" << actuator_info_.name_ << ")";
-  d.name = str.str();
+  d.setNamef("Force/Torque sensor (%s)", actuator_info_.name_);
   char serial[32];
   snprintf(serial, sizeof(serial), "%d-%05d-%05d", config_info_.product_id_ / 100000 , config_info_.product_id_ % 100000, config_info_.device_serial_number_);
-  d.hardware_id = serial;
+  d.setHardwareId(serial);
 
   d.summary(d.OK, "OK");
   d.clear();
@@ -1062,30 +1219,31 @@ void WG06::diagnosticsFT(diagnostic_updater::DiagnosticStatusWrapper &d, WG06Sta
 
   //d.addf("F/T sample count", "%llu", ft_sample_count_);
   d.addf("F/T sample frequency", "%.2f (Hz)", sample_frequency);
-  d.addf("F/T missed samples", "%llu", ft_missed_samples_);
-  std::stringstream ss;
+  d.addf("F/T missed samples", "%llu", (unsigned long long)ft_missed_samples_);
   const FTDataSample &sample(status->ft_samples_[0]);  //use newest data sample
+  char key[16];
   for (unsigned i=0;i<NUM_FT_CHANNELS;++i)
   {
-    ss.str(""); ss << "Ch"<< (i);
-    d.addf(ss.str(), "%d", int(sample.data_[i]));
+    snprintf(key, sizeof(key), "Ch%u", i);
+    d.addf(key, "%d", int(sample.data_[i]));
   }
   d.addf("FT Vhalf", "%d", int(sample.vhalf_));
 
   if (ft_overload_flags_ != 0)
   {
     d.mergeSummary(d.ERROR, "Sensor overloaded");
-    ss.str("");
+    char channels[NUM_FT_CHANNELS * 4 + 1];
+    unsigned len = 0;
     for (unsigned i=0;i<NUM_FT_CHANNELS;++i)
     {
-      ss << "Ch" << i << " ";
+      len += snprintf(channels + len, sizeof(channels) - len, "Ch%u ", i);
     }
+    d.add("Overload Channels", channels);
   }
   else 
   {
-    ss.str("None");
+    d.add("Overload Channels", "None");
   }
-  d.add("Overload Channels", ss.str());
 
   if (ft_sampling_rate_error_)
   {
@@ -71,15 +71,21 @@ WG0XDiagnostics::WG0XDiagnostics() :
   bridge_over_temp_total_(0),
   operate_disable_total_(0),
   watchdog_disable_total_(0),
-  lock_errors_(0),
-  checksum_errors_(0),
-  zero_offset_(0),
   cached_zero_offset_(0)
 {
   memset(&safety_disable_status_, 0, sizeof(safety_disable_status_));
   memset(&diagnostics_info_, 0, sizeof(diagnostics_info_));
 }
 
+WG0XRealtimeDiagnostics::WG0XRealtimeDiagnostics() :
+  checksum_errors_(0),
+  zero_offset_(0),
+  drops_(0),
+  max_consecutive_drops_(0)
+{
+  
+}
+
 /*!
  * \brief  Use new updates WG0X diagnostics with new safety disable data
  *
@@ -162,6 +168,7 @@ WG0X::WG0X() :
   encoder_errors_detected_(false),
   cached_zero_offset_(0), 
   calibration_status_(NO_CALIBRATION),
+  hw_(NULL),
   app_ram_status_(APP_RAM_MISSING),
   motor_model_(NULL),
   disable_motor_model_checking_(false)
@@ -177,13 +184,6 @@ WG0X::WG0X() :
   in_lockout_ = false;
   resetting_ = false;
   has_error_ = false;
-
-  int error;
-  if ((error = pthread_mutex_init(&wg0x_diagnostics_lock_, NULL)) != 0)
-  {
-    ROS_ERROR("WG0X : init diagnostics mutex :%s", strerror(error));
-  }
-
 }
 
 WG0X::~WG0X()
@@ -393,6 +393,8 @@ bool WG0X::initializeMotorHeatingModel(bool allow_unprogrammed)
 
 int WG0X::initialize(pr2_hardware_interface::HardwareInterface *hw, bool allow_unprogrammed)
 {
+  hw_ = hw;
+
   ROS_DEBUG("Device #%02d: WG0%d (%#08x) Firmware Revision %d.%02d, PCB Revision %c.%02d, Serial #: %d", 
             sh_->get_ring_position(),
             sh_->get_product_code() % 100,
@@ -489,6 +491,10 @@ int WG0X::initialize(pr2_hardware_interface::HardwareInterface *hw, bool allow_u
         ROS_DEBUG("Read calibration from device %s: %f", actuator_info_.name_, zero_offset);
         actuator_.state_.zero_offset_ = zero_offset;
         cached_zero_offset_ = zero_offset;
+        // Offset is already on device, collection thread does not need to write it
+        realtime_diagnostics_.zero_offset_ = zero_offset;
+        realtime_diagnostics_snapshot_.write(realtime_diagnostics_);
+        wg0x_collect_diagnostics_.cached_zero_offset_ = zero_offset;
         calibration_status_ = SAVED_CALIBRATION;
       }
       else
@@ -578,18 +584,11 @@ void WG0X::packCommand(unsigned char *buffer, bool halt, bool reset)
   double zero_offset = actuator_.state_.zero_offset_;
   if (zero_offset != cached_zero_offset_) 
   {
-    if (tryLockWG0XDiagnostics())
-    {
-      ROS_DEBUG("Calibration change of %s, new %f, old %f", actuator_info_.name_, zero_offset, cached_zero_offset_);
-      cached_zero_offset_ = zero_offset;
-      wg0x_collect_diagnostics_.zero_offset_ = zero_offset;
-      calibration_status_ = CONTROLLER_CALIBRATION;
-      unlockWG0XDiagnostics();
-    }
-    else 
-    {
-      // It is OK if trylock failed, this will still try again next cycle.
-    }
+    ROS_DEBUG("Calibration change of %s, new %f, old %f", actuator_info_.name_, zero_offset, cached_zero_offset_);
+    cached_zero_offset_ = zero_offset;
+    realtime_diagnostics_.zero_offset_ = zero_offset;
+    realtime_diagnostics_snapshot_.write(realtime_diagnostics_);
+    calibration_status_ = CONTROLLER_CALIBRATION;
   }
 
   // Compute the current
@@ -620,6 +619,8 @@ bool WG0X::unpackState(unsigned char *this_buffer, unsigned char *prev_buffer)
 
   digital_out_.state_.data_ = this_status->digital_out_;
 
+  alignSampleTime(this_status->timestamp_);
+
   // Do not report timestamp directly to controllers because 32bit integer 
   // value in microseconds will overflow every 72 minutes.   
   // Instead a accumulate small time differences into a ros::Duration variable
@@ -661,14 +662,30 @@ bool WG0X::unpackState(unsigned char *this_buffer, unsigned char *prev_buffer)
 }
 
 
+/*!
+ * \brief Updates device clock alignment with timestamp of newest status.
+ *
+ * EthercatHardware sets current time of hardware interface to the time 
+ * process data was received, before any device unpacks its state.  
+ * Device clock ignores repeated timestamps, so this can be called more than once per cycle.
+ */
+void WG0X::alignSampleTime(uint32_t device_time_us)
+{
+  ros::Time receive_time((hw_ != NULL) ? hw_->current_time_ : ros::Time::now());
+  if (device_clock_.update(device_time_us, receive_time))
+  {
+    device_clock_snapshot_.write(device_clock_.estimate());
+  }
+  sample_host_time_ = device_clock_.toHostTime(device_time_us);
+}
+
+
 bool WG0X::verifyChecksum(const void* buffer, unsigned size)
 {
   bool success = wg_util::computeChecksum(buffer, size) == 0;
   if (!success) {
-    if (tryLockWG0XDiagnostics()) {
-      ++wg0x_collect_diagnostics_.checksum_errors_;
-      unlockWG0XDiagnostics();
-    }
+    ++realtime_diagnostics_.checksum_errors_;
+    realtime_diagnostics_snapshot_.write(realtime_diagnostics_);
   }
   return success;
 }
@@ -795,6 +812,9 @@ bool WG0X::verifyState(WG0XStatus *this_status, WG0XStatus *prev_status)
     ++drops_;
     ++consecutive_drops_;
     max_consecutive_drops_ = max(max_consecutive_drops_, consecutive_drops_);
+    realtime_diagnostics_.drops_ = drops_;
+    realtime_diagnostics_.max_consecutive_drops_ = max_consecutive_drops_;
+    realtime_diagnostics_snapshot_.write(realtime_diagnostics_);
   } else {
     consecutive_drops_ = 0;
   }
@@ -924,15 +944,16 @@ void WG0X::collectDiagnostics(EthercatCom *com)
   
   { // Try writing zero offset to to WG0X devices that have application ram
     WG0XDiagnostics &dg(wg0x_collect_diagnostics_);
+    double zero_offset = realtime_diagnostics_snapshot_.read().zero_offset_;
 
-    if ((app_ram_status_ == APP_RAM_PRESENT) && (dg.zero_offset_ != dg.cached_zero_offset_))
+    if ((app_ram_status_ == APP_RAM_PRESENT) && (zero_offset != dg.cached_zero_offset_))
     {
-      if (writeAppRam(com, dg.zero_offset_)){
-	ROS_DEBUG("Writing new calibration to device %s, new %f, old %f", actuator_info_.name_, dg.zero_offset_, dg.cached_zero_offset_);
-	dg.cached_zero_offset_ = dg.zero_offset_;
+      if (writeAppRam(com, zero_offset)){
+	ROS_DEBUG("Writing new calibration to device %s, new %f, old %f", actuator_info_.name_, zero_offset, dg.cached_zero_offset_);
+	dg.cached_zero_offset_ = zero_offset;
       }
       else{
-	ROS_ERROR("Failed to write new calibration to device %s, new %f, old %f", actuator_info_.name_, dg.zero_offset_, dg.cached_zero_offset_);
+	ROS_ERROR("Failed to write new calibration to device %s, new %f, old %f", actuator_info_.name_, zero_offset, dg.cached_zero_offset_);
 	// Diagnostics thread will try again next update cycle
       }
     }
@@ -941,18 +962,12 @@ void WG0X::collectDiagnostics(EthercatCom *com)
   success = true;
 
  end:
-  if (!lockWG0XDiagnostics()) {
-    wg0x_collect_diagnostics_.valid_ = false;   // change these values even if we did't get the lock
-    wg0x_collect_diagnostics_.first_ = false;   
-    return;
-  }
-
   wg0x_collect_diagnostics_.valid_ = success;   
   if (success) {
     wg0x_collect_diagnostics_.update(s,di);
   }
 
-  unlockWG0XDiagnostics();
+  wg0x_diagnostics_snapshot_.write(wg0x_collect_diagnostics_);
 }
 
 
@@ -1103,43 +1118,6 @@ int WG0X::readMailbox(EthercatCom *com, unsigned address, void *data, unsigned l
   return mailbox_.readMailbox(com, address, data, length);
 }
 
-bool WG0X::lockWG0XDiagnostics() 
-{
-  int error = pthread_mutex_lock(&wg0x_diagnostics_lock_);
-  if (error != 0) {
-    fprintf(stderr, "%s : " ERROR_HDR " getting diagnostics lock\n", __func__);
-    // update error counters even if we didn't get lock
-    ++wg0x_collect_diagnostics_.lock_errors_;
-    return false;
-  }
-  return true;
-}
-
-bool WG0X::tryLockWG0XDiagnostics() 
-{
-  int error = pthread_mutex_trylock(&wg0x_diagnostics_lock_);
-  if (error == EBUSY) {
-    return false;
-  }
-  else if (error != 0) {
-    fprintf(stderr, "%s : " ERROR_HDR " getting diagnostics lock\n", __func__);
-    // update error counters even if we didn't get lock
-    ++wg0x_collect_diagnostics_.lock_errors_;
-    return false;
-  }
-  return true;
-}
-
-void WG0X::unlockWG0XDiagnostics() 
-{
-  int error = pthread_mutex_unlock(&wg0x_diagnostics_lock_);
-  if (error != 0) {
-    fprintf(stderr, "%s : " ERROR_HDR " freeing diagnostics lock\n", __func__);
-    ++wg0x_collect_diagnostics_.lock_errors_;
-  }
-}
-
-
 /*!
  * \brief  Write data to WG0X local bus using mailbox communication.
  *
@@ -1219,13 +1197,11 @@ string WG0X::modeString(uint8_t mode)
   return str;
 }
 
-void WG0X::publishGeneralDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d)
+void WG0X::publishGeneralDiagnostics(ethercat_hardware::DiagnosticsBuilder &d)
 { 
-  // If possible, copy new diagnositics from collection thread, into diagnostics thread
-  if (tryLockWG0XDiagnostics()) { 
-    wg0x_publish_diagnostics_ = wg0x_collect_diagnostics_;
-    unlockWG0XDiagnostics(); 
-  }
+  // Copy new diagnositics from collection and realtime threads, into diagnostics thread
+  wg0x_diagnostics_snapshot_.read(wg0x_publish_diagnostics_);
+  WG0XRealtimeDiagnostics realtime_diagnostics(realtime_diagnostics_snapshot_.read());
 
   if (too_many_dropped_packets_)
   {
@@ -1248,7 +1224,7 @@ void WG0X::publishGeneralDiagnostics(diagnostic_updater::DiagnosticStatusWrapper
 
   WG0XDiagnostics const &p(wg0x_publish_diagnostics_);
   WG0XSafetyDisableStatus const &s(p.safety_disable_status_);
-  d.addf("Status Checksum Error Count", "%d", p.checksum_errors_);
+  d.addf("Status Checksum Error Count", "%d", realtime_diagnostics.checksum_errors_);
   d.addf("Safety Disable Status", "%s (%02x)", safetyDisableString(s.safety_disable_status_).c_str(), s.safety_disable_status_);
   d.addf("Safety Disable Status Hold", "%s (%02x)", safetyDisableString(s.safety_disable_status_hold_).c_str(), s.safety_disable_status_hold_);
   d.addf("Safety Disable Count", "%d", p.safety_disable_total_);
@@ -1320,16 +1296,57 @@ void WG0X::publishGeneralDiagnostics(diagnostic_updater::DiagnosticStatusWrapper
 
 
 
-void WG0X::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned char *buffer)
+void WG0X::telemetry(ethercat_hardware::DeviceTelemetry &t)
+{
+  EthercatDevice::telemetry(t);
+
+  // Same snapshots that publishGeneralDiagnostics() uses
+  wg0x_diagnostics_snapshot_.read(wg0x_publish_diagnostics_);
+  WG0XRealtimeDiagnostics realtime_diagnostics(realtime_diagnostics_snapshot_.read());
+  const WG0XDiagnostics &p(wg0x_publish_diagnostics_);
+  const ethercat_hardware::MbxDiagnostics &m(mailbox_.snapshotMailboxDiagnostics());
+
+  t.wg0x.resize(1);
+  ethercat_hardware::WG0XTelemetry &w(t.wg0x[0]);
+  w.valid = p.valid_;
+  w.safety_disable_status = p.safety_disable_status_.safety_disable_status_;
+  w.safety_disable_count = p.safety_disable_total_;
+  w.undervoltage_count = p.undervoltage_total_;
+  w.over_current_count = p.over_current_total_;
+  w.board_over_temp_count = p.board_over_temp_total_;
+  w.bridge_over_temp_count = p.bridge_over_temp_total_;
+  w.operate_disable_count = p.operate_disable_total_;
+  w.watchdog_disable_count = p.watchdog_disable_total_;
+  w.status_checksum_errors = realtime_diagnostics.checksum_errors_;
+  w.pdi_timeout_errors = p.diagnostics_info_.pdi_timeout_error_count_;
+  w.pdi_checksum_errors = p.diagnostics_info_.pdi_checksum_error_count_;
+  w.dropped_packets = realtime_diagnostics.drops_;
+  w.max_consecutive_drops = realtime_diagnostics.max_consecutive_drops_;
+
+  w.mailbox_write_errors = m.write_errors_;
+  w.mailbox_read_errors = m.read_errors_;
+  w.mailbox_retries = m.retries_;
+  w.mailbox_retry_errors = m.retry_errors_;
+  w.mailbox_frames = m.total_frames_;
+  w.mailbox_dropped_frames = m.total_dropped_frames_;
+}
+
+
+void WG0X::metrics(ethercat_hardware::DeviceMetrics &m)
+{
+  m.drops_ = drops_;
+  m.max_consecutive_drops_ = max_consecutive_drops_;
+}
+
+
+void WG0X::diagnostics(ethercat_hardware::DiagnosticsBuilder &d, unsigned char *buffer)
 {
   WG0XStatus *status = (WG0XStatus *)(buffer + command_size_);
 
-  stringstream str;
-  str << "EtherCAT Device (" << actuator_info_.name_ << ")";
-  d.name = str.str();
+  d.setNamef("EtherCAT Device (%s)", actuator_info_.name_);
   char serial[32];
   snprintf(serial, sizeof(serial), "%d-%05d-%05d", config_info_.product_id_ / 100000 , config_info_.product_id_ % 100000, config_info_.device_serial_number_);
-  d.hardware_id = serial;
+  d.setHardwareId(serial);
 
   d.summary(d.OK, "OK");
 
@@ -1360,7 +1377,7 @@ void WG0X::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned
   publishGeneralDiagnostics(d);
   mailbox_.publishMailboxDiagnostics(d);
 
-  d.addf("Calibration Offset", "%f", cached_zero_offset_);
+  d.addf("Calibration Offset", "%f", realtime_diagnostics_snapshot_.read().zero_offset_);
   d.addf("Calibration Status", "%s", 
          (calibration_status_ == NO_CALIBRATION) ? "No calibration" :
          (calibration_status_ == CONTROLLER_CALIBRATION) ? "Calibrated by controller" :
@@ -1373,6 +1390,14 @@ void WG0X::diagnostics(diagnostic_updater::DiagnosticStatusWrapper &d, unsigned
   d.addf("Programmed current", "%f", status->programmed_current_ * config_info_.nominal_current_scale_);
   d.addf("Measured current", "%f", status->measured_current_ * config_info_.nominal_current_scale_);
   d.addf("Timestamp", "%u", status->timestamp_);
+  {
+    ethercat_hardware::DeviceClockEstimate clock(device_clock_snapshot_.read());
+    d.add("Clock Aligned", clock.aligned_ ? "Yes" : "No");
+    d.addf("Clock Drift (ppm)", "%.2f", clock.drift_ppm_);
+    d.addf("Clock Fit Error (us)", "%.2f", clock.fit_error_us_);
+    d.addf("Status Latency (us)", "%.1f", clock.latency_us_);
+    d.addf("Clock Resets", "%u", clock.resets_);
+  }
   d.addf("Encoder count", "%d", status->encoder_count_);
   d.addf("Encoder index pos", "%d", status->encoder_index_pos_);
   d.addf("Num encoder_errors", "%d", status->num_encoder_errors_);
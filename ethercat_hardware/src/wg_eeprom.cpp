@@ -160,6 +160,21 @@ bool WGEeprom::sendSpiEepromCmd(EthercatCom *com, WGMailbox *mbx, const WG0XSpiE
     return false;
   }
 
+  return issueSpiEepromCmd(com, mbx, cmd);
+}
+
+
+/*!
+ * \brief  Sends command to SPI EEPROM state machine, without first checking that it is idle.
+ *
+ * Used when state machine is already known to be idle, such as right after a previous 
+ * command completed.  Waits for command to complete before returning.
+ * 
+ * \param com       EtherCAT communication class used for communicating with device
+ * \return          true if command was send, false if there is an error
+ */
+bool WGEeprom::issueSpiEepromCmd(EthercatCom *com, WGMailbox *mbx, const WG0XSpiEepromCmd &cmd)
+{
   // Send command
   if (mbx->writeMailbox(com, WG0XSpiEepromCmd::SPI_COMMAND_ADDR, &cmd, sizeof(cmd)))
   {
@@ -343,6 +358,136 @@ bool WGEeprom::writeEepromPage(EthercatCom *com, WGMailbox *mbx, unsigned page,
 }
 
 
+bool WGEeprom::checkPageRange(unsigned first_page, unsigned num_pages, const char *op)
+{
+  if ((first_page >= NUM_EEPROM_PAGES) || (num_pages > NUM_EEPROM_PAGES - first_page))
+  {
+    ROS_ERROR("Eeprom %s of pages %d-%d is outside of 0-%d", op, first_page, first_page+num_pages-1, NUM_EEPROM_PAGES-1);
+    return false;
+  }
+  return true;
+}
+
+
+/*!
+ * \brief  Read data from multiple consecutive eeprom pages.
+ *
+ * Compared to readEepromPage(), the FPGA buffer is zeroed only once, and SPI state machine 
+ * is not polled before each command, since the readback of the previous command already 
+ * showed it to be idle.  This cuts mailbox operations per page from five to three.
+ * Function may block for extended periods of time (is not realtime safe).
+ * 
+ * \param com        EtherCAT communication class used for communicating with device
+ * \param mbx        Mailbox for used communication with device
+ * \param first_page First EEPROM page number to read
+ * \param num_pages  Number of pages to read
+ * \param data       buffer for num_pages*MAX_EEPROM_PAGE_SIZE bytes of data
+ * \return           true if there is success, false if there is an error
+ */
+bool WGEeprom::readEepromPages(EthercatCom *com, WGMailbox *mbx, unsigned first_page, unsigned num_pages, void* data)
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  if (!checkPageRange(first_page, num_pages, "read"))
+  {
+    return false;
+  }
+
+  // With 256 byte eeproms, page reads only fill first 256 bytes of FPGA buffer.
+  // Zeroing buffer once is enough to keep the last 8 bytes of every page zero, 
+  // because nothing but page reads touches the buffer until we are done.
+  uint8_t *buf = static_cast<uint8_t*>(data);
+  memset(buf, 0, MAX_EEPROM_PAGE_SIZE);
+  if (mbx->writeMailbox(com, WG0XSpiEepromCmd::SPI_BUFFER_ADDR, buf, MAX_EEPROM_PAGE_SIZE)) 
+  {
+    ROS_ERROR("Error zeroing eeprom data buffer");
+    return false;
+  }
+
+  if (!waitForSpiEepromReady(com, mbx))
+  {
+    return false;
+  }
+
+  for (unsigned i=0; i<num_pages; ++i)
+  {
+    WG0XSpiEepromCmd cmd;
+    memset(&cmd,0,sizeof(cmd));
+    cmd.build_read(first_page+i);
+    if (!issueSpiEepromCmd(com, mbx, cmd)) 
+    {
+      ROS_ERROR("Error sending SPI read command for page %d", first_page+i);
+      return false;
+    }
+
+    if (mbx->readMailbox(com, WG0XSpiEepromCmd::SPI_BUFFER_ADDR, buf + i*MAX_EEPROM_PAGE_SIZE, MAX_EEPROM_PAGE_SIZE)) 
+    {
+      ROS_ERROR("Error reading eeprom data for page %d from buffer", first_page+i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+/*!
+ * \brief  Write data to multiple consecutive eeprom pages.
+ *
+ * Each page still has to wait for eeprom to finish programming, since status 
+ * register polling uses the same FPGA buffer as page data.  SPI state machine is 
+ * only checked once before first page, since waiting for eeprom ready leaves it idle.
+ * Function may block for extended periods of time (is not realtime safe).
+ * 
+ * \param com        EtherCAT communication class used for communicating with device
+ * \param mbx        Mailbox for used communication with device
+ * \param first_page First EEPROM page number to write
+ * \param num_pages  Number of pages to write
+ * \param data       num_pages*MAX_EEPROM_PAGE_SIZE bytes of data
+ * \return           true if there is success, false if there is an error
+ */
+bool WGEeprom::writeEepromPages(EthercatCom *com, WGMailbox *mbx, unsigned first_page, unsigned num_pages, const void* data)
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+
+  if (!checkPageRange(first_page, num_pages, "write"))
+  {
+    return false;
+  }
+
+  if (!waitForSpiEepromReady(com, mbx))
+  {
+    return false;
+  }
+
+  const uint8_t *buf = static_cast<const uint8_t*>(data);
+  for (unsigned i=0; i<num_pages; ++i)
+  {
+    if (mbx->writeMailbox(com, WG0XSpiEepromCmd::SPI_BUFFER_ADDR, buf + i*MAX_EEPROM_PAGE_SIZE, MAX_EEPROM_PAGE_SIZE))
+    {
+      ROS_ERROR("Write of SPI EEPROM buffer for page %d failed", first_page+i);
+      return false;
+    }
+
+    WG0XSpiEepromCmd cmd;
+    memset(&cmd,0,sizeof(cmd));
+    cmd.build_write(first_page+i);
+    if (!issueSpiEepromCmd(com, mbx, cmd)) 
+    {
+      ROS_ERROR("Error giving SPI EEPROM write command for page %d", first_page+i);
+      return false;
+    }
+
+    if (!waitForEepromReady(com, mbx))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
 /*!
  * \brief  Waits for EEPROM to become ready
  *
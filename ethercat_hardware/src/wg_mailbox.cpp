@@ -37,6 +37,10 @@
 #include "dll/ethercat_device_addressed_telegram.h"
 #include "ethercat_hardware/ethercat_device.h"
 
+#include <boost/bind.hpp>
+#include <boost/static_assert.hpp>
+#include <algorithm>
+
 namespace ethercat_hardware
 {
 
@@ -75,6 +79,8 @@ struct WG0XMbxHdr
 
 static const unsigned MBX_SIZE = 512;
 static const unsigned MBX_DATA_SIZE = (MBX_SIZE - sizeof(WG0XMbxHdr) - 1);
+BOOST_STATIC_ASSERT(MBX_DATA_SIZE == WGMailbox::MBX_MAX_WRITE_LENGTH);
+BOOST_STATIC_ASSERT((MBX_SIZE-1) == WGMailbox::MBX_MAX_READ_LENGTH);
 struct WG0XMbxCmd
 {
   WG0XMbxHdr hdr_;
@@ -144,16 +150,62 @@ bool WG0XMbxCmd::build(unsigned address, unsigned length, MbxCmdType type, unsig
 }
 
 
+MbxPhaseStats::MbxPhaseStats() :
+  count_(0),
+  total_latency_us_(0),
+  max_latency_us_(0),
+  frames_(0),
+  dropped_frames_(0)
+{
+  memset(histogram_, 0, sizeof(histogram_));
+}
+
+void MbxPhaseStats::record(unsigned latency_us, unsigned frames, unsigned dropped)
+{
+  ++count_;
+  total_latency_us_ += latency_us;
+  max_latency_us_ = std::max(max_latency_us_, latency_us);
+  frames_ += frames;
+  dropped_frames_ += dropped;
+
+  unsigned bucket = 0;
+  while ((bucket < (NUM_BUCKETS-1)) && (latency_us >= bucketLimit(bucket)))
+  {
+    ++bucket;
+  }
+  ++histogram_[bucket];
+}
+
+
 MbxDiagnostics::MbxDiagnostics() :
   write_errors_(0),
   read_errors_(0),
   lock_errors_(0),
   retries_(0),
-  retry_errors_(0)
+  retry_errors_(0),
+  total_frames_(0),
+  total_dropped_frames_(0)
 {
   // Empty
 }
 
+const char* MbxDiagnostics::phaseName(Phase phase)
+{
+  switch (phase)
+  {
+  case CLEAR_READ:        return "Clear Read";
+  case WRITE_CMD:         return "Write Command";
+  case WAIT_WRITE_EMPTY:  return "Wait Write Empty";
+  case WAIT_READ_READY:   return "Wait Read Ready";
+  case READ_RESULT:       return "Read Result";
+  case REPEAT_REQUEST:    return "Repeat Request";
+  case READ_TRANSACTION:  return "Read Transaction";
+  case WRITE_TRANSACTION: return "Write Transaction";
+  case NUM_PHASES:        break;
+  }
+  return "Unknown";
+}
+
 
 /*!
  * \brief  Find difference between two timespec values
@@ -170,6 +222,19 @@ int timediff_ms(const timespec &current, const timespec &start)
 }
 
 
+/*!
+ * \brief  Find difference between two timespec values
+ *
+ * \return          returns time difference (current-start) in microseconds, 0 if negative
+ */
+static unsigned timediff_us(const timespec &current, const timespec &start)
+{
+  int64_t diff = int64_t(current.tv_sec-start.tv_sec)*1000000 // 1000000 us in a sec
+    + (current.tv_nsec-start.tv_nsec)/1000; // 1000 ns in a us
+  return (diff > 0) ? unsigned(diff) : 0;
+}
+
+
 /*!
  * \brief  error checking wrapper around clock_gettime
  *
@@ -224,7 +289,69 @@ void updateIndexAndWkc(EC_Telegram *tg, EC_Logic *logic)
   tg->set_wkc(logic->get_wkc());
 }
 
-WGMailbox::WGMailbox() : sh_(NULL)
+
+/*!
+ * \brief  Records latency and frame counts of a mailbox phase when it goes out of scope.
+ *
+ * Phases add their frames to running totals, which transactions use 
+ * to determine how many frames they took overall.
+ * Mailbox lock should be held while timer exists.
+ */
+class MbxPhaseTimer
+{
+public:
+  MbxPhaseTimer(MbxDiagnostics &diag, MbxDiagnostics::Phase phase) :
+    frames_(0),
+    dropped_(0),
+    diag_(diag),
+    phase_(phase),
+    start_frames_(diag.total_frames_),
+    start_dropped_(diag.total_dropped_frames_)
+  {
+    valid_ = (safe_clock_gettime(CLOCK_MONOTONIC, &start_) == 0);
+  }
+
+  ~MbxPhaseTimer()
+  {
+    bool transaction = (phase_ == MbxDiagnostics::READ_TRANSACTION) || (phase_ == MbxDiagnostics::WRITE_TRANSACTION);
+    if (transaction)
+    {
+      frames_ = diag_.total_frames_ - start_frames_;
+      dropped_ = diag_.total_dropped_frames_ - start_dropped_;
+    }
+    else 
+    {
+      diag_.total_frames_ += frames_;
+      diag_.total_dropped_frames_ += dropped_;
+    }
+
+    timespec end;
+    if (valid_ && (safe_clock_gettime(CLOCK_MONOTONIC, &end) == 0))
+    {
+      diag_.phases_[phase_].record(timediff_us(end, start_), frames_, dropped_);
+    }
+  }
+
+  unsigned frames_;
+  unsigned dropped_;
+
+protected:
+  MbxDiagnostics &diag_;
+  MbxDiagnostics::Phase phase_;
+  timespec start_;
+  bool valid_;
+  uint64_t start_frames_;
+  uint64_t start_dropped_;
+};
+
+WGMailbox::WGMailbox() : 
+  sh_(NULL), 
+  scheduler_(NULL), 
+  async_phase_(ASYNC_IDLE),
+  async_poll_frames_(0),
+  async_poll_dropped_(0),
+  async_request_start_frames_(0),
+  async_request_start_dropped_(0)
 {
   int error;
   if ((error = pthread_mutex_init(&mailbox_lock_, NULL)) != 0)
@@ -306,13 +433,16 @@ bool WGMailbox::clearReadMailbox(EthercatCom *com)
 
 
   // Retry sending packet multiple times 
+  MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::CLEAR_READ);
   bool success=false;
   static const unsigned MAX_DROPS = 15;
   for (unsigned tries=0; tries<MAX_DROPS; ++tries) {
+    ++timer.frames_;
     success = com->txandrx_once(&frame);
     if (success) {
       break;
     }
+    ++timer.dropped_;
     updateIndexAndWkc(&read_start, logic);
     updateIndexAndWkc(&read_end  , logic);
   }
@@ -347,6 +477,23 @@ bool WGMailbox::clearReadMailbox(EthercatCom *com)
 
 
 
+/*!
+ * \brief  Reads status register of one of the mailbox syncmanagers.
+ *
+ * Bit 3 of status is set when mailbox is full.
+ *
+ * \param com          used to perform communication with device
+ * \param syncman_num  syncmanager to read status of
+ * \param status       status register value
+ * \return             returns true for success, false for failure
+ */
+bool WGMailbox::readSyncManStatus(EthercatCom *com, unsigned syncman_num, uint8_t &status)
+{
+  const unsigned SyncManAddr = 0x805+(syncman_num*8);
+  return (EthercatDevice::readData(com, sh_, SyncManAddr, &status, sizeof(status), EthercatDevice::FIXED_ADDR) == 0);
+}
+
+
 /*!
  * \brief  Waits until read mailbox is full or timeout.
  *
@@ -369,11 +516,14 @@ bool WGMailbox::waitForReadMailboxReady(EthercatCom *com)
     return false;
   }
   
+  MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::WAIT_READ_READY);
   do {      
     // Check if mailbox is full by looking at bit 3 of SyncMan status register.
     uint8_t SyncManStatus=0;
-    const unsigned SyncManAddr = 0x805+(MBX_STATUS_SYNCMAN_NUM*8);
-    if (EthercatDevice::readData(com, sh_, SyncManAddr, &SyncManStatus, sizeof(SyncManStatus), EthercatDevice::FIXED_ADDR) == 0) {
+    ++timer.frames_;
+    if (!readSyncManStatus(com, MBX_STATUS_SYNCMAN_NUM, SyncManStatus)) {
+      ++timer.dropped_;
+    } else {
       ++good_results;
       const uint8_t MailboxStatusMask = (1<<3);
       if (SyncManStatus & MailboxStatusMask) {
@@ -421,11 +571,14 @@ bool WGMailbox::waitForWriteMailboxReady(EthercatCom *com)
     return false;
   }
   
+  MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::WAIT_WRITE_EMPTY);
   do {      
     // Check if mailbox is full by looking at bit 3 of SyncMan status register.
     uint8_t SyncManStatus=0;
-    const unsigned SyncManAddr = 0x805+(MBX_COMMAND_SYNCMAN_NUM*8);
-    if (EthercatDevice::readData(com, sh_, SyncManAddr, &SyncManStatus, sizeof(SyncManStatus), EthercatDevice::FIXED_ADDR) == 0) {
+    ++timer.frames_;
+    if (!readSyncManStatus(com, MBX_COMMAND_SYNCMAN_NUM, SyncManStatus)) {
+      ++timer.dropped_;
+    } else {
       ++good_results;
       const uint8_t MailboxStatusMask = (1<<3);
       if ( !(SyncManStatus & MailboxStatusMask) ) {
@@ -518,11 +671,14 @@ bool WGMailbox::writeMailboxInternal(EthercatCom *com, void const *data, unsigne
     EC_Ethernet_Frame frame(&write_start);
       
     // Try multiple times, but remember number of of successful sends
+    MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::WRITE_CMD);
     unsigned sends=0;      
     bool success=false;
     for (unsigned tries=0; (tries<10) && !success; ++tries) {
+      ++timer.frames_;
       success = com->txandrx_once(&frame);
       if (!success) {
+        ++timer.dropped_;
         updateIndexAndWkc(&write_start, logic);
         updateIndexAndWkc(&write_end, logic);
       }
@@ -581,7 +737,8 @@ bool WGMailbox::writeMailboxInternal(EthercatCom *com, void const *data, unsigne
 
 bool WGMailbox::readMailboxRepeatRequest(EthercatCom *com)
 {
-  bool success = _readMailboxRepeatRequest(com);
+  MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::REPEAT_REQUEST);
+  bool success = _readMailboxRepeatRequest(com, timer);
   ++mailbox_diagnostics_.retries_;
   if (!success) {
     ++mailbox_diagnostics_.retry_errors_;
@@ -589,11 +746,12 @@ bool WGMailbox::readMailboxRepeatRequest(EthercatCom *com)
   return success;
 }
 
-bool WGMailbox::_readMailboxRepeatRequest(EthercatCom *com)
+bool WGMailbox::_readMailboxRepeatRequest(EthercatCom *com, MbxPhaseTimer &timer)
 {
   // Toggle repeat request flag, wait for ack from device
   // Returns true if ack is received, false for failure
   SyncMan sm;
+  ++timer.frames_;
   if (!sm.readData(com, sh_, EthercatDevice::FIXED_ADDR, MBX_STATUS_SYNCMAN_NUM)) {
     fprintf(stderr, "%s : " ERROR_HDR 
             " could not read status mailbox syncman (1)\n", __func__);
@@ -610,6 +768,7 @@ bool WGMailbox::_readMailboxRepeatRequest(EthercatCom *com)
   // Write toggled repeat request,,, wait for ack.
   SyncManActivate orig_activate(sm.activate);
   sm.activate.repeat_request = ~orig_activate.repeat_request;
+  ++timer.frames_;
   if (!sm.activate.writeData(com, sh_, EthercatDevice::FIXED_ADDR, MBX_STATUS_SYNCMAN_NUM)) {
     fprintf(stderr, "%s : " ERROR_HDR 
             " could not write syncman repeat request\n", __func__);
@@ -627,6 +786,7 @@ bool WGMailbox::_readMailboxRepeatRequest(EthercatCom *com)
   }
   
   do {
+    ++timer.frames_;
     if (!sm.readData(com, sh_, EthercatDevice::FIXED_ADDR, MBX_STATUS_SYNCMAN_NUM)) {
       fprintf(stderr, "%s : " ERROR_HDR 
               " could not read status mailbox syncman (2)\n", __func__);
@@ -730,6 +890,7 @@ bool WGMailbox::readMailboxInternal(EthercatCom *com, void *data, unsigned lengt
     
   EC_Ethernet_Frame frame(&read_start);
 
+  MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::READ_RESULT);
   unsigned tries = 0;    
   unsigned total_dropped =0;
   for (tries=0; tries<MAX_TRIES; ++tries) {      
@@ -737,9 +898,11 @@ bool WGMailbox::readMailboxInternal(EthercatCom *com, void *data, unsigned lengt
     // Send read - keep track of how many packets were dropped (for later)
     unsigned dropped=0;
     for (dropped=0; dropped<MAX_DROPPED; ++dropped) {
+      ++timer.frames_;
       if (com->txandrx_once(&frame)) {
         break;
       }
+      ++timer.dropped_;
       ++total_dropped;
       updateIndexAndWkc(&read_start   , logic);
       updateIndexAndWkc(&read_end     , logic);
@@ -811,10 +974,17 @@ bool WGMailbox::readMailboxInternal(EthercatCom *com, void *data, unsigned lengt
  */
 int WGMailbox::readMailbox(EthercatCom *com, unsigned address, void *data, unsigned length)
 {
+  if (useScheduler())
+    return readMailboxAsync(address, data, length)->wait();
+
   if (!lockMailbox())
     return -1;
 
-  int result = readMailbox_(com, address, data, length);
+  int result;
+  {
+    MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::READ_TRANSACTION);
+    result = readMailbox_(com, address, data, length);
+  }
   if (result != 0) {
     ++mailbox_diagnostics_.read_errors_;
   }
@@ -938,10 +1108,17 @@ void WGMailbox::unlockMailbox()
  */
 int WGMailbox::writeMailbox(EthercatCom *com, unsigned address, void const *data, unsigned length)
 {
+  if (useScheduler())
+    return writeMailboxAsync(address, data, length)->wait();
+
   if (!lockMailbox())
     return -1;
 
-  int result = writeMailbox_(com, address, data, length);
+  int result;
+  {
+    MbxPhaseTimer timer(mailbox_diagnostics_, MbxDiagnostics::WRITE_TRANSACTION);
+    result = writeMailbox_(com, address, data, length);
+  }
   if (result != 0) {
     ++mailbox_diagnostics_.write_errors_;
   }
@@ -990,18 +1167,520 @@ int WGMailbox::writeMailbox_(EthercatCom *com, unsigned address, void const *dat
 }
 
 
-void WGMailbox::publishMailboxDiagnostics(diagnostic_updater::DiagnosticStatusWrapper &d)
+const MbxDiagnostics &WGMailbox::snapshotMailboxDiagnostics()
 {
   if (lockMailbox()) { 
     mailbox_publish_diagnostics_ = mailbox_diagnostics_;
     unlockMailbox();
   }
+  return mailbox_publish_diagnostics_;
+}
 
-  MbxDiagnostics const &m(mailbox_publish_diagnostics_);
+
+void WGMailbox::publishMailboxDiagnostics(ethercat_hardware::DiagnosticsBuilder &d)
+{
+  MbxDiagnostics const &m(snapshotMailboxDiagnostics());
   d.addf("Mailbox Write Errors", "%d", m.write_errors_);
   d.addf("Mailbox Read Errors", "%d",  m.read_errors_);
   d.addf("Mailbox Retries", "%d",      m.retries_);
   d.addf("Mailbox Retry Errors", "%d", m.retry_errors_);
+  d.addf("Mailbox Frames", "%llu", (unsigned long long) m.total_frames_);
+  d.addf("Mailbox Dropped Frames", "%llu", (unsigned long long) m.total_dropped_frames_);
+
+  // Per-phase latency.  Histogram is comma separated count per bucket, 
+  // bucket limits are 64us, 128us, ... with last bucket holding everything slower.
+  for (unsigned i=0; i<MbxDiagnostics::NUM_PHASES; ++i)
+  {
+    MbxPhaseStats const &p(m.phases_[i]);
+    if (p.count_ == 0)
+    {
+      continue;
+    }
+    std::string name(std::string("Mailbox ") + MbxDiagnostics::phaseName(MbxDiagnostics::Phase(i)));
+    d.addf(name + " Count", "%u", p.count_);
+    d.addf(name + " Avg (us)", "%u", unsigned(p.total_latency_us_ / p.count_));
+    d.addf(name + " Max (us)", "%u", p.max_latency_us_);
+    d.addf(name + " Frames/Dropped", "%u/%u", p.frames_, p.dropped_frames_);
+    char histogram[MbxPhaseStats::NUM_BUCKETS*11];
+    unsigned len = 0;
+    for (unsigned j=0; j<MbxPhaseStats::NUM_BUCKETS; ++j)
+    {
+      len += snprintf(histogram+len, sizeof(histogram)-len, (j==0) ? "%u" : ",%u", p.histogram_[j]);
+    }
+    d.add(name + " Histogram", histogram);
+  }
+}
+
+
+void WGMailbox::dumpMailboxStatistics(std::ostream &out, const std::string &indent, bool snapshot)
+{
+  if (snapshot && lockMailbox()) { 
+    mailbox_publish_diagnostics_ = mailbox_diagnostics_;
+    unlockMailbox();
+  }
+
+  MbxDiagnostics const &m(mailbox_publish_diagnostics_);
+  out << indent << "write_errors: " << m.write_errors_ << std::endl;
+  out << indent << "read_errors: " << m.read_errors_ << std::endl;
+  out << indent << "lock_errors: " << m.lock_errors_ << std::endl;
+  out << indent << "retries: " << m.retries_ << std::endl;
+  out << indent << "retry_errors: " << m.retry_errors_ << std::endl;
+  out << indent << "frames: " << m.total_frames_ << std::endl;
+  out << indent << "dropped_frames: " << m.total_dropped_frames_ << std::endl;
+  out << indent << "bucket_limits_us: [";
+  for (unsigned j=0; j<MbxPhaseStats::NUM_BUCKETS-1; ++j)
+  {
+    out << ((j==0) ? "" : ", ") << MbxPhaseStats::bucketLimit(j);
+  }
+  out << "]" << std::endl;
+  out << indent << "phases:" << std::endl;
+  for (unsigned i=0; i<MbxDiagnostics::NUM_PHASES; ++i)
+  {
+    MbxPhaseStats const &p(m.phases_[i]);
+    out << indent << "  - name: \"" << MbxDiagnostics::phaseName(MbxDiagnostics::Phase(i)) << "\"" << std::endl;
+    out << indent << "    count: " << p.count_ << std::endl;
+    out << indent << "    total_latency_us: " << p.total_latency_us_ << std::endl;
+    out << indent << "    max_latency_us: " << p.max_latency_us_ << std::endl;
+    out << indent << "    frames: " << p.frames_ << std::endl;
+    out << indent << "    dropped_frames: " << p.dropped_frames_ << std::endl;
+    out << indent << "    histogram: [";
+    for (unsigned j=0; j<MbxPhaseStats::NUM_BUCKETS; ++j)
+    {
+      out << ((j==0) ? "" : ", ") << p.histogram_[j];
+    }
+    out << "]" << std::endl;
+  }
+}
+
+
+WGMailboxRequest::WGMailboxRequest(Type type, unsigned address, void *read_data, void const *write_data,
+                                   unsigned length, const Callback &callback) :
+  type_(type),
+  address_(address),
+  length_(length),
+  read_data_(read_data),
+  buffer_(std::max(length,1U), 0),
+  callback_(callback),
+  done_(false),
+  result_(-1)
+{
+  if ((write_data != NULL) && (length > 0))
+  {
+    memcpy(&buffer_[0], write_data, length);
+  }
+}
+
+bool WGMailboxRequest::done()
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  return done_;
+}
+
+int WGMailboxRequest::wait()
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (!done_) {
+    cond_.wait(lock);
+  }
+  return result_;
+}
+
+void WGMailboxRequest::complete(int result)
+{
+  if ((result == 0) && (type_ == READ) && (read_data_ != NULL))
+  {
+    memcpy(read_data_, &buffer_[0], length_);
+  }
+
+  { // LOCKED
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    result_ = result;
+    done_ = true;
+    cond_.notify_all();
+  } // UNLOCKED
+
+  if (callback_)
+  {
+    callback_(*this);
+  }
+}
+
+
+WGMailboxRequestPtr WGMailbox::readMailboxAsync(unsigned address, void *data, unsigned length, 
+                                                const WGMailboxRequest::Callback &callback)
+{
+  WGMailboxRequestPtr request(new WGMailboxRequest(WGMailboxRequest::READ, address, data, NULL, length, callback));
+  return queueRequest(request);
+}
+
+WGMailboxRequestPtr WGMailbox::writeMailboxAsync(unsigned address, void const *data, unsigned length, 
+                                                 const WGMailboxRequest::Callback &callback)
+{
+  WGMailboxRequestPtr request(new WGMailboxRequest(WGMailboxRequest::WRITE, address, NULL, data, length, callback));
+  return queueRequest(request);
+}
+
+WGMailboxRequestPtr WGMailbox::queueRequest(const WGMailboxRequestPtr &request)
+{
+  { // LOCKED
+    // Scheduler detaches mailbox with this lock held, so it cannot go away while request is queued
+    boost::lock_guard<boost::mutex> lock(request_queue_lock_);
+    if (scheduler_ != NULL)
+    {
+      request_queue_.push_back(request);
+      scheduler_->notify();
+      return request;
+    }
+  } // UNLOCKED
+
+  fprintf(stderr, "%s : " ERROR_HDR " mailbox is not attached to a scheduler\n", __func__);
+  request->complete(-1);
+  return request;
+}
+
+bool WGMailbox::useScheduler()
+{
+  boost::lock_guard<boost::mutex> lock(request_queue_lock_);
+  return (scheduler_ != NULL) && !scheduler_->inSchedulerThread();
+}
+
+
+/*!
+ * \brief  Advances active asynchronous request by (at most) one mailbox operation.
+ *
+ * Only called by scheduler thread.  
+ * Mailbox lock is held from when request is started until it is finished, 
+ * so blocking readMailbox()/writeMailbox() calls from other threads are still serialized.
+ *
+ * \param com       used to perform communication with device
+ * \return          STEP_IDLE if there is no work, STEP_POLLING if waiting on device, 
+ *                  STEP_PROGRESS otherwise.
+ */
+WGMailbox::StepResult WGMailbox::stepAsyncRequest(EthercatCom *com)
+{
+  static const int MAX_WAIT_TIME_MS = 100;
+
+  if (async_phase_ == ASYNC_IDLE)
+  {
+    { // LOCKED
+      boost::lock_guard<boost::mutex> lock(request_queue_lock_);
+      if (request_queue_.empty())
+      {
+        return STEP_IDLE;
+      }
+      // Blocking mailbox operation from some other thread is in progress, try again later
+      if (pthread_mutex_trylock(&mailbox_lock_) != 0)
+      {
+        return STEP_POLLING;
+      }
+      active_request_ = request_queue_.front();
+      request_queue_.pop_front();
+    } // UNLOCKED
+
+    safe_clock_gettime(CLOCK_MONOTONIC, &async_request_start_time_);
+    async_request_start_frames_ = mailbox_diagnostics_.total_frames_;
+    async_request_start_dropped_ = mailbox_diagnostics_.total_dropped_frames_;
+
+    if (!verifyDeviceStateForMailboxOperation())
+    {
+      finishAsyncRequest(-1);
+      return STEP_PROGRESS;
+    }
+    async_phase_ = (active_request_->type_ == WGMailboxRequest::READ) ? ASYNC_CLEAR : ASYNC_WRITE_CMD;
+  }
+
+  WGMailboxRequest &request(*active_request_);
+  switch (async_phase_)
+  {
+  case ASYNC_CLEAR:
+    if (!clearReadMailbox(com))
+    {
+      fprintf(stderr, "%s : " ERROR_HDR " clearing read mbx\n", __func__);
+      finishAsyncRequest(-1);
+      break;
+    }
+    async_phase_ = ASYNC_WRITE_CMD;
+    break;
+
+  case ASYNC_WRITE_CMD:
+    {
+      bool is_read = (request.type_ == WGMailboxRequest::READ);
+      WG0XMbxCmd cmd;
+      if (!cmd.build(request.address_, request.length_, is_read ? LOCAL_BUS_READ : LOCAL_BUS_WRITE, 
+                     sh_->get_mbx_counter(), is_read ? NULL : &request.buffer_[0]))
+      {
+        fprintf(stderr, "%s : " ERROR_HDR " builing mbx header\n", __func__);
+        finishAsyncRequest(-1);
+        break;
+      }
+      unsigned write_length = is_read ? sizeof(cmd.hdr_) : (sizeof(cmd.hdr_)+request.length_+sizeof(cmd.checksum_));
+      if (!writeMailboxInternal(com, &cmd, write_length))
+      {
+        fprintf(stderr, "%s : " ERROR_HDR " write of cmd failed\n", __func__);
+        finishAsyncRequest(-1);
+        break;
+      }
+      if (safe_clock_gettime(CLOCK_MONOTONIC, &async_start_time_) != 0)
+      {
+        finishAsyncRequest(-1);
+        break;
+      }
+      async_poll_frames_ = 0;
+      async_poll_dropped_ = 0;
+      async_phase_ = is_read ? ASYNC_WAIT_READ_READY : ASYNC_WAIT_WRITE_EMPTY;
+    }
+    break;
+
+  case ASYNC_WAIT_READ_READY:
+  case ASYNC_WAIT_WRITE_EMPTY:
+    {
+      bool wait_read = (async_phase_ == ASYNC_WAIT_READ_READY);
+      MbxPhaseStats &stats(mailbox_diagnostics_.phases_[wait_read ? MbxDiagnostics::WAIT_READ_READY : MbxDiagnostics::WAIT_WRITE_EMPTY]);
+      uint8_t status=0;
+      const uint8_t MailboxStatusMask = (1<<3);
+      bool ready = false;
+      ++async_poll_frames_;
+      if (!readSyncManStatus(com, wait_read ? MBX_STATUS_SYNCMAN_NUM : MBX_COMMAND_SYNCMAN_NUM, status))
+      {
+        ++async_poll_dropped_;
+      }
+      else
+      {
+        bool full = (status & MailboxStatusMask);
+        ready = (wait_read == full);
+      }
+
+      timespec current_time;
+      if (safe_clock_gettime(CLOCK_MONOTONIC, &current_time) != 0)
+      {
+        finishAsyncRequest(-1);
+        break;
+      }
+      int timediff = timediff_ms(current_time, async_start_time_);
+      if (ready || (timediff >= MAX_WAIT_TIME_MS))
+      {
+        // Polling spans many scheduler steps, so phase is recorded here rather than with MbxPhaseTimer
+        stats.record(timediff_us(current_time, async_start_time_), async_poll_frames_, async_poll_dropped_);
+        mailbox_diagnostics_.total_frames_ += async_poll_frames_;
+        mailbox_diagnostics_.total_dropped_frames_ += async_poll_dropped_;
+      }
+
+      if (ready)
+      {
+        if (wait_read)
+          async_phase_ = ASYNC_READ_RESULT;
+        else 
+          finishAsyncRequest(0);
+        break;
+      }
+      else if (timediff >= MAX_WAIT_TIME_MS)
+      {
+        if (wait_read)
+        {
+          fprintf(stderr, "%s : " ERROR_HDR " error read mbx not full after %d ms\n", __func__, timediff);
+          finishAsyncRequest(-1);
+        }
+        else
+        {
+          // Same as writeMailbox_(), device not emptying write mailbox is not treated as failure
+          fprintf(stderr, "%s : " ERROR_HDR " error write mbx not empty after %d ms\n", __func__, timediff);
+          finishAsyncRequest(0);
+        }
+        break;
+      }
+      return STEP_POLLING;
+    }
+
+  case ASYNC_READ_RESULT:
+    {
+      WG0XMbxCmd stat;
+      memset(&stat,0,sizeof(stat));
+      if (!readMailboxInternal(com, &stat, request.length_+1))
+      {
+        fprintf(stderr, "%s : " ERROR_HDR " read failed\n", __func__);
+        finishAsyncRequest(-1);
+        break;
+      }
+      if (wg_util::computeChecksum(&stat, request.length_+1) != 0) 
+      {
+        fprintf(stderr, "%s : " ERROR_HDR "checksum error reading mailbox data\n", __func__);
+        finishAsyncRequest(-1);
+        break;
+      }
+      memcpy(&request.buffer_[0], &stat, request.length_);
+      finishAsyncRequest(0);
+    }
+    break;
+
+  case ASYNC_IDLE:
+    break;
+  }
+
+  return STEP_PROGRESS;
+}
+
+void WGMailbox::finishAsyncRequest(int result)
+{
+  WGMailboxRequestPtr request;
+  request.swap(active_request_);
+  async_phase_ = ASYNC_IDLE;
+
+  timespec end_time;
+  if (safe_clock_gettime(CLOCK_MONOTONIC, &end_time) == 0)
+  {
+    bool is_read = (request->type_ == WGMailboxRequest::READ);
+    mailbox_diagnostics_.phases_[is_read ? MbxDiagnostics::READ_TRANSACTION : MbxDiagnostics::WRITE_TRANSACTION].record(
+        timediff_us(end_time, async_request_start_time_), 
+        mailbox_diagnostics_.total_frames_ - async_request_start_frames_,
+        mailbox_diagnostics_.total_dropped_frames_ - async_request_start_dropped_);
+  }
+
+  if (result != 0) {
+    if (request->type_ == WGMailboxRequest::READ)
+      ++mailbox_diagnostics_.read_errors_;
+    else
+      ++mailbox_diagnostics_.write_errors_;
+  }
+  unlockMailbox();
+
+  // Complete request after releasing mailbox lock, so callback can queue or run more mailbox operations
+  request->complete(result);
+}
+
+
+void WGMailbox::cancelAsyncRequests()
+{
+  if (active_request_) {
+    finishAsyncRequest(-1);
+  }
+
+  std::deque<WGMailboxRequestPtr> queue;
+  { // LOCKED
+    boost::lock_guard<boost::mutex> lock(request_queue_lock_);
+    queue.swap(request_queue_);
+  } // UNLOCKED
+  for (unsigned i=0; i<queue.size(); ++i) {
+    queue[i]->complete(-1);
+  }
+}
+
+
+//! After this, new requests fail immediately instead of waiting for a scheduler that is gone
+void WGMailbox::detachScheduler()
+{
+  std::deque<WGMailboxRequestPtr> queue;
+  { // LOCKED
+    boost::lock_guard<boost::mutex> lock(request_queue_lock_);
+    scheduler_ = NULL;
+    queue.swap(request_queue_);
+  } // UNLOCKED
+  for (unsigned i=0; i<queue.size(); ++i) {
+    queue[i]->complete(-1);
+  }
+}
+
+
+WGMailboxScheduler::WGMailboxScheduler(EthercatCom *com) :
+  com_(com),
+  work_pending_(false)
+{
+}
+
+WGMailboxScheduler::~WGMailboxScheduler()
+{
+  stop();
+}
+
+bool WGMailboxScheduler::attach(WGMailbox *mbx)
+{
+  if (mbx->scheduler_ == this)
+  {
+    return true;
+  }
+  if (mbx->scheduler_ != NULL)
+  {
+    fprintf(stderr, "%s : " ERROR_HDR " mailbox is already attached to another scheduler\n", __func__);
+    return false;
+  }
+  { // LOCKED
+    boost::lock_guard<boost::mutex> lock(mbx->request_queue_lock_);
+    mbx->scheduler_ = this;
+  } // UNLOCKED
+  mailboxes_.push_back(mbx);
+  return true;
+}
+
+void WGMailboxScheduler::start()
+{
+  thread_ = boost::thread(boost::bind(&WGMailboxScheduler::schedulerThreadFunc, this));
+}
+
+void WGMailboxScheduler::stop()
+{
+  // Scheduler thread fails active requests before it exits, see schedulerThreadFunc()
+  thread_.interrupt();
+  thread_.join();
+
+  // Requests queued after thread exited (or when it was never started) would otherwise never complete
+  for (unsigned i=0; i<mailboxes_.size(); ++i) {
+    mailboxes_[i]->detachScheduler();
+  }
+  mailboxes_.clear();
+}
+
+void WGMailboxScheduler::notify()
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  work_pending_ = true;
+  cond_.notify_one();
+}
+
+bool WGMailboxScheduler::inSchedulerThread() const
+{
+  return boost::this_thread::get_id() == thread_.get_id();
+}
+
+void WGMailboxScheduler::schedulerThreadFunc()
+{
+  try {
+    while (1) {
+      {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (!work_pending_) {
+          cond_.wait(lock);
+        }
+        work_pending_ = false;
+      }
+
+      // Round-robin between devices until every request queue is drained.  
+      // Only sleep when all busy devices are just waiting for their mailbox.
+      bool busy = true;
+      while (busy) {
+        boost::this_thread::interruption_point();
+        bool progress = false;
+        busy = false;
+        for (unsigned i=0; i<mailboxes_.size(); ++i) {
+          WGMailbox::StepResult step = mailboxes_[i]->stepAsyncRequest(com_);
+          if (step == WGMailbox::STEP_PROGRESS) {
+            progress = true;
+            busy = true;
+          } else if (step == WGMailbox::STEP_POLLING) {
+            busy = true;
+          }
+        }
+        if (busy && !progress) {
+          safe_usleep(100);
+        }
+      }
+    }
+  } catch (boost::thread_interrupted const&) {
+    // Active request holds mailbox lock that this thread took, so only this thread can release it.
+    // Fail left over requests too, so nobody waits forever.
+    for (unsigned i=0; i<mailboxes_.size(); ++i) {
+      mailboxes_[i]->cancelAsyncRequests();
+    }
+    return;
+  }
 }
 
 
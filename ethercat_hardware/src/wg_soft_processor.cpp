@@ -3,22 +3,58 @@
 #include <sstream>
 #include <boost/foreach.hpp>
 #include <boost/static_assert.hpp>
+#include <boost/crc.hpp>
+#include <boost/weak_ptr.hpp>
 
 namespace ethercat_hardware
 {
 
-WGSoftProcessor::WGSoftProcessor()
+WGSoftProcessor::WGSoftProcessor() : initialized_(false), com_(NULL)
 {
 
 }
 
+WGSoftProcessor::~WGSoftProcessor()
+{
+  // Service threads use this object, stop them before anything else goes away
+  if (spinner_)
+  {
+    spinner_->stop();
+  }
+}
+
+boost::shared_ptr<WGSoftProcessor> WGSoftProcessor::shared()
+{
+  static boost::mutex mutex;
+  static boost::weak_ptr<WGSoftProcessor> instance;
+
+  boost::lock_guard<boost::mutex> lock(mutex);
+  boost::shared_ptr<WGSoftProcessor> processor(instance.lock());
+  if (!processor)
+  {
+    processor.reset(new WGSoftProcessor());
+    instance = processor;
+  }
+  return processor;
+}
+
 bool WGSoftProcessor::initialize(EthercatCom *com)
 {
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  if (initialized_)
+  {
+    return true;
+  }
+  initialized_ = true;
+
   com_ = com;
   ros::NodeHandle nh("~/soft_processor/");
+  nh.setCallbackQueue(&callback_queue_);
   read_firmware_service_ = nh.advertiseService("read_firmware", &WGSoftProcessor::readFirmwareCB, this);
   write_firmware_service_ = nh.advertiseService("write_firmware", &WGSoftProcessor::writeFirmwareCB, this);
   reset_service_ = nh.advertiseService("reset", &WGSoftProcessor::resetCB, this);
+  spinner_.reset(new ros::AsyncSpinner(SERVICE_THREADS, &callback_queue_));
+  spinner_->start();
   return true;
 }
 
@@ -29,26 +65,80 @@ void WGSoftProcessor::add(WGMailbox *mbx,
                           unsigned iram_address, unsigned ctrl_address)
 {
   Info info(mbx, actuator_name, processor_name, iram_address, ctrl_address);
-  processors_.push_back(info);
+  { // LOCKED
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    processors_.push_back(info);
+  } // UNLOCKED
   ROS_INFO("Processor : %s/%s", actuator_name.c_str(), processor_name.c_str());
 }
 
 
+void WGSoftProcessor::remove(WGMailbox *mbx)
+{
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (busy_devices_.count(mbx))
+  {
+    busy_cond_.wait(lock);
+  }
+
+  std::list<Info>::iterator it = processors_.begin();
+  while (it != processors_.end())
+  {
+    if (it->mbx_ == mbx)
+      it = processors_.erase(it);
+    else
+      ++it;
+  }
+}
+
+
+WGSoftProcessor::DeviceLock::~DeviceLock()
+{
+  if (mbx_ != NULL)
+  {
+    boost::lock_guard<boost::mutex> lock(owner_.mutex_);
+    owner_.busy_devices_.erase(mbx_);
+    owner_.busy_cond_.notify_all();
+  }
+}
+
+
 
 const WGSoftProcessor::Info* WGSoftProcessor::get(const std::string &actuator_name, 
                                                   const std::string &processor_name,
-                                                  std::ostream &err_out) const
+                                                  DeviceLock &device_lock,
+                                                  std::ostream &err_out)
 {
-  BOOST_FOREACH(const Info &info, processors_)
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (true)
   {
-    if ((info.actuator_name_ == actuator_name) && (info.processor_name_ == processor_name))
+    const Info *found = NULL;
+    BOOST_FOREACH(const Info &info, processors_)
     {
-      return &info;
+      if ((info.actuator_name_ == actuator_name) && (info.processor_name_ == processor_name))
+      {
+        found = &info;
+        break;
+      }
+    }
+
+    if (found == NULL)
+    {
+      err_out << "No actuator/processor with name " << actuator_name << "/" << processor_name;
+      return NULL;
+    }
+
+    // Device may have been removed while waiting, so look processor up again afterwards
+    if (busy_devices_.count(found->mbx_))
+    {
+      busy_cond_.wait(lock);
+      continue;
     }
-  }
 
-  err_out << "No actuator/processor with name " << actuator_name << "/" << processor_name;
-  return NULL;
+    busy_devices_.insert(found->mbx_);
+    device_lock.mbx_ = found->mbx_;
+    return found;
+  }
 }
 
 
@@ -61,40 +151,18 @@ bool WGSoftProcessor::readFirmwareCB(ethercat_hardware::SoftProcessorFirmwareRea
 
   std::ostringstream err_out;
 
-  const Info *info = get(request.actuator_name, request.processor_name, err_out);
+  DeviceLock device_lock(*this);
+  const Info *info = get(request.actuator_name, request.processor_name, device_lock, err_out);
   if (!info)
   {
     response.error_msg = err_out.str();
     return true;
   }
 
-  // Each instruction is maped to 32bit memory array.  Read 64 instructions at a time.
-  response.instructions.resize(IRAM_INSTRUCTION_LENGTH);
-  static const unsigned INSTRUCTION_READ_CHUNK = 64;
-  uint8_t buf[INSTRUCTION_READ_CHUNK*4]; // Each instruction in 4 bytes
-  
-  BOOST_STATIC_ASSERT((IRAM_INSTRUCTION_LENGTH%INSTRUCTION_READ_CHUNK) == 0);
-
-  for (unsigned ii=0; ii<(IRAM_INSTRUCTION_LENGTH/INSTRUCTION_READ_CHUNK); ii+=INSTRUCTION_READ_CHUNK)
+  if (!readIram(*info, response.instructions, err_out))
   {
-    if (info->mbx_->readMailbox(com_, info->iram_address_ + ii*4, buf, sizeof(buf)))
-    {
-      response.error_msg = "Error reading IRAM data with mailbox";
-      return true;
-    }
-    
-    // Data 4-bytes and make integer out of them
-    for (unsigned jj=0; jj<INSTRUCTION_READ_CHUNK; ++jj)
-    {     
-      // instrutions are little endian
-      uint32_t instruction = 
-        (uint32_t(buf[jj*4+3])<<24) | 
-        (uint32_t(buf[jj*4+2])<<16) | 
-        (uint32_t(buf[jj*4+1])<<8 ) | 
-        (uint32_t(buf[jj*4+0])<<0 ) ;
-      
-      response.instructions[ii+jj] = instruction;
-    }
+    response.error_msg = err_out.str();
+    return true;
   }
 
   response.success = true;
@@ -111,13 +179,54 @@ bool WGSoftProcessor::writeFirmwareCB(ethercat_hardware::SoftProcessorFirmwareWr
 
   std::ostringstream err_out;
 
-  const Info *info = get(request.actuator_name, request.processor_name, err_out);
+  DeviceLock device_lock(*this);
+  const Info *info = get(request.actuator_name, request.processor_name, device_lock, err_out);
   if (!info)
   {
     response.error_msg = err_out.str();
     return true;
   }
 
+  if (request.instructions.size() > IRAM_INSTRUCTION_LENGTH)
+  {
+    err_out << "Firmware has " << request.instructions.size() << " instructions, but IRAM only holds "
+            << IRAM_INSTRUCTION_LENGTH;
+    response.error_msg = err_out.str();
+    return true;
+  }
+
+  // Unused part of IRAM is zero-filled
+  std::vector<uint32_t> instructions(request.instructions);
+  instructions.resize(IRAM_INSTRUCTION_LENGTH, 0);
+
+  // Only re-write chunks that differ from what is already in IRAM
+  std::vector<uint32_t> current;
+  if (!readIram(*info, current, err_out))
+  {
+    response.error_msg = err_out.str();
+    return true;
+  }
+
+  static const unsigned NUM_CHUNKS = (IRAM_INSTRUCTION_LENGTH + INSTRUCTION_CHUNK - 1) / INSTRUCTION_CHUNK;
+  std::vector<bool> changed(NUM_CHUNKS, false);
+  unsigned num_changed = 0;
+  for (unsigned ii=0; ii<IRAM_INSTRUCTION_LENGTH; ++ii)
+  {
+    if ((current[ii] != instructions[ii]) && !changed[ii/INSTRUCTION_CHUNK])
+    {
+      changed[ii/INSTRUCTION_CHUNK] = true;
+      ++num_changed;
+    }
+  }
+
+  if (num_changed == 0)
+  {
+    ROS_INFO("Firmware of %s/%s is unchanged, skipping write", 
+             info->actuator_name_.c_str(), info->processor_name_.c_str());
+    response.success = true;
+    return true;
+  }
+
   // Put soft-processor in reset before starting to re-write firmware
   if (!assertReset(*info, err_out))
   {
@@ -125,8 +234,34 @@ bool WGSoftProcessor::writeFirmwareCB(ethercat_hardware::SoftProcessorFirmwareWr
     return true;
   }
 
-  // perform write here
+  if (!writeIramChunks(*info, instructions, changed, err_out))
+  {
+    response.error_msg = err_out.str();    
+    return true;
+  }
+
+  // Verify complete IRAM image against CRC of requested image.
+  // On failure processor is left in reset, so it does not run corrupted firmware.
+  std::vector<uint32_t> readback;
+  if (!readIram(*info, readback, err_out))
+  {
+    response.error_msg = err_out.str() + " (processor left in reset)";
+    return true;
+  }
+
+  boost::crc_32_type expected_crc, readback_crc;
+  expected_crc.process_bytes(&instructions[0], instructions.size() * sizeof(uint32_t));
+  readback_crc.process_bytes(&readback[0], readback.size() * sizeof(uint32_t));
+  if (expected_crc.checksum() != readback_crc.checksum())
+  {
+    err_out << "Firmware verify failed : expected CRC 0x" << std::hex << expected_crc.checksum() 
+            << ", read back CRC 0x" << readback_crc.checksum() << " (processor left in reset)";
+    response.error_msg = err_out.str();
+    return true;
+  }
 
+  ROS_INFO("Wrote %d of %d firmware chunks to %s/%s", num_changed, NUM_CHUNKS, 
+           info->actuator_name_.c_str(), info->processor_name_.c_str());
 
   // Take soft-processor out of reset now that firmware is completely re-written
   if (!releaseReset(*info, err_out))
@@ -148,7 +283,8 @@ bool WGSoftProcessor::resetCB(ethercat_hardware::SoftProcessorReset::Request &re
 
   std::ostringstream err_out;
 
-  const Info *info = get(request.actuator_name, request.processor_name, err_out);
+  DeviceLock device_lock(*this);
+  const Info *info = get(request.actuator_name, request.processor_name, device_lock, err_out);
   if (!info)
   {
     response.error_msg = err_out.str();
@@ -175,20 +311,130 @@ bool WGSoftProcessor::resetCB(ethercat_hardware::SoftProcessorReset::Request &re
 //! Puts soft processor in reset
 bool WGSoftProcessor::assertReset(const Info &info, std::ostream &err_msg)
 {
-  // use mailbox to set bit 0 of byte at info->ctrl_address
-
-  return true;
+  return writeReset(info, true, err_msg);
 }
 
 //! Takes soft processor out of reset
 bool WGSoftProcessor::releaseReset(const Info &info, std::ostream &err_msg)
 {
-  // use mailbox to clear bit 0 of byte at info->ctrl_address
-  
+  return writeReset(info, false, err_msg);
+}
+
+
+bool WGSoftProcessor::writeReset(const Info &info, bool reset, std::ostream &err_msg)
+{
+  // use mailbox to set or clear bit 0 of byte at info->ctrl_address, leaving other bits alone
+  static const uint8_t RESET_BIT = 1<<0;
+  uint8_t ctrl = 0;
+  if (info.mbx_->readMailbox(com_, info.ctrl_address_, &ctrl, sizeof(ctrl)) != 0)
+  {
+    err_msg << "Error reading soft processor control register with mailbox";
+    return false;
+  }
+
+  ctrl = reset ? (ctrl | RESET_BIT) : (ctrl & ~RESET_BIT);
+  if (info.mbx_->writeMailbox(com_, info.ctrl_address_, &ctrl, sizeof(ctrl)) != 0)
+  {
+    err_msg << "Error writing soft processor control register with mailbox";
+    return false;
+  }
+
   return true;
 }
 
 
+bool WGSoftProcessor::readIram(const Info &info, std::vector<uint32_t> &instructions, std::ostream &err_msg)
+{
+  // Each instruction is maped to 32bit memory array.
+  instructions.resize(IRAM_INSTRUCTION_LENGTH);
+
+  std::vector<WGMailboxRequestPtr> requests;
+  for (unsigned ii=0; ii<IRAM_INSTRUCTION_LENGTH; ii+=INSTRUCTION_CHUNK)
+  {
+    unsigned remaining = IRAM_INSTRUCTION_LENGTH-ii;
+    unsigned count = (remaining < INSTRUCTION_CHUNK) ? remaining : INSTRUCTION_CHUNK;
+    requests.push_back(info.mbx_->readMailboxAsync(info.iram_address_ + ii*4, NULL, count*4));
+  }
+
+  bool success = true;
+  for (unsigned chunk=0; chunk<requests.size(); ++chunk)
+  {
+    WGMailboxRequest &request(*requests[chunk]);
+    if (request.wait() != 0)
+    {
+      success = false;
+      continue;
+    }
+
+    // Data 4-bytes and make integer out of them
+    const uint8_t *buf = static_cast<const uint8_t*>(request.data());
+    for (unsigned jj=0; jj<request.length()/4; ++jj)
+    {     
+      // instrutions are little endian
+      uint32_t instruction = 
+        (uint32_t(buf[jj*4+3])<<24) | 
+        (uint32_t(buf[jj*4+2])<<16) | 
+        (uint32_t(buf[jj*4+1])<<8 ) | 
+        (uint32_t(buf[jj*4+0])<<0 ) ;
+      
+      instructions[chunk*INSTRUCTION_CHUNK+jj] = instruction;
+    }
+  }
+
+  if (!success)
+  {
+    err_msg << "Error reading IRAM data with mailbox";
+  }
+  return success;
+}
+
+
+bool WGSoftProcessor::writeIramChunks(const Info &info, const std::vector<uint32_t> &instructions, 
+                                      const std::vector<bool> &changed, std::ostream &err_msg)
+{
+  assert(instructions.size() == IRAM_INSTRUCTION_LENGTH);
+
+  std::vector<WGMailboxRequestPtr> requests;
+  uint8_t buf[INSTRUCTION_CHUNK*4]; // Each instruction in 4 bytes
+  for (unsigned ii=0; ii<IRAM_INSTRUCTION_LENGTH; ii+=INSTRUCTION_CHUNK)
+  {
+    if (!changed[ii/INSTRUCTION_CHUNK])
+    {
+      continue;
+    }
+
+    unsigned remaining = IRAM_INSTRUCTION_LENGTH-ii;
+    unsigned count = (remaining < INSTRUCTION_CHUNK) ? remaining : INSTRUCTION_CHUNK;
+    for (unsigned jj=0; jj<count; ++jj)
+    {
+      // instrutions are little endian
+      uint32_t instruction = instructions[ii+jj];
+      buf[jj*4+0] = (instruction>>0 ) & 0xFF;
+      buf[jj*4+1] = (instruction>>8 ) & 0xFF;
+      buf[jj*4+2] = (instruction>>16) & 0xFF;
+      buf[jj*4+3] = (instruction>>24) & 0xFF;
+    }
+    // Write data is copied into request, so buffer can be re-used for next chunk
+    requests.push_back(info.mbx_->writeMailboxAsync(info.iram_address_ + ii*4, buf, count*4));
+  }
+
+  bool success = true;
+  BOOST_FOREACH(WGMailboxRequestPtr &request, requests)
+  {
+    if (request->wait() != 0)
+    {
+      success = false;
+    }
+  }
+
+  if (!success)
+  {
+    err_msg << "Error writing IRAM data with mailbox";
+  }
+  return success;
+}
+
+
 
 
 }; // end namespace ethercat_hardware
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include "ethercat_hardware/device_clock.h"
+
+#include <stdlib.h>
+
+using ethercat_hardware::DeviceClock;
+
+
+static const uint64_t HOST_START_NS = 1300000000ULL * 1000000000ULL;
+
+//! Host time that device sampled at, for device clock with given drift
+static uint64_t sampleTimeNs(uint64_t elapsed_us, double drift_ppm)
+{
+  return HOST_START_NS + uint64_t(double(elapsed_us) * 1e3 * (1.0 + drift_ppm * 1e-6));
+}
+
+static ros::Time fromNSec(uint64_t ns)
+{
+  ros::Time t;
+  t.fromNSec(ns);
+  return t;
+}
+
+/*!
+ * Runs clock for given number of 1ms cycles.  Host receives data 200us after device
+ * samples it, plus up to 300us of one-sided jitter, but every 10th cycle has no jitter.
+ */
+static void runCycles(DeviceClock &clock, uint32_t device_start_us, uint64_t &elapsed_us, 
+                      unsigned cycles, double drift_ppm)
+{
+  for (unsigned i = 0; i < cycles; ++i)
+  {
+    elapsed_us += 1000;
+    uint64_t jitter_ns = ((i % 10) == 0) ? 0 : (rand() % 300000);
+    uint64_t receive_ns = sampleTimeNs(elapsed_us, drift_ppm) + 200000 + jitter_ns;
+    clock.update(uint32_t(device_start_us + elapsed_us), fromNSec(receive_ns));
+  }
+}
+
+
+TEST(DeviceClock, alignsDriftingClock)
+{
+  DeviceClock clock;
+  uint64_t elapsed_us = 0;
+  runCycles(clock, 12345, elapsed_us, DeviceClock::WINDOW_SIZE * (DeviceClock::MIN_WINDOWS - 1), 50.0);
+  EXPECT_FALSE(clock.isAligned());
+  runCycles(clock, 12345, elapsed_us, DeviceClock::WINDOW_SIZE * DeviceClock::NUM_WINDOWS, 50.0);
+  ASSERT_TRUE(clock.isAligned());
+
+  EXPECT_NEAR(50.0, clock.estimate().drift_ppm_, 1.0);
+  EXPECT_LT(clock.estimate().fit_error_us_, 5.0);
+  EXPECT_GT(clock.estimate().latency_us_, 100.0);
+
+  // Aligned time only has the constant part of latency left in it
+  uint64_t expected_ns = sampleTimeNs(elapsed_us, 50.0) + 200000;
+  int64_t error_ns = int64_t(clock.toHostTime(uint32_t(12345 + elapsed_us)).toNSec() - expected_ns);
+  EXPECT_LT(llabs(error_ns), 5000);
+
+  // Earlier samples of same cycle map to earlier host times
+  int64_t step_ns = int64_t(clock.toHostTime(uint32_t(12345 + elapsed_us)).toNSec() - 
+                            clock.toHostTime(uint32_t(12345 + elapsed_us - 333)).toNSec());
+  EXPECT_NEAR(333000, step_ns, 100);
+}
+
+
+TEST(DeviceClock, timestampWrap)
+{
+  DeviceClock clock;
+  uint64_t elapsed_us = 0;
+  uint32_t start_us = 0xFFFFFFFF - 2000000;
+  runCycles(clock, start_us, elapsed_us, DeviceClock::WINDOW_SIZE * DeviceClock::NUM_WINDOWS, 0.0);
+  ASSERT_TRUE(clock.isAligned());
+  EXPECT_EQ(0u, clock.estimate().resets_);
+  EXPECT_NEAR(0.0, clock.estimate().drift_ppm_, 1.0);
+
+  uint64_t expected_ns = sampleTimeNs(elapsed_us, 0.0) + 200000;
+  int64_t error_ns = int64_t(clock.toHostTime(uint32_t(start_us + elapsed_us)).toNSec() - expected_ns);
+  EXPECT_LT(llabs(error_ns), 5000);
+}
+
+
+TEST(DeviceClock, restartsAfterJump)
+{
+  DeviceClock clock;
+  uint64_t elapsed_us = 0;
+  runCycles(clock, 5000000, elapsed_us, DeviceClock::WINDOW_SIZE * DeviceClock::MIN_WINDOWS, 0.0);
+  ASSERT_TRUE(clock.isAligned());
+
+  // Device reset, so its timestamp starts from zero again
+  clock.update(1000, fromNSec(sampleTimeNs(elapsed_us + 1000, 0.0)));
+  EXPECT_FALSE(clock.isAligned());
+  EXPECT_EQ(1u, clock.estimate().resets_);
+}
+
+
+TEST(DeviceClock, notAlignedUsesReceiveTime)
+{
+  DeviceClock clock;
+  EXPECT_FALSE(clock.update(1000, fromNSec(HOST_START_NS)));
+  // Same timestamp again is ignored
+  EXPECT_FALSE(clock.update(1000, fromNSec(HOST_START_NS + 5000000)));
+  EXPECT_EQ(HOST_START_NS, clock.toHostTime(1000).toNSec());
+  EXPECT_EQ(HOST_START_NS - 100000, clock.toHostTime(900).toNSec());
+}
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include "ethercat_hardware/ethercat_topology.h"
+
+using ethercat_hardware::EthercatTopology;
+using ethercat_hardware::TopologyNode;
+
+
+static TopologyNode makeNode(uint8_t open_ports, uint32_t t0, uint32_t t1=0, uint32_t t2=0, uint32_t t3=0)
+{
+  TopologyNode node;
+  node.valid_ = true;
+  node.open_ports_ = open_ports;
+  node.receive_time_[0] = t0;
+  node.receive_time_[1] = t1;
+  node.receive_time_[2] = t2;
+  node.receive_time_[3] = t3;
+  return node;
+}
+
+
+// Line of three devices : 50ns link between first two, 70ns link to last
+TEST(EthercatTopology, line)
+{
+  std::vector<TopologyNode> nodes;
+  nodes.push_back(makeNode(0x3, 1000, 1240));
+  nodes.push_back(makeNode(0x3, 5000, 5140));
+  nodes.push_back(makeNode(0x1, 9));
+  ASSERT_TRUE(EthercatTopology::buildGraph(nodes));
+
+  EXPECT_EQ(-1, nodes[0].parent_);
+  EXPECT_EQ(0, nodes[1].parent_);
+  EXPECT_EQ(1u, nodes[1].parent_port_);
+  EXPECT_EQ(50u, nodes[1].hop_delay_ns_);
+  EXPECT_EQ(50u, nodes[1].delay_ns_);
+  EXPECT_EQ(1, nodes[2].parent_);
+  EXPECT_EQ(70u, nodes[2].hop_delay_ns_);
+  EXPECT_EQ(120u, nodes[2].delay_ns_);
+}
+
+
+// Junction with devices on port 3 (30ns) and port 1 (40ns), frame visits port 3 first
+TEST(EthercatTopology, branch)
+{
+  std::vector<TopologyNode> nodes;
+  nodes.push_back(makeNode(0xB, 0, 140, 0, 60));
+  nodes.push_back(makeNode(0x1, 777));
+  nodes.push_back(makeNode(0x1, 12345));
+  ASSERT_TRUE(EthercatTopology::buildGraph(nodes));
+
+  EXPECT_EQ(0, nodes[1].parent_);
+  EXPECT_EQ(3u, nodes[1].parent_port_);
+  EXPECT_EQ(30u, nodes[1].hop_delay_ns_);
+  EXPECT_EQ(0, nodes[2].parent_);
+  EXPECT_EQ(1u, nodes[2].parent_port_);
+  EXPECT_EQ(40u, nodes[2].hop_delay_ns_);
+  EXPECT_EQ(100u, nodes[2].delay_ns_);
+}
+
+
+// Branch ends, and next device hangs off earlier junction
+TEST(EthercatTopology, returnToJunction)
+{
+  std::vector<TopologyNode> nodes;
+  nodes.push_back(makeNode(0xB, 0, 300, 0, 200));  // port 3 branch : 200ns, port 1 branch : 100ns
+  nodes.push_back(makeNode(0x3, 50, 150));         // on port 3, 50ns link, 100ns behind it
+  nodes.push_back(makeNode(0x1, 0));               // on port 1 of previous device
+  nodes.push_back(makeNode(0x1, 0));               // on port 1 of junction
+  ASSERT_TRUE(EthercatTopology::buildGraph(nodes));
+
+  EXPECT_EQ(0, nodes[1].parent_);
+  EXPECT_EQ(50u, nodes[1].hop_delay_ns_);
+  EXPECT_EQ(1, nodes[2].parent_);
+  EXPECT_EQ(50u, nodes[2].hop_delay_ns_);
+  EXPECT_EQ(0, nodes[3].parent_);
+  EXPECT_EQ(1u, nodes[3].parent_port_);
+  EXPECT_EQ(50u, nodes[3].hop_delay_ns_);
+  EXPECT_EQ(250u, nodes[3].delay_ns_);
+}
+
+
+TEST(EthercatTopology, clockWrap)
+{
+  std::vector<TopologyNode> nodes;
+  nodes.push_back(makeNode(0x3, 0xFFFFFF00, 0x64));
+  nodes.push_back(makeNode(0x1, 0));
+  ASSERT_TRUE(EthercatTopology::buildGraph(nodes));
+  EXPECT_EQ(178u, nodes[1].hop_delay_ns_);
+}
+
+
+TEST(EthercatTopology, invalidGraph)
+{
+  std::vector<TopologyNode> nodes;
+  nodes.push_back(makeNode(0x1, 0));
+  nodes.push_back(makeNode(0x1, 0));
+  EXPECT_FALSE(EthercatTopology::buildGraph(nodes));
+
+  nodes[0].open_ports_ = 0x3;
+  nodes[1].valid_ = false;
+  EXPECT_FALSE(EthercatTopology::buildGraph(nodes));
+}
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
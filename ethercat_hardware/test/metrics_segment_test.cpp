@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "ethercat_hardware/metrics_segment.h"
+
+using ethercat_hardware::MetricsHistogram;
+using ethercat_hardware::MasterMetrics;
+using ethercat_hardware::DeviceMetrics;
+using ethercat_hardware::MetricsSegmentHeader;
+using ethercat_hardware::MetricsSegmentWriter;
+using ethercat_hardware::MetricsSegmentReader;
+
+
+// Unique segment name, so tests running in parallel do not interfere
+static std::string segmentName(const char *test)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/ethercat_metrics_test_%s_%d", test, int(getpid()));
+  return name;
+}
+
+
+TEST(MetricsHistogram, buckets)
+{
+  MetricsHistogram h;
+  memset(&h, 0, sizeof(h));
+
+  h.record(0.0000005); // 0.5us  -> bucket 0
+  h.record(0.0000015); // 1.5us  -> bucket 1
+  h.record(0.000100);  // 100us  -> bucket 7 [64,128)
+  h.record(10.0);      // 10s    -> last bucket
+
+  EXPECT_EQ(4u, h.count_);
+  EXPECT_EQ(1u, h.buckets_[0]);
+  EXPECT_EQ(1u, h.buckets_[1]);
+  EXPECT_EQ(1u, h.buckets_[7]);
+  EXPECT_EQ(1u, h.buckets_[MetricsHistogram::NUM_BUCKETS-1]);
+  EXPECT_EQ(uint64_t(10000000000ULL), h.max_ns_);
+}
+
+
+// Reader acts as stand-in for external metrics exporter
+TEST(MetricsSegment, writeAndRead)
+{
+  std::string name(segmentName("rw"));
+  MetricsSegmentWriter writer;
+  ASSERT_TRUE(writer.open(name, 3));
+
+  MasterMetrics master;
+  memset(&master, 0, sizeof(master));
+  DeviceMetrics devices[3];
+  memset(devices, 0, sizeof(devices));
+
+  master.cycle_count_ = 1234;
+  master.sent_ = 1000;
+  master.dropped_ = 7;
+  master.txandrx_errors_ = 3;
+  master.halt_motors_error_count_ = 2;
+  master.txandrx_.record(0.000200);
+  for (unsigned i=0; i<3; ++i)
+  {
+    devices[i].ring_position_ = i;
+    devices[i].drops_ = 10*i;
+    devices[i].max_consecutive_drops_ = i;
+  }
+  writer.write(master, devices);
+
+  MetricsSegmentReader reader;
+  ASSERT_TRUE(reader.open(name));
+  EXPECT_EQ(3u, reader.numDevices());
+
+  MasterMetrics read_master;
+  std::vector<DeviceMetrics> read_devices;
+  ASSERT_TRUE(reader.read(read_master, read_devices));
+  EXPECT_EQ(0, memcmp(&master, &read_master, sizeof(master)));
+  ASSERT_EQ(3u, read_devices.size());
+  for (unsigned i=0; i<3; ++i)
+  {
+    EXPECT_EQ(i, read_devices[i].ring_position_);
+    EXPECT_EQ(10*i, read_devices[i].drops_);
+    EXPECT_EQ(i, read_devices[i].max_consecutive_drops_);
+  }
+
+  // Reader sees later updates without re-opening segment
+  master.cycle_count_ = 1235;
+  writer.write(master, devices);
+  ASSERT_TRUE(reader.read(read_master, read_devices));
+  EXPECT_EQ(1235u, read_master.cycle_count_);
+
+  // Segment is removed when writer closes
+  reader.close();
+  writer.close();
+  EXPECT_FALSE(reader.open(name));
+}
+
+
+TEST(MetricsSegment, rejectsUnknownLayout)
+{
+  std::string name(segmentName("bad"));
+  MetricsSegmentWriter writer;
+  ASSERT_TRUE(writer.open(name, 1));
+
+  // Tamper with version field, like an incompatible newer writer would
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  ASSERT_GE(fd, 0);
+  void *segment = mmap(NULL, sizeof(MetricsSegmentHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(MAP_FAILED, segment);
+  MetricsSegmentHeader *header = (MetricsSegmentHeader*) segment;
+  header->version_ = MetricsSegmentHeader::VERSION + 1;
+
+  MetricsSegmentReader reader;
+  EXPECT_FALSE(reader.open(name));
+
+  header->version_ = MetricsSegmentHeader::VERSION;
+  header->magic_[0] = 'X';
+  EXPECT_FALSE(reader.open(name));
+
+  munmap(segment, sizeof(MetricsSegmentHeader));
+}
+
+
+TEST(MetricsSegment, readerWithoutWriter)
+{
+  MetricsSegmentReader reader;
+  EXPECT_FALSE(reader.open(segmentName("missing")));
+  MasterMetrics master;
+  std::vector<DeviceMetrics> devices;
+  EXPECT_FALSE(reader.read(master, devices));
+}
+
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,506 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+
+#include <dll/ethercat_frame.h>
+#include <dll/ethercat_device_addressed_telegram.h>
+#include <dll/ethercat_dll.h>
+
+#include "ethercat_hardware/multi_chain_netif.h"
+#include "ethercat_hardware/packet_mmap_netif.h"
+#include "veth_peer.h"
+
+using ethercat_hardware::MultiChainStats;
+using ethercat_hardware::initMultiChainNetif;
+using ethercat_hardware::closeMultiChainNetif;
+using ethercat_hardware::setMultiChainProcessData;
+using ethercat_hardware::getMultiChainStats;
+using ethercat_hardware::mergeChainReply;
+using ethercat_hardware::PacketMmapConfig;
+using ethercat_hardware::initPacketMmapNetif;
+using ethercat_hardware::closePacketMmapNetif;
+using ethercat_hardware::setPacketMmapTimeout;
+
+
+//! Fills in datagram header with given data length, returns offset of next datagram
+static unsigned addDatagram(unsigned char *frame, unsigned offset, unsigned length, bool more)
+{
+  memset(frame + offset, 0, 10 + length + 2);
+  frame[offset + 6] = length & 0xFF;
+  frame[offset + 7] = ((length >> 8) & 0x7) | (more ? 0x80 : 0);
+  return offset + 10 + length + 2;
+}
+
+
+TEST(MultiChainNetif, mergeReplies)
+{
+  // Frame header, datagram with 4 data bytes, datagram with 2 data bytes
+  unsigned char sent[64];
+  memset(sent, 0, sizeof(sent));
+  unsigned second = addDatagram(sent, 2, 4, true);
+  unsigned length = addDatagram(sent, second, 2, false);
+
+  unsigned char reply0[64], reply1[64], merged[64];
+  memcpy(reply0, sent, length);
+  memcpy(reply1, sent, length);
+  memcpy(merged, sent, length);
+
+  // First chain handles first half of first datagram
+  reply0[12] = 1; reply0[13] = 2; 
+  reply0[16] = 1;
+  // Second chain handles rest of first datagram, and all of second one
+  reply1[14] = 3; reply1[15] = 4; 
+  reply1[16] = 1;
+  reply1[second + 10] = 5; reply1[second + 11] = 6;
+  reply1[second + 12] = 2;
+
+  EXPECT_TRUE(mergeChainReply(merged, sent, reply0, length));
+  EXPECT_TRUE(mergeChainReply(merged, sent, reply1, length));
+  EXPECT_EQ(1, merged[12]);
+  EXPECT_EQ(2, merged[13]);
+  EXPECT_EQ(3, merged[14]);
+  EXPECT_EQ(4, merged[15]);
+  EXPECT_EQ(2, merged[16]);  // Working counters are added up
+  EXPECT_EQ(0, merged[17]);
+  EXPECT_EQ(5, merged[second + 10]);
+  EXPECT_EQ(6, merged[second + 11]);
+  EXPECT_EQ(2, merged[second + 12]);
+
+  // Datagram that does not fit in frame
+  EXPECT_FALSE(mergeChainReply(merged, sent, reply0, length - 1));
+}
+
+
+/*!
+ * In-process stand-in for a chain, so merging and retries are tested without any network interfaces.
+ * Does to frames what ChainPeer below does : device of chain N writes marker into data byte N, 
+ * and every chain increments last data byte and working counter.  Frames can also be dropped.
+ */
+struct FakeChain
+{
+  static const unsigned DATA_OFFSET = 2 + 10;  // Frame header, then datagram header
+  static const unsigned DATA_LENGTH = 8;
+  static const unsigned MAX_HANDLES = 16;
+
+  struct netif ni_;  // Must be first member, chain is only known by netif pointer
+  unsigned chain_;
+  unsigned drop_;
+  unsigned frames_;  // Frames sent to chain, including dropped ones
+  bool in_use_[MAX_HANDLES];
+  unsigned char data_[MAX_HANDLES][2048];
+
+  void init(unsigned chain)
+  {
+    memset(&ni_, 0, sizeof(ni_));
+    ni_.tx = &FakeChain::tx;
+    ni_.rx = &FakeChain::rx;
+    ni_.rx_nowait = &FakeChain::rx;
+    ni_.drop = &FakeChain::drop;
+    chain_ = chain;
+    drop_ = 0;
+    frames_ = 0;
+    memset(in_use_, 0, sizeof(in_use_));
+  }
+
+  static FakeChain *get(struct netif *ni) { return reinterpret_cast<FakeChain*>(ni); }
+
+  static int tx(struct EtherCAT_Frame *frame, struct netif *ni)
+  {
+    FakeChain *c = get(ni);
+    for (unsigned h = 0; h < MAX_HANDLES; ++h)
+    {
+      if (!c->in_use_[h])
+      {
+        if (framedump(frame, c->data_[h], sizeof(c->data_[h])) <= 0)
+          return -1;
+        c->in_use_[h] = true;
+        ++c->frames_;
+        ++ni->counters.sent;
+        return h;
+      }
+    }
+    ++ni->counters.tx_full;
+    return -1;
+  }
+
+  static bool rx(struct EtherCAT_Frame *frame, struct netif *ni, int handle)
+  {
+    FakeChain *c = get(ni);
+    if ((handle < 0) || (handle >= int(MAX_HANDLES)) || !c->in_use_[handle])
+      return false;
+    c->in_use_[handle] = false;
+    if (c->drop_ > 0)
+    {
+      --c->drop_;
+      ++ni->counters.dropped;
+      return false;
+    }
+    unsigned char *buf = c->data_[handle];
+    buf[DATA_OFFSET + c->chain_] = 0xA0 + c->chain_;
+    ++buf[DATA_OFFSET + DATA_LENGTH - 1];
+    ++buf[DATA_OFFSET + DATA_LENGTH];
+    ++ni->counters.received;
+    return framebuild(frame, buf);
+  }
+
+  static int drop(struct netif *ni, int handle)
+  {
+    FakeChain *c = get(ni);
+    if ((handle < 0) || (handle >= int(MAX_HANDLES)))
+      return -1;
+    c->in_use_[handle] = false;
+    ++ni->counters.dropped;
+    return 0;
+  }
+};
+
+
+class FakeChainTest : public testing::Test
+{
+protected:
+  static const unsigned NUM_FAKE_CHAINS = 2;
+
+  FakeChainTest() : 
+    telegram_(0, 0, 0, 0, FakeChain::DATA_LENGTH, data_), 
+    frame_(&telegram_), 
+    ni_(NULL)
+  { }
+
+  void SetUp()
+  {
+    std::vector<struct netif*> chains;
+    for (unsigned i = 0; i < NUM_FAKE_CHAINS; ++i)
+    {
+      chains_[i].init(i);
+      chains.push_back(&chains_[i].ni_);
+    }
+    ni_ = initMultiChainNetif(chains, 1);
+    ASSERT_TRUE(ni_ != NULL);
+  }
+
+  void TearDown()
+  {
+    if (ni_ != NULL)
+    {
+      EXPECT_EQ(0, closeMultiChainNetif(ni_));
+    }
+  }
+
+  bool roundTrip()
+  {
+    memset(data_, 0, sizeof(data_));
+    int handle = ni_->tx(&frame_, ni_);
+    if (handle < 0)
+      return false;
+    return ni_->rx(&frame_, ni_, handle);
+  }
+
+  unsigned char data_[FakeChain::DATA_LENGTH];
+  NPRD_Telegram telegram_;
+  EC_Ethernet_Frame frame_;
+  struct netif *ni_;
+  FakeChain chains_[NUM_FAKE_CHAINS];
+};
+
+
+TEST_F(FakeChainTest, forwardedFrames)
+{
+  ASSERT_TRUE(roundTrip());
+  // Frame went through both chains, one after another
+  EXPECT_EQ(0xA0, data_[0]);
+  EXPECT_EQ(0xA1, data_[1]);
+  EXPECT_EQ(2, data_[FakeChain::DATA_LENGTH-1]);
+
+  // Forwarded frames are never retried on their own
+  chains_[1].drop_ = 1;
+  EXPECT_FALSE(roundTrip());
+  EXPECT_EQ(2u, chains_[0].frames_);
+  EXPECT_EQ(2u, chains_[1].frames_);
+}
+
+
+TEST_F(FakeChainTest, processDataRetry)
+{
+  setMultiChainProcessData(ni_, true);
+  ASSERT_TRUE(roundTrip());
+  // Both chains got same frame, and their replies were merged
+  EXPECT_EQ(0xA0, data_[0]);
+  EXPECT_EQ(0xA1, data_[1]);
+  EXPECT_EQ(1, data_[FakeChain::DATA_LENGTH-1]);
+
+  // Chain that drops frame is retried alone
+  chains_[1].drop_ = 1;
+  ASSERT_TRUE(roundTrip());
+  EXPECT_EQ(0xA0, data_[0]);
+  EXPECT_EQ(0xA1, data_[1]);
+  EXPECT_EQ(2u, chains_[0].frames_);
+  EXPECT_EQ(3u, chains_[1].frames_);
+
+  // Chain that drops retried frame too fails whole exchange
+  chains_[1].drop_ = 2;
+  EXPECT_FALSE(roundTrip());
+
+  MultiChainStats stats;
+  getMultiChainStats(ni_, stats);
+  EXPECT_EQ(3u, stats.process_data_frames_);
+  EXPECT_EQ(0u, stats.chain_retries_[0]);
+  EXPECT_EQ(2u, stats.chain_retries_[1]);
+  EXPECT_EQ(0u, stats.chain_failures_[0]);
+  EXPECT_EQ(1u, stats.chain_failures_[1]);
+  setMultiChainProcessData(ni_, false);
+}
+
+
+TEST_F(FakeChainTest, txandrxThroughDataLinkLayer)
+{
+  ASSERT_TRUE(ni_->txandrx != NULL);
+  EtherCAT_DataLinkLayer *dll = EtherCAT_DataLinkLayer::instance();
+  dll->attach(ni_);
+
+  // Forwarded frame that is lost on second chain is sent again from start, as it was first sent
+  memset(data_, 0, sizeof(data_));
+  chains_[1].drop_ = 1;
+  ASSERT_TRUE(dll->txandrx(&frame_));
+  EXPECT_EQ(0xA0, data_[0]);
+  EXPECT_EQ(0xA1, data_[1]);
+  EXPECT_EQ(2, data_[FakeChain::DATA_LENGTH-1]);
+  EXPECT_EQ(2u, chains_[0].frames_);
+  EXPECT_EQ(2u, chains_[1].frames_);
+
+  // Process data is merged, and chain that drops frame is retried alone first
+  setMultiChainProcessData(ni_, true);
+  memset(data_, 0, sizeof(data_));
+  chains_[1].drop_ = 1;
+  ASSERT_TRUE(dll->txandrx(&frame_));
+  EXPECT_EQ(0xA0, data_[0]);
+  EXPECT_EQ(0xA1, data_[1]);
+  EXPECT_EQ(1, data_[FakeChain::DATA_LENGTH-1]);
+  EXPECT_EQ(3u, chains_[0].frames_);
+  EXPECT_EQ(4u, chains_[1].frames_);
+  setMultiChainProcessData(ni_, false);
+
+  // Gives up when chain never returns frame
+  chains_[1].drop_ = 1000;
+  EXPECT_FALSE(dll->txandrx(&frame_));
+}
+
+
+/*
+ * Other tests need two veth pairs and permission to open packet sockets, for example :
+ *   ip link add ectest0 type veth peer name ectest1
+ *   ip link add ectest2 type veth peer name ectest3
+ *   (and set all four interfaces up)
+ *   MULTI_CHAIN_TEST_INTERFACES=ectest0,ectest2 MULTI_CHAIN_TEST_PEERS=ectest1,ectest3 multi_chain_netif_test
+ * Without them, tests are skipped.
+ */
+static const unsigned NUM_CHAINS = 2;
+
+static bool getTestInterfaces(std::string interfaces[NUM_CHAINS], std::string peers[NUM_CHAINS])
+{
+  const char *interface_list = getenv("MULTI_CHAIN_TEST_INTERFACES");
+  const char *peer_list = getenv("MULTI_CHAIN_TEST_PEERS");
+  if ((interface_list == NULL) || (peer_list == NULL))
+  {
+    return false;
+  }
+  std::string i(interface_list), p(peer_list);
+  size_t i_comma = i.find(','), p_comma = p.find(',');
+  if ((i_comma == std::string::npos) || (p_comma == std::string::npos))
+  {
+    ADD_FAILURE() << "MULTI_CHAIN_TEST_INTERFACES and MULTI_CHAIN_TEST_PEERS need two comma separated interfaces";
+    return false;
+  }
+  interfaces[0] = i.substr(0, i_comma);
+  interfaces[1] = i.substr(i_comma + 1);
+  peers[0] = p.substr(0, p_comma);
+  peers[1] = p.substr(p_comma + 1);
+  return true;
+}
+
+
+/*!
+ * Simulated chain of devices on other end of veth pair.
+ * Device of chain N writes marker into data byte N, and every chain increments 
+ * last data byte, so test can tell whether frame went through chains one after 
+ * another or in parallel.
+ */
+class ChainPeer : public VethPeer
+{
+public:
+  static const unsigned DATA_OFFSET = sizeof(struct ether_header) + 2 + 10;
+  static const unsigned DATA_LENGTH = 8;
+
+  ChainPeer() : chain_(0) { }
+
+  ~ChainPeer() { stop(); }
+
+  bool start(const std::string &interface, unsigned chain)
+  {
+    chain_ = chain;
+    return VethPeer::start(interface);
+  }
+
+protected:
+  bool process(unsigned char *buf, int length)
+  {
+    if (length < int(DATA_OFFSET + DATA_LENGTH + 2))
+      return false;
+    buf[DATA_OFFSET + chain_] = 0xA0 + chain_;
+    ++buf[DATA_OFFSET + DATA_LENGTH - 1];
+    ++buf[DATA_OFFSET + DATA_LENGTH];
+    return true;
+  }
+
+  unsigned chain_;
+};
+
+
+class MultiChainTest : public testing::Test
+{
+protected:
+  MultiChainTest() : 
+    telegram_(0, 0, 0, 0, ChainPeer::DATA_LENGTH, data_), 
+    frame_(&telegram_), 
+    ni_(NULL), 
+    enabled_(false) 
+  { }
+
+  void SetUp()
+  {
+    std::string interfaces[NUM_CHAINS], peers[NUM_CHAINS];
+    if (!getTestInterfaces(interfaces, peers))
+    {
+      SKIP_TEST("MULTI_CHAIN_TEST_INTERFACES and MULTI_CHAIN_TEST_PEERS are not set");
+    }
+    PacketMmapConfig config;
+    config.timeout_us_ = 100000;
+    for (unsigned i = 0; i < NUM_CHAINS; ++i)
+    {
+      ASSERT_TRUE(peers_[i].start(peers[i], i));
+      struct netif *chain = initPacketMmapNetif(interfaces[i].c_str(), config);
+      ASSERT_TRUE(chain != NULL);
+      chains_.push_back(chain);
+    }
+    ni_ = initMultiChainNetif(chains_, 1);
+    ASSERT_TRUE(ni_ != NULL);
+    enabled_ = true;
+  }
+
+  void TearDown()
+  {
+    if (ni_ != NULL)
+    {
+      EXPECT_EQ(0, closeMultiChainNetif(ni_));
+    }
+    for (unsigned i = 0; i < chains_.size(); ++i)
+      EXPECT_EQ(0, closePacketMmapNetif(chains_[i]));
+  }
+
+  //! Sends cleared frame and waits for it to return, returns false if it did not
+  bool roundTrip()
+  {
+    memset(data_, 0, sizeof(data_));
+    int handle = ni_->tx(&frame_, ni_);
+    if (handle < 0)
+      return false;
+    return ni_->rx(&frame_, ni_, handle);
+  }
+
+  unsigned char data_[ChainPeer::DATA_LENGTH];
+  NPRD_Telegram telegram_;
+  EC_Ethernet_Frame frame_;
+  struct netif *ni_;
+  std::vector<struct netif*> chains_;
+  ChainPeer peers_[NUM_CHAINS];
+  bool enabled_;
+};
+
+
+TEST_F(MultiChainTest, forwardedFrames)
+{
+  if (!enabled_)
+    return;
+
+  static const unsigned NUM_FRAMES = 100;
+  for (unsigned i=0; i<NUM_FRAMES; ++i)
+  {
+    ASSERT_TRUE(roundTrip());
+    // Frame went through both chains, one after another
+    EXPECT_EQ(0xA0, data_[0]);
+    EXPECT_EQ(0xA1, data_[1]);
+    EXPECT_EQ(2, data_[ChainPeer::DATA_LENGTH-1]);
+  }
+  EXPECT_EQ(NUM_FRAMES, peers_[0].frames());
+  EXPECT_EQ(NUM_FRAMES, peers_[1].frames());
+  EXPECT_EQ(2*NUM_FRAMES, ni_->counters.sent);
+  EXPECT_EQ(2*NUM_FRAMES, ni_->counters.received);
+
+  MultiChainStats stats;
+  getMultiChainStats(ni_, stats);
+  EXPECT_EQ(NUM_CHAINS, stats.num_chains_);
+  EXPECT_EQ(NUM_FRAMES, stats.forwarded_frames_);
+  EXPECT_EQ(0u, stats.process_data_frames_);
+
+  // Frame is lost when any chain does not return it
+  EXPECT_EQ(0, setPacketMmapTimeout(chains_[1], 1000));
+  peers_[1].dropFrames(1);
+  EXPECT_FALSE(roundTrip());
+  EXPECT_EQ(1u, ni_->counters.dropped);
+}
+
+
+TEST_F(MultiChainTest, processData)
+{
+  if (!enabled_)
+    return;
+
+  setMultiChainProcessData(ni_, true);
+  static const unsigned NUM_FRAMES = 100;
+  for (unsigned i=0; i<NUM_FRAMES; ++i)
+  {
+    ASSERT_TRUE(roundTrip());
+    // Both chains got same frame at once, and their replies were merged
+    EXPECT_EQ(0xA0, data_[0]);
+    EXPECT_EQ(0xA1, data_[1]);
+    EXPECT_EQ(1, data_[ChainPeer::DATA_LENGTH-1]);
+  }
+
+  // Chain that drops frame is retried alone
+  EXPECT_EQ(0, setPacketMmapTimeout(chains_[1], 1000));
+  peers_[1].dropFrames(1);
+  ASSERT_TRUE(roundTrip());
+  EXPECT_EQ(0xA0, data_[0]);
+  EXPECT_EQ(0xA1, data_[1]);
+  EXPECT_EQ(NUM_FRAMES+1, peers_[0].frames());
+  EXPECT_EQ(NUM_FRAMES+2, peers_[1].frames());
+
+  // Chain that drops frame again fails whole exchange
+  peers_[1].dropFrames(2);
+  EXPECT_FALSE(roundTrip());
+  setMultiChainProcessData(ni_, false);
+
+  MultiChainStats stats;
+  getMultiChainStats(ni_, stats);
+  EXPECT_EQ(NUM_FRAMES+2, stats.process_data_frames_);
+  EXPECT_EQ(0u, stats.forwarded_frames_);
+  EXPECT_EQ(0u, stats.chain_retries_[0]);
+  EXPECT_EQ(2u, stats.chain_retries_[1]);
+  EXPECT_EQ(0u, stats.chain_failures_[0]);
+  EXPECT_EQ(1u, stats.chain_failures_[1]);
+}
+
+
+int main(int argc, char **argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
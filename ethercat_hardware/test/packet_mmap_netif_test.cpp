@@ -0,0 +1,603 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <time.h>
+
+#include <vector>
+
+#include <dll/ethercat_frame.h>
+#include <dll/ethercat_device_addressed_telegram.h>
+#include <dll/ethercat_dll.h>
+
+#include "ethercat_hardware/packet_mmap_netif.h"
+#include "veth_peer.h"
+
+using ethercat_hardware::PacketMmapConfig;
+using ethercat_hardware::initPacketMmapNetif;
+using ethercat_hardware::closePacketMmapNetif;
+using ethercat_hardware::setPacketMmapTimeout;
+using ethercat_hardware::setPacketMmapProcessData;
+using ethercat_hardware::getPacketMmapStats;
+using ethercat_hardware::PacketMmapStats;
+using ethercat_hardware::PacketMmapTestRings;
+using ethercat_hardware::initPacketMmapTestNetif;
+using ethercat_hardware::PACKET_MMAP_FRAME_SIZE;
+
+
+/*!
+ * In-process stand-in for kernel side of packet rings, and for devices behind them.
+ * Frame queued in TX ring is put into RX ring as soon as interface asks for it to be sent,
+ * unless it is dropped or held back, so nothing depends on timing except timeouts of 
+ * frames that never return.
+ */
+struct FakeRing
+{
+  static const unsigned NUM_FRAMES = 8;
+  static const unsigned MAX_HELD = 4;
+
+  std::vector<char> rx_ring_;
+  std::vector<char> tx_ring_;
+  unsigned rx_next_;
+  unsigned tx_next_;
+  unsigned frames_;       // Frames taken from TX ring, including dropped ones
+  unsigned overruns_;     // Frames lost because RX ring was full
+  unsigned drop_;         // Next n frames are not returned
+  unsigned hold_;         // Next n frames are held until releaseHeld()
+  unsigned unprocessed_;  // Next n frames are returned with working counter unchanged
+  bool timestamps_;       // Frames get software timestamps
+  unsigned wire_ns_;      // RX timestamp is this much later than TX timestamp
+  unsigned num_held_;
+  unsigned char held_[MAX_HELD][PACKET_MMAP_FRAME_SIZE];
+  unsigned held_length_[MAX_HELD];
+
+  FakeRing() : 
+    rx_ring_(NUM_FRAMES * PACKET_MMAP_FRAME_SIZE, 0), 
+    tx_ring_(NUM_FRAMES * PACKET_MMAP_FRAME_SIZE, 0),
+    rx_next_(0), tx_next_(0), frames_(0), overruns_(0), 
+    drop_(0), hold_(0), unprocessed_(0), timestamps_(false), wire_ns_(0), num_held_(0)
+  { }
+
+  PacketMmapTestRings rings()
+  {
+    PacketMmapTestRings rings;
+    rings.rx_ring_ = &rx_ring_[0];
+    rings.tx_ring_ = &tx_ring_[0];
+    rings.num_frames_ = NUM_FRAMES;
+    rings.kick_ = &FakeRing::kick;
+    rings.kick_arg_ = this;
+    return rings;
+  }
+
+  tpacket2_hdr *frame(std::vector<char> &ring, unsigned index)
+  {
+    return (tpacket2_hdr*) &ring[(index % NUM_FRAMES) * PACKET_MMAP_FRAME_SIZE];
+  }
+
+  //! Returns frame like last device of chain would, into next RX ring frame
+  void deliver(const unsigned char *data, unsigned length, const timespec &stamp)
+  {
+    tpacket2_hdr *hdr = frame(rx_ring_, rx_next_);
+    if (hdr->tp_status != TP_STATUS_KERNEL)
+    {
+      ++overruns_;
+      return;
+    }
+    ++rx_next_;
+    struct sockaddr_ll *sll = (struct sockaddr_ll*) ((char*) hdr + TPACKET_ALIGN(sizeof(tpacket2_hdr)));
+    memset(sll, 0, sizeof(*sll));
+    sll->sll_pkttype = PACKET_HOST;
+    unsigned char *reply = (unsigned char*) hdr + TPACKET2_HDRLEN;
+    memcpy(reply, data, length);
+    // Devices set locally administered bit of source address in returned frames
+    reply[ETH_ALEN] |= 0x02;
+    if (unprocessed_ > 0)
+      --unprocessed_;
+    else
+      incrementWorkingCounter(reply, length);
+    hdr->tp_mac = TPACKET2_HDRLEN;
+    hdr->tp_len = length;
+    hdr->tp_snaplen = length;
+    hdr->tp_sec = stamp.tv_sec;
+    hdr->tp_nsec = stamp.tv_nsec;
+    __sync_synchronize();
+    hdr->tp_status = TP_STATUS_USER | (timestamps_ ? TP_STATUS_TS_SOFTWARE : 0);
+  }
+
+  //! Returns held frames, newest first
+  void releaseHeld()
+  {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    while (num_held_ > 0)
+    {
+      --num_held_;
+      deliver(held_[num_held_], held_length_[num_held_], now);
+    }
+  }
+
+  //! Called instead of send(), takes every queued frame from TX ring
+  static int kick(void *arg)
+  {
+    FakeRing *r = static_cast<FakeRing*>(arg);
+    for (;;)
+    {
+      tpacket2_hdr *hdr = r->frame(r->tx_ring_, r->tx_next_);
+      if (!(hdr->tp_status & TP_STATUS_SEND_REQUEST))
+        return 0;
+      ++r->tx_next_;
+      ++r->frames_;
+      const unsigned char *data = (const unsigned char*) hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+      timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      if (r->drop_ > 0)
+      {
+        --r->drop_;
+      }
+      else if ((r->hold_ > 0) && (r->num_held_ < MAX_HELD))
+      {
+        --r->hold_;
+        memcpy(r->held_[r->num_held_], data, hdr->tp_len);
+        r->held_length_[r->num_held_] = hdr->tp_len;
+        ++r->num_held_;
+      }
+      else
+      {
+        timespec stamp = now;
+        stamp.tv_nsec += r->wire_ns_;
+        stamp.tv_sec += stamp.tv_nsec / 1000000000;
+        stamp.tv_nsec %= 1000000000;
+        r->deliver(data, hdr->tp_len, stamp);
+      }
+      hdr->tp_sec = now.tv_sec;
+      hdr->tp_nsec = now.tv_nsec;
+      __sync_synchronize();
+      hdr->tp_status = TP_STATUS_AVAILABLE | (r->timestamps_ ? TP_STATUS_TS_SOFTWARE : 0);
+    }
+  }
+};
+
+
+class FakeRingTest : public testing::Test
+{
+protected:
+  FakeRingTest() : 
+    telegram_(0, 0, 0, 0, sizeof(data_), data_), 
+    frame_(&telegram_), 
+    ni_(NULL)
+  { }
+
+  void TearDown()
+  {
+    if (ni_ != NULL)
+    {
+      EXPECT_EQ(0, closePacketMmapNetif(ni_));
+    }
+  }
+
+  bool open(const PacketMmapConfig &config)
+  {
+    static const unsigned char hwaddr[ETH_ALEN] = {0x00, 0x1b, 0x21, 0x00, 0x00, 0x00};
+    ni_ = initPacketMmapTestNetif(ring_.rings(), hwaddr, config);
+    return ni_ != NULL;
+  }
+
+  bool roundTrip()
+  {
+    int handle = ni_->tx(&frame_, ni_);
+    if (handle < 0)
+      return false;
+    return ni_->rx(&frame_, ni_, handle);
+  }
+
+  unsigned char data_[64];
+  NPRD_Telegram telegram_;
+  EC_Ethernet_Frame frame_;
+  FakeRing ring_;
+  struct netif *ni_;
+};
+
+
+TEST_F(FakeRingTest, roundTrip)
+{
+  PacketMmapConfig config;
+  config.timeout_us_ = 1000;
+  ASSERT_TRUE(open(config));
+
+  for (unsigned i=0; i<sizeof(data_); ++i)
+    data_[i] = i;
+  static const unsigned NUM_FRAMES = 100;  // Both rings and sequence numbers wrap around many times
+  for (unsigned i=0; i<NUM_FRAMES; ++i)
+  {
+    ASSERT_TRUE(roundTrip()) << "frame " << i;
+  }
+  EXPECT_EQ(NUM_FRAMES, ni_->counters.sent);
+  EXPECT_EQ(NUM_FRAMES, ni_->counters.received);
+  EXPECT_EQ(0u, ni_->counters.dropped);
+  EXPECT_EQ(0u, ring_.overruns_);
+  for (unsigned i=0; i<sizeof(data_); ++i)
+    EXPECT_EQ(i, data_[i]);
+
+  // Frame that does not return is dropped after timeout
+  ring_.drop_ = 1;
+  EXPECT_FALSE(roundTrip());
+  EXPECT_EQ(1u, ni_->counters.dropped);
+  EXPECT_TRUE(roundTrip());
+}
+
+
+TEST_F(FakeRingTest, outOfOrderFrames)
+{
+  PacketMmapConfig config;
+  config.timeout_us_ = 1000;
+  ASSERT_TRUE(open(config));
+
+  unsigned char data1[32], data2[32];
+  memset(data1, 1, sizeof(data1));
+  memset(data2, 2, sizeof(data2));
+  NPRD_Telegram telegram1(1, 0, 0, 0, sizeof(data1), data1);
+  NPRD_Telegram telegram2(2, 0, 0, 0, sizeof(data2), data2);
+  EC_Ethernet_Frame frame1(&telegram1);
+  EC_Ethernet_Frame frame2(&telegram2);
+
+  // Thread waiting for second frame finds first one on ring, and puts it in pending slot
+  int handle1 = ni_->tx(&frame1, ni_);
+  int handle2 = ni_->tx(&frame2, ni_);
+  ASSERT_GE(handle1, 0);
+  ASSERT_GE(handle2, 0);
+  EXPECT_NE(handle1, handle2);
+  memset(data1, 0, sizeof(data1));
+  memset(data2, 0, sizeof(data2));
+  EXPECT_TRUE(ni_->rx_nowait(&frame2, ni_, handle2));
+  EXPECT_TRUE(ni_->rx_nowait(&frame1, ni_, handle1));
+  EXPECT_EQ(2u, ni_->counters.received);
+  EXPECT_EQ(1, data1[0]);
+  EXPECT_EQ(2, data2[0]);
+
+  // Replies that come back in reverse order are matched by sequence number
+  ring_.hold_ = 2;
+  handle1 = ni_->tx(&frame1, ni_);
+  handle2 = ni_->tx(&frame2, ni_);
+  ASSERT_GE(handle1, 0);
+  ASSERT_GE(handle2, 0);
+  EXPECT_FALSE(ni_->rx_nowait(&frame1, ni_, handle1));
+  ring_.releaseHeld();
+  EXPECT_TRUE(ni_->rx(&frame1, ni_, handle1));
+  EXPECT_TRUE(ni_->rx(&frame2, ni_, handle2));
+  EXPECT_EQ(4u, ni_->counters.received);
+  EXPECT_EQ(0u, ni_->counters.rx_bad_seqnum);
+
+  // Frame that is not waited for anymore is counted as late when it returns
+  ring_.hold_ = 1;
+  int handle3 = ni_->tx(&frame1, ni_);
+  ASSERT_GE(handle3, 0);
+  EXPECT_EQ(0, ni_->drop(ni_, handle3));
+  usleep(2000);
+  ring_.releaseHeld();
+  EXPECT_TRUE(roundTrip());
+  EXPECT_EQ(1u, ni_->counters.rx_late_pkt);
+  EXPECT_GE(ni_->counters.rx_late_pkt_rtt_us, 2000u);
+  EXPECT_EQ(ni_->counters.rx_late_pkt_rtt_us, ni_->counters.rx_late_pkt_rtt_us_sum);
+}
+
+
+TEST_F(FakeRingTest, pendingSlotsFull)
+{
+  PacketMmapConfig config;
+  config.timeout_us_ = 1000;
+  ASSERT_TRUE(open(config));
+
+  // Replies stay on RX ring until someone waits for them, so only pending slots limit frames in flight
+  ring_.drop_ = 1000;
+  std::vector<int> handles;
+  for (;;)
+  {
+    int handle = ni_->tx(&frame_, ni_);
+    if (handle < 0)
+      break;
+    handles.push_back(handle);
+  }
+  EXPECT_EQ(16u, handles.size());
+  EXPECT_EQ(1u, ni_->counters.tx_full);
+
+  // Dropping a frame frees its slot
+  EXPECT_EQ(0, ni_->drop(ni_, handles[0]));
+  ring_.drop_ = 0;
+  EXPECT_TRUE(roundTrip());
+  for (unsigned i=1; i<handles.size(); ++i)
+    EXPECT_EQ(0, ni_->drop(ni_, handles[i]));
+}
+
+
+TEST_F(FakeRingTest, txandrxRetry)
+{
+  PacketMmapConfig config;
+  config.timeout_us_ = 1000;
+  ASSERT_TRUE(open(config));
+
+  // Dropped frame is sent again
+  ring_.drop_ = 2;
+  EXPECT_TRUE(ni_->txandrx(&frame_, ni_));
+  EXPECT_EQ(3u, ni_->counters.sent);
+  EXPECT_EQ(2u, ni_->counters.dropped);
+  EXPECT_EQ(1u, ni_->counters.received);
+
+  // Gives up once frame never returns
+  ring_.drop_ = 1000;
+  EXPECT_FALSE(ni_->txandrx(&frame_, ni_));
+  EXPECT_EQ(1u, ni_->counters.received);
+  EXPECT_EQ(13u, ni_->counters.sent);
+}
+
+
+TEST_F(FakeRingTest, earlyResend)
+{
+  // Timeout only matters if early resend does not work, so it is long enough that 
+  // resends happen first even on a loaded host
+  PacketMmapConfig config;
+  config.timeout_us_ = 200000;
+  config.early_resend_ = true;
+  ASSERT_TRUE(open(config));
+
+  // Replies are on ring as soon as frames are sent, so round trip is only host time, 
+  // and no reply is ever late enough to be resent.  On a loaded host a few round trips 
+  // can still be too slow for histogram, until they age out of it.
+  setPacketMmapProcessData(ni_, true);
+  PacketMmapStats stats;
+  for (unsigned i=0; i<16; ++i)
+  {
+    for (unsigned j=0; j<1024; ++j)
+    {
+      ASSERT_TRUE(roundTrip());
+    }
+    getPacketMmapStats(ni_, stats);
+    if (stats.resend_after_us_ > 0)
+      break;
+  }
+  EXPECT_GT(stats.expected_rtt_us_, 0u);
+  ASSERT_GT(stats.resend_after_us_, 0u);
+  EXPECT_GE(stats.resend_after_us_, config.min_resend_us_);
+  EXPECT_EQ(0u, stats.resends_);
+
+  // Dropped process data frame is sent again long before timeout, and reply to resent copy is used
+  ring_.drop_ = 1;
+  EXPECT_TRUE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(1u, stats.resends_);
+  EXPECT_EQ(0u, ni_->counters.dropped);
+
+  // Frame is sent again at most max_resends_ times, then dropped at timeout
+  ring_.drop_ = 1 + config.max_resends_;
+  EXPECT_FALSE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(1u + config.max_resends_, stats.resends_);
+  EXPECT_EQ(1u, ni_->counters.dropped);
+
+  // Reply to resent copy is used, and reply to first copy that shows up afterwards is only a duplicate
+  ring_.hold_ = 1;
+  EXPECT_TRUE(roundTrip());
+  ring_.releaseHeld();
+  EXPECT_TRUE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(2u + config.max_resends_, stats.resends_);
+  EXPECT_EQ(1u, stats.duplicates_);
+  EXPECT_EQ(0u, ni_->counters.rx_late_pkt);
+
+  // Other frames are never sent again
+  setPacketMmapProcessData(ni_, false);
+  ring_.drop_ = 1;
+  EXPECT_FALSE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(2u + config.max_resends_, stats.resends_);
+  EXPECT_EQ(2u, ni_->counters.dropped);
+}
+
+
+TEST_F(FakeRingTest, redundantProcessData)
+{
+  PacketMmapConfig config;
+  config.timeout_us_ = 2000;
+  config.redundant_pd_ = true;
+  ASSERT_TRUE(open(config));
+
+  // Both copies go out in one send, and reply to first copy is used
+  setPacketMmapProcessData(ni_, true);
+  EXPECT_TRUE(roundTrip());
+  PacketMmapStats stats;
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(1u, stats.redundant_sent_);
+  EXPECT_EQ(0u, stats.redundant_used_);
+  EXPECT_EQ(2u, ni_->counters.sent);
+  EXPECT_EQ(2u, ring_.frames_);
+
+  // Reply to other copy is still on ring, it is counted as duplicate and not handed to EML
+  EXPECT_TRUE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(1u, stats.duplicates_);
+  EXPECT_EQ(0u, ni_->counters.rx_late_pkt);
+
+  // First copy is lost, reply to second copy is used
+  ring_.drop_ = 1;
+  EXPECT_TRUE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(1u, stats.redundant_used_);
+  EXPECT_EQ(2u, stats.duplicates_);
+
+  // First copy never reached devices, so second copy is used although first reply arrived first
+  ring_.unprocessed_ = 1;
+  EXPECT_TRUE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(1u, stats.invalid_replies_);
+  EXPECT_EQ(2u, stats.redundant_used_);
+  EXPECT_EQ(0u, ni_->counters.dropped);
+
+  // Frame is only dropped once both copies are lost
+  ring_.drop_ = 2;
+  EXPECT_FALSE(roundTrip());
+  EXPECT_EQ(1u, ni_->counters.dropped);
+
+  // Only process data frames are copied
+  setPacketMmapProcessData(ni_, false);
+  EXPECT_TRUE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(5u, stats.redundant_sent_);
+  EXPECT_EQ(11u, ni_->counters.sent);
+}
+
+
+TEST_F(FakeRingTest, latencySplit)
+{
+  PacketMmapConfig config;
+  config.timeout_us_ = 2000;
+  config.timestamps_ = true;
+  ASSERT_TRUE(open(config));
+
+  // Frames without RX timestamp can not be split
+  static const unsigned NUM_FRAMES = 100;
+  setPacketMmapProcessData(ni_, true);
+  EXPECT_TRUE(roundTrip());
+  PacketMmapStats stats;
+  getPacketMmapStats(ni_, stats);
+  EXPECT_FALSE(stats.hardware_timestamps_);
+  EXPECT_EQ(1u, stats.timestamps_missing_);
+  EXPECT_EQ(0u, stats.wire_.count_);
+
+  // Every process data frame is split, and wire latency is time between kernel timestamps
+  ring_.timestamps_ = true;
+  ring_.wire_ns_ = 100000;
+  for (unsigned i=0; i<NUM_FRAMES; ++i)
+  {
+    ASSERT_TRUE(roundTrip());
+  }
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(1u, stats.timestamps_missing_);
+  EXPECT_EQ(NUM_FRAMES, stats.wire_.count_);
+  EXPECT_EQ(NUM_FRAMES, stats.host_send_.count_);
+  EXPECT_EQ(NUM_FRAMES, stats.host_wake_.count_);
+  // Timestamps are converted through doubles, which costs some precision
+  EXPECT_NEAR(100000.0, double(stats.wire_.total_ns_) / NUM_FRAMES, 1000.0);
+
+  // Timestamps are only kept for process data
+  setPacketMmapProcessData(ni_, false);
+  EXPECT_TRUE(roundTrip());
+  getPacketMmapStats(ni_, stats);
+  EXPECT_EQ(NUM_FRAMES, stats.wire_.count_);
+  EXPECT_EQ(1u, stats.timestamps_missing_);
+}
+
+
+/*
+ * Loopback interface sends every frame straight back, so it can stand in for a chain 
+ * without any setup.  Only permission to open packet sockets is needed.
+ */
+TEST(PacketMmapNetif, txandrxThroughDataLinkLayer)
+{
+  PacketMmapConfig config;
+  config.timeout_us_ = 100000;
+  struct netif *ni = initPacketMmapNetif("lo", config);
+  if (ni == NULL)
+  {
+    SKIP_TEST("Could not open packet socket on loopback interface");
+  }
+  ASSERT_TRUE(ni->txandrx != NULL);
+
+  unsigned char data[64];
+  for (unsigned i=0; i<sizeof(data); ++i)
+    data[i] = i;
+  NPRD_Telegram telegram(0, 0, 0, 0, sizeof(data), data);
+  EC_Ethernet_Frame frame(&telegram);
+
+  // EML init and EthercatDirectCom only use DLL's txandrx()
+  EtherCAT_DataLinkLayer *dll = EtherCAT_DataLinkLayer::instance();
+  dll->attach(ni);
+  static const unsigned NUM_FRAMES = 100;
+  for (unsigned i=0; i<NUM_FRAMES; ++i)
+  {
+    ASSERT_TRUE(dll->txandrx(&frame));
+  }
+  EXPECT_EQ(NUM_FRAMES, ni->counters.sent);
+  EXPECT_EQ(NUM_FRAMES, ni->counters.received);
+  EXPECT_EQ(0u, ni->counters.dropped);
+  for (unsigned i=0; i<sizeof(data); ++i)
+    EXPECT_EQ(i, data[i]);
+
+  EXPECT_EQ(0, closePacketMmapNetif(ni));
+}
+
+
+/*
+ * Test through a real network needs a veth pair and permission to open packet sockets, for example :
+ *   ip link add ectest0 type veth peer name ectest1
+ *   ip link set ectest0 up; ip link set ectest1 up
+ *   PACKET_MMAP_TEST_INTERFACE=ectest0 PACKET_MMAP_TEST_PEER=ectest1 packet_mmap_netif_test
+ * Without them, test is skipped.
+ */
+static bool getTestInterfaces(const char *&interface, const char *&peer)
+{
+  interface = getenv("PACKET_MMAP_TEST_INTERFACE");
+  peer = getenv("PACKET_MMAP_TEST_PEER");
+  return (interface != NULL) && (peer != NULL);
+}
+
+
+TEST(PacketMmapNetif, roundTrip)
+{
+  const char *interface, *peer_interface;
+  if (!getTestInterfaces(interface, peer_interface))
+  {
+    SKIP_TEST("PACKET_MMAP_TEST_INTERFACE and PACKET_MMAP_TEST_PEER are not set");
+  }
+
+  VethPeer peer;
+  ASSERT_TRUE(peer.start(peer_interface));
+
+  PacketMmapConfig config;
+  config.timeout_us_ = 100000;
+  struct netif *ni = initPacketMmapNetif(interface, config);
+  ASSERT_TRUE(ni != NULL);
+
+  unsigned char data[64];
+  for (unsigned i=0; i<sizeof(data); ++i)
+    data[i] = i;
+  NPRD_Telegram telegram(0, 0, 0, 0, sizeof(data), data);
+  EC_Ethernet_Frame frame(&telegram);
+
+  static const unsigned NUM_FRAMES = 1000;  // More than fit in rings
+  for (unsigned i=0; i<NUM_FRAMES; ++i)
+  {
+    int handle = ni->tx(&frame, ni);
+    ASSERT_GE(handle, 0);
+    ASSERT_TRUE(ni->rx(&frame, ni, handle));
+  }
+  EXPECT_EQ(NUM_FRAMES, ni->counters.sent);
+  EXPECT_EQ(NUM_FRAMES, ni->counters.received);
+  EXPECT_EQ(0u, ni->counters.dropped);
+
+  // Frame that does not return is dropped after timeout
+  peer.stop();
+  EXPECT_EQ(0, setPacketMmapTimeout(ni, 1000));
+  int handle = ni->tx(&frame, ni);
+  ASSERT_GE(handle, 0);
+  EXPECT_FALSE(ni->rx(&frame, ni, handle));
+  EXPECT_EQ(1u, ni->counters.dropped);
+
+  EXPECT_EQ(0, closePacketMmapNetif(ni));
+}
+
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
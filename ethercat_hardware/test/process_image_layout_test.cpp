@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include "ethercat_hardware/process_image_layout.h"
+
+using ethercat_hardware::ProcessImageLayout;
+
+
+//! Stands in for construct() of device with command and status FMMUs
+static bool addDevice(ProcessImageLayout &layout, unsigned command_size, unsigned status_size)
+{
+  int start_address = layout.nextAddress();
+  start_address += command_size;
+  start_address += status_size;
+  return layout.addDevice(start_address, command_size, status_size);
+}
+
+
+TEST(ProcessImageLayout, packed)
+{
+  ProcessImageLayout layout;
+  EXPECT_EQ(int(ProcessImageLayout::START_ADDRESS), layout.nextAddress());
+  EXPECT_TRUE(addDevice(layout, 11, 45));
+  EXPECT_TRUE(addDevice(layout, 0, 0));    // Device without process data
+  EXPECT_TRUE(addDevice(layout, 11, 50));
+  layout.addEmptyDevice();
+
+  ASSERT_EQ(4u, layout.numDevices());
+  EXPECT_EQ(0u, layout.offset(0));
+  EXPECT_EQ(56u, layout.offset(1));
+  EXPECT_EQ(56u, layout.offset(2));
+  EXPECT_EQ(117u, layout.offset(3));
+  EXPECT_EQ(117u, layout.size());
+  EXPECT_EQ(22u, layout.commandBytes());
+  EXPECT_EQ(95u, layout.statusBytes());
+  EXPECT_EQ(0u, layout.paddingBytes());
+}
+
+
+TEST(ProcessImageLayout, aligned)
+{
+  ProcessImageLayout layout;
+  EXPECT_FALSE(layout.reset(6));
+  EXPECT_EQ(1u, layout.alignment());
+  ASSERT_TRUE(layout.reset(8));
+
+  EXPECT_TRUE(addDevice(layout, 11, 45));
+  EXPECT_EQ(int(ProcessImageLayout::START_ADDRESS) + 56, layout.nextAddress());
+  EXPECT_TRUE(addDevice(layout, 0, 0));
+  EXPECT_TRUE(addDevice(layout, 11, 50));
+  EXPECT_TRUE(addDevice(layout, 11, 45));
+
+  EXPECT_EQ(0u, layout.offset(0));
+  EXPECT_EQ(56u, layout.offset(1));
+  EXPECT_EQ(56u, layout.offset(2));
+  EXPECT_EQ(120u, layout.offset(3));
+  EXPECT_EQ(176u, layout.size());
+  EXPECT_EQ(3u, layout.paddingBytes());
+}
+
+
+TEST(ProcessImageLayout, mismatch)
+{
+  // Device that maps more logical addresses than its command and status take
+  ProcessImageLayout layout;
+  int start_address = layout.nextAddress() + 64;
+  EXPECT_FALSE(layout.addDevice(start_address, 11, 45));
+  EXPECT_EQ(0u, layout.numDevices());
+  EXPECT_EQ(0u, layout.size());
+}
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
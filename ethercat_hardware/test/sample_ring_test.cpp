@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "ethercat_hardware/sample_ring.h"
+
+using ethercat_hardware::SampleRingWriter;
+using ethercat_hardware::SampleRingReader;
+using ethercat_hardware::FTRingSample;
+using ethercat_hardware::AccelRingSample;
+
+
+// Unique ring name, so tests running in parallel do not interfere
+static std::string ringName(const char *test)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/ethercat_sample_ring_test_%s_%d", test, int(getpid()));
+  return name;
+}
+
+static FTRingSample makeSample(uint64_t n)
+{
+  FTRingSample sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.sample_count_ = n;
+  sample.raw_[0] = int16_t(n);
+  sample.wrench_[5] = double(n);
+  return sample;
+}
+
+
+TEST(SampleRing, everySampleIsRead)
+{
+  std::string name(ringName("all"));
+  SampleRingWriter<FTRingSample> writer;
+  ASSERT_TRUE(writer.open(name, 16));
+
+  // Two readers follow ring independently
+  SampleRingReader<FTRingSample> reader1, reader2;
+  ASSERT_TRUE(reader1.open(name));
+  ASSERT_TRUE(reader2.open(name));
+
+  FTRingSample sample;
+  EXPECT_FALSE(reader1.read(sample));
+
+  for (uint64_t n=1; n<=10; ++n)
+  {
+    writer.write(makeSample(n));
+  }
+  EXPECT_EQ(10u, reader1.available());
+  for (uint64_t n=1; n<=10; ++n)
+  {
+    ASSERT_TRUE(reader1.read(sample));
+    EXPECT_EQ(n, sample.sample_count_);
+    EXPECT_EQ(double(n), sample.wrench_[5]);
+  }
+  EXPECT_FALSE(reader1.read(sample));
+  EXPECT_EQ(0u, reader1.lostCount());
+
+  // Second reader was not slowed down by first
+  ASSERT_TRUE(reader2.read(sample));
+  EXPECT_EQ(1u, sample.sample_count_);
+}
+
+
+TEST(SampleRing, slowReaderLosesOldestSamples)
+{
+  std::string name(ringName("slow"));
+  SampleRingWriter<FTRingSample> writer;
+  ASSERT_TRUE(writer.open(name, 10)); // rounded up to 16
+
+  SampleRingReader<FTRingSample> reader;
+  ASSERT_TRUE(reader.open(name));
+
+  for (uint64_t n=1; n<=40; ++n)
+  {
+    writer.write(makeSample(n));
+  }
+
+  FTRingSample sample;
+  ASSERT_TRUE(reader.read(sample));
+  EXPECT_EQ(25u, sample.sample_count_);
+  EXPECT_EQ(24u, reader.lostCount());
+  unsigned count = 1;
+  while (reader.read(sample))
+  {
+    ++count;
+  }
+  EXPECT_EQ(16u, count);
+  EXPECT_EQ(40u, sample.sample_count_);
+}
+
+
+TEST(SampleRing, seekOldest)
+{
+  std::string name(ringName("seek"));
+  SampleRingWriter<FTRingSample> writer;
+  ASSERT_TRUE(writer.open(name, 16));
+  for (uint64_t n=1; n<=5; ++n)
+  {
+    writer.write(makeSample(n));
+  }
+
+  // New reader only sees samples written after it opened ring, unless it seeks
+  SampleRingReader<FTRingSample> reader;
+  ASSERT_TRUE(reader.open(name));
+  EXPECT_EQ(0u, reader.available());
+  reader.seekOldest();
+  EXPECT_EQ(5u, reader.available());
+  FTRingSample sample;
+  ASSERT_TRUE(reader.read(sample));
+  EXPECT_EQ(1u, sample.sample_count_);
+}
+
+
+TEST(SampleRing, writeInPlace)
+{
+  using ethercat_hardware::RawPressureRingSample;
+  std::string name(ringName("inplace"));
+  SampleRingWriter<RawPressureRingSample> writer;
+  ASSERT_TRUE(writer.open(name, 4));
+  SampleRingReader<RawPressureRingSample> reader;
+  ASSERT_TRUE(reader.open(name));
+
+  RawPressureRingSample *sample = writer.beginWrite();
+  ASSERT_TRUE(sample != NULL);
+  sample->size_ = 94;
+  memset(sample->data_, 0xA5, sample->size_);
+
+  // Sample is not visible until it is committed
+  RawPressureRingSample read_sample;
+  EXPECT_FALSE(reader.read(read_sample));
+  writer.commit();
+  ASSERT_TRUE(reader.read(read_sample));
+  EXPECT_EQ(94u, read_sample.size_);
+  EXPECT_EQ(0xA5, read_sample.data_[93]);
+}
+
+
+TEST(SampleRing, rejectsWrongType)
+{
+  std::string name(ringName("type"));
+  SampleRingWriter<FTRingSample> writer;
+  ASSERT_TRUE(writer.open(name, 16));
+
+  SampleRingReader<AccelRingSample> reader;
+  EXPECT_FALSE(reader.open(name));
+
+  writer.close();
+  SampleRingReader<FTRingSample> ft_reader;
+  EXPECT_FALSE(ft_reader.open(name));
+}
+
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
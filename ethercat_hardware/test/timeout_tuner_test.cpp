@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include "ethercat_hardware/timeout_tuner.h"
+
+using ethercat_hardware::TimeoutTuner;
+
+
+TEST(TimeoutTuner, needsEnoughSamples)
+{
+  TimeoutTuner tuner;
+  unsigned timeout = 0, retries = 0;
+  for (unsigned i=0; i<TimeoutTuner::MIN_SAMPLES-1; ++i)
+    tuner.recordRtt(100);
+  EXPECT_FALSE(tuner.update(timeout, retries));
+  tuner.recordRtt(100);
+  EXPECT_TRUE(tuner.update(timeout, retries));
+  EXPECT_EQ(1u, tuner.tuning().tunings_);
+}
+
+
+TEST(TimeoutTuner, staysWithinHaltLatency)
+{
+  static const unsigned HALT_LATENCY = 100000;
+  TimeoutTuner tuner;
+  tuner.configure(HALT_LATENCY, 500, 4, 50);
+  unsigned timeout = 0, retries = 0;
+
+  // Fast, steady network : timeout is limited by minimum, retries by maximum
+  for (unsigned i=0; i<TimeoutTuner::UPDATE_INTERVAL; ++i)
+    tuner.recordRtt(80);
+  ASSERT_TRUE(tuner.update(timeout, retries));
+  EXPECT_EQ(500u, timeout);
+  EXPECT_EQ(50u, retries);
+  EXPECT_LE(timeout * retries, HALT_LATENCY);
+
+  // Slow tail : timeout covers it, fewer retries fit
+  for (unsigned i=0; i<TimeoutTuner::UPDATE_INTERVAL; ++i)
+    tuner.recordRtt((i % 100 == 0) ? 3000 : 80);
+  ASSERT_TRUE(tuner.update(timeout, retries));
+  EXPECT_GE(timeout, 2 * 3000u);
+  EXPECT_LE(timeout * retries, HALT_LATENCY);
+  EXPECT_GE(tuner.tuning().p9999_us_, 3000u);
+  EXPECT_LT(tuner.tuning().p50_us_, 100u);
+
+  // Very slow late packets : timeout is limited so minimum number of retries still fits
+  for (unsigned i=0; i<TimeoutTuner::UPDATE_INTERVAL; ++i)
+    tuner.recordLateRtt(60000);
+  ASSERT_TRUE(tuner.update(timeout, retries));
+  EXPECT_EQ(HALT_LATENCY / 4, timeout);
+  EXPECT_EQ(4u, retries);
+  EXPECT_EQ(uint64_t(TimeoutTuner::UPDATE_INTERVAL), tuner.tuning().late_samples_);
+}
+
+
+TEST(TimeoutTuner, ignoresSmallChanges)
+{
+  TimeoutTuner tuner;
+  tuner.configure(100000, 10, 4, 50);
+  unsigned timeout = 0, retries = 0;
+  for (unsigned i=0; i<TimeoutTuner::UPDATE_INTERVAL; ++i)
+    tuner.recordRtt(1000);
+  ASSERT_TRUE(tuner.update(timeout, retries));
+  unsigned first_timeout = timeout;
+  for (unsigned i=0; i<TimeoutTuner::UPDATE_INTERVAL; ++i)
+    tuner.recordRtt(1050);
+  EXPECT_FALSE(tuner.update(timeout, retries));
+  EXPECT_EQ(first_timeout, tuner.tuning().timeout_us_);
+}
+
+
+TEST(TimeoutTuner, bucketLimits)
+{
+  for (unsigned i=1; i<TimeoutTuner::NUM_BUCKETS; ++i)
+    EXPECT_GE(TimeoutTuner::bucketLimit(i), TimeoutTuner::bucketLimit(i-1));
+  EXPECT_EQ(2u, TimeoutTuner::bucketLimit(TimeoutTuner::BUCKETS_PER_OCTAVE-1));
+}
+
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+
+#include <string>
+
+
+/*
+ * Tests that need something this host does not have are reported as skipped, never as passed.
+ * Older gtest has no GTEST_SKIP(), so skip is recorded as a test property instead.
+ */
+#ifdef GTEST_SKIP
+#define SKIP_TEST(reason) GTEST_SKIP() << reason
+#else
+#define SKIP_TEST(reason) do { ::testing::Test::RecordProperty("skipped", reason); printf("[  SKIPPED ] %s\n", reason); return; } while (0)
+#endif
+
+
+//! Every device that handles datagram increments its working counter, only first datagram is handled here
+inline void incrementWorkingCounter(unsigned char *buf, int length)
+{
+  int datagram = sizeof(struct ether_header) + 2;
+  if (datagram + 10 > length)
+    return;
+  int wkc = datagram + 10 + ((buf[datagram+6] | (buf[datagram+7] << 8)) & 0x7FF);
+  if (wkc + 2 > length)
+    return;
+  ++buf[wkc];
+}
+
+
+/*!
+ * Stand-in for EtherCAT devices on other end of veth pair.
+ * Returns every EtherCAT frame it receives, like last device on a chain would.
+ * Frames can also be dropped.  Derived classes change what devices do to returned frames,
+ * and must call stop() in their destructor, before they stop being able to do that.
+ */
+class VethPeer
+{
+public:
+  VethPeer() : fd_(-1), running_(false), drop_(0), frames_(0) { }
+
+  virtual ~VethPeer() { stop(); }
+
+  bool start(const std::string &interface)
+  {
+    fd_ = socket(AF_PACKET, SOCK_RAW, htons(0x88A4));
+    if (fd_ < 0)
+      return false;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ-1);
+    if (ioctl(fd_, SIOCGIFINDEX, &ifr) < 0)
+      return false;
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(0x88A4);
+    addr.sll_ifindex = ifr.ifr_ifindex;
+    if (bind(fd_, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+      return false;
+    struct timeval tv = {0, 10000};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    running_ = true;
+    return pthread_create(&thread_, NULL, &VethPeer::run, this) == 0;
+  }
+
+  void stop()
+  {
+    if (running_)
+    {
+      running_ = false;
+      pthread_join(thread_, NULL);
+    }
+    if (fd_ >= 0)
+      close(fd_);
+    fd_ = -1;
+  }
+
+  //! Next n frames are not returned
+  void dropFrames(unsigned n) { drop_ = n; }
+  //! Number of frames peer has received, including dropped ones
+  unsigned frames() const { return frames_; }
+
+protected:
+  //! Does to frame what devices would, returns false if frame is not one devices handle
+  virtual bool process(unsigned char *buf, int length)
+  {
+    incrementWorkingCounter(buf, length);
+    return true;
+  }
+
+  static void *run(void *arg)
+  {
+    VethPeer *peer = static_cast<VethPeer*>(arg);
+    while (peer->running_)
+    {
+      unsigned char buf[2048];
+      int length = recv(peer->fd_, buf, sizeof(buf), 0);
+      if (length <= int(sizeof(struct ether_header)))
+        continue;
+      ++peer->frames_;
+      if (peer->drop_ > 0)
+      {
+        --peer->drop_;
+        continue;
+      }
+      // Devices set locally administered bit of source address in returned frames
+      buf[ETH_ALEN] |= 0x02;
+      if (peer->process(buf, length))
+        send(peer->fd_, buf, length, 0);
+    }
+    return NULL;
+  }
+
+  int fd_;
+  volatile bool running_;
+  volatile unsigned drop_;
+  volatile unsigned frames_;
+  pthread_t thread_;
+};
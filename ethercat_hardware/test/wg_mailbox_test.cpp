@@ -0,0 +1,218 @@
+#include <gtest/gtest.h>
+
+#include "ethercat_hardware/wg_mailbox.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+using ethercat_hardware::WGMailbox;
+using ethercat_hardware::WGMailboxRequest;
+using ethercat_hardware::WGMailboxRequestPtr;
+using ethercat_hardware::WGMailboxScheduler;
+
+
+/*!
+ * \brief Mailbox that completes each request after a fixed number of scheduler steps, without a device.
+ *
+ * Every step is recorded in shared log, so tests can see how scheduler interleaves mailboxes.
+ */
+class FakeMailbox : public WGMailbox
+{
+public:
+  FakeMailbox(int id, unsigned steps_per_request, std::vector<int> *log, boost::mutex *log_lock) :
+    id_(id), steps_per_request_(steps_per_request), steps_(0), log_(log), log_lock_(log_lock)
+  { }
+
+protected:
+  virtual StepResult stepAsyncRequest(EthercatCom *com)
+  {
+    if (!active_request_)
+    {
+      { // LOCKED
+        boost::lock_guard<boost::mutex> lock(request_queue_lock_);
+        if (request_queue_.empty())
+        {
+          return STEP_IDLE;
+        }
+        active_request_ = request_queue_.front();
+        request_queue_.pop_front();
+      } // UNLOCKED
+      lockMailbox();
+      clock_gettime(CLOCK_MONOTONIC, &async_request_start_time_);
+      steps_ = 0;
+    }
+
+    { // LOCKED
+      boost::lock_guard<boost::mutex> lock(*log_lock_);
+      log_->push_back(id_);
+    } // UNLOCKED
+
+    if (++steps_ == steps_per_request_)
+    {
+      finishAsyncRequest(0);
+    }
+    return STEP_PROGRESS;
+  }
+
+  int id_;
+  unsigned steps_per_request_;
+  unsigned steps_;
+  std::vector<int> *log_;
+  boost::mutex *log_lock_;
+};
+
+
+class WGMailboxSchedulerTest : public ::testing::Test
+{
+protected:
+  WGMailboxSchedulerTest() :
+    mbx0_(0, 2, &log_, &log_lock_),
+    mbx1_(1, 2, &log_, &log_lock_),
+    scheduler_(NULL)
+  { }
+
+public:
+  void recordCompletion(int id, WGMailboxRequest &request)
+  {
+    boost::lock_guard<boost::mutex> lock(log_lock_);
+    completed_.push_back(std::make_pair(id, request.address()));
+  }
+
+protected:
+  std::vector<int> log_;
+  std::vector<std::pair<int, unsigned> > completed_;
+  boost::mutex log_lock_;
+  FakeMailbox mbx0_;
+  FakeMailbox mbx1_;
+  // Declared last, so it is stopped before mailboxes go away
+  WGMailboxScheduler scheduler_;
+};
+
+
+TEST_F(WGMailboxSchedulerTest, roundRobin)
+{
+  ASSERT_TRUE(scheduler_.attach(&mbx0_));
+  ASSERT_TRUE(scheduler_.attach(&mbx1_));
+
+  // Queue everything before start, so both queues stay busy for the whole run
+  std::vector<WGMailboxRequestPtr> requests;
+  uint8_t buf[4] = {0};
+  for (unsigned i=0; i<3; ++i)
+  {
+    requests.push_back(mbx0_.writeMailboxAsync(0x100+i, buf, sizeof(buf)));
+    requests.push_back(mbx1_.writeMailboxAsync(0x200+i, buf, sizeof(buf)));
+  }
+  scheduler_.start();
+  for (unsigned i=0; i<requests.size(); ++i)
+  {
+    EXPECT_EQ(0, requests[i]->wait());
+  }
+
+  // Each device advances by one step per round, even across request boundaries
+  ASSERT_EQ(12u, log_.size());
+  for (unsigned i=0; i<log_.size(); ++i)
+  {
+    EXPECT_EQ(int(i%2), log_[i]) << "step " << i;
+  }
+}
+
+
+TEST_F(WGMailboxSchedulerTest, completion)
+{
+  ASSERT_TRUE(scheduler_.attach(&mbx0_));
+  ASSERT_TRUE(scheduler_.attach(&mbx1_));
+  scheduler_.start();
+
+  uint8_t data[8] = {1,2,3,4,5,6,7,8};
+  uint8_t read_data[8] = {0};
+  std::vector<WGMailboxRequestPtr> requests;
+  for (unsigned i=0; i<4; ++i)
+  {
+    requests.push_back(mbx0_.writeMailboxAsync(i, data, sizeof(data),
+                                               boost::bind(&WGMailboxSchedulerTest::recordCompletion, this, 0, _1)));
+  }
+  requests.push_back(mbx1_.readMailboxAsync(0x10, read_data, sizeof(read_data),
+                                            boost::bind(&WGMailboxSchedulerTest::recordCompletion, this, 1, _1)));
+
+  for (unsigned i=0; i<requests.size(); ++i)
+  {
+    EXPECT_EQ(0, requests[i]->wait());
+    EXPECT_TRUE(requests[i]->done());
+    EXPECT_EQ(0, requests[i]->result());
+  }
+  // Write data is copied into request
+  EXPECT_EQ(0, memcmp(requests[0]->data(), data, sizeof(data)));
+
+  // Callback runs after waiters are woken, stopping scheduler makes sure last one has finished
+  scheduler_.stop();
+
+  // Every callback runs once, and each device completes its requests in order they were queued
+  ASSERT_EQ(5u, completed_.size());
+  unsigned next_address = 0;
+  for (unsigned i=0; i<completed_.size(); ++i)
+  {
+    if (completed_[i].first == 0)
+    {
+      EXPECT_EQ(next_address++, completed_[i].second);
+    }
+    else
+    {
+      EXPECT_EQ(0x10u, completed_[i].second);
+    }
+  }
+  EXPECT_EQ(4u, next_address);
+}
+
+
+TEST_F(WGMailboxSchedulerTest, blockingCallsUseScheduler)
+{
+  ASSERT_TRUE(scheduler_.attach(&mbx0_));
+  scheduler_.start();
+
+  // There is no device behind mailbox, so this only works if request is passed to scheduler
+  uint8_t buf[4] = {0};
+  EXPECT_EQ(0, mbx0_.readMailbox(NULL, 0x100, buf, sizeof(buf)));
+  EXPECT_EQ(0, mbx0_.writeMailbox(NULL, 0x100, buf, sizeof(buf)));
+  EXPECT_EQ(4u, log_.size());
+}
+
+
+TEST_F(WGMailboxSchedulerTest, stopFailsAndDetaches)
+{
+  ASSERT_TRUE(scheduler_.attach(&mbx0_));
+
+  // Never started, so nothing runs this request until stop() fails it
+  uint8_t buf[4] = {0};
+  WGMailboxRequestPtr queued(mbx0_.writeMailboxAsync(0x100, buf, sizeof(buf)));
+  EXPECT_FALSE(queued->done());
+  scheduler_.stop();
+  EXPECT_TRUE(queued->done());
+  EXPECT_NE(0, queued->result());
+
+  // Detached mailbox fails new requests immediately, instead of queueing them for nobody
+  WGMailboxRequestPtr late(mbx0_.writeMailboxAsync(0x100, buf, sizeof(buf)));
+  EXPECT_TRUE(late->done());
+  EXPECT_NE(0, late->result());
+  EXPECT_TRUE(log_.empty());
+
+  // Mailbox can be attached to another scheduler afterwards
+  WGMailboxScheduler other(NULL);
+  EXPECT_TRUE(other.attach(&mbx0_));
+}
+
+
+TEST_F(WGMailboxSchedulerTest, attachOnce)
+{
+  WGMailboxScheduler other(NULL);
+  ASSERT_TRUE(scheduler_.attach(&mbx0_));
+  EXPECT_TRUE(scheduler_.attach(&mbx0_));
+  EXPECT_FALSE(other.attach(&mbx0_));
+}
+
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}